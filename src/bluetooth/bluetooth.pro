@@ -42,12 +42,13 @@ HEADERS += \
     qbluetoothserver_p.h\
     qbluetoothtransferreply_p.h \
     qbluetoothtransferrequest_p.h \
-    qprivatelinearbuffer_p.h \
     qbluetoothlocaldevice_p.h \
     qlowenergycontrollerbase_p.h \
     qlowenergyserviceprivate_p.h \
     qleadvertiser_p.h \
-    lecmaccalculator_p.h
+    lecmaccalculator_p.h \
+    legattcache_p.h \
+    leattrequest_p.h
 
 SOURCES += \
     qbluetoothaddress.cpp\
@@ -114,10 +115,22 @@ qtConfig(bluez) {
             qleadvertiser_bluez.cpp \
             qlowenergycontroller_bluez.cpp \
             lecmaccalculator.cpp \
+            legattcache.cpp \
+            leattbearer.cpp \
+            leattrequest.cpp \
+            leattserverconnection.cpp \
+            lecccdstore.cpp \
+            lesigncounterjournal.cpp \
+            lewritestream.cpp \
             qlowenergycontroller_bluezdbus.cpp
 
         HEADERS += qlowenergycontroller_bluezdbus_p.h \
-                           qlowenergycontroller_bluez_p.h
+                           qlowenergycontroller_bluez_p.h \
+                           leattbearer_p.h \
+                           leattserverconnection_p.h \
+                           lecccdstore_p.h \
+                           lesigncounterjournal_p.h \
+                           lewritestream_p.h
 
         qtConfig(linux_crypto_api): DEFINES += CONFIG_LINUX_CRYPTO_API
     } else {
@@ -159,6 +159,9 @@ static bool hasBtMgmtPermission()
 
 BluetoothManagement::BluetoothManagement(QObject *parent) : QObject(parent)
 {
+    // each read reserves a full block, keep it for the next read
+    buffer.setChunkSize(QPRIVATELINEARBUFFER_BUFFERSIZE);
+
     bool hasPermission = hasBtMgmtPermission();
     if (!hasPermission) {
         qCInfo(QT_BT_BLUEZ, "Missing CAP_NET_ADMIN permission. Cannot determine whether "
@@ -216,28 +219,28 @@ void BluetoothManagement::_q_readNotifier()
         return;
     }
 
-    // do we have at least one complete mgmt header?
-    if ((uint)buffer.size() < sizeof(MgmtHdr))
-        return;
-
-    QByteArray data = buffer.readAll();
-
-    while (true) {
-        if ((uint)data.size() < sizeof(MgmtHdr))
-            break;
-
-        const MgmtHdr *hdr = reinterpret_cast<const MgmtHdr*>(data.constData());
-        const int nextPackageSize = qFromLittleEndian(hdr->length) + sizeof(MgmtHdr);
-        const int remainingPackageSize = data.length() - nextPackageSize;
-
-        if (data.length() < nextPackageSize)
-            break; // not a complete event header -> wait for next notifier
+    // Process the complete events, a partial event stays in the buffer until
+    // the next notification. Events which span two chunks are copied.
+    QByteArray spanningEvent;
+    while ((uint)buffer.size() >= sizeof(MgmtHdr)) {
+        MgmtHdr header;
+        buffer.peek(reinterpret_cast<char *>(&header), sizeof(MgmtHdr));
+        const qint64 nextPackageSize = qFromLittleEndian(header.length) + sizeof(MgmtHdr);
+        if (buffer.size() < nextPackageSize)
+            break; // not a complete event -> wait for next notifier
+
+        const char *package = buffer.readPointer();
+        if (buffer.nextDataBlockSize() < nextPackageSize) {
+            spanningEvent.resize(int(nextPackageSize));
+            buffer.peek(spanningEvent.data(), nextPackageSize);
+            package = spanningEvent.constData();
+        }
 
-        switch (static_cast<EventCode>(qFromLittleEndian(hdr->cmdCode))) {
+        switch (static_cast<EventCode>(qFromLittleEndian(header.cmdCode))) {
         case EventCode::DeviceFound:
         {
             const MgmtEventDeviceFound *event = reinterpret_cast<const MgmtEventDeviceFound*>
-                                                   (data.constData() + sizeof(MgmtHdr));
+                                                   (package + sizeof(MgmtHdr));
 
             if (event->type == BDADDR_LE_RANDOM) {
                 const bdaddr_t address = event->bdaddr;
@@ -254,21 +257,12 @@ void BluetoothManagement::_q_readNotifier()
         }
         default:
             qCDebug(QT_BT_BLUEZ) << "BluetoothManagement: Ignored event:"
-                                 << Qt::hex << qFromLittleEndian(hdr->cmdCode);
+                                 << Qt::hex << qFromLittleEndian(header.cmdCode);
             break;
         }
 
-        if (data.length() > nextPackageSize)
-            data = data.right(remainingPackageSize);
-        else
-            data.clear();
-
-        if (data.isEmpty())
-            break;
+        buffer.free(nextPackageSize);
     }
-
-    if (!data.isEmpty())
-        buffer.ungetBlock(data.constData(), data.size());
 }
 
 void BluetoothManagement::processRandomAddressFlagInformation(const QBluetoothAddress &address)
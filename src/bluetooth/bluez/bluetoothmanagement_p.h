@@ -60,7 +60,7 @@
 #ifndef QPRIVATELINEARBUFFER_BUFFERSIZE
 #define QPRIVATELINEARBUFFER_BUFFERSIZE Q_INT64_C(16384)
 #endif
-#include "../qprivatelinearbuffer_p.h"
+#include <QtCore/private/qringbuffer_p.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -87,7 +87,7 @@ private:
 
     int fd = -1;
     QSocketNotifier* notifier;
-    QPrivateLinearBuffer buffer;
+    QRingBuffer buffer;
     QHash<QBluetoothAddress, QDateTime> privateFlagAddresses;
     mutable QMutex accessLock;
 };
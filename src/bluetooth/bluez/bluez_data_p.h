@@ -86,6 +86,23 @@ QT_BEGIN_NAMESPACE
 #define L2CAP_LM_TRUSTED    0x0008
 #define L2CAP_LM_SECURE     0x0020
 
+#define L2CAP_OPTIONS       0x01
+struct l2cap_options {
+    quint16 omtu;
+    quint16 imtu;
+    quint16 flush_to;
+    quint8 mode;
+    quint8 fcs;
+    quint8 max_tx;
+    quint16 txwin_size;
+};
+
+#define L2CAP_CONNINFO      0x02
+struct l2cap_conninfo {
+    quint16 hci_handle;
+    quint8 dev_class[3];
+};
+
 #define BT_SECURITY 4
 struct bt_security {
     quint8 level;
@@ -96,6 +113,14 @@ struct bt_security {
 #define BT_SECURITY_MEDIUM  2
 #define BT_SECURITY_HIGH    3
 
+#define BT_SNDMTU   12
+#define BT_RCVMTU   13
+#define BT_MODE     15
+#define BT_MODE_EXT_FLOWCTL 0x04
+
+// PSM of the L2CAP channels of the Enhanced ATT bearer
+#define EATT_PSM    0x0027
+
 #define BDADDR_LE_PUBLIC    0x01
 #define BDADDR_LE_RANDOM    0x02
 
@@ -0,0 +1,567 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "leattbearer_p.h"
+#include "qbluetoothsocketbase_p.h"
+#include "bluez/bluez_data_p.h"
+
+#include <QtBluetooth/qbluetoothaddress.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsocketnotifier.h>
+#include <QtCore/qtimer.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/private/qcore_unix_p.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <sys/socket.h>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint8 attOpErrorResponse = 0x01;
+static const quint8 attOpHandleValueNotification = 0x1b;
+static const quint8 attOpHandleValueIndication = 0x1d;
+static const quint8 attOpHandleValueConfirmation = 0x1e;
+static const quint8 attCommandFlag = 0x40;
+static const quint8 attErrorRequestNotSupported = 0x06;
+
+// An EATT bearer supports at least an MTU of 64
+static const int minimumMtu = 64;
+static const int maximumMtu = 0x200;
+static const int maximumPduSize = 0x205;
+
+LeAttBearer::LeAttBearer(int socketDescriptor, QObject *parent)
+    : QObject(parent), m_socket(socketDescriptor), m_mtu(minimumMtu)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &LeAttBearer::requestTimeout);
+
+    m_readNotifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    m_readNotifier->setEnabled(false);
+    connect(m_readNotifier, &QSocketNotifier::activated, this, &LeAttBearer::socketReadable);
+
+    // the socket signals writability once the connection has been established
+    m_writeNotifier = new QSocketNotifier(m_socket, QSocketNotifier::Write, this);
+    connect(m_writeNotifier, &QSocketNotifier::activated, this, &LeAttBearer::socketWritable);
+}
+
+LeAttBearer::~LeAttBearer()
+{
+    close();
+}
+
+/*
+  Opens a non-blocking L2CAP channel in enhanced credit based flow control mode
+  to the EATT PSM of \a remoteAddress. The channel is bound to \a localAddress
+  with the LE address type \a localAddressType. The connection is still in progress when
+  this function returns. Returns -1 if the channel cannot be opened, for example
+  because the kernel does not support the mode.
+ */
+int LeAttBearer::openChannel(const QBluetoothAddress &localAddress, quint8 localAddressType,
+                             const QBluetoothAddress &remoteAddress, quint8 addressType)
+{
+    const int socket = ::socket(AF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                                BTPROTO_L2CAP);
+    if (socket < 0) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot create EATT channel:" << qt_error_string(errno);
+        return -1;
+    }
+
+    sockaddr_l2 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.l2_family = AF_BLUETOOTH;
+    addr.l2_bdaddr_type = localAddressType;
+    convertAddress(localAddress.toUInt64(), addr.l2_bdaddr.b);
+    if (::bind(socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot bind EATT channel:" << qt_error_string(errno);
+        qt_safe_close(socket);
+        return -1;
+    }
+
+    // EATT requires an encrypted link
+    bt_security security;
+    memset(&security, 0, sizeof(security));
+    security.level = BT_SECURITY_MEDIUM;
+    const quint8 mode = BT_MODE_EXT_FLOWCTL;
+    if (::setsockopt(socket, SOL_BLUETOOTH, BT_SECURITY, &security, sizeof(security)) < 0
+            || ::setsockopt(socket, SOL_BLUETOOTH, BT_MODE, &mode, sizeof(mode)) < 0) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot configure EATT channel:" << qt_error_string(errno);
+        qt_safe_close(socket);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.l2_family = AF_BLUETOOTH;
+    addr.l2_psm = htobs(EATT_PSM);
+    addr.l2_bdaddr_type = addressType;
+    convertAddress(remoteAddress.toUInt64(), addr.l2_bdaddr.b);
+    if (::connect(socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0
+            && errno != EINPROGRESS) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot connect EATT channel:" << qt_error_string(errno);
+        qt_safe_close(socket);
+        return -1;
+    }
+
+    return socket;
+}
+
+void LeAttBearer::setMtu(int mtu)
+{
+    m_mtu = qBound(minimumMtu, mtu, maximumMtu);
+}
+
+void LeAttBearer::setRequestTimeout(int msecs)
+{
+    m_requestTimeout = msecs;
+}
+
+const QLowEnergyServicePrivate *LeAttBearer::busyService() const
+{
+    if (m_requestPending)
+        return m_request.service.data();
+    if (!m_continuations.isEmpty())
+        return m_continuations.head().service.data();
+    return nullptr;
+}
+
+void LeAttBearer::sendRequest(const LeAttRequest &request)
+{
+    Q_ASSERT(isReady() && !m_requestPending);
+
+    m_request = request;
+    m_requestPending = true;
+    if (m_requestTimeout > 0)
+        m_timer->start(m_requestTimeout);
+
+    if (!writePdu(request.payload.constData(), request.payload.size())) {
+        // The response never arrives, the request is taken over by another bearer.
+        // The caller might still be iterating over the bearers.
+        close();
+        QTimer::singleShot(0, this, [this]() { emit disconnected(); });
+    }
+}
+
+/*
+  Queues \a request to be sent next on this bearer. This continues the chain
+  of the request whose response is currently being processed.
+ */
+void LeAttBearer::prependRequest(const LeAttRequest &request)
+{
+    m_continuations.prepend(request);
+}
+
+bool LeAttBearer::sendContinuation()
+{
+    if (!isReady() || m_requestPending || m_continuations.isEmpty())
+        return false;
+
+    sendRequest(m_continuations.dequeue());
+    return true;
+}
+
+/*
+  Removes the continuation which is sent next on the bearer. Returns an invalid
+  request if no continuation is queued.
+ */
+LeAttRequest LeAttBearer::takeContinuation()
+{
+    if (m_continuations.isEmpty())
+        return LeAttRequest();
+    return m_continuations.dequeue();
+}
+
+/*
+  Removes the outstanding request and the queued continuations from the bearer.
+ */
+QVector<LeAttRequest> LeAttBearer::takeRequests()
+{
+    QVector<LeAttRequest> requests;
+    if (m_requestPending) {
+        requests.append(m_request);
+        m_request = LeAttRequest();
+        m_requestPending = false;
+        m_timer->stop();
+    }
+    while (!m_continuations.isEmpty())
+        requests.append(m_continuations.dequeue());
+    return requests;
+}
+
+void LeAttBearer::close()
+{
+    if (m_state == ClosedState)
+        return;
+
+    m_state = ClosedState;
+    m_timer->stop();
+    m_readNotifier->setEnabled(false);
+    m_writeNotifier->setEnabled(false);
+    qt_safe_close(m_socket);
+}
+
+void LeAttBearer::socketWritable()
+{
+    m_writeNotifier->setEnabled(false);
+    if (m_state != ConnectingState)
+        return;
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error) {
+        qCDebug(QT_BT_BLUEZ) << "EATT channel cannot be established:"
+                             << qt_error_string(error ? error : errno);
+        close();
+        emit disconnected();
+        return;
+    }
+
+    // The ATT MTU of the bearer is the smaller MTU of both directions.
+    // Local sockets do not provide these options.
+    quint16 sendMtu = 0;
+    quint16 receiveMtu = 0;
+    length = sizeof(sendMtu);
+    if (::getsockopt(m_socket, SOL_BLUETOOTH, BT_SNDMTU, &sendMtu, &length) == 0) {
+        length = sizeof(receiveMtu);
+        if (::getsockopt(m_socket, SOL_BLUETOOTH, BT_RCVMTU, &receiveMtu, &length) == 0)
+            setMtu(qMin(sendMtu, receiveMtu));
+    }
+
+    qCDebug(QT_BT_BLUEZ) << "EATT bearer" << m_socket << "ready, MTU:" << m_mtu;
+    m_state = ReadyState;
+    m_readNotifier->setEnabled(true);
+    emit ready();
+}
+
+void LeAttBearer::socketReadable()
+{
+    char pdu[maximumPduSize];
+    while (m_state == ReadyState) {
+        const ssize_t size = qt_safe_read(m_socket, pdu, sizeof(pdu));
+        if (size > 0) {
+            processPdu(pdu, int(size));
+            continue;
+        }
+
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        qCDebug(QT_BT_BLUEZ) << "EATT bearer" << m_socket << "disconnected";
+        close();
+        emit disconnected();
+    }
+}
+
+void LeAttBearer::processPdu(const char *data, int size)
+{
+    const quint8 opcode = quint8(data[0]);
+    if (opcode == attOpHandleValueNotification) {
+        emit unsolicitedReceived(QByteArray(data, size));
+        return;
+    }
+    if (opcode == attOpHandleValueIndication) {
+        const char confirmation = char(attOpHandleValueConfirmation);
+        writePdu(&confirmation, 1);
+        emit unsolicitedReceived(QByteArray(data, size));
+        return;
+    }
+
+    // requests have an even opcode, responses an odd one
+    if (!(opcode & 0x01)) {
+        if (opcode & attCommandFlag || opcode == attOpHandleValueConfirmation)
+            return;
+
+        // the GATT server of the local device is not available on this bearer
+        char response[5];
+        response[0] = char(attOpErrorResponse);
+        response[1] = char(opcode);
+        response[2] = response[3] = 0;
+        response[4] = char(attErrorRequestNotSupported);
+        writePdu(response, sizeof(response));
+        return;
+    }
+
+    if (!m_requestPending) {
+        qCWarning(QT_BT_BLUEZ) << "Unexpected response on EATT bearer" << m_socket;
+        return;
+    }
+
+    m_timer->stop();
+    m_requestPending = false;
+    const LeAttRequest request = std::move(m_request);
+    m_request = LeAttRequest();
+    emit responseReceived(request, QByteArray(data, size));
+}
+
+void LeAttBearer::requestTimeout()
+{
+    if (!m_requestPending)
+        return;
+
+    // no further PDU may be sent on a bearer after a transaction timed out
+    const LeAttRequest request = m_request;
+    m_request = LeAttRequest();
+    m_requestPending = false;
+    close();
+    emit requestTimedOut(request);
+}
+
+bool LeAttBearer::writePdu(const char *data, int size)
+{
+    if (qt_safe_write(m_socket, data, size) == size)
+        return true;
+
+    qCWarning(QT_BT_BLUEZ) << "Cannot write to EATT bearer" << m_socket << ":"
+                           << qt_error_string(errno);
+    return false;
+}
+
+LeAttBearerPool::LeAttBearerPool(QObject *parent)
+    : QObject(parent)
+{
+}
+
+LeAttBearerPool::~LeAttBearerPool()
+{
+    clear();
+}
+
+/*
+  Adds \a bearer to the pool. The pool takes ownership of the bearer.
+ */
+void LeAttBearerPool::addBearer(LeAttBearer *bearer)
+{
+    bearer->setParent(this);
+    bearer->setRequestTimeout(m_requestTimeout);
+    m_bearers.append(bearer);
+
+    connect(bearer, &LeAttBearer::ready, this, &LeAttBearerPool::dispatch);
+    connect(bearer, &LeAttBearer::unsolicitedReceived,
+            this, &LeAttBearerPool::unsolicitedReceived);
+    connect(bearer, &LeAttBearer::responseReceived, this,
+            [this, bearer](const LeAttRequest &request, const QByteArray &response) {
+        emit responseReceived(bearer, request, response);
+        dispatch();
+    });
+    connect(bearer, &LeAttBearer::requestTimedOut, this,
+            [this, bearer](const LeAttRequest &request) {
+        emit requestTimedOut(bearer, request);
+        removeBearer(bearer);
+    });
+    connect(bearer, &LeAttBearer::disconnected, this, [this, bearer]() {
+        removeBearer(bearer);
+    });
+}
+
+int LeAttBearerPool::readyBearerCount() const
+{
+    return int(std::count_if(m_bearers.cbegin(), m_bearers.cend(),
+                             [](const LeAttBearer *bearer) { return bearer->isReady(); }));
+}
+
+/*
+  Returns \c true if a ready bearer can carry \a request.
+ */
+bool LeAttBearerPool::canSend(const LeAttRequest &request) const
+{
+    return std::any_of(m_bearers.cbegin(), m_bearers.cend(),
+                       [&request](const LeAttBearer *bearer) {
+        return bearer->isReady() && request.payload.size() <= bearer->mtu();
+    });
+}
+
+/*
+  Returns \c true if a request of \a service is queued, outstanding on
+  a bearer or waiting as a continuation.
+ */
+bool LeAttBearerPool::hasRequests(const QLowEnergyServicePrivate *service) const
+{
+    for (int i = 0; i < m_queue.count(); ++i) {
+        if (m_queue.at(i).service.data() == service)
+            return true;
+    }
+    return std::any_of(m_bearers.cbegin(), m_bearers.cend(),
+                       [service](const LeAttBearer *bearer) {
+        return bearer->isBusy() && bearer->busyService() == service;
+    });
+}
+
+void LeAttBearerPool::setRequestTimeout(int msecs)
+{
+    m_requestTimeout = msecs;
+    for (LeAttBearer *bearer : qAsConst(m_bearers))
+        bearer->setRequestTimeout(msecs);
+}
+
+/*
+  Holds back requests while \a suspended is \c true, for example
+  during a change of the link encryption.
+ */
+void LeAttBearerPool::setSuspended(bool suspended)
+{
+    if (m_suspended == suspended)
+        return;
+
+    m_suspended = suspended;
+    if (!m_suspended)
+        dispatch();
+}
+
+void LeAttBearerPool::enqueue(const LeAttRequest &request)
+{
+    m_queue.enqueue(request);
+    dispatch();
+}
+
+/*
+  Removes the queued requests of \a service. Outstanding requests and
+  continuations are kept. Returns the number of removed requests.
+ */
+int LeAttBearerPool::cancel(const QLowEnergyServicePrivate *service)
+{
+    return m_queue.removeIf([service](const LeAttRequest &request) {
+        return request.service.data() == service;
+    });
+}
+
+void LeAttBearerPool::clear()
+{
+    m_queue.clear();
+    const QVector<LeAttBearer *> bearers = m_bearers;
+    m_bearers.clear();
+    for (LeAttBearer *bearer : bearers) {
+        disconnect(bearer, nullptr, this, nullptr);
+        bearer->close();
+        bearer->deleteLater();
+    }
+}
+
+void LeAttBearerPool::dispatch()
+{
+    if (m_suspended)
+        return;
+
+    for (LeAttBearer *bearer : qAsConst(m_bearers))
+        bearer->sendContinuation();
+
+    // services whose requests must wait for an outstanding request
+    QVarLengthArray<const QLowEnergyServicePrivate *, 8> busyServices;
+    for (const LeAttBearer *bearer : qAsConst(m_bearers)) {
+        if (bearer->isBusy())
+            busyServices.append(bearer->busyService());
+    }
+
+    QVector<LeAttRequest> handedBack;
+    for (int i = 0; i < m_queue.count(); ) {
+        const LeAttRequest &request = m_queue.at(i);
+        const QLowEnergyServicePrivate *service = request.service.data();
+        if (busyServices.contains(service)) {
+            ++i;
+            continue;
+        }
+
+        if (!canSend(request) && readyBearerCount() > 0) {
+            // the later requests of the service follow it to keep their order
+            handedBack.append(m_queue.takeAt(i));
+            for (int j = i; j < m_queue.count(); ) {
+                if (m_queue.at(j).service.data() == service)
+                    handedBack.append(m_queue.takeAt(j));
+                else
+                    ++j;
+            }
+            continue;
+        }
+
+        // later requests of the service must not overtake this one
+        busyServices.append(service);
+
+        LeAttBearer *bearer = idleBearer(request.payload.size());
+        if (!bearer) {
+            if (!idleBearer(0))
+                break;
+            ++i;
+            continue;
+        }
+
+        bearer->sendRequest(m_queue.takeAt(i));
+    }
+
+    if (!handedBack.isEmpty())
+        emit requestsOrphaned(handedBack);
+}
+
+void LeAttBearerPool::removeBearer(LeAttBearer *bearer)
+{
+    if (!m_bearers.removeOne(bearer))
+        return;
+
+    disconnect(bearer, nullptr, this, nullptr);
+    const QVector<LeAttRequest> requests = bearer->takeRequests();
+    bearer->deleteLater();
+
+    // the requests of the lost bearer are sent before any other request
+    for (int i = requests.count() - 1; i >= 0; --i)
+        m_queue.prepend(requests.at(i));
+
+    // the remaining bearers are either ready or still connecting
+    if (!m_bearers.isEmpty()) {
+        dispatch();
+        return;
+    }
+
+    QVector<LeAttRequest> orphans;
+    orphans.reserve(m_queue.count());
+    while (!m_queue.isEmpty())
+        orphans.append(m_queue.dequeue());
+    if (!orphans.isEmpty())
+        emit requestsOrphaned(orphans);
+}
+
+LeAttBearer *LeAttBearerPool::idleBearer(int pduSize) const
+{
+    for (LeAttBearer *bearer : m_bearers) {
+        if (bearer->isReady() && !bearer->isBusy() && pduSize <= bearer->mtu())
+            return bearer;
+    }
+    return nullptr;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,193 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LEATTBEARER_P_H
+#define LEATTBEARER_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "leattrequest_p.h"
+
+#include <QtCore/qobject.h>
+#include <QtCore/qvector.h>
+
+QT_BEGIN_NAMESPACE
+
+class QBluetoothAddress;
+class QSocketNotifier;
+class QTimer;
+
+/*
+  An additional ATT bearer of a connection (Enhanced ATT). Each bearer is
+  a separate L2CAP channel with its own slot for one outstanding request.
+
+  The bearer takes ownership of a non-blocking socket. It becomes ready once
+  the socket is connected. The ATT MTU of the bearer is determined by the
+  MTUs of the L2CAP channel. Sockets which do not report an L2CAP MTU, such as
+  local socket pairs, keep the MTU set by setMtu().
+
+  Responses are matched with the outstanding request. Notifications and
+  indications are passed on, indications are confirmed by the bearer.
+ */
+class Q_AUTOTEST_EXPORT LeAttBearer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LeAttBearer(int socketDescriptor, QObject *parent = nullptr);
+    ~LeAttBearer() override;
+
+    static int openChannel(const QBluetoothAddress &localAddress, quint8 localAddressType,
+                           const QBluetoothAddress &remoteAddress, quint8 addressType);
+
+    int socketDescriptor() const { return m_socket; }
+    bool isReady() const { return m_state == ReadyState; }
+
+    void setMtu(int mtu);
+    int mtu() const { return m_mtu; }
+
+    void setRequestTimeout(int msecs);
+
+    // a bearer is busy while a request is outstanding or a continuation is queued
+    bool isBusy() const { return m_requestPending || !m_continuations.isEmpty(); }
+    const QLowEnergyServicePrivate *busyService() const;
+
+    void sendRequest(const LeAttRequest &request);
+    void prependRequest(const LeAttRequest &request);
+    bool sendContinuation();
+    LeAttRequest takeContinuation();
+    QVector<LeAttRequest> takeRequests();
+
+    void close();
+
+signals:
+    void ready();
+    void responseReceived(const LeAttRequest &request, const QByteArray &response);
+    void unsolicitedReceived(const QByteArray &packet);
+    void requestTimedOut(const LeAttRequest &request);
+    void disconnected();
+
+private slots:
+    void socketWritable();
+    void socketReadable();
+    void requestTimeout();
+
+private:
+    enum State { ConnectingState, ReadyState, ClosedState };
+
+    bool writePdu(const char *data, int size);
+    void processPdu(const char *data, int size);
+
+    LeAttRequest m_request;
+    LeRingQueue<LeAttRequest> m_continuations;
+    QSocketNotifier *m_readNotifier = nullptr;
+    QSocketNotifier *m_writeNotifier = nullptr;
+    QTimer *m_timer = nullptr;
+    int m_socket;
+    int m_mtu;
+    int m_requestTimeout = 0;
+    State m_state = ConnectingState;
+    bool m_requestPending = false;
+};
+
+/*
+  Distributes ATT requests across the ready bearers of a pool.
+
+  Requests of the same service are sent in the order in which they were queued
+  and never concurrently. Requests of different services proceed in parallel.
+  A request is only sent on a bearer whose MTU can carry it. Continuations
+  prepended while a response of a bearer is processed are sent next on
+  the same bearer.
+
+  Requests of bearers which are lost are sent on the remaining bearers.
+  If no bearer is left, the queued requests are handed back via requestsOrphaned().
+  A request which no ready bearer can carry is handed back the same way,
+  together with the later requests of its service.
+ */
+class Q_AUTOTEST_EXPORT LeAttBearerPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LeAttBearerPool(QObject *parent = nullptr);
+    ~LeAttBearerPool() override;
+
+    void addBearer(LeAttBearer *bearer);
+    int readyBearerCount() const;
+    bool canSend(const LeAttRequest &request) const;
+    bool hasRequests(const QLowEnergyServicePrivate *service) const;
+
+    void setRequestTimeout(int msecs);
+    void setSuspended(bool suspended);
+
+    void enqueue(const LeAttRequest &request);
+    int count() const { return m_queue.count(); }
+    int cancel(const QLowEnergyServicePrivate *service);
+    void clear();
+
+public slots:
+    void dispatch();
+
+signals:
+    void responseReceived(LeAttBearer *bearer, const LeAttRequest &request,
+                          const QByteArray &response);
+    void unsolicitedReceived(const QByteArray &packet);
+    void requestTimedOut(LeAttBearer *bearer, const LeAttRequest &request);
+    void requestsOrphaned(const QVector<LeAttRequest> &requests);
+
+private:
+    void removeBearer(LeAttBearer *bearer);
+    LeAttBearer *idleBearer(int pduSize) const;
+
+    QVector<LeAttBearer *> m_bearers;
+    LeRingQueue<LeAttRequest> m_queue;
+    int m_requestTimeout = 0;
+    bool m_suspended = false;
+};
+
+QT_END_NAMESPACE
+
+#endif // LEATTBEARER_P_H
@@ -0,0 +1,314 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "leattrequest_p.h"
+#include "qlowenergyserviceprivate_p.h"
+
+#include <QtCore/qatomic.h>
+#include <QtCore/qendian.h>
+
+QT_BEGIN_NAMESPACE
+
+// requests dispatched by all schedulers of the process
+static QBasicAtomicInteger<quint64> dispatchedRequests = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+LeAttRequestScheduler::LeAttRequestScheduler()
+{
+    m_clock.start();
+}
+
+/*
+  Replaces the monotonic clock which timestamps the queued requests. The wait times
+  of the statistics are based on \a clock. A \c nullptr restores the monotonic clock.
+ */
+void LeAttRequestScheduler::setClock(Clock clock)
+{
+    m_clockOverride = clock;
+}
+
+bool LeAttRequestScheduler::isEmpty() const
+{
+    return count() == 0;
+}
+
+int LeAttRequestScheduler::count() const
+{
+    int result = 0;
+    for (const LeRingQueue<LeAttRequest> &lane : m_lanes)
+        result += lane.count();
+    return result;
+}
+
+/*
+  Returns the request to be sent next. The request is selected on the first call
+  and stays selected until it is removed by dequeue().
+ */
+LeAttRequest &LeAttRequestScheduler::head()
+{
+    Q_ASSERT(!isEmpty());
+
+    if (m_activeLane < 0) {
+        const LeAttRequest::Lane lane = selectLane();
+        m_activeLane = lane;
+        m_chainContinues = false;
+
+        if (lane == LeAttRequest::InteractiveLane
+                && !m_lanes[LeAttRequest::BulkLane].isEmpty()) {
+            ++m_interactiveBurst;
+        } else {
+            m_interactiveBurst = 0;
+        }
+
+        LaneStatistics &stats = m_statistics[lane];
+        const qint64 waitTime = now() - m_lanes[lane].head().enqueueTime;
+        ++stats.dispatched;
+        dispatchedRequests.fetchAndAddRelaxed(1);
+        stats.totalWaitTime += waitTime;
+        stats.maxWaitTime = qMax(stats.maxWaitTime, waitTime);
+    }
+
+    return m_lanes[m_activeLane].head();
+}
+
+void LeAttRequestScheduler::enqueue(const LeAttRequest &request)
+{
+    Q_ASSERT(request.lane < LeAttRequest::LaneCount);
+
+    LeAttRequest queued = request;
+    queued.enqueueTime = now();
+    m_lanes[request.lane].enqueue(queued);
+    updateDepth(request.lane);
+}
+
+/*
+  Prepends \a request to the lane of the previously dequeued request.
+  The request is sent next as it continues the chain of the previous request.
+ */
+void LeAttRequestScheduler::prepend(const LeAttRequest &request)
+{
+    // the selected request might be on the air already
+    Q_ASSERT(m_activeLane < 0);
+
+    LeRingQueue<LeAttRequest> &lane = m_lanes[m_lastLane];
+    lane.prepend(request);
+    lane.head().lane = m_lastLane;
+    lane.head().enqueueTime = now();
+    m_chainContinues = true;
+    updateDepth(m_lastLane);
+}
+
+LeAttRequest LeAttRequestScheduler::dequeue()
+{
+    Q_ASSERT(!isEmpty());
+
+    if (m_activeLane < 0)
+        head();
+
+    const LeAttRequest::Lane lane = LeAttRequest::Lane(m_activeLane);
+    m_activeLane = -1;
+    m_lastLane = lane;
+    m_chainContinues = false;
+
+    LeAttRequest request = m_lanes[lane].dequeue();
+    updateDepth(lane);
+    return request;
+}
+
+void LeAttRequestScheduler::clear()
+{
+    for (int i = 0; i < LeAttRequest::LaneCount; ++i) {
+        m_lanes[i].clear();
+        updateDepth(LeAttRequest::Lane(i));
+    }
+    m_activeLane = -1;
+    m_lastLane = LeAttRequest::BulkLane;
+    m_chainContinues = false;
+    m_interactiveBurst = 0;
+}
+
+/*
+  Removes the queued requests of \a service. The selected request and the next step
+  of a running chain are kept as the remote device expects them.
+  Returns the number of removed requests.
+ */
+int LeAttRequestScheduler::cancel(const QLowEnergyServicePrivate *service)
+{
+    int removed = 0;
+    for (int i = 0; i < LeAttRequest::LaneCount; ++i) {
+        const bool keepHead = (i == m_activeLane)
+                || (m_activeLane < 0 && m_chainContinues && i == m_lastLane);
+        removed += m_lanes[i].removeIf([service](const LeAttRequest &request) {
+            return request.service.data() == service;
+        }, keepHead ? 1 : 0);
+        updateDepth(LeAttRequest::Lane(i));
+    }
+    return removed;
+}
+
+/*
+  Returns \c true if a request of \a service is queued, including the selected request.
+ */
+bool LeAttRequestScheduler::contains(const QLowEnergyServicePrivate *service) const
+{
+    for (const LeRingQueue<LeAttRequest> &lane : m_lanes) {
+        for (int i = 0; i < lane.count(); ++i) {
+            if (lane.at(i).service.data() == service)
+                return true;
+        }
+    }
+    return false;
+}
+
+LeAttRequestScheduler::LaneStatistics LeAttRequestScheduler::statistics(
+        LeAttRequest::Lane lane) const
+{
+    return m_statistics[lane];
+}
+
+/*
+  Returns the number of requests which the schedulers of all connections have
+  dispatched since the process started. Each request is one ATT round trip.
+ */
+quint64 LeAttRequestScheduler::totalDispatched()
+{
+    return dispatchedRequests.loadRelaxed();
+}
+
+void LeAttRequestScheduler::resetStatistics()
+{
+    for (int i = 0; i < LeAttRequest::LaneCount; ++i) {
+        m_statistics[i] = LaneStatistics();
+        updateDepth(LeAttRequest::Lane(i));
+    }
+}
+
+LeAttRequest::Lane LeAttRequestScheduler::selectLane() const
+{
+    if (m_chainContinues && !m_lanes[m_lastLane].isEmpty())
+        return m_lastLane;
+
+    if (m_lanes[LeAttRequest::InteractiveLane].isEmpty())
+        return LeAttRequest::BulkLane;
+    if (m_lanes[LeAttRequest::BulkLane].isEmpty()
+            || m_interactiveBurst < MaxInteractiveBurst) {
+        return LeAttRequest::InteractiveLane;
+    }
+    return LeAttRequest::BulkLane;
+}
+
+void LeAttRequestScheduler::updateDepth(LeAttRequest::Lane lane)
+{
+    LaneStatistics &stats = m_statistics[lane];
+    stats.depth = m_lanes[lane].count();
+    stats.maxDepth = qMax(stats.maxDepth, stats.depth);
+}
+
+qint64 LeAttRequestScheduler::now() const
+{
+    if (m_clockOverride)
+        return m_clockOverride();
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+void LePreparedWrite::addEntry(const Entry &entry)
+{
+    m_entries.append(entry);
+    m_segments.clear();
+}
+
+/*
+  Splits the values of all entries into Prepare Write Request PDUs which
+  fit into \a mtu. An empty value is written using a single empty segment.
+ */
+void LePreparedWrite::buildSegments(int mtu)
+{
+    Q_ASSERT(mtu > HeaderSize);
+    const int maxPayload = mtu - HeaderSize;
+
+    int segmentCount = 0;
+    int totalSize = 0;
+    for (const Entry &entry : qAsConst(m_entries)) {
+        const int count = qMax(1, (entry.value.size() + maxPayload - 1) / maxPayload);
+        segmentCount += count;
+        totalSize += count * HeaderSize + entry.value.size();
+    }
+
+    m_segments.clear();
+    m_segments.reserve(segmentCount);
+    m_pdus.clear();
+    m_pdus.reserve(totalSize);
+
+    for (const Entry &entry : qAsConst(m_entries)) {
+        int offset = 0;
+        do {
+            const int payload = qMin(entry.value.size() - offset, maxPayload);
+            char header[HeaderSize];
+            header[0] = 0x16; // ATT_OP_PREPARE_WRITE_REQUEST
+            qToLittleEndian<quint16>(entry.attributeHandle, header + 1);
+            qToLittleEndian<quint16>(quint16(offset), header + 3);
+
+            m_segments.append(Segment{m_pdus.size(), HeaderSize + payload});
+            m_pdus.append(header, HeaderSize);
+            m_pdus.append(entry.value.constData() + offset, payload);
+            offset += payload;
+        } while (offset < entry.value.size());
+    }
+}
+
+const char *LePreparedWrite::segment(int index, int *size) const
+{
+    Q_ASSERT(index >= 0 && index < m_segments.size());
+    const Segment &segment = m_segments.at(index);
+    *size = segment.size;
+    return m_pdus.constData() + segment.offset;
+}
+
+/*
+  Returns \c true if \a response is the Prepare Write Response which echoes
+  the segment \a index. Apart from the opcode the echo is identical to the request.
+ */
+bool LePreparedWrite::verifyEcho(int index, const char *response, int size) const
+{
+    int segmentSize = 0;
+    const char *pdu = segment(index, &segmentSize);
+    if (size != segmentSize || quint8(response[0]) != 0x17) // ATT_OP_PREPARE_WRITE_RESPONSE
+        return false;
+    return memcmp(pdu + 1, response + 1, size_t(size - 1)) == 0;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,344 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef LEATTREQUEST_P_H
+#define LEATTREQUEST_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qvarlengtharray.h>
+#include <QtCore/qvector.h>
+#include <QtBluetooth/qbluetooth.h>
+
+#include <utility>
+
+QT_BEGIN_NAMESPACE
+
+class QLowEnergyServicePrivate;
+class LePreparedWrite;
+
+// PDUs up to the default ATT MTU are stored inline
+enum { LeAttInlinePduSize = 23 };
+typedef QVarLengthArray<char, LeAttInlinePduSize> LeAttPdu;
+
+/*
+  An ATT request waiting to be sent or waiting for its response.
+
+  The command determines which of the context fields are used when
+  the response is processed. None of them allocates memory unless
+  they carry data. The service pointer and the value share their data
+  with the caller.
+ */
+struct LeAttRequest
+{
+    enum Lane : quint8 {
+        InteractiveLane,    // reads and writes issued via QLowEnergyService
+        BulkLane,           // service discovery and long writes
+        LaneCount
+    };
+
+    quint8 command = 0;
+    Lane lane = BulkLane;
+    LeAttPdu payload;
+
+    // service the request belongs to; null if the request spans several services
+    QSharedPointer<QLowEnergyServicePrivate> service;
+    // value to be written
+    QByteArray value;
+    // read multiple: read context of each value (see handleData)
+    QVector<uint> handleDataList;
+    // descriptor discovery: characteristics which still need to be processed
+    QList<QLowEnergyHandle> pendingCharHandles;
+    // prepare and execute write: the values being written
+    QSharedPointer<LePreparedWrite> preparedWrite;
+
+    // characteristic handle in the lower and descriptor handle in the upper 16 bit;
+    // prepare write: index of the segment, execute write: 0 for a cancellation
+    uint handleData = 0;
+    // service discovery: group type, characteristic discovery: attribute type
+    quint16 attributeType = 0;
+    // descriptor discovery: first handle of the request
+    QLowEnergyHandle startHandle = 0;
+    // service discovery: last value read of the current discovery step
+    bool isLastValue = false;
+
+    // time at which the request was queued (see LeAttRequestScheduler)
+    qint64 enqueueTime = 0;
+};
+
+/*
+  FIFO queue on top of a ring of preallocated slots. Slots are reused such that
+  queueing requests does not allocate once the ring has grown to the
+  number of concurrently queued requests.
+ */
+template <typename T>
+class LeRingQueue
+{
+public:
+    explicit LeRingQueue(int capacity = 16)
+    {
+        m_slots.resize(qMax(capacity, 1));
+    }
+
+    bool isEmpty() const { return m_count == 0; }
+    int count() const { return m_count; }
+
+    T &head()
+    {
+        Q_ASSERT(!isEmpty());
+        return m_slots[m_head];
+    }
+
+    const T &head() const
+    {
+        Q_ASSERT(!isEmpty());
+        return m_slots.at(m_head);
+    }
+
+    void enqueue(const T &t)
+    {
+        if (m_count == m_slots.size())
+            grow();
+        m_slots[(m_head + m_count) % m_slots.size()] = t;
+        ++m_count;
+    }
+
+    void prepend(const T &t)
+    {
+        if (m_count == m_slots.size())
+            grow();
+        m_head = (m_head + m_slots.size() - 1) % m_slots.size();
+        m_slots[m_head] = t;
+        ++m_count;
+    }
+
+    T &operator[](int i)
+    {
+        Q_ASSERT(i >= 0 && i < m_count);
+        return m_slots[(m_head + i) % m_slots.size()];
+    }
+
+    const T &at(int i) const
+    {
+        Q_ASSERT(i >= 0 && i < m_count);
+        return m_slots.at((m_head + i) % m_slots.size());
+    }
+
+    T takeAt(int i)
+    {
+        Q_ASSERT(i >= 0 && i < m_count);
+        const int size = m_slots.size();
+        T t = std::move(m_slots[(m_head + i) % size]);
+        // close the gap by moving the preceding entries towards the back
+        for (int j = i; j > 0; --j)
+            m_slots[(m_head + j) % size] = std::move(m_slots[(m_head + j - 1) % size]);
+        m_slots[m_head] = T(); // release shared data
+        m_head = (m_head + 1) % size;
+        --m_count;
+        return t;
+    }
+
+    T dequeue()
+    {
+        Q_ASSERT(!isEmpty());
+        T t = std::move(m_slots[m_head]);
+        m_slots[m_head] = T(); // release shared data
+        m_head = (m_head + 1) % m_slots.size();
+        --m_count;
+        return t;
+    }
+
+    T takeFirst() { return dequeue(); }
+
+    void clear()
+    {
+        while (!isEmpty())
+            dequeue();
+        m_head = 0;
+    }
+
+    // removes all entries from index first onwards for which pred returns true
+    template <typename Predicate>
+    int removeIf(Predicate pred, int first = 0)
+    {
+        int removed = 0;
+        const int n = m_count;
+        for (int i = 0; i < n; ++i) {
+            T t = dequeue();
+            if (i >= first && pred(t))
+                ++removed;
+            else
+                enqueue(t);
+        }
+        return removed;
+    }
+
+private:
+    void grow()
+    {
+        QVector<T> slots(m_slots.size() * 2);
+        for (int i = 0; i < m_count; ++i)
+            slots[i] = std::move(m_slots[(m_head + i) % m_slots.size()]);
+        m_slots.swap(slots);
+        m_head = 0;
+    }
+
+    QVector<T> m_slots;
+    int m_head = 0;
+    int m_count = 0;
+};
+
+/*
+  Schedules the ATT requests of a connection across priority lanes.
+
+  Interactive requests are preferred over bulk requests. To avoid starving
+  the bulk lane, a bulk request is sent after a burst of interactive requests.
+  Requests which are prepended while processing the response of the previous request
+  continue a chain (Read Blob, Prepare/Execute Write or the retry of a request
+  after an encryption change). Such continuations are always sent next
+  such that chains are never interleaved with requests of another lane.
+
+  The request which has been selected by head() stays selected until dequeue()
+  is called.
+ */
+class Q_AUTOTEST_EXPORT LeAttRequestScheduler
+{
+public:
+    struct LaneStatistics {
+        int depth = 0;              // currently queued requests
+        int maxDepth = 0;
+        quint64 dispatched = 0;
+        qint64 totalWaitTime = 0;   // in microseconds
+        qint64 maxWaitTime = 0;     // in microseconds
+    };
+
+    LeAttRequestScheduler();
+
+    // returns a timestamp in microseconds
+    typedef qint64 (*Clock)();
+    void setClock(Clock clock);
+
+    bool isEmpty() const;
+    int count() const;
+
+    LeAttRequest &head();
+    void enqueue(const LeAttRequest &request);
+    void prepend(const LeAttRequest &request);
+    LeAttRequest dequeue();
+    LeAttRequest takeFirst() { return dequeue(); }
+    void clear();
+
+    int cancel(const QLowEnergyServicePrivate *service);
+    bool contains(const QLowEnergyServicePrivate *service) const;
+
+    LaneStatistics statistics(LeAttRequest::Lane lane) const;
+    void resetStatistics();
+    static quint64 totalDispatched();
+
+    enum { MaxInteractiveBurst = 4 };
+
+private:
+    LeAttRequest::Lane selectLane() const;
+    void updateDepth(LeAttRequest::Lane lane);
+    qint64 now() const;
+
+    LeRingQueue<LeAttRequest> m_lanes[LeAttRequest::LaneCount];
+    LaneStatistics m_statistics[LeAttRequest::LaneCount];
+    QElapsedTimer m_clock;
+    Clock m_clockOverride = nullptr;
+    int m_activeLane = -1;                  // lane of the selected request
+    LeAttRequest::Lane m_lastLane = LeAttRequest::BulkLane;
+    bool m_chainContinues = false;
+    int m_interactiveBurst = 0;
+};
+
+/*
+  The values of a long write or of a reliable write across several characteristics.
+
+  All Prepare Write Request PDUs are built up front for the given MTU and
+  sent back to back. The server echoes every prepared segment. The echo is
+  compared with the PDU which has been sent. A mismatch cancels the write
+  as the server would execute a corrupted value.
+ */
+class Q_AUTOTEST_EXPORT LePreparedWrite
+{
+public:
+    struct Entry {
+        QLowEnergyHandle charHandle = 0;
+        QLowEnergyHandle descriptorHandle = 0;  // 0 if the characteristic value is written
+        QLowEnergyHandle attributeHandle = 0;   // handle on the server
+        QByteArray value;
+    };
+
+    enum { HeaderSize = 5 };
+
+    void addEntry(const Entry &entry);
+    const QVector<Entry> &entries() const { return m_entries; }
+
+    void buildSegments(int mtu);
+    int segmentCount() const { return m_segments.size(); }
+    const char *segment(int index, int *size) const;
+    bool verifyEcho(int index, const char *response, int size) const;
+
+private:
+    struct Segment {
+        int offset;
+        int size;
+    };
+
+    QVector<Entry> m_entries;
+    QVector<Segment> m_segments;
+    QByteArray m_pdus;          // all Prepare Write Request PDUs
+};
+
+QT_END_NAMESPACE
+
+#endif // LEATTREQUEST_P_H
@@ -0,0 +1,442 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "leattserverconnection_p.h"
+#include "bluez/bluez_data_p.h"
+
+#include <QtBluetooth/qbluetoothsocket.h>
+#include <QtCore/qiodevice.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsocketnotifier.h>
+#include <QtCore/qvarlengtharray.h>
+
+#include <cstring>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint8 attOpHandleValueNotification = 0x1b;
+static const quint8 attOpHandleValueIndication = 0x1d;
+static const int maxPduSize = 3 + 512;
+
+LeAttValueQueue::LeAttValueQueue(Policy policy, int maxDepth)
+    : m_policy(policy), m_maxDepth(qMax(maxDepth, 1))
+{
+}
+
+/*
+  Drops all pending values.
+ */
+void LeAttValueQueue::setPolicy(Policy policy, int maxDepth)
+{
+    clear();
+    m_policy = policy;
+    m_maxDepth = qMax(maxDepth, 1);
+}
+
+/*
+  Returns \c false if \a value or an older value was dropped because the
+  queue is full.
+ */
+bool LeAttValueQueue::enqueue(QLowEnergyHandle handle, const QByteArray &value)
+{
+    if (m_policy == MergePolicy) {
+        const auto it = m_sequences.constFind(handle);
+        if (it != m_sequences.constEnd()) {
+            m_entries[int(*it - m_headSequence)].value = value;
+            ++m_merged;
+            return true;
+        }
+    }
+
+    bool complete = true;
+    if (m_entries.count() == m_maxDepth) {
+        ++m_dropped;
+        complete = false;
+        if (m_policy == DropNewestPolicy)
+            return false;
+        dequeue();
+    }
+
+    Entry entry;
+    entry.handle = handle;
+    entry.value = value;
+    if (m_policy == MergePolicy)
+        m_sequences.insert(handle, m_headSequence + quint64(m_entries.count()));
+    m_entries.enqueue(entry);
+    return complete;
+}
+
+LeAttValueQueue::Entry LeAttValueQueue::dequeue()
+{
+    Entry entry = m_entries.dequeue();
+    ++m_headSequence;
+    if (m_policy == MergePolicy)
+        m_sequences.remove(entry.handle);
+    return entry;
+}
+
+void LeAttValueQueue::clear()
+{
+    m_entries.clear();
+    m_sequences.clear();
+    m_headSequence = 0;
+}
+
+char *LeAttPduBuilder::start(quint8 opcode, int mtu)
+{
+    Q_ASSERT(mtu > 0);
+    if (m_buffer.size() < mtu)
+        m_buffer.resize(mtu);
+    char *data = m_buffer.data();
+    m_limit = data + mtu;
+    *data = char(opcode);
+    return data + 1;
+}
+
+/*
+  Starts a list response whose elements have \a elementSize bytes. The returned
+  pointer refers to the \a headerSize bytes which precede the first element.
+ */
+char *LeAttPduBuilder::startList(quint8 opcode, int mtu, int elementSize, int headerSize)
+{
+    Q_ASSERT(elementSize > 0 && headerSize >= 0);
+    char *header = start(opcode, mtu);
+    m_listEnd = header + headerSize;
+    m_elementSize = elementSize;
+    m_elementCount = 0;
+    return header;
+}
+
+/*
+  Returns where the next element of the list goes or \c nullptr if
+  the element would exceed the MTU.
+ */
+char *LeAttPduBuilder::nextElement()
+{
+    Q_ASSERT(m_listEnd);
+    if (m_limit - m_listEnd < m_elementSize)
+        return nullptr;
+    char *element = m_listEnd;
+    m_listEnd += m_elementSize;
+    ++m_elementCount;
+    return element;
+}
+
+/*
+  Returns the size of the PDU which was written up to \a end.
+ */
+int LeAttPduBuilder::size(const char *end) const
+{
+    Q_ASSERT(end > m_buffer.constData() && end <= m_limit);
+    return int(end - m_buffer.constData());
+}
+
+/*
+  Returns the characteristic whose value has the handle \a handle or \c nullptr
+  if \a handle is not the value of the owning characteristic.
+ */
+QLowEnergyServicePrivate::CharData *LeAttributeOwner::characteristicData(
+        QLowEnergyHandle handle) const
+{
+    if (!service || handle != charHandle + 1) // Char value decl comes right after char decl.
+        return nullptr;
+    const auto charIt = service->characteristicList.find(charHandle);
+    return charIt != service->characteristicList.end() ? &charIt.value() : nullptr;
+}
+
+/*
+  Returns the descriptor with the handle \a handle or \c nullptr if the owning
+  characteristic has no such descriptor.
+ */
+QLowEnergyServicePrivate::DescData *LeAttributeOwner::descriptorData(
+        QLowEnergyHandle handle) const
+{
+    if (!service)
+        return nullptr;
+    const auto charIt = service->characteristicList.find(charHandle);
+    if (charIt == service->characteristicList.end())
+        return nullptr;
+    const auto descIt = charIt->descriptorList.find(handle);
+    return descIt != charIt->descriptorList.end() ? &descIt.value() : nullptr;
+}
+
+/*
+  Extends the range by the range of \a pendingValue, the indication which a
+  bonded central missed while it was not connected. Values of invalid size
+  are ignored.
+ */
+void LeServiceChangedRange::merge(const QByteArray &pendingValue)
+{
+    if (pendingValue.count() != 2 * int(sizeof(QLowEnergyHandle)))
+        return;
+    start = qMin(start, getBtData<QLowEnergyHandle>(pendingValue.constData()));
+    end = qMax(end, getBtData<QLowEnergyHandle>(pendingValue.constData()
+                                                + sizeof(QLowEnergyHandle)));
+}
+
+QByteArray LeServiceChangedRange::value() const
+{
+    QByteArray value(2 * int(sizeof(QLowEnergyHandle)), Qt::Uninitialized);
+    putBtData(start, value.data());
+    putBtData(end, value.data() + sizeof(QLowEnergyHandle));
+    return value;
+}
+
+LeAttServerConnection::~LeAttServerConnection()
+{
+    delete writeNotifier;
+}
+
+quint16 LeAttServerConnection::clientConfiguration(QLowEnergyHandle configHandle) const
+{
+    const auto it = clientConfigurations.constFind(configHandle);
+    if (it == clientConfigurations.constEnd() || it->size() != 2)
+        return 0;
+    return bt_get_le16(it->constData());
+}
+
+/*
+  Returns the size of the PDU if it was passed on to the socket, \c 0 if the
+  socket buffer is full and \c -1 if the PDU could not be sent.
+ */
+qint64 LeAttServerConnection::sendPdu(const char *data, int size)
+{
+    const qint64 result = socket->write(data, size);
+    if (result == size || result == 0)
+        return result;
+
+    qCDebug(QT_BT_BLUEZ) << "Cannot send PDU to" << remoteDevice << socket->errorString();
+    return -1;
+}
+
+/*
+  Returns the next PDU which the central sent, or an empty byte array if none
+  is pending. Every packet of the L2CAP channel carries one PDU. Other devices
+  do not keep the packet boundaries, all their pending data forms one PDU.
+ */
+QByteArray LeAttServerConnection::readPdu()
+{
+    QBluetoothSocket *l2capSocket = qobject_cast<QBluetoothSocket *>(socket);
+    if (!l2capSocket)
+        return socket->readAll();
+    if (!l2capSocket->hasPendingDatagrams())
+        return QByteArray();
+
+    QByteArray pdu(int(l2capSocket->pendingDatagramSize()), Qt::Uninitialized);
+    const qint64 size = l2capSocket->readDatagram(pdu.data(), pdu.size());
+    if (size <= 0)
+        return QByteArray();
+    pdu.resize(int(size));
+    return pdu;
+}
+
+void LeAttServerConnection::setQueuePolicy(LeAttValueQueue::Policy policy, int maxDepth)
+{
+    pendingNotifications.setPolicy(policy, maxDepth);
+    pendingIndications.setPolicy(policy, maxDepth);
+}
+
+void LeAttServerConnection::queueNotification(QLowEnergyHandle handle, const QByteArray &value)
+{
+    if (!pendingNotifications.enqueue(handle, value))
+        qCDebug(QT_BT_BLUEZ) << "Notification queue of" << remoteDevice << "is full";
+}
+
+void LeAttServerConnection::queueIndication(QLowEnergyHandle handle, const QByteArray &value)
+{
+    if (!pendingIndications.enqueue(handle, value))
+        qCDebug(QT_BT_BLUEZ) << "Indication queue of" << remoteDevice << "is full";
+}
+
+/*
+  Handles the confirmation of the indication in flight and sends the next one.
+  Returns \c false if no indication was waiting for a confirmation.
+ */
+bool LeAttServerConnection::confirmIndication()
+{
+    if (!indicationInFlight)
+        return false;
+    indicationInFlight = false;
+    sendPendingValues();
+    return true;
+}
+
+/*
+  Sends the queued notifications and the next indication until the socket
+  buffer is full. The remaining values are sent once the socket is writable.
+  A value which cannot be sent due to a socket error is dropped.
+ */
+void LeAttServerConnection::sendPendingValues()
+{
+    while (!pendingNotifications.isEmpty()) {
+        if (sendValue(attOpHandleValueNotification, pendingNotifications.head()) == 0) {
+            waitForWritable();
+            return;
+        }
+        pendingNotifications.dequeue();
+    }
+
+    if (indicationInFlight || pendingIndications.isEmpty())
+        return;
+    const qint64 result = sendValue(attOpHandleValueIndication, pendingIndications.head());
+    if (result == 0) {
+        waitForWritable();
+        return;
+    }
+    pendingIndications.dequeue();
+    indicationInFlight = result > 0;
+}
+
+void LeAttServerConnection::clearPendingValues()
+{
+    pendingNotifications.clear();
+    pendingIndications.clear();
+    indicationInFlight = false;
+    if (writeNotifier)
+        writeNotifier->setEnabled(false);
+}
+
+qint64 LeAttServerConnection::sendValue(quint8 opCode, const LeAttValueQueue::Entry &entry)
+{
+    const int valueSize = qMin(entry.value.size(), int(mtuSize) - 3);
+    char pdu[maxPduSize];
+    pdu[0] = char(opCode);
+    putBtData(entry.handle, pdu + 1);
+    memcpy(pdu + 3, entry.value.constData(), size_t(valueSize));
+    return sendPdu(pdu, 3 + valueSize);
+}
+
+/*
+  Without a socket descriptor the queued values are sent by the
+  next call of sendPendingValues().
+ */
+void LeAttServerConnection::waitForWritable()
+{
+    if (socketDescriptor == -1)
+        return;
+
+    if (!writeNotifier) {
+        writeNotifier = new QSocketNotifier(socketDescriptor, QSocketNotifier::Write);
+        QObject::connect(writeNotifier, &QSocketNotifier::activated, writeNotifier, [this]() {
+            writeNotifier->setEnabled(false);
+            sendPendingValues();
+        });
+    }
+    writeNotifier->setEnabled(true);
+}
+
+/*
+  Returns the connection among \a connections whose link has the HCI
+  handle \a hciHandle or \c nullptr if there is none.
+ */
+LeAttServerConnection *LeAttServerConnection::forHciHandle(
+        const QVector<LeAttServerConnection *> &connections, quint16 hciHandle)
+{
+    for (LeAttServerConnection *connection : connections) {
+        if (connection->hciHandle == hciHandle)
+            return connection;
+    }
+    return nullptr;
+}
+
+/*
+  Sends \a value of the characteristic at \a valueHandle to all \a connections which
+  enabled notifications or indications via the configuration descriptor at
+  \a configHandle. The PDU is built once and sent with the length permitted by
+  the MTU of each connection. The value is queued for connections which still
+  have values pending, whose socket buffer is full or which wait for the
+  confirmation of a previous indication.
+
+  Returns the number of connections the value was sent or queued for.
+ */
+int LeAttServerConnection::distributeValue(const QVector<LeAttServerConnection *> &connections,
+                                           QLowEnergyHandle valueHandle,
+                                           QLowEnergyHandle configHandle,
+                                           const QByteArray &value,
+                                           QLowEnergyCharacteristic::PropertyTypes properties)
+{
+    const bool canNotify = properties & QLowEnergyCharacteristic::Notify;
+    const bool canIndicate = properties & QLowEnergyCharacteristic::Indicate;
+    if (!canNotify && !canIndicate)
+        return 0;
+
+    QVarLengthArray<char, maxPduSize> pdu(3 + value.size());
+    putBtData(valueHandle, pdu.data() + 1);
+    memcpy(pdu.data() + 3, value.constData(), size_t(value.size()));
+
+    int reached = 0;
+    for (LeAttServerConnection *connection : connections) {
+        const quint16 configValue = connection->clientConfiguration(configHandle);
+        const int size = 3 + qMin(value.size(), connection->mtuSize - 3);
+        if (canNotify && (configValue & 0x1)) {
+            if (connection->pendingNotifications.isEmpty()) {
+                pdu[0] = char(attOpHandleValueNotification);
+                const qint64 result = connection->sendPdu(pdu.constData(), size);
+                if (result > 0)
+                    ++reached;
+                if (result != 0)
+                    continue; // sent or dropped due to a socket error
+            }
+            connection->queueNotification(valueHandle, value);
+            connection->waitForWritable();
+        } else if (canIndicate && (configValue & 0x2)) {
+            if (!connection->indicationInFlight && connection->pendingIndications.isEmpty()) {
+                pdu[0] = char(attOpHandleValueIndication);
+                const qint64 result = connection->sendPdu(pdu.constData(), size);
+                if (result > 0) {
+                    connection->indicationInFlight = true;
+                    ++reached;
+                }
+                if (result != 0)
+                    continue;
+            }
+            connection->queueIndication(valueHandle, value);
+            if (!connection->indicationInFlight)
+                connection->waitForWritable();
+        } else {
+            continue;
+        }
+        ++reached;
+    }
+    return reached;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,259 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef LEATTSERVERCONNECTION_P_H
+#define LEATTSERVERCONNECTION_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include "leattrequest_p.h"
+#include "qlowenergyserviceprivate_p.h"
+
+#include <QtBluetooth/qbluetoothaddress.h>
+#include <QtBluetooth/qlowenergycharacteristic.h>
+#include <QtCore/qbytearray.h>
+#include <QtCore/qhash.h>
+#include <QtCore/qvector.h>
+
+QT_BEGIN_NAMESPACE
+
+class QIODevice;
+class QSocketNotifier;
+
+/*
+  Characteristic values waiting to be sent to a central as notifications
+  or indications.
+
+  With MergePolicy the queue keeps at most one value per characteristic.
+  A new value replaces the value which is still pending for the same
+  characteristic and keeps its place in the queue, such that the central
+  only receives the newest value. The other policies keep every value.
+
+  The queue holds at most maxDepth() values. Once it is full, a new value
+  replaces the oldest value unless the policy is DropNewestPolicy, in which
+  case the new value is dropped.
+ */
+class Q_AUTOTEST_EXPORT LeAttValueQueue
+{
+public:
+    enum Policy { MergePolicy, DropOldestPolicy, DropNewestPolicy };
+    enum { DefaultMaxDepth = 64 };
+
+    struct Entry {
+        QLowEnergyHandle handle = 0;
+        QByteArray value;
+    };
+
+    explicit LeAttValueQueue(Policy policy = MergePolicy, int maxDepth = DefaultMaxDepth);
+
+    void setPolicy(Policy policy, int maxDepth);
+    Policy policy() const { return m_policy; }
+    int maxDepth() const { return m_maxDepth; }
+
+    bool isEmpty() const { return m_entries.isEmpty(); }
+    int count() const { return m_entries.count(); }
+
+    const Entry &head() const { return m_entries.head(); }
+    bool enqueue(QLowEnergyHandle handle, const QByteArray &value);
+    Entry dequeue();
+    void clear();
+
+    // values which were replaced or dropped before they could be sent
+    quint64 mergedCount() const { return m_merged; }
+    quint64 droppedCount() const { return m_dropped; }
+
+private:
+    LeRingQueue<Entry> m_entries;
+    // MergePolicy: handle -> sequence number of its pending value
+    QHash<QLowEnergyHandle, quint64> m_sequences;
+    quint64 m_headSequence = 0; // sequence number of head()
+    quint64 m_merged = 0;
+    quint64 m_dropped = 0;
+    Policy m_policy;
+    int m_maxDepth;
+};
+
+/*
+  Buffer in which the GATT server writes its responses in place. start()
+  returns where the parameters of the PDU go, nothing may be written beyond
+  limit(). The buffer only grows, such that it is allocated once for the
+  largest MTU and then reused for every response.
+
+  List responses consist of a header and elements which all have the size
+  of the first element. startList() returns where the header goes,
+  nextElement() where the next element goes as long as it fits into the MTU.
+ */
+class Q_AUTOTEST_EXPORT LeAttPduBuilder
+{
+public:
+    char *start(quint8 opcode, int mtu);
+    const char *limit() const { return m_limit; }
+
+    char *startList(quint8 opcode, int mtu, int elementSize, int headerSize);
+    char *nextElement();
+    int elementCount() const { return m_elementCount; }
+    const char *listEnd() const { return m_listEnd; }
+
+    const char *constData() const { return m_buffer.constData(); }
+    int size(const char *end) const;
+
+private:
+    QByteArray m_buffer;
+    const char *m_limit = nullptr;
+    char *m_listEnd = nullptr;
+    int m_elementSize = 0;
+    int m_elementCount = 0;
+};
+
+/*
+  Owner of a characteristic value or descriptor of the local GATT server: the
+  service and the handle of the characteristic declaration. Other attributes
+  have no owning service.
+ */
+struct Q_AUTOTEST_EXPORT LeAttributeOwner
+{
+    QSharedPointer<QLowEnergyServicePrivate> service;
+    QLowEnergyHandle charHandle = 0;
+
+    QLowEnergyServicePrivate::CharData *characteristicData(QLowEnergyHandle handle) const;
+    QLowEnergyServicePrivate::DescData *descriptorData(QLowEnergyHandle handle) const;
+};
+
+/*
+  Handle range of the attributes which a Service Changed indication reports
+  as changed. The value holds the first and the last handle.
+ */
+struct Q_AUTOTEST_EXPORT LeServiceChangedRange
+{
+    LeServiceChangedRange(QLowEnergyHandle s, QLowEnergyHandle e) : start(s), end(e) {}
+
+    QLowEnergyHandle start;
+    QLowEnergyHandle end;
+
+    void merge(const QByteArray &pendingValue);
+    QByteArray value() const;
+};
+
+/*
+  State of a central connected to the GATT server. The attribute database is
+  shared by all connections of a controller, each connection only keeps the
+  state which the ATT protocol defines per client.
+
+  The values of the client characteristic configuration descriptors are kept
+  per connection as well. Requests of a central read and write its own values,
+  the shared attribute database is not touched by them.
+
+  Notifications and indications which cannot be sent right away are queued.
+  Notifications are sent once the socket accepts data again, indications
+  once the central confirmed the previous indication.
+ */
+class Q_AUTOTEST_EXPORT LeAttServerConnection
+{
+public:
+    LeAttServerConnection() = default;
+    ~LeAttServerConnection();
+
+    struct WriteRequest {
+        WriteRequest() {}
+        WriteRequest(quint16 h, quint16 o, const QByteArray &v)
+            : handle(h), valueOffset(o), value(v) {}
+        quint16 handle;
+        quint16 valueOffset;
+        QByteArray value;
+    };
+
+    QIODevice *socket = nullptr;
+    int socketDescriptor = -1; // permits waiting for the socket to become writable
+    quint16 hciHandle = 0; // HCI events refer to the link by this handle
+    QBluetoothAddress remoteDevice;
+    QString remoteName;
+
+    quint16 mtuSize = 23; // ATT_DEFAULT_LE_MTU
+    bool receivedMtuExchangeRequest = false;
+    QVector<WriteRequest> openPrepareWriteRequests;
+
+    LeAttValueQueue pendingNotifications;
+    LeAttValueQueue pendingIndications;
+    bool indicationInFlight = false;
+
+    // configuration descriptor handle -> value
+    QHash<QLowEnergyHandle, QByteArray> clientConfigurations;
+
+    quint16 clientConfiguration(QLowEnergyHandle configHandle) const;
+    qint64 sendPdu(const char *data, int size);
+    QByteArray readPdu();
+
+    void setQueuePolicy(LeAttValueQueue::Policy policy, int maxDepth);
+    void queueNotification(QLowEnergyHandle handle, const QByteArray &value);
+    void queueIndication(QLowEnergyHandle handle, const QByteArray &value);
+    bool confirmIndication();
+    void sendPendingValues();
+    void clearPendingValues();
+
+    static LeAttServerConnection *forHciHandle(
+            const QVector<LeAttServerConnection *> &connections, quint16 hciHandle);
+    static int distributeValue(const QVector<LeAttServerConnection *> &connections,
+                               QLowEnergyHandle valueHandle, QLowEnergyHandle configHandle,
+                               const QByteArray &value,
+                               QLowEnergyCharacteristic::PropertyTypes properties);
+
+private:
+    Q_DISABLE_COPY(LeAttServerConnection)
+
+    qint64 sendValue(quint8 opCode, const LeAttValueQueue::Entry &entry);
+    void waitForWritable();
+
+    QSocketNotifier *writeNotifier = nullptr;
+};
+
+Q_DECLARE_TYPEINFO(LeAttValueQueue::Entry, Q_MOVABLE_TYPE);
+Q_DECLARE_TYPEINFO(LeAttServerConnection::WriteRequest, Q_MOVABLE_TYPE);
+
+QT_END_NAMESPACE
+
+#endif // LEATTSERVERCONNECTION_P_H
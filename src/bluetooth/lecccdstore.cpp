@@ -0,0 +1,234 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "lecccdstore_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsavefile.h>
+
+#include <unistd.h>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint32 cccdStoreMagic = 0x51434344; // "QCCD"
+static const quint16 cccdStoreVersion = 1;
+static const qint64 headerSize = 4 + 2 + 8;
+static const qint64 recordSize = 8;
+static const quint8 charValueWasUpdatedFlag = 0x1;
+
+static quint8 recordChecksum(const LeCccdStore::Entry &entry, quint8 flags)
+{
+    const quint8 bytes[] = {
+        quint8(entry.charValueHandle), quint8(entry.charValueHandle >> 8),
+        quint8(entry.configHandle), quint8(entry.configHandle >> 8),
+        quint8(entry.configValue), quint8(entry.configValue >> 8),
+        flags
+    };
+    quint8 sum = 0;
+    for (const quint8 byte : bytes)
+        sum += byte;
+    return quint8(~sum);
+}
+
+static void writeRecord(QDataStream &stream, const LeCccdStore::Entry &entry)
+{
+    const quint8 flags = entry.charValueWasUpdated ? charValueWasUpdatedFlag : 0;
+    stream << entry.charValueHandle << entry.configHandle << entry.configValue << flags
+           << recordChecksum(entry, flags);
+}
+
+static void writeHeader(QDataStream &stream, quint64 signature)
+{
+    stream << cccdStoreMagic << cccdStoreVersion << signature;
+}
+
+LeCccdStore::LeCccdStore(const QString &directory)
+    : m_directory(directory)
+{
+}
+
+/*
+  Returns the centrals for which configurations are stored.
+ */
+QList<QBluetoothAddress> LeCccdStore::peers() const
+{
+    QList<QBluetoothAddress> result;
+    const QStringList files = QDir(m_directory).entryList(
+                QStringList(QStringLiteral("*.cccd")), QDir::Files);
+    for (const QString &file : files) {
+        const QBluetoothAddress address(file.left(file.indexOf(QLatin1Char('.'))).toULongLong(
+                                            nullptr, 16));
+        if (!address.isNull())
+            result << address;
+    }
+    return result;
+}
+
+LeCccdStore::Entries LeCccdStore::load(const QBluetoothAddress &remoteDevice) const
+{
+    QFile file(filePath(remoteDevice));
+    if (!file.open(QIODevice::ReadOnly))
+        return Entries();
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint64 signature = 0;
+    stream >> magic >> version >> signature;
+    if (magic != cccdStoreMagic || version != cccdStoreVersion) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring CCCD store file" << file.fileName()
+                               << "with unknown format";
+        return Entries();
+    }
+    if (signature != m_signature) {
+        qCDebug(QT_BT_BLUEZ) << "Ignoring configurations of" << remoteDevice
+                             << "stored for a different attribute database";
+        return Entries();
+    }
+
+    Entries entries;
+    const qint64 recordCount = (file.size() - headerSize) / recordSize;
+    for (qint64 i = 0; i < recordCount; ++i) {
+        Entry entry;
+        quint8 flags = 0;
+        quint8 checksum = 0;
+        stream >> entry.charValueHandle >> entry.configHandle >> entry.configValue >> flags
+               >> checksum;
+        if (stream.status() != QDataStream::Ok || checksum != recordChecksum(entry, flags)) {
+            qCWarning(QT_BT_BLUEZ) << "CCCD store file" << file.fileName()
+                                   << "is corrupt after" << i << "records";
+            break;
+        }
+        entry.charValueWasUpdated = flags & charValueWasUpdatedFlag;
+        if (entry.configValue == 0)
+            entries.remove(entry.charValueHandle);
+        else
+            entries.insert(entry.charValueHandle, entry);
+    }
+    return entries;
+}
+
+/*
+  Replaces the stored configurations of \a remoteDevice with \a entries.
+ */
+bool LeCccdStore::store(const QBluetoothAddress &remoteDevice, const Entries &entries) const
+{
+    if (!QDir().mkpath(m_directory)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot create CCCD store directory" << m_directory;
+        return false;
+    }
+
+    QSaveFile file(filePath(remoteDevice));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot write CCCD store file" << file.fileName()
+                               << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    writeHeader(stream, m_signature);
+    for (const Entry &entry : entries)
+        writeRecord(stream, entry);
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(QT_BT_BLUEZ) << "Failed to write CCCD store file" << file.fileName();
+        return false;
+    }
+    return true;
+}
+
+/*
+  Appends \a changedEntry to the stored configurations of \a remoteDevice.
+  An entry with a configuration value of 0 removes the configuration.
+  The file is rewritten with \a entries if it does not belong to the current
+  attribute database or once MaxAppendedRecords records have been appended.
+ */
+bool LeCccdStore::update(const QBluetoothAddress &remoteDevice, const Entries &entries,
+                         const Entry &changedEntry) const
+{
+    QFile file(filePath(remoteDevice));
+    const qint64 size = file.size();
+    if (size < headerSize || size - headerSize >= MaxAppendedRecords * recordSize
+            || !file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        return store(remoteDevice, entries);
+    }
+
+    // records are appended, the header is read from the start of the file
+    file.seek(0);
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint64 signature = 0;
+    stream >> magic >> version >> signature;
+    if (magic != cccdStoreMagic || version != cccdStoreVersion || signature != m_signature) {
+        file.close();
+        return store(remoteDevice, entries);
+    }
+
+    // drop a partial record left behind by a crash
+    const qint64 partialRecordSize = (size - headerSize) % recordSize;
+    if (partialRecordSize != 0)
+        file.resize(size - partialRecordSize);
+
+    // the record must survive a power loss just like a file written by store()
+    writeRecord(stream, changedEntry);
+    return stream.status() == QDataStream::Ok && file.flush() && ::fsync(file.handle()) == 0;
+}
+
+void LeCccdStore::remove(const QBluetoothAddress &remoteDevice) const
+{
+    QFile::remove(filePath(remoteDevice));
+}
+
+QString LeCccdStore::filePath(const QBluetoothAddress &remoteDevice) const
+{
+    return m_directory + QLatin1Char('/')
+            + remoteDevice.toString().remove(QLatin1Char(':')) + QLatin1String(".cccd");
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,115 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef LEGATTCACHE_P_H
+
+#ifndef LECCCDSTORE_P_H
+#define LECCCDSTORE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/qhash.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qstring.h>
+#include <QtBluetooth/qbluetooth.h>
+#include <QtBluetooth/qbluetoothaddress.h>
+
+QT_BEGIN_NAMESPACE
+
+/*
+  On-disk store of the client characteristic configuration descriptor values
+  of bonded centrals. There is one file per central.
+
+  Each file starts with the signature of the local attribute database
+  followed by fixed-size records. A change of a single configuration is
+  appended as a new record, later records replace earlier ones. A record
+  which was cut short by a crash is ignored when the file is read. store()
+  replaces a file atomically with one record per configuration.
+
+  A file whose signature does not match databaseSignature() belongs to a
+  different attribute database and is ignored.
+ */
+class Q_AUTOTEST_EXPORT LeCccdStore
+{
+public:
+    struct Entry {
+        Entry(QLowEnergyHandle chHndl = 0, QLowEnergyHandle coHndl = 0, quint16 val = 0)
+            : charValueHandle(chHndl), configHandle(coHndl), configValue(val) {}
+
+        QLowEnergyHandle charValueHandle;
+        QLowEnergyHandle configHandle;
+        quint16 configValue;
+        bool charValueWasUpdated = false;
+    };
+    typedef QHash<QLowEnergyHandle, Entry> Entries; // characteristic value handle -> entry
+
+    explicit LeCccdStore(const QString &directory);
+
+    void setDatabaseSignature(quint64 signature) { m_signature = signature; }
+    quint64 databaseSignature() const { return m_signature; }
+
+    QList<QBluetoothAddress> peers() const;
+    Entries load(const QBluetoothAddress &remoteDevice) const;
+    bool store(const QBluetoothAddress &remoteDevice, const Entries &entries) const;
+    bool update(const QBluetoothAddress &remoteDevice, const Entries &entries,
+                const Entry &changedEntry) const;
+    void remove(const QBluetoothAddress &remoteDevice) const;
+
+    enum { MaxAppendedRecords = 256 };
+
+private:
+    QString filePath(const QBluetoothAddress &remoteDevice) const;
+
+    QString m_directory;
+    quint64 m_signature = 0;
+};
+
+Q_DECLARE_TYPEINFO(LeCccdStore::Entry, Q_MOVABLE_TYPE);
+
+QT_END_NAMESPACE
+
+#endif // LECCCDSTORE_P_H
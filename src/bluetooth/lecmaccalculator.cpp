@@ -41,9 +41,12 @@
 #include "bluez/bluez_data_p.h"
 
 #include <QtCore/qbytearray.h>
+#include <QtCore/qendian.h>
 #include <QtCore/qloggingcategory.h>
 #include <QtCore/private/qcore_unix_p.h>
+#include <QtCore/private/qsimd_p.h>
 
+#include <algorithm>
 #include <cstring>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -53,17 +56,328 @@
 #include <linux/if_alg.h>
 #endif
 
+#if defined(Q_PROCESSOR_X86) && QT_COMPILER_SUPPORTS_HERE(AES)
+#  define LECMAC_HAVE_AESNI
+#  include <wmmintrin.h>
+#elif defined(Q_PROCESSOR_ARM_64) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#  define LECMAC_HAVE_ARMV8_AES
+#  include <arm_neon.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
 
-LeCmacCalculator::LeCmacCalculator()
+namespace {
+
+/*
+    AES-128 as needed for the CMAC of LE data signing (FIPS 197). The portable code
+    must not leak the key through cache timing, so it has no lookup tables: the S-box
+    is evaluated as a boolean circuit (Boyar and Peralta) on the bit planes of all
+    state bytes at once, and the multiplication in MixColumns is done with masks.
+*/
+
+void bitslicedSbox(quint32 *q)
+{
+    const quint32 x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    const quint32 x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // top linear transformation
+    const quint32 y14 = x3 ^ x5;
+    const quint32 y13 = x0 ^ x6;
+    const quint32 y9 = x0 ^ x3;
+    const quint32 y8 = x0 ^ x5;
+    const quint32 t0 = x1 ^ x2;
+    const quint32 y1 = t0 ^ x7;
+    const quint32 y4 = y1 ^ x3;
+    const quint32 y12 = y13 ^ y14;
+    const quint32 y2 = y1 ^ x0;
+    const quint32 y5 = y1 ^ x6;
+    const quint32 y3 = y5 ^ y8;
+    const quint32 t1 = x4 ^ y12;
+    const quint32 y15 = t1 ^ x5;
+    const quint32 y20 = t1 ^ x1;
+    const quint32 y6 = y15 ^ x7;
+    const quint32 y10 = y15 ^ t0;
+    const quint32 y11 = y20 ^ y9;
+    const quint32 y7 = x7 ^ y11;
+    const quint32 y17 = y10 ^ y11;
+    const quint32 y19 = y10 ^ y8;
+    const quint32 y16 = t0 ^ y11;
+    const quint32 y21 = y13 ^ y16;
+    const quint32 y18 = x0 ^ y16;
+
+    // inversion in GF(2^8)
+    const quint32 t2 = y12 & y15;
+    const quint32 t3 = y3 & y6;
+    const quint32 t4 = t3 ^ t2;
+    const quint32 t5 = y4 & x7;
+    const quint32 t6 = t5 ^ t2;
+    const quint32 t7 = y13 & y16;
+    const quint32 t8 = y5 & y1;
+    const quint32 t9 = t8 ^ t7;
+    const quint32 t10 = y2 & y7;
+    const quint32 t11 = t10 ^ t7;
+    const quint32 t12 = y9 & y11;
+    const quint32 t13 = y14 & y17;
+    const quint32 t14 = t13 ^ t12;
+    const quint32 t15 = y8 & y10;
+    const quint32 t16 = t15 ^ t12;
+    const quint32 t17 = t4 ^ t14;
+    const quint32 t18 = t6 ^ t16;
+    const quint32 t19 = t9 ^ t14;
+    const quint32 t20 = t11 ^ t16;
+    const quint32 t21 = t17 ^ y20;
+    const quint32 t22 = t18 ^ y19;
+    const quint32 t23 = t19 ^ y21;
+    const quint32 t24 = t20 ^ y18;
+
+    const quint32 t25 = t21 ^ t22;
+    const quint32 t26 = t21 & t23;
+    const quint32 t27 = t24 ^ t26;
+    const quint32 t28 = t25 & t27;
+    const quint32 t29 = t28 ^ t22;
+    const quint32 t30 = t23 ^ t24;
+    const quint32 t31 = t22 ^ t26;
+    const quint32 t32 = t31 & t30;
+    const quint32 t33 = t32 ^ t24;
+    const quint32 t34 = t23 ^ t33;
+    const quint32 t35 = t27 ^ t33;
+    const quint32 t36 = t24 & t35;
+    const quint32 t37 = t36 ^ t34;
+    const quint32 t38 = t27 ^ t36;
+    const quint32 t39 = t29 & t38;
+    const quint32 t40 = t25 ^ t39;
+
+    const quint32 t41 = t40 ^ t37;
+    const quint32 t42 = t29 ^ t33;
+    const quint32 t43 = t29 ^ t40;
+    const quint32 t44 = t33 ^ t37;
+    const quint32 t45 = t42 ^ t41;
+    const quint32 z0 = t44 & y15;
+    const quint32 z1 = t37 & y6;
+    const quint32 z2 = t33 & x7;
+    const quint32 z3 = t43 & y16;
+    const quint32 z4 = t40 & y1;
+    const quint32 z5 = t29 & y7;
+    const quint32 z6 = t42 & y11;
+    const quint32 z7 = t45 & y17;
+    const quint32 z8 = t41 & y10;
+    const quint32 z9 = t44 & y12;
+    const quint32 z10 = t37 & y3;
+    const quint32 z11 = t33 & y4;
+    const quint32 z12 = t43 & y13;
+    const quint32 z13 = t40 & y5;
+    const quint32 z14 = t29 & y2;
+    const quint32 z15 = t42 & y9;
+    const quint32 z16 = t45 & y14;
+    const quint32 z17 = t41 & y8;
+
+    // bottom linear transformation
+    const quint32 t46 = z15 ^ z16;
+    const quint32 t47 = z10 ^ z11;
+    const quint32 t48 = z5 ^ z13;
+    const quint32 t49 = z9 ^ z10;
+    const quint32 t50 = z2 ^ z12;
+    const quint32 t51 = z2 ^ z5;
+    const quint32 t52 = z7 ^ z8;
+    const quint32 t53 = z0 ^ z3;
+    const quint32 t54 = z6 ^ z7;
+    const quint32 t55 = z16 ^ z17;
+    const quint32 t56 = z12 ^ t48;
+    const quint32 t57 = t50 ^ t53;
+    const quint32 t58 = z4 ^ t46;
+    const quint32 t59 = z3 ^ t54;
+    const quint32 t60 = t46 ^ t57;
+    const quint32 t61 = z14 ^ t57;
+    const quint32 t62 = t52 ^ t58;
+    const quint32 t63 = t49 ^ t58;
+    const quint32 t64 = z4 ^ t59;
+    const quint32 t65 = t61 ^ t62;
+    const quint32 t66 = z1 ^ t63;
+    const quint32 t67 = t64 ^ t65;
+    const quint32 s3 = t53 ^ t66;
+
+    q[7] = t59 ^ t63;
+    q[6] = t64 ^ ~s3;
+    q[5] = t55 ^ ~t67;
+    q[4] = s3;
+    q[3] = t51 ^ t66;
+    q[2] = t47 ^ t65;
+    q[1] = t56 ^ ~t62;
+    q[0] = t48 ^ ~t60;
+}
+
+// Substitutes up to 32 bytes; bit i of q[bit] holds that bit of bytes[i].
+void subBytes(quint8 *bytes, int count)
 {
+    quint32 q[8] = {};
+    for (int i = 0; i < count; ++i) {
+        for (int bit = 0; bit < 8; ++bit)
+            q[bit] |= quint32((bytes[i] >> bit) & 1) << i;
+    }
+    bitslicedSbox(q);
+    for (int i = 0; i < count; ++i) {
+        quint8 value = 0;
+        for (int bit = 0; bit < 8; ++bit)
+            value |= quint8(((q[bit] >> i) & 1) << bit);
+        bytes[i] = value;
+    }
+}
+
+inline quint8 xtime(quint8 value)
+{
+    return quint8((value << 1) ^ (0x1b & -(value >> 7)));
+}
+
+inline void xorBlock(quint8 *out, const quint8 *a, const quint8 *b)
+{
+    for (int i = 0; i < 16; ++i)
+        out[i] = a[i] ^ b[i];
+}
+
+void shiftRows(quint8 *state)
+{
+    quint8 t = state[1];
+    state[1] = state[5];
+    state[5] = state[9];
+    state[9] = state[13];
+    state[13] = t;
+    std::swap(state[2], state[10]);
+    std::swap(state[6], state[14]);
+    t = state[15];
+    state[15] = state[11];
+    state[11] = state[7];
+    state[7] = state[3];
+    state[3] = t;
+}
+
+void mixColumns(quint8 *state)
+{
+    for (int column = 0; column < 16; column += 4) {
+        quint8 * const c = state + column;
+        const quint8 all = c[0] ^ c[1] ^ c[2] ^ c[3];
+        const quint8 first = c[0];
+        c[0] ^= all ^ xtime(c[0] ^ c[1]);
+        c[1] ^= all ^ xtime(c[1] ^ c[2]);
+        c[2] ^= all ^ xtime(c[2] ^ c[3]);
+        c[3] ^= all ^ xtime(c[3] ^ first);
+    }
+}
+
+void expandKey(const quint8 *key, quint8 (*roundKeys)[16])
+{
+    quint8 * const words = roundKeys[0];
+    std::memcpy(words, key, 16);
+    quint8 rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+        quint8 temp[4] = { words[i - 4], words[i - 3], words[i - 2], words[i - 1] };
+        if (i % 16 == 0) {
+            const quint8 first = temp[0];
+            temp[0] = temp[1];
+            temp[1] = temp[2];
+            temp[2] = temp[3];
+            temp[3] = first;
+            subBytes(temp, 4);
+            temp[0] ^= rcon;
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; ++j)
+            words[i + j] = words[i - 16 + j] ^ temp[j];
+    }
+}
+
+void encryptBlockPortable(const quint8 (*roundKeys)[16], const quint8 *in, quint8 *out)
+{
+    quint8 state[16];
+    xorBlock(state, in, roundKeys[0]);
+    for (int round = 1; round < 10; ++round) {
+        subBytes(state, 16);
+        shiftRows(state);
+        mixColumns(state);
+        xorBlock(state, state, roundKeys[round]);
+    }
+    subBytes(state, 16);
+    shiftRows(state);
+    xorBlock(out, state, roundKeys[10]);
+}
+
+#if defined(LECMAC_HAVE_AESNI)
+QT_FUNCTION_TARGET(AES)
+void encryptBlockAesNi(const quint8 (*roundKeys)[16], const quint8 *in, quint8 *out)
+{
+    __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    state = _mm_xor_si128(state, _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys[0])));
+    for (int round = 1; round < 10; ++round) {
+        state = _mm_aesenc_si128(state,
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys[round])));
+    }
+    state = _mm_aesenclast_si128(state,
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys[10])));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), state);
+}
+#elif defined(LECMAC_HAVE_ARMV8_AES)
+void encryptBlockArmv8(const quint8 (*roundKeys)[16], const quint8 *in, quint8 *out)
+{
+    uint8x16_t state = vld1q_u8(in);
+    for (int round = 0; round < 9; ++round)
+        state = vaesmcq_u8(vaeseq_u8(state, vld1q_u8(roundKeys[round])));
+    state = vaeseq_u8(state, vld1q_u8(roundKeys[9]));
+    vst1q_u8(out, veorq_u8(state, vld1q_u8(roundKeys[10])));
+}
+#endif
+
+inline void encryptBlock(const quint8 (*roundKeys)[16], const quint8 *in, quint8 *out)
+{
+#if defined(LECMAC_HAVE_AESNI)
+    if (qCpuHasFeature(AES)) {
+        encryptBlockAesNi(roundKeys, in, out);
+        return;
+    }
+#elif defined(LECMAC_HAVE_ARMV8_AES)
+    encryptBlockArmv8(roundKeys, in, out);
+    return;
+#endif
+    encryptBlockPortable(roundKeys, in, out);
+}
+
+// Multiplication by x in GF(2^128) as needed for the CMAC subkeys (RFC 4493, 2.3).
+void doubleBlock(const quint8 *in, quint8 *out)
+{
+    const quint8 carry = 0x87 & -(in[0] >> 7);
+    for (int i = 0; i < 15; ++i)
+        out[i] = quint8((in[i] << 1) | (in[i + 1] >> 7));
+    out[15] = quint8((in[15] << 1) ^ carry);
+}
+
+bool keysEqual(const quint8 *a, const quint8 *b)
+{
+    quint8 difference = 0;
+    for (int i = 0; i < 16; ++i)
+        difference |= a[i] ^ b[i];
+    return difference == 0;
+}
+
+void wipe(void *data, size_t size)
+{
+    volatile quint8 *bytes = static_cast<volatile quint8 *>(data);
+    while (size--)
+        *bytes++ = 0;
+}
+
+} // unnamed namespace
+
+LeCmacCalculator::LeCmacCalculator(Backend backend) : m_backend(backend)
+{
+    if (m_backend == SoftwareBackend)
+        return;
+
 #ifdef CONFIG_LINUX_CRYPTO_API
     m_baseSocket = socket(AF_ALG, SOCK_SEQPACKET, 0);
     if (m_baseSocket == -1) {
         qCWarning(QT_BT_BLUEZ) << "failed to create first level crypto socket:"
-                               << strerror(errno);
+                               << strerror(errno) << "- using built-in CMAC implementation";
+        m_backend = SoftwareBackend;
         return;
     }
     sockaddr_alg sa;
@@ -73,11 +387,16 @@ LeCmacCalculator::LeCmacCalculator()
     strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
     strcpy(reinterpret_cast<char *>(sa.salg_name), "cmac(aes)");
     if (::bind(m_baseSocket, reinterpret_cast<sockaddr *>(&sa), sizeof sa) == -1) {
-        qCWarning(QT_BT_BLUEZ) << "bind() failed for crypto socket:" << strerror(errno);
+        qCWarning(QT_BT_BLUEZ) << "bind() failed for crypto socket:" << strerror(errno)
+                               << "- using built-in CMAC implementation";
+        close(m_baseSocket);
+        m_baseSocket = -1;
+        m_backend = SoftwareBackend;
         return;
     }
 #else // CONFIG_LINUX_CRYPTO_API
-    qCWarning(QT_BT_BLUEZ) << "Linux crypto API not present, CMAC verification will fail.";
+    qCWarning(QT_BT_BLUEZ) << "Linux crypto API not present, using built-in CMAC implementation.";
+    m_backend = SoftwareBackend;
 #endif
 }
 
@@ -85,6 +404,7 @@ LeCmacCalculator::~LeCmacCalculator()
 {
     if (m_baseSocket != -1)
         close(m_baseSocket);
+    wipe(m_keyCache, sizeof m_keyCache);
 }
 
 QByteArray LeCmacCalculator::createFullMessage(const QByteArray &message, quint32 signCounter)
@@ -96,11 +416,112 @@ QByteArray LeCmacCalculator::createFullMessage(const QByteArray &message, quint3
     return fullMessage;
 }
 
+/*
+    Returns the expanded key and the CMAC subkeys of \a key, given MSB first. The
+    schedules of the last few keys are kept, so that a peer signing a stream of
+    writes costs only one key expansion. The least recently used schedule makes
+    room for a new key.
+*/
+const LeCmacCalculator::KeySchedule &LeCmacCalculator::keySchedule(const quint8 *key) const
+{
+    ++m_keyCacheClock;
+    int slot = 0;
+    for (int i = 0; i < m_cachedKeys; ++i) {
+        if (keysEqual(m_keyCache[i].key, key)) {
+            m_keyCache[i].lastUse = m_keyCacheClock;
+            return m_keyCache[i];
+        }
+        if (m_keyCache[i].lastUse < m_keyCache[slot].lastUse)
+            slot = i;
+    }
+    if (m_cachedKeys < KeyCacheSize)
+        slot = m_cachedKeys++;
+
+    KeySchedule &schedule = m_keyCache[slot];
+    std::memcpy(schedule.key, key, sizeof schedule.key);
+    expandKey(schedule.key, schedule.roundKeys);
+    quint8 l[16] = {};
+    encryptBlock(schedule.roundKeys, l, l);
+    doubleBlock(l, schedule.subkey1);
+    doubleBlock(schedule.subkey1, schedule.subkey2);
+    wipe(l, sizeof l);
+    schedule.lastUse = m_keyCacheClock;
+    return schedule;
+}
+
+/*
+    RFC 4493, 2.4. If \a reversed is set, the message is LSB first like the
+    signed data of the spec and its blocks are read from its end.
+*/
+void LeCmacCalculator::calculateCmac(const KeySchedule &schedule, const quint8 *message,
+                                     int length, bool reversed, quint8 *mac)
+{
+    const auto byteAt = [message, length, reversed](int position) {
+        return reversed ? message[length - 1 - position] : message[position];
+    };
+    const int blockCount = qMax(1, (length + 15) / 16);
+
+    quint8 block[16];
+    std::memset(mac, 0, 16);
+    for (int i = 0; i < blockCount - 1; ++i) {
+        for (int j = 0; j < 16; ++j)
+            block[j] = mac[j] ^ byteAt(16 * i + j);
+        encryptBlock(schedule.roundKeys, block, mac);
+    }
+
+    const int lastBlockOffset = 16 * (blockCount - 1);
+    const int lastBlockLength = length - lastBlockOffset;
+    for (int j = 0; j < 16; ++j) {
+        if (lastBlockLength == 16) {
+            block[j] = byteAt(lastBlockOffset + j) ^ schedule.subkey1[j];
+        } else {
+            const quint8 padded = j < lastBlockLength ? byteAt(lastBlockOffset + j)
+                                                      : (j == lastBlockLength ? 0x80 : 0);
+            block[j] = padded ^ schedule.subkey2[j];
+        }
+    }
+    xorBlock(block, block, mac);
+    encryptBlock(schedule.roundKeys, block, mac);
+}
+
 quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128 &csrk) const
+{
+    if (m_backend == KernelBackend)
+        return calculateMacInKernel(message, csrk);
+
+    // The spec transports keys LSB first, AES wants them MSB first.
+    quint8 key[16];
+    std::reverse_copy(std::begin(csrk.data), std::end(csrk.data), key);
+    const KeySchedule &schedule = keySchedule(key);
+    wipe(key, sizeof key);
+
+    quint8 mac[16];
+    calculateCmac(schedule, reinterpret_cast<const quint8 *>(message.constData()),
+                  message.count(), true, mac);
+
+    // Only the most significant 64 bits of the MAC are used (Vol 3, Part H, 2.4.5).
+    return qFromBigEndian<quint64>(mac);
+}
+
+/*
+    Returns the full AES-CMAC of \a message with \a key, both in the byte order
+    of RFC 4493. The GATT Database Hash is calculated this way.
+    The built-in implementation is used for any backend.
+*/
+QByteArray LeCmacCalculator::calculateCmac(const QByteArray &message, const quint128 &key) const
+{
+    QByteArray mac(16, Qt::Uninitialized);
+    calculateCmac(keySchedule(key.data), reinterpret_cast<const quint8 *>(message.constData()),
+                  message.count(), false, reinterpret_cast<quint8 *>(mac.data()));
+    return mac;
+}
+
+quint64 LeCmacCalculator::calculateMacInKernel(const QByteArray &message,
+                                               const quint128 &csrk) const
 {
 #ifdef CONFIG_LINUX_CRYPTO_API
     if (m_baseSocket == -1)
-        return false;
+        return 0;
     quint128 csrkMsb;
     std::reverse_copy(std::begin(csrk.data), std::end(csrk.data), std::begin(csrkMsb.data));
     qCDebug(QT_BT_BLUEZ) << "CSRK (MSB):" << QByteArray(reinterpret_cast<char *>(csrkMsb.data),
@@ -158,7 +579,6 @@ quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128
 #else // CONFIG_LINUX_CRYPTO_API
     Q_UNUSED(message);
     Q_UNUSED(csrk);
-    qCWarning(QT_BT_BLUEZ) << "CMAC calculation failed due to missing Linux crypto API.";
     return 0;
 #endif
 }
@@ -166,7 +586,6 @@ quint64 LeCmacCalculator::calculateMac(const QByteArray &message, const quint128
 bool LeCmacCalculator::verify(const QByteArray &message, const quint128 &csrk,
                            quint64 expectedMac) const
 {
-#ifdef CONFIG_LINUX_CRYPTO_API
     const quint64 actualMac = calculateMac(message, csrk);
     if (actualMac != expectedMac) {
         qCWarning(QT_BT_BLUEZ) << Qt::hex << "signature verification failed: calculated mac:"
@@ -174,13 +593,6 @@ bool LeCmacCalculator::verify(const QByteArray &message, const quint128 &csrk,
         return false;
     }
     return true;
-#else // CONFIG_LINUX_CRYPTO_API
-    Q_UNUSED(message);
-    Q_UNUSED(csrk);
-    Q_UNUSED(expectedMac);
-    qCWarning(QT_BT_BLUEZ) << "CMAC verification failed due to missing Linux crypto API.";
-    return false;
-#endif
 }
 
 QT_END_NAMESPACE
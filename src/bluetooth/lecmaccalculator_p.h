@@ -59,18 +59,46 @@ struct quint128;
 class Q_AUTOTEST_EXPORT LeCmacCalculator
 {
 public:
-    LeCmacCalculator();
+    enum Backend {
+        SoftwareBackend,    // built-in AES, using AES-NI or ARMv8 crypto extensions if present
+        KernelBackend       // Linux crypto API (AF_ALG)
+    };
+
+    explicit LeCmacCalculator(Backend backend = SoftwareBackend);
     ~LeCmacCalculator();
 
+    Backend backend() const { return m_backend; }
+
     static QByteArray createFullMessage(const QByteArray &message, quint32 signCounter);
 
     quint64 calculateMac(const QByteArray &message, const quint128 &csrk) const;
+    QByteArray calculateCmac(const QByteArray &message, const quint128 &key) const;
 
     // Convenience function.
     bool verify(const QByteArray &message, const quint128 &csrk, quint64 expectedMac) const;
 
 private:
+    Q_DISABLE_COPY(LeCmacCalculator)
+
+    struct KeySchedule {
+        quint8 key[16];             // MSB first
+        quint8 roundKeys[11][16];
+        quint8 subkey1[16];
+        quint8 subkey2[16];
+        quint64 lastUse;
+    };
+    enum { KeyCacheSize = 8 };
+
+    const KeySchedule &keySchedule(const quint8 *key) const;
+    static void calculateCmac(const KeySchedule &schedule, const quint8 *message, int length,
+                              bool reversed, quint8 *mac);
+    quint64 calculateMacInKernel(const QByteArray &message, const quint128 &csrk) const;
+
+    Backend m_backend;
     int m_baseSocket = -1;
+    mutable KeySchedule m_keyCache[KeyCacheSize];
+    mutable int m_cachedKeys = 0;
+    mutable quint64 m_keyCacheClock = 0;
 };
 
 
@@ -0,0 +1,282 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "legattcache_p.h"
+#include "qlowenergyserviceprivate_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qdir.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsavefile.h>
+#include <QtCore/quuid.h>
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint32 gattCacheMagic = 0x51474154; // "QGAT"
+static const quint16 gattCacheVersion = 1;
+
+static void writeUuid(QDataStream &stream, const QBluetoothUuid &uuid)
+{
+    stream << static_cast<const QUuid &>(uuid);
+}
+
+static QBluetoothUuid readUuid(QDataStream &stream)
+{
+    QUuid uuid;
+    stream >> uuid;
+    return QBluetoothUuid(uuid);
+}
+
+const LeGattCache::Service *LeGattCache::Database::service(const QBluetoothUuid &uuid) const
+{
+    for (const Service &s : services) {
+        if (s.uuid == uuid)
+            return &s;
+    }
+    return nullptr;
+}
+
+/*
+  Returns the value handle of the Service Changed characteristic or 0 if
+  the Generic Attribute service details are not part of the database.
+ */
+QLowEnergyHandle LeGattCache::Database::serviceChangedHandle() const
+{
+    const Service *gattService = service(QBluetoothUuid::GenericAttribute);
+    if (!gattService)
+        return 0;
+
+    for (const Characteristic &characteristic : gattService->characteristics) {
+        if (characteristic.uuid == QBluetoothUuid::ServiceChanged)
+            return characteristic.valueHandle;
+    }
+    return 0;
+}
+
+LeGattCache::LeGattCache(const QString &directory)
+    : m_directory(directory)
+{
+}
+
+LeGattCache::Database LeGattCache::load(const QBluetoothAddress &remoteDevice) const
+{
+    QFile file(filePath(remoteDevice));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCDebug(QT_BT_BLUEZ) << "No GATT cache for" << remoteDevice;
+        return Database();
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    stream >> magic >> version;
+    if (magic != gattCacheMagic || version != gattCacheVersion) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring GATT cache file" << file.fileName()
+                               << "with unknown format";
+        return Database();
+    }
+
+    Database database;
+    quint32 serviceCount = 0;
+    stream >> database.hash >> serviceCount;
+    for (quint32 i = 0; i < serviceCount && stream.status() == QDataStream::Ok; ++i) {
+        Service service;
+        service.uuid = readUuid(stream);
+        quint32 includedCount = 0;
+        stream >> service.startHandle >> service.endHandle >> service.isPrimary
+               >> service.detailsKnown >> includedCount;
+        for (quint32 j = 0; j < includedCount && stream.status() == QDataStream::Ok; ++j)
+            service.includedServices.append(readUuid(stream));
+
+        quint32 characteristicCount = 0;
+        stream >> characteristicCount;
+        for (quint32 j = 0; j < characteristicCount && stream.status() == QDataStream::Ok; ++j) {
+            Characteristic characteristic;
+            quint32 properties = 0;
+            quint32 descriptorCount = 0;
+            stream >> characteristic.handle >> characteristic.valueHandle;
+            characteristic.uuid = readUuid(stream);
+            stream >> properties >> descriptorCount;
+            characteristic.properties = QLowEnergyCharacteristic::PropertyTypes(properties);
+            for (quint32 k = 0; k < descriptorCount && stream.status() == QDataStream::Ok; ++k) {
+                Descriptor descriptor;
+                stream >> descriptor.handle;
+                descriptor.uuid = readUuid(stream);
+                characteristic.descriptors.append(descriptor);
+            }
+            service.characteristics.append(characteristic);
+        }
+        database.services.append(service);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(QT_BT_BLUEZ) << "GATT cache file" << file.fileName() << "is corrupt";
+        return Database();
+    }
+
+    return database;
+}
+
+bool LeGattCache::store(const QBluetoothAddress &remoteDevice, const Database &database) const
+{
+    if (!QDir().mkpath(m_directory)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot create GATT cache directory" << m_directory;
+        return false;
+    }
+
+    QSaveFile file(filePath(remoteDevice));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot write GATT cache file" << file.fileName()
+                               << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << gattCacheMagic << gattCacheVersion;
+    stream << database.hash << quint32(database.services.count());
+    for (const Service &service : database.services) {
+        writeUuid(stream, service.uuid);
+        stream << service.startHandle << service.endHandle << service.isPrimary
+               << service.detailsKnown << quint32(service.includedServices.count());
+        for (const QBluetoothUuid &uuid : service.includedServices)
+            writeUuid(stream, uuid);
+
+        stream << quint32(service.characteristics.count());
+        for (const Characteristic &characteristic : service.characteristics) {
+            stream << characteristic.handle << characteristic.valueHandle;
+            writeUuid(stream, characteristic.uuid);
+            stream << quint32(characteristic.properties)
+                   << quint32(characteristic.descriptors.count());
+            for (const Descriptor &descriptor : characteristic.descriptors) {
+                stream << descriptor.handle;
+                writeUuid(stream, descriptor.uuid);
+            }
+        }
+    }
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(QT_BT_BLUEZ) << "Failed to write GATT cache file" << file.fileName();
+        return false;
+    }
+    return true;
+}
+
+void LeGattCache::remove(const QBluetoothAddress &remoteDevice) const
+{
+    QFile::remove(filePath(remoteDevice));
+}
+
+/*
+  Creates the cache representation of \a service. The details are only
+  considered to be known if the service discovery has finished.
+ */
+LeGattCache::Service LeGattCache::fromService(const QLowEnergyServicePrivate &service)
+{
+    Service cachedService;
+    cachedService.uuid = service.uuid;
+    cachedService.startHandle = service.startHandle;
+    cachedService.endHandle = service.endHandle;
+    cachedService.isPrimary = service.type & QLowEnergyService::PrimaryService;
+    cachedService.detailsKnown = service.state == QLowEnergyService::ServiceDiscovered;
+    if (!cachedService.detailsKnown)
+        return cachedService;
+
+    cachedService.includedServices = service.includedServices;
+    for (auto charIt = service.characteristicList.constBegin();
+         charIt != service.characteristicList.constEnd(); ++charIt) {
+        Characteristic characteristic;
+        characteristic.handle = charIt.key();
+        characteristic.valueHandle = charIt.value().valueHandle;
+        characteristic.uuid = charIt.value().uuid;
+        characteristic.properties = charIt.value().properties;
+
+        const DescriptorDataMap &descriptors = charIt.value().descriptorList;
+        for (auto descIt = descriptors.constBegin(); descIt != descriptors.constEnd(); ++descIt)
+            characteristic.descriptors.append({ descIt.key(), descIt.value().uuid });
+        std::sort(characteristic.descriptors.begin(), characteristic.descriptors.end(),
+                  [](const Descriptor &a, const Descriptor &b) { return a.handle < b.handle; });
+
+        cachedService.characteristics.append(characteristic);
+    }
+    std::sort(cachedService.characteristics.begin(), cachedService.characteristics.end(),
+              [](const Characteristic &a, const Characteristic &b) {
+                  return a.handle < b.handle;
+              });
+
+    return cachedService;
+}
+
+/*
+  Recreates the characteristics and descriptors of \a service. The values
+  remain empty and must be read from the peer.
+ */
+void LeGattCache::restoreDetails(const Service &cachedService, QLowEnergyServicePrivate *service)
+{
+    Q_ASSERT(cachedService.detailsKnown);
+
+    service->includedServices = cachedService.includedServices;
+    service->characteristicList.clear();
+    for (const Characteristic &characteristic : cachedService.characteristics) {
+        QLowEnergyServicePrivate::CharData charData;
+        charData.valueHandle = characteristic.valueHandle;
+        charData.uuid = characteristic.uuid;
+        charData.properties = characteristic.properties;
+        for (const Descriptor &descriptor : characteristic.descriptors) {
+            QLowEnergyServicePrivate::DescData descData;
+            descData.uuid = descriptor.uuid;
+            charData.descriptorList.insert(descriptor.handle, descData);
+        }
+        service->characteristicList.insert(characteristic.handle, charData);
+    }
+}
+
+QString LeGattCache::filePath(const QBluetoothAddress &remoteDevice) const
+{
+    return m_directory + QLatin1Char('/')
+            + remoteDevice.toString().remove(QLatin1Char(':')) + QLatin1String(".gatt");
+}
+
+QT_END_NAMESPACE
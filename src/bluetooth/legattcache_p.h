@@ -0,0 +1,126 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef LEGATTCACHE_P_H
+#define LEGATTCACHE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qlist.h>
+#include <QtCore/qstring.h>
+#include <QtCore/qvector.h>
+#include <QtBluetooth/qbluetooth.h>
+#include <QtBluetooth/qbluetoothaddress.h>
+#include <QtBluetooth/qbluetoothuuid.h>
+#include <QtBluetooth/qlowenergycharacteristic.h>
+
+QT_BEGIN_NAMESPACE
+
+class QLowEnergyServicePrivate;
+
+/*
+  On-disk cache of the attribute layout of remote GATT servers. There is
+  one file per remote device. It contains the handles, types and properties
+  of services, characteristics and descriptors but no attribute values.
+
+  The cache does not decide whether its content is still valid. This is up to
+  the caller which compares the stored database hash with the one of the peer
+  or watches for Service Changed indications.
+ */
+class Q_AUTOTEST_EXPORT LeGattCache
+{
+public:
+    struct Descriptor {
+        QLowEnergyHandle handle = 0;
+        QBluetoothUuid uuid;
+    };
+
+    struct Characteristic {
+        QLowEnergyHandle handle = 0;
+        QLowEnergyHandle valueHandle = 0;
+        QBluetoothUuid uuid;
+        QLowEnergyCharacteristic::PropertyTypes properties;
+        QVector<Descriptor> descriptors;
+    };
+
+    struct Service {
+        QBluetoothUuid uuid;
+        QLowEnergyHandle startHandle = 0;
+        QLowEnergyHandle endHandle = 0;
+        bool isPrimary = true;
+        bool detailsKnown = false;      // characteristics have been discovered
+        QList<QBluetoothUuid> includedServices;
+        QVector<Characteristic> characteristics;
+    };
+
+    struct Database {
+        QByteArray hash;                // value of peer's Database Hash characteristic
+        QVector<Service> services;
+
+        const Service *service(const QBluetoothUuid &uuid) const;
+        QLowEnergyHandle serviceChangedHandle() const;
+    };
+
+    explicit LeGattCache(const QString &directory);
+
+    Database load(const QBluetoothAddress &remoteDevice) const;
+    bool store(const QBluetoothAddress &remoteDevice, const Database &database) const;
+    void remove(const QBluetoothAddress &remoteDevice) const;
+
+    static Service fromService(const QLowEnergyServicePrivate &service);
+    static void restoreDetails(const Service &cachedService, QLowEnergyServicePrivate *service);
+
+private:
+    QString filePath(const QBluetoothAddress &remoteDevice) const;
+
+    QString m_directory;
+};
+
+QT_END_NAMESPACE
+
+#endif // LEGATTCACHE_P_H
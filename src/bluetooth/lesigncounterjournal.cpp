@@ -0,0 +1,237 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "lesigncounterjournal_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsavefile.h>
+#include <QtCore/qsettings.h>
+#include <QtCore/qtimer.h>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint32 journalMagic = 0x51534a4e; // "QSJN"
+static const quint16 journalVersion = 1;
+
+LeSignCounterJournal::LeSignCounterJournal(QObject *parent)
+    : QObject(parent), m_flushTimer(new QTimer(this))
+{
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(DefaultFlushInterval);
+    connect(m_flushTimer, &QTimer::timeout, this, &LeSignCounterJournal::flush);
+}
+
+LeSignCounterJournal::~LeSignCounterJournal()
+{
+    flush();
+}
+
+void LeSignCounterJournal::setFlushInterval(int msecs)
+{
+    m_flushTimer->setInterval(msecs);
+}
+
+/*
+  Returns the counter of \a group to continue with. This is \a counter, the value
+  read from the settings file, unless the journal reserved a higher value for a
+  local counter or recorded a value which has not been flushed yet.
+ */
+quint32 LeSignCounterJournal::load(const QString &settingsFilePath, const QString &group,
+                                   quint32 counter, CounterType type)
+{
+    Counter &entry = counterEntry(settingsFilePath, group);
+    entry.reserving = type == LocalCounter;
+    if (!entry.reserving) {
+        if (!entry.dirty)
+            entry.value = counter;
+        return entry.value;
+    }
+    if (entry.reserved > counter) {
+        qCDebug(QT_BT_BLUEZ) << "Continuing sign counter of" << group << "with reserved value"
+                             << entry.reserved << "instead of" << counter;
+    }
+    entry.value = qMax(qMax(entry.value, counter), entry.reserved);
+    return entry.value;
+}
+
+/*
+  Records \a counter as the new value of the "Counter" key of \a group.
+  Returns \c false if the counter left the reserved range and the new range
+  could not be reserved. The counter must not be used in that case.
+ */
+bool LeSignCounterJournal::record(const QString &settingsFilePath, const QString &group,
+                                  quint32 counter)
+{
+    Counter &entry = counterEntry(settingsFilePath, group);
+    if (counter == entry.value)
+        return true;
+    if (!entry.persistent) {
+        entry.value = counter;
+        return true;
+    }
+
+    if (entry.reserving && counter >= entry.reserved) {
+        const quint32 previousReservation = entry.reserved;
+        entry.reserved = counter + qMin(m_reservationSize, quint32(-1) - counter);
+        if (!writeReservations(settingsFilePath)) {
+            entry.reserved = previousReservation;
+            return false;
+        }
+    }
+
+    entry.value = counter;
+    entry.dirty = true;
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start();
+    return true;
+}
+
+/*
+  Writes the recorded counters to their settings files. Only groups
+  which already contain a counter are updated.
+ */
+void LeSignCounterJournal::flush()
+{
+    m_flushTimer->stop();
+    for (auto it = m_counters.begin(); it != m_counters.end(); ++it) {
+        Counter &entry = it.value();
+        if (!entry.dirty)
+            continue;
+        entry.dirty = false;
+        QSettings settings(entry.settingsFilePath, QSettings::IniFormat);
+        if (!settings.isWritable())
+            continue;
+        settings.beginGroup(entry.group);
+        const QString counterKey = QLatin1String("Counter");
+        if (!settings.contains(counterKey) || settings.value(counterKey).toUInt() == entry.value)
+            continue;
+        settings.setValue(counterKey, entry.value);
+    }
+}
+
+/*
+  Returns the counter of \a group. A new counter starts with the reservation
+  found in the journal file. Counters of settings files which cannot be
+  written are only kept in memory.
+ */
+LeSignCounterJournal::Counter &LeSignCounterJournal::counterEntry(
+        const QString &settingsFilePath, const QString &group)
+{
+    Counter &entry = m_counters[settingsFilePath + QLatin1Char('#') + group];
+    if (entry.settingsFilePath.isEmpty()) {
+        entry.settingsFilePath = settingsFilePath;
+        entry.group = group;
+        entry.persistent = QFileInfo(settingsFilePath).isWritable();
+        if (entry.persistent)
+            entry.reserved = readReservations(settingsFilePath).value(group);
+    }
+    return entry;
+}
+
+QHash<QString, quint32> LeSignCounterJournal::readReservations(const QString &settingsFilePath)
+{
+    QHash<QString, quint32> reservations;
+    QFile file(journalFilePath(settingsFilePath));
+    if (!file.open(QIODevice::ReadOnly))
+        return reservations;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (magic != journalMagic || version != journalVersion) {
+        qCWarning(QT_BT_BLUEZ) << "Ignoring sign counter journal" << file.fileName()
+                               << "with unknown format";
+        return reservations;
+    }
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString group;
+        quint32 reserved = 0;
+        stream >> group >> reserved;
+        if (stream.status() == QDataStream::Ok)
+            reservations.insert(group, reserved);
+    }
+    return reservations;
+}
+
+QString LeSignCounterJournal::journalFilePath(const QString &settingsFilePath)
+{
+    return settingsFilePath + QLatin1String(".qtsigncounters");
+}
+
+/*
+  Replaces the journal file of \a settingsFilePath with the reservations
+  of all groups of the settings file. QSaveFile syncs the file to disk
+  before it replaces the previous one.
+ */
+bool LeSignCounterJournal::writeReservations(const QString &settingsFilePath)
+{
+    QHash<QString, quint32> reservations = readReservations(settingsFilePath);
+    for (const Counter &entry : qAsConst(m_counters)) {
+        if (entry.settingsFilePath == settingsFilePath)
+            reservations.insert(entry.group, entry.reserved);
+    }
+
+    QSaveFile file(journalFilePath(settingsFilePath));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(QT_BT_BLUEZ) << "Cannot write sign counter journal" << file.fileName()
+                               << file.errorString();
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << journalMagic << journalVersion << quint32(reservations.count());
+    for (auto it = reservations.cbegin(); it != reservations.cend(); ++it)
+        stream << it.key() << it.value();
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(QT_BT_BLUEZ) << "Failed to write sign counter journal" << file.fileName();
+        return false;
+    }
+    return true;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,124 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef LEGATTCACHE_P_H
+
+#ifndef LESIGNCOUNTERJOURNAL_P_H
+#define LESIGNCOUNTERJOURNAL_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/qhash.h>
+#include <QtCore/qobject.h>
+#include <QtCore/qstring.h>
+
+QT_BEGIN_NAMESPACE
+
+class QTimer;
+
+/*
+  Keeps the sign counters of the signing keys in memory and writes them to
+  the BlueZ settings files in batches, once the flush interval has passed
+  or when flush() is called.
+
+  Replay protection must survive a crash before the counters have been
+  written. The journal therefore reserves a range of counter values in a
+  file next to the settings file before a counter leaves the previously
+  reserved range. The reservation is synced to disk. After a crash, load()
+  continues with the end of the reserved range instead of the older value
+  of the settings file. No counter value is thus used twice.
+
+  Only the counters of the local signing key are reserved. The counter of a
+  remote key is the lowest value the remote device may sign with next. A
+  reserved value would reject its valid writes after a restart, such counters
+  are loaded as found in the settings file.
+ */
+class Q_AUTOTEST_EXPORT LeSignCounterJournal : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LeSignCounterJournal(QObject *parent = nullptr);
+    ~LeSignCounterJournal() override;
+
+    void setReservationSize(quint32 size) { m_reservationSize = qMax<quint32>(size, 1); }
+    quint32 reservationSize() const { return m_reservationSize; }
+    void setFlushInterval(int msecs);
+
+    enum CounterType { LocalCounter, RemoteCounter };
+    quint32 load(const QString &settingsFilePath, const QString &group, quint32 counter,
+                 CounterType type);
+    bool record(const QString &settingsFilePath, const QString &group, quint32 counter);
+
+    enum { DefaultReservationSize = 1024, DefaultFlushInterval = 2000 };
+
+public slots:
+    void flush();
+
+private:
+    struct Counter {
+        QString settingsFilePath;
+        QString group;
+        quint32 value = 0;      // value of the "Counter" key of the group
+        quint32 reserved = 0;   // values below are reserved in the journal file
+        bool reserving = true;  // only local counters are reserved
+        bool persistent = false;
+        bool dirty = false;
+    };
+
+    Counter &counterEntry(const QString &settingsFilePath, const QString &group);
+    static QString journalFilePath(const QString &settingsFilePath);
+    static QHash<QString, quint32> readReservations(const QString &settingsFilePath);
+    bool writeReservations(const QString &settingsFilePath);
+
+    QHash<QString, Counter> m_counters;
+    QTimer *m_flushTimer;
+    quint32 m_reservationSize = DefaultReservationSize;
+};
+
+QT_END_NAMESPACE
+
+#endif // LESIGNCOUNTERJOURNAL_P_H
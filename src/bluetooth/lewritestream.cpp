@@ -0,0 +1,259 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#include "lewritestream_p.h"
+#include "bluez/bluez_data_p.h"
+
+#include <QtCore/qloggingcategory.h>
+#include <QtCore/qsocketnotifier.h>
+#include <QtCore/private/qcore_unix_p.h>
+
+#include <errno.h>
+
+QT_BEGIN_NAMESPACE
+
+Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
+
+static const quint8 attOpWriteCommand = 0x52;
+static const int writeCommandHeaderSize = 3;
+static const int defaultMtu = 23;
+static const int maxMtu = 0x200;
+
+LeWriteStream::LeWriteStream(QLowEnergyHandle valueHandle, QObject *parent)
+    : QIODevice(parent), m_valueHandle(valueHandle)
+{
+    open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+}
+
+LeWriteStream::~LeWriteStream()
+{
+}
+
+bool LeWriteStream::isSequential() const
+{
+    return true;
+}
+
+qint64 LeWriteStream::bytesToWrite() const
+{
+    return m_buffer.size();
+}
+
+/*
+  Closes the stream. Data which has not been written yet is discarded.
+ */
+void LeWriteStream::close()
+{
+    QIODevice::close();
+    m_buffer.clear();
+}
+
+qint64 LeWriteStream::peekPending(char *data, qint64 maxSize) const
+{
+    return m_buffer.peek(data, maxSize);
+}
+
+void LeWriteStream::consumePending(qint64 size)
+{
+    m_buffer.free(size);
+    emit bytesWritten(size);
+}
+
+qint64 LeWriteStream::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+qint64 LeWriteStream::writeData(const char *data, qint64 maxSize)
+{
+    if (maxSize <= 0)
+        return 0;
+
+    m_buffer.append(data, maxSize);
+    emit dataQueued();
+    return maxSize;
+}
+
+LeAttStreamWriter::LeAttStreamWriter(QObject *parent)
+    : QObject(parent), m_mtu(defaultMtu)
+{
+}
+
+LeAttStreamWriter::~LeAttStreamWriter()
+{
+}
+
+/*
+  Sets the non-blocking socket the ATT commands are written to.
+ */
+void LeAttStreamWriter::setSocketDescriptor(int socketDescriptor)
+{
+    if (socketDescriptor == m_socket)
+        return;
+
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+        m_notifier->deleteLater();
+        m_notifier = nullptr;
+    }
+    m_socket = socketDescriptor;
+}
+
+void LeAttStreamWriter::setMtu(int mtu)
+{
+    m_mtu = qBound(defaultMtu, mtu, maxMtu);
+}
+
+LeWriteStream *LeAttStreamWriter::createStream(QLowEnergyHandle valueHandle, QObject *parent)
+{
+    LeWriteStream *stream = new LeWriteStream(valueHandle, parent);
+    connect(stream, &LeWriteStream::dataQueued, this, &LeAttStreamWriter::drain);
+    m_streams.append(stream);
+    return stream;
+}
+
+bool LeAttStreamWriter::hasPendingData() const
+{
+    for (const QPointer<LeWriteStream> &stream : m_streams) {
+        if (stream && stream->bytesToWrite() > 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+  Emits writable() once the socket accepts data again. Pending stream data is
+  sent afterwards.
+ */
+void LeAttStreamWriter::waitForWritable()
+{
+    if (m_socket == -1)
+        return;
+
+    if (!m_notifier) {
+        m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Write, this);
+        connect(m_notifier, &QSocketNotifier::activated,
+                this, &LeAttStreamWriter::socketWritable);
+    }
+    m_notifier->setEnabled(true);
+}
+
+/*
+  Closes all streams and detaches from the socket.
+ */
+void LeAttStreamWriter::clear()
+{
+    const QVector<QPointer<LeWriteStream>> streams = m_streams;
+    m_streams.clear();
+    for (const QPointer<LeWriteStream> &stream : streams) {
+        if (stream)
+            stream->close();
+    }
+
+    setSocketDescriptor(-1);
+    m_mtu = defaultMtu;
+}
+
+/*
+  Writes the pending data of all streams until the socket buffer is full.
+  The streams are served in turn, one packet at a time.
+ */
+void LeAttStreamWriter::drain()
+{
+    if (m_draining || m_socket == -1)
+        return;
+
+    // waiting for the socket to become writable
+    if (m_notifier && m_notifier->isEnabled())
+        return;
+
+    m_draining = true;
+
+    char packet[maxMtu];
+    bool progress = true;
+    while (progress && m_socket != -1) {
+        progress = false;
+        for (int i = 0; i < m_streams.count() && m_socket != -1;) {
+            const QPointer<LeWriteStream> stream = m_streams.at(i);
+            if (!stream || !stream->isOpen()) {
+                m_streams.removeAt(i);
+                continue;
+            }
+
+            const qint64 size = stream->peekPending(packet + writeCommandHeaderSize,
+                                                    m_mtu - writeCommandHeaderSize);
+            if (size <= 0) {
+                ++i;
+                continue;
+            }
+
+            packet[0] = attOpWriteCommand;
+            putBtData(stream->valueHandle(), packet + 1);
+            const qint64 result = qt_safe_write(m_socket, packet, size + writeCommandHeaderSize);
+            if (result < 0) {
+                m_draining = false;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    waitForWritable();
+                } else {
+                    const int errorCode = errno;
+                    qCWarning(QT_BT_BLUEZ) << "Cannot write ATT command:" << qt_error_string(errorCode);
+                    emit errorOccurred(errorCode);
+                }
+                return;
+            }
+
+            // L2CAP ATT sockets are packet based, the command is sent entirely or not at all
+            stream->consumePending(size);
+            progress = true;
+            ++i;
+        }
+    }
+
+    m_draining = false;
+}
+
+void LeAttStreamWriter::socketWritable()
+{
+    m_notifier->setEnabled(false);
+    emit writable();
+    drain();
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,145 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef LEWRITESTREAM_P_H
+#define LEWRITESTREAM_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists purely as an
+// implementation detail.  This header file may change from version to
+// version without notice, or even be removed.
+//
+// We mean it.
+//
+
+#include <QtCore/qiodevice.h>
+#include <QtCore/qpointer.h>
+#include <QtCore/qvector.h>
+#include <QtCore/private/qringbuffer_p.h>
+#include <QtBluetooth/qbluetooth.h>
+
+QT_BEGIN_NAMESPACE
+
+class QSocketNotifier;
+
+/*
+  Write-only device whose data is sent to a characteristic using
+  ATT Write Commands. The data is buffered until LeAttStreamWriter
+  can pass it to the socket.
+ */
+class Q_AUTOTEST_EXPORT LeWriteStream : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit LeWriteStream(QLowEnergyHandle valueHandle, QObject *parent = nullptr);
+    ~LeWriteStream() override;
+
+    bool isSequential() const override;
+    qint64 bytesToWrite() const override;
+    void close() override;
+
+    QLowEnergyHandle valueHandle() const { return m_valueHandle; }
+
+    // used by LeAttStreamWriter
+    qint64 peekPending(char *data, qint64 maxSize) const;
+    void consumePending(qint64 size);
+
+signals:
+    void dataQueued();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QRingBuffer m_buffer;
+    const QLowEnergyHandle m_valueHandle;
+};
+
+/*
+  Sends the data of LeWriteStream objects as ATT Write Commands
+  on a non-blocking socket. Each command carries up to MTU - 3 bytes.
+  Data is only removed from the streams once the socket has accepted it.
+  If the socket buffer is full, the writer waits until the socket becomes
+  writable again instead of dropping the packet.
+
+  Other writers on the same socket can use waitForWritable()
+  to be notified via writable() when the socket accepts data again.
+ */
+class Q_AUTOTEST_EXPORT LeAttStreamWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LeAttStreamWriter(QObject *parent = nullptr);
+    ~LeAttStreamWriter() override;
+
+    void setSocketDescriptor(int socketDescriptor);
+    int socketDescriptor() const { return m_socket; }
+
+    void setMtu(int mtu);
+    int mtu() const { return m_mtu; }
+
+    LeWriteStream *createStream(QLowEnergyHandle valueHandle, QObject *parent = nullptr);
+    bool hasPendingData() const;
+    void waitForWritable();
+    void clear();
+
+public slots:
+    void drain();
+
+signals:
+    void writable();
+    void errorOccurred(int errorCode);
+
+private slots:
+    void socketWritable();
+
+private:
+    QVector<QPointer<LeWriteStream>> m_streams;
+    QSocketNotifier *m_notifier = nullptr;
+    int m_socket = -1;
+    int m_mtu;
+    bool m_draining = false;
+};
+
+QT_END_NAMESPACE
+
+#endif // LEWRITESTREAM_P_H
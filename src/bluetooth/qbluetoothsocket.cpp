@@ -57,6 +57,7 @@
 
 #include "qbluetoothservicediscoveryagent.h"
 
+#include <QtCore/QFile>
 #include <QtCore/QLoggingCategory>
 #include <QSocketNotifier>
 
@@ -554,6 +555,221 @@ QBluetooth::SecurityFlags QBluetoothSocket::preferredSecurityFlags() const
 #endif // QT_OSX_BLUETOOTH
 }
 
+/*!
+    \since 6.0
+
+    Returns the size of the internal read buffer. This limits the amount of
+    data that the client can receive before calling \l read() or \l readAll().
+
+    A read buffer size of 0 (the default) means that the buffer has no size
+    limit, ensuring that no data is lost.
+
+    \sa setReadBufferSize(), read()
+*/
+qint64 QBluetoothSocket::readBufferSize() const
+{
+    Q_D(const QBluetoothSocketBase);
+    return d->readBufferMaxSize;
+}
+
+/*!
+    \since 6.0
+
+    Sets the size of QBluetoothSocket's internal read buffer to be \a size bytes.
+
+    If the buffer size is limited to a certain size, QBluetoothSocket won't
+    buffer more than this size of data. Once the buffer is full, the socket stops
+    reading until the application reads from it. The data then remains in the
+    buffers of the operating system, which in turn stops the remote device from
+    sending more data. A buffer size of 0 means that the read buffer is unlimited
+    and all incoming data is buffered. This is the default.
+
+    L2CAP sockets always read complete packets, so their buffer can exceed
+    \a size by up to one packet.
+
+    \note Only the BlueZ backends on Linux support this function. On other
+    platforms the read buffer is always unlimited.
+
+    \sa readBufferSize(), read()
+*/
+void QBluetoothSocket::setReadBufferSize(qint64 size)
+{
+    Q_D(QBluetoothSocketBase);
+    d->setReadBufferSize(qMax<qint64>(size, 0));
+}
+
+/*!
+    \since 6.0
+
+    Returns \c true if at least one packet is waiting to be read by
+    \l readDatagram(); otherwise returns \c false.
+
+    L2CAP sockets preserve the boundaries of the packets they receive. Besides
+    reading the received data as a byte stream using \l read(), the application
+    can read one packet at a time using \l readDatagram(). The \l readyRead()
+    signal is emitted when new packets arrive.
+
+    \note Only the BlueZ backend on Linux supports datagrams, on other
+    platforms this function always returns \c false.
+
+    \sa pendingDatagramSize(), readDatagram(), writeDatagram()
+*/
+bool QBluetoothSocket::hasPendingDatagrams() const
+{
+    Q_D(const QBluetoothSocketBase);
+    return d->hasPendingDatagrams();
+}
+
+/*!
+    \since 6.0
+
+    Returns the size of the first pending packet. If there is no packet
+    available, this function returns -1.
+
+    \sa hasPendingDatagrams(), readDatagram()
+*/
+qint64 QBluetoothSocket::pendingDatagramSize() const
+{
+    Q_D(const QBluetoothSocketBase);
+    return d->pendingDatagramSize();
+}
+
+/*!
+    \since 6.0
+
+    Reads the first pending packet of at most \a maxSize bytes into \a data
+    and returns the number of bytes read. If the packet is larger than
+    \a maxSize, the remainder of the packet is discarded.
+
+    Returns -1 if no packet is pending or an error occurred.
+
+    Data that was read into the buffer of QIODevice by \l read() or
+    \l peek() is not available to this function, the application should
+    not mix both ways of reading from the same socket.
+
+    \note Only L2CAP sockets of the BlueZ backend on Linux support datagrams.
+
+    \sa hasPendingDatagrams(), pendingDatagramSize(), writeDatagram()
+*/
+qint64 QBluetoothSocket::readDatagram(char *data, qint64 maxSize)
+{
+    Q_D(QBluetoothSocketBase);
+
+    if (d->state != QBluetoothSocket::ConnectedState) {
+        d->errorString = tr("Cannot read while not connected");
+        setSocketError(QBluetoothSocket::OperationError);
+        return -1;
+    }
+
+    if (!d->supportsDatagrams()) {
+        d->errorString = tr("Datagrams are only supported by L2CAP sockets");
+        setSocketError(QBluetoothSocket::UnsupportedProtocolError);
+        return -1;
+    }
+
+    return d->readDatagram(data, qMax<qint64>(maxSize, 0));
+}
+
+/*!
+    \since 6.0
+
+    Sends the \a size bytes of \a data as one L2CAP packet and returns the
+    number of bytes queued, or -1 if an error occurred. Unlike \l write(),
+    which may combine several writes into one packet, the remote device
+    receives exactly this packet.
+
+    The packet must not exceed the maximum transmission unit of the channel.
+
+    \note Only L2CAP sockets of the BlueZ backend on Linux support datagrams.
+
+    \sa readDatagram(), write()
+*/
+qint64 QBluetoothSocket::writeDatagram(const char *data, qint64 size)
+{
+    Q_D(QBluetoothSocketBase);
+
+    if (!data || size <= 0) {
+        d->errorString = tr("Invalid data/data size");
+        setSocketError(QBluetoothSocket::OperationError);
+        return -1;
+    }
+
+    if (d->state != QBluetoothSocket::ConnectedState) {
+        d->errorString = tr("Cannot write while not connected");
+        setSocketError(QBluetoothSocket::OperationError);
+        return -1;
+    }
+
+    if (!d->supportsDatagrams()) {
+        d->errorString = tr("Datagrams are only supported by L2CAP sockets");
+        setSocketError(QBluetoothSocket::UnsupportedProtocolError);
+        return -1;
+    }
+
+    return d->writeDatagram(data, size);
+}
+
+/*!
+    \fn qint64 QBluetoothSocket::writeDatagram(const QByteArray &datagram)
+    \since 6.0
+    \overload
+
+    Sends \a datagram as one L2CAP packet.
+*/
+
+/*!
+    \since 6.0
+
+    Queues \a length bytes of \a file, starting at \a offset, for sending
+    and returns \c true on success. A \a length of -1 sends the file up to
+    its end. The position of \a file is not changed.
+
+    The data is sent after the data written before this call and before the
+    data written after it. The kernel moves the file contents straight into the
+    socket, the data is not copied into the write buffer of the socket. The
+    progress is reported by \l bytesWritten(), and \l bytesToWrite() includes
+    the bytes of the file that have not been sent yet.
+
+    \a file must be open for reading and must not be sequential. It has to
+    stay open until all of its data was sent. If the file is truncated
+    before its data was sent, the error OperationError is reported.
+
+    \note Only RFCOMM sockets of the BlueZ kernel socket backend on Linux
+    support this function. This includes the sockets returned by
+    QBluetoothServer. On other platforms, the file has to be sent with
+    \l write().
+
+    \sa bytesToWrite(), bytesWritten()
+*/
+bool QBluetoothSocket::sendFile(QFile *file, qint64 offset, qint64 length)
+{
+    Q_D(QBluetoothSocketBase);
+
+    if (!file || !file->isReadable() || file->isSequential()
+            || offset < 0 || offset > file->size() || length < -1
+            || (length > file->size() - offset)) {
+        d->errorString = tr("Invalid file/file range");
+        setSocketError(QBluetoothSocket::OperationError);
+        return false;
+    }
+
+    if (d->state != QBluetoothSocket::ConnectedState) {
+        d->errorString = tr("Cannot write while not connected");
+        setSocketError(QBluetoothSocket::OperationError);
+        return false;
+    }
+
+    if (!d->supportsFileSending()) {
+        d->errorString = tr("Sending files is not supported by this socket");
+        setSocketError(QBluetoothSocket::UnsupportedProtocolError);
+        return false;
+    }
+
+    if (length == -1)
+        length = file->size() - offset;
+    return length == 0 || d->sendFile(file, offset, length);
+}
+
 /*!
     Sets the socket state to \a state.
 */
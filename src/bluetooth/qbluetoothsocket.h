@@ -54,6 +54,7 @@ QT_BEGIN_NAMESPACE
 
 
 class QBluetoothSocketBasePrivate;
+class QFile;
 
 class Q_BLUETOOTH_EXPORT QBluetoothSocket : public QIODevice
 {
@@ -134,8 +135,17 @@ public:
     quint16 peerPort() const;
     //QBluetoothServiceInfo peerService() const;
 
-    //qint64 readBufferSize() const;
-    //void setReadBufferSize(qint64 size);
+    qint64 readBufferSize() const;
+    void setReadBufferSize(qint64 size);
+
+    bool hasPendingDatagrams() const;
+    qint64 pendingDatagramSize() const;
+    qint64 readDatagram(char *data, qint64 maxSize);
+    qint64 writeDatagram(const char *data, qint64 size);
+    inline qint64 writeDatagram(const QByteArray &datagram)
+    { return writeDatagram(datagram.constData(), datagram.size()); }
+
+    bool sendFile(QFile *file, qint64 offset = 0, qint64 length = -1);
 
     bool setSocketDescriptor(int socketDescriptor, QBluetoothServiceInfo::Protocol socketType,
                              SocketState socketState = ConnectedState,
@@ -54,6 +54,9 @@
 #include <QtCore/QLoggingCategory>
 
 #include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -63,6 +66,19 @@ QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(QT_BT_BLUEZ)
 
+// largest packet written to buffered L2CAP sockets
+static const int l2capWriteSize = 1024;
+// chunks of the write buffer passed to one writev() call
+static const int maxWriteSegments = 16;
+// reads per read notification, such that other events are not starved
+static const int maxReadsPerNotification = 16;
+// L2CAP packets moved by one recvmmsg() or sendmmsg() call
+static const int maxPacketsPerCall = 16;
+// bytes reserved in the read buffer for one recvmmsg() call
+static const qint64 maxPacketReadSize = 4 * QPRIVATELINEARBUFFER_BUFFERSIZE;
+// bytes of a file passed to one sendfile() call, and mapped at once by the fallback
+static const qint64 maxFileWriteSize = Q_INT64_C(1) << 20;
+
 QBluetoothSocketPrivateBluez::QBluetoothSocketPrivateBluez()
     : QBluetoothSocketBasePrivate()
 {
@@ -71,6 +87,7 @@ QBluetoothSocketPrivateBluez::QBluetoothSocketPrivateBluez()
 
 QBluetoothSocketPrivateBluez::~QBluetoothSocketPrivateBluez()
 {
+    clearFileTransfers();
     delete readNotifier;
     readNotifier = nullptr;
     delete connectWriteNotifier;
@@ -85,12 +102,14 @@ bool QBluetoothSocketPrivateBluez::ensureNativeSocket(QBluetoothServiceInfo::Pro
 
         delete readNotifier;
         readNotifier = nullptr;
+        readPaused = false;
         delete connectWriteNotifier;
         connectWriteNotifier = nullptr;
         QT_CLOSE(socket);
     }
 
     socketType = type;
+    receiveMtu = sendMtu = -1;
 
     switch (type) {
     case QBluetoothServiceInfo::L2capProtocol:
@@ -330,38 +349,25 @@ void QBluetoothSocketPrivateBluez::_q_writeNotify()
         connecting = false;
     }
     else {
-        if (txBuffer.size() == 0) {
+        if (bytesToWrite() == 0) {
             connectWriteNotifier->setEnabled(false);
             return;
         }
 
-        char buf[1024];
-
-        int size = txBuffer.read(buf, 1024);
-        int writtenBytes = qt_safe_write(socket, buf, size);
-        if (writtenBytes < 0) {
-            switch (errno) {
-            case EAGAIN:
-                writtenBytes = 0;
-                txBuffer.ungetBlock(buf, size);
-                break;
-            default:
-                // every other case returns error
-                errorString = QBluetoothSocket::tr("Network Error: %1").arg(qt_error_string(errno)) ;
-                q->setSocketError(QBluetoothSocket::NetworkError);
-                break;
-            }
-        } else {
-            if (writtenBytes < size) {
-                // add remainder back to buffer
-                char* remainder = buf + writtenBytes;
-                txBuffer.ungetBlock(remainder, size - writtenBytes);
-            }
-            if (writtenBytes > 0)
-                emit q->bytesWritten(writtenBytes);
+        int writeError = 0;
+        const qint64 writtenBytes = socketType == QBluetoothServiceInfo::L2capProtocol
+                ? writePackets(&writeError) : writeStream(&writeError);
+        if (writeError == ENODATA) {
+            errorString = QBluetoothSocket::tr("File was truncated while it was sent");
+            q->setSocketError(QBluetoothSocket::OperationError);
+        } else if (writeError) {
+            errorString = QBluetoothSocket::tr("Network Error: %1").arg(qt_error_string(writeError));
+            q->setSocketError(QBluetoothSocket::NetworkError);
         }
+        if (writtenBytes > 0)
+            emit q->bytesWritten(writtenBytes);
 
-        if (txBuffer.size()) {
+        if (bytesToWrite()) {
             connectWriteNotifier->setEnabled(true);
         }
         else if (state == QBluetoothSocket::ClosingState) {
@@ -371,19 +377,214 @@ void QBluetoothSocketPrivateBluez::_q_writeNotify()
     }
 }
 
+/*
+  Writes straight from the buffer's chunks until it is empty or the socket is full.
+  Queued files are sent once the data written before them is gone.
+ */
+qint64 QBluetoothSocketPrivateBluez::writeStream(int *errorCode)
+{
+    qint64 writtenBytes = 0;
+    while (!*errorCode) {
+        if (!fileTransfers.isEmpty() && fileTransfers.head().precedingBytes == 0) {
+            FileTransfer &transfer = fileTransfers.head();
+            writtenBytes += writeFile(transfer, errorCode);
+            if (transfer.remaining > 0 && !*errorCode)
+                break; // the socket buffer is full
+            // a failed transfer is dropped
+            FileTransfer finished = fileTransfers.dequeue();
+            if (finished.mapping && finished.file)
+                finished.file->unmap(finished.mapping);
+            continue;
+        }
+
+        const qint64 available = fileTransfers.isEmpty()
+                ? txBuffer.size() : fileTransfers.head().precedingBytes;
+        if (available == 0)
+            break;
+
+        iovec segments[maxWriteSegments];
+        int segmentCount = 0;
+        qint64 size = 0;
+        while (size < available && segmentCount < maxWriteSegments) {
+            qint64 length = 0;
+            const char *segment = txBuffer.readPointerAtPosition(size, length);
+            length = qMin(length, available - size);
+            segments[segmentCount].iov_base = const_cast<char *>(segment);
+            segments[segmentCount].iov_len = size_t(length);
+            ++segmentCount;
+            size += length;
+        }
+
+        qint64 result;
+        EINTR_LOOP(result, ::writev(socket, segments, segmentCount));
+        if (result < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                *errorCode = errno;
+            break;
+        }
+        txBuffer.free(result);
+        writtenBytes += result;
+        if (!fileTransfers.isEmpty())
+            fileTransfers.head().precedingBytes -= result;
+        if (result < size)
+            break; // the socket buffer is full
+    }
+    return writtenBytes;
+}
+
+/*
+  Sends the file of \a transfer with sendfile(), such that its contents never enter
+  user space. Files without a descriptor, or whose file system does not support
+  sendfile(), are mapped into memory and written from the mapping instead.
+  If the file shrinks before all of its data was sent, \a errorCode is set
+  to ENODATA.
+ */
+qint64 QBluetoothSocketPrivateBluez::writeFile(FileTransfer &transfer, int *errorCode)
+{
+    qint64 writtenBytes = 0;
+    while (transfer.remaining > 0) {
+        if (!transfer.file || !transfer.file->isOpen()) {
+            *errorCode = EBADF;
+            break;
+        }
+
+        const int descriptor = transfer.file->handle();
+        if (descriptor == -1)
+            transfer.useMapping = true;
+
+        qint64 result;
+        if (!transfer.useMapping) {
+            off_t offset = off_t(transfer.offset);
+            EINTR_LOOP(result, ::sendfile(socket, descriptor, &offset,
+                                          size_t(qMin(transfer.remaining, maxFileWriteSize))));
+            if (result < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                transfer.useMapping = true;
+                continue;
+            }
+        } else {
+            if (!transfer.mapping) {
+                // accessing a mapping beyond the end of the file raises SIGBUS
+                if (transfer.file->size() < transfer.offset + transfer.remaining) {
+                    *errorCode = ENODATA;
+                    break;
+                }
+                transfer.mappingSize = qMin(transfer.remaining, maxFileWriteSize);
+                transfer.mapping = transfer.file->map(transfer.offset, transfer.mappingSize);
+                if (!transfer.mapping) {
+                    *errorCode = EIO;
+                    break;
+                }
+                transfer.mappingOffset = transfer.offset;
+            }
+            const qint64 position = transfer.offset - transfer.mappingOffset;
+            EINTR_LOOP(result, ::write(socket, transfer.mapping + position,
+                                       size_t(transfer.mappingSize - position)));
+        }
+
+        if (result < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                *errorCode = errno;
+            break;
+        }
+        if (result == 0) {
+            // the file was truncated, the missing bytes cannot be sent
+            *errorCode = ENODATA;
+            break;
+        }
+
+        transfer.offset += result;
+        transfer.remaining -= result;
+        writtenBytes += result;
+        if (transfer.mapping && transfer.offset == transfer.mappingOffset + transfer.mappingSize) {
+            transfer.file->unmap(transfer.mapping);
+            transfer.mapping = nullptr;
+        }
+    }
+    return writtenBytes;
+}
+
+void QBluetoothSocketPrivateBluez::clearFileTransfers()
+{
+    for (const FileTransfer &transfer : qAsConst(fileTransfers)) {
+        if (transfer.mapping && transfer.file)
+            transfer.file->unmap(transfer.mapping);
+    }
+    fileTransfers.clear();
+}
+
+/*
+  Sends the packets queued in txPacketSizes, up to maxPacketsPerCall per sendmmsg() call.
+  A packet spans at most two chunks of the buffer, so every batch holds at least one.
+ */
+qint64 QBluetoothSocketPrivateBluez::writePackets(int *errorCode)
+{
+    qint64 writtenBytes = 0;
+    while (!txPacketSizes.isEmpty()) {
+        mmsghdr messages[maxPacketsPerCall];
+        iovec segments[maxWriteSegments];
+        memset(messages, 0, sizeof(messages));
+        int messageCount = 0;
+        int segmentCount = 0;
+        qint64 position = 0;
+        while (messageCount < qMin(int(txPacketSizes.size()), maxPacketsPerCall)) {
+            const qint64 packetSize = txPacketSizes.at(messageCount);
+            iovec *packetSegments = segments + segmentCount;
+            int packetSegmentCount = 0;
+            qint64 size = 0;
+            while (size < packetSize && segmentCount + packetSegmentCount < maxWriteSegments) {
+                qint64 length = 0;
+                const char *segment = txBuffer.readPointerAtPosition(position + size, length);
+                length = qMin(length, packetSize - size);
+                packetSegments[packetSegmentCount].iov_base = const_cast<char *>(segment);
+                packetSegments[packetSegmentCount].iov_len = size_t(length);
+                ++packetSegmentCount;
+                size += length;
+            }
+            if (size < packetSize)
+                break; // the packet goes into the next batch
+
+            messages[messageCount].msg_hdr.msg_iov = packetSegments;
+            messages[messageCount].msg_hdr.msg_iovlen = size_t(packetSegmentCount);
+            segmentCount += packetSegmentCount;
+            position += packetSize;
+            ++messageCount;
+        }
+        Q_ASSERT(messageCount > 0);
+
+        int sentPackets;
+        EINTR_LOOP(sentPackets, ::sendmmsg(socket, messages, uint(messageCount), 0));
+        if (sentPackets < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                *errorCode = errno;
+            break;
+        }
+        for (int i = 0; i < sentPackets; ++i) {
+            const qint64 packetSize = txPacketSizes.dequeue();
+            txBuffer.free(packetSize);
+            writtenBytes += packetSize;
+        }
+        if (sentPackets < messageCount)
+            break; // the socket buffer is full
+    }
+    if (txPacketSizes.isEmpty())
+        txPacketOpen = false;
+    return writtenBytes;
+}
+
 void QBluetoothSocketPrivateBluez::_q_readNotify()
 {
     Q_Q(QBluetoothSocket);
-    char *writePointer = buffer.reserve(QPRIVATELINEARBUFFER_BUFFERSIZE);
-//    qint64 readFromDevice = q->readData(writePointer, QPRIVATELINEARBUFFER_BUFFERSIZE);
-    int readFromDevice = ::read(socket, writePointer, QPRIVATELINEARBUFFER_BUFFERSIZE);
-    buffer.chop(QPRIVATELINEARBUFFER_BUFFERSIZE - (readFromDevice < 0 ? 0 : readFromDevice));
-    if(readFromDevice <= 0){
-        int errsv = errno;
+
+    // Read until the kernel has no more data or the read buffer is full. Once it
+    // is full, reading pauses and the kernel socket throttles the remote device.
+    int errsv = 0;
+    const qint64 totalRead = socketType == QBluetoothServiceInfo::L2capProtocol
+            ? readPackets(&errsv) : readStream(&errsv);
+    if (totalRead < 0) {
         readNotifier->setEnabled(false);
         connectWriteNotifier->setEnabled(false);
         errorString = qt_error_string(errsv);
-        qCWarning(QT_BT_BLUEZ) << Q_FUNC_INFO << socket << "error:" << readFromDevice << errorString;
+        qCWarning(QT_BT_BLUEZ) << Q_FUNC_INFO << socket << "error:" << errorString;
         if (errsv == EHOSTDOWN)
             q->setSocketError(QBluetoothSocket::HostNotFoundError);
         else if (errsv == ECONNRESET)
@@ -392,18 +593,182 @@ void QBluetoothSocketPrivateBluez::_q_readNotify()
             q->setSocketError(QBluetoothSocket::UnknownSocketError);
 
         q->disconnectFromService();
+        return;
     }
-    else {
+
+    if (totalRead > 0)
         emit q->readyRead();
+}
+
+/*
+  Returns the number of bytes read, or -1 if the connection failed before any data
+  was read. Data read before an error is delivered first, the error is reported by
+  the next notification.
+ */
+qint64 QBluetoothSocketPrivateBluez::readStream(int *errorCode)
+{
+    qint64 totalRead = 0;
+    for (int i = 0; i < maxReadsPerNotification; ++i) {
+        if (isReadBufferFull()) {
+            readNotifier->setEnabled(false);
+            readPaused = true;
+            break;
+        }
+        qint64 readSize = QPRIVATELINEARBUFFER_BUFFERSIZE;
+        if (readBufferMaxSize > 0)
+            readSize = qMin(readSize, readBufferMaxSize - buffer.size());
+
+        char *writePointer = buffer.reserve(readSize);
+        qint64 readFromDevice;
+        EINTR_LOOP(readFromDevice, ::read(socket, writePointer, size_t(readSize)));
+        const int errsv = errno;
+        buffer.chop(readSize - (readFromDevice < 0 ? 0 : readFromDevice));
+        if (readFromDevice > 0) {
+            totalRead += readFromDevice;
+            if (readFromDevice < readSize)
+                break; // nothing left in the kernel buffer
+            continue;
+        }
+        if (readFromDevice < 0 && (errsv == EAGAIN || errsv == EWOULDBLOCK))
+            break;
+        if (totalRead > 0)
+            break;
+
+        *errorCode = errsv;
+        return -1;
+    }
+    return totalRead;
+}
+
+/*
+  Receives batches of L2CAP packets with recvmmsg(). Every packet gets a block of
+  the receive MTU at the end of the read buffer; the packets are moved together
+  afterwards and their sizes are queued in packetSizes. An empty packet marks
+  the end of the connection. Returns like readStream().
+ */
+qint64 QBluetoothSocketPrivateBluez::readPackets(int *errorCode)
+{
+    qint64 packetSize = packetMtu(true);
+    if (packetSize <= 0)
+        packetSize = QPRIVATELINEARBUFFER_BUFFERSIZE;
+
+    qint64 totalRead = 0;
+    for (int i = 0; i < maxReadsPerNotification; ++i) {
+        if (isReadBufferFull()) {
+            readNotifier->setEnabled(false);
+            readPaused = true;
+            break;
+        }
+        // a limited read buffer takes at most one packet beyond its limit
+        qint64 batchSize = qBound<qint64>(1, maxPacketReadSize / packetSize, maxPacketsPerCall);
+        if (readBufferMaxSize > 0)
+            batchSize = qBound<qint64>(1, (readBufferMaxSize - buffer.size()) / packetSize, batchSize);
+
+        const qint64 reservedSize = batchSize * packetSize;
+        char *block = buffer.reserve(reservedSize);
+        mmsghdr messages[maxPacketsPerCall];
+        iovec segments[maxPacketsPerCall];
+        memset(messages, 0, sizeof(messages));
+        for (int j = 0; j < batchSize; ++j) {
+            segments[j].iov_base = block + j * packetSize;
+            segments[j].iov_len = size_t(packetSize);
+            messages[j].msg_hdr.msg_iov = &segments[j];
+            messages[j].msg_hdr.msg_iovlen = 1;
+        }
+
+        int receivedPackets;
+        EINTR_LOOP(receivedPackets, ::recvmmsg(socket, messages, uint(batchSize), 0, nullptr));
+        const int errsv = errno;
+
+        qint64 size = 0;
+        bool endOfFile = false;
+        for (int j = 0; j < receivedPackets; ++j) {
+            const qint64 length = messages[j].msg_len;
+            if (length == 0) {
+                endOfFile = true;
+                break;
+            }
+            if (j > 0)
+                memmove(block + size, block + j * packetSize, size_t(length));
+            packetSizes.enqueue(length);
+            size += length;
+        }
+        buffer.chop(reservedSize - size);
+        totalRead += size;
+
+        if (!endOfFile && receivedPackets > 0) {
+            if (receivedPackets < batchSize)
+                break; // nothing left in the kernel buffer
+            continue;
+        }
+        if (receivedPackets < 0 && (errsv == EAGAIN || errsv == EWOULDBLOCK))
+            break;
+        if (totalRead > 0)
+            break;
+
+        *errorCode = errsv;
+        return -1;
     }
+    return totalRead;
+}
+
+/*
+  Returns the receive or send MTU of the connected L2CAP channel, or 0 if it is not
+  known. Older kernels only report the MTU of BR/EDR channels through L2CAP_OPTIONS.
+ */
+qint64 QBluetoothSocketPrivateBluez::packetMtu(bool receive)
+{
+    qint64 &mtu = receive ? receiveMtu : sendMtu;
+    if (mtu >= 0)
+        return mtu;
+
+    mtu = 0;
+    quint16 value = 0;
+    socklen_t length = sizeof(value);
+    if (::getsockopt(socket, SOL_BLUETOOTH, receive ? BT_RCVMTU : BT_SNDMTU,
+                     &value, &length) == 0 && value) {
+        mtu = value;
+    } else {
+        l2cap_options options = {};
+        length = sizeof(options);
+        if (::getsockopt(socket, SOL_L2CAP, L2CAP_OPTIONS, &options, &length) == 0)
+            mtu = receive ? options.imtu : options.omtu;
+    }
+    return mtu;
+}
+
+bool QBluetoothSocketPrivateBluez::isReadBufferFull() const
+{
+    return readBufferMaxSize > 0 && buffer.size() >= readBufferMaxSize;
+}
+
+/*
+  Enables the read notifier again once the application made room in the read buffer.
+ */
+void QBluetoothSocketPrivateBluez::resumeReading()
+{
+    if (!readPaused || isReadBufferFull())
+        return;
+    readPaused = false;
+    if (readNotifier)
+        readNotifier->setEnabled(true);
+}
+
+void QBluetoothSocketPrivateBluez::setReadBufferSize(qint64 size)
+{
+    readBufferMaxSize = size;
+    resumeReading();
 }
 
 void QBluetoothSocketPrivateBluez::abort()
 {
     delete readNotifier;
     readNotifier = nullptr;
+    readPaused = false;
     delete connectWriteNotifier;
     connectWriteNotifier = nullptr;
+    receiveMtu = sendMtu = -1;
+    clearFileTransfers();
 
     // We don't transition through Closing for abort, so
     // we don't call disconnectFromService or
@@ -603,7 +968,8 @@ qint64 QBluetoothSocketPrivateBluez::writeData(const char *data, qint64 maxSize)
         return -1;
     }
 
-    if (q->openMode() & QIODevice::Unbuffered) {
+    // data written after a file queued by sendFile() waits for the file
+    if ((q->openMode() & QIODevice::Unbuffered) && bytesToWrite() == 0) {
         int sz = ::qt_safe_write(socket, data, maxSize);
         if (sz < 0) {
             switch (errno) {
@@ -626,7 +992,7 @@ qint64 QBluetoothSocketPrivateBluez::writeData(const char *data, qint64 maxSize)
         if(!connectWriteNotifier)
             return -1;
 
-        if(txBuffer.size() == 0) {
+        if(bytesToWrite() == 0) {
             connectWriteNotifier->setEnabled(true);
             QMetaObject::invokeMethod(this, "_q_writeNotify", Qt::QueuedConnection);
         }
@@ -634,6 +1000,23 @@ qint64 QBluetoothSocketPrivateBluez::writeData(const char *data, qint64 maxSize)
         char *txbuf = txBuffer.reserve(maxSize);
         memcpy(txbuf, data, maxSize);
 
+        if (socketType == QBluetoothServiceInfo::L2capProtocol) {
+            // fill the open packet, then split the rest into packets of l2capWriteSize
+            qint64 remaining = maxSize;
+            if (txPacketOpen) {
+                qint64 &openPacketSize = txPacketSizes.last();
+                const qint64 appended = qMin<qint64>(remaining, l2capWriteSize - openPacketSize);
+                openPacketSize += appended;
+                remaining -= appended;
+            }
+            while (remaining > 0) {
+                const qint64 packetSize = qMin<qint64>(remaining, l2capWriteSize);
+                txPacketSizes.enqueue(packetSize);
+                remaining -= packetSize;
+            }
+            txPacketOpen = true;
+        }
+
         return maxSize;
     }
 }
@@ -649,16 +1032,128 @@ qint64 QBluetoothSocketPrivateBluez::readData(char *data, qint64 maxSize)
     }
 
     if (!buffer.isEmpty()) {
-        int i = buffer.read(data, maxSize);
+        const qint64 i = buffer.read(data, maxSize);
+        discardPacketBytes(i);
+        resumeReading();
         return i;
     }
 
     return 0;
 }
 
+/*
+  Keeps packetSizes in line with the read buffer once \a size bytes were read as a
+  stream. A partially read packet stays queued with its remaining size.
+ */
+void QBluetoothSocketPrivateBluez::discardPacketBytes(qint64 size)
+{
+    while (size > 0 && !packetSizes.isEmpty()) {
+        qint64 &packetSize = packetSizes.head();
+        if (size < packetSize) {
+            packetSize -= size;
+            return;
+        }
+        size -= packetSize;
+        packetSizes.dequeue();
+    }
+}
+
+bool QBluetoothSocketPrivateBluez::supportsFileSending() const
+{
+    return socketType == QBluetoothServiceInfo::RfcommProtocol;
+}
+
+bool QBluetoothSocketPrivateBluez::sendFile(QFile *file, qint64 offset, qint64 length)
+{
+    if (!connectWriteNotifier)
+        return false;
+
+    if (bytesToWrite() == 0) {
+        connectWriteNotifier->setEnabled(true);
+        QMetaObject::invokeMethod(this, "_q_writeNotify", Qt::QueuedConnection);
+    }
+
+    FileTransfer transfer;
+    transfer.file = file;
+    transfer.precedingBytes = txBuffer.size();
+    for (const FileTransfer &queued : qAsConst(fileTransfers))
+        transfer.precedingBytes -= queued.precedingBytes;
+    transfer.offset = offset;
+    transfer.remaining = length;
+    fileTransfers.enqueue(transfer);
+    return true;
+}
+
+bool QBluetoothSocketPrivateBluez::supportsDatagrams() const
+{
+    return socketType == QBluetoothServiceInfo::L2capProtocol;
+}
+
+bool QBluetoothSocketPrivateBluez::hasPendingDatagrams() const
+{
+    return !packetSizes.isEmpty();
+}
+
+qint64 QBluetoothSocketPrivateBluez::pendingDatagramSize() const
+{
+    return packetSizes.isEmpty() ? -1 : packetSizes.head();
+}
+
+qint64 QBluetoothSocketPrivateBluez::readDatagram(char *data, qint64 maxSize)
+{
+    if (packetSizes.isEmpty())
+        return -1;
+
+    const qint64 packetSize = packetSizes.dequeue();
+    const qint64 readBytes = buffer.read(data, qMin(maxSize, packetSize));
+    buffer.skip(packetSize - readBytes);
+    resumeReading();
+    return readBytes;
+}
+
+qint64 QBluetoothSocketPrivateBluez::writeDatagram(const char *data, qint64 size)
+{
+    Q_Q(QBluetoothSocket);
+
+    const qint64 mtu = packetMtu(false);
+    if (mtu > 0 && size > mtu) {
+        errorString = QBluetoothSocket::tr("Datagram exceeds the MTU of %1 bytes").arg(mtu);
+        q->setSocketError(QBluetoothSocket::OperationError);
+        return -1;
+    }
+
+    if (q->openMode() & QIODevice::Unbuffered) {
+        qint64 sz;
+        EINTR_LOOP(sz, ::send(socket, data, size_t(size), 0));
+        if (sz < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            errorString = QBluetoothSocket::tr("Network Error: %1").arg(qt_error_string(errno));
+            q->setSocketError(QBluetoothSocket::NetworkError);
+            return -1;
+        }
+        emit q->bytesWritten(sz);
+        return sz;
+    }
+
+    if (!connectWriteNotifier)
+        return -1;
+
+    if (txBuffer.size() == 0) {
+        connectWriteNotifier->setEnabled(true);
+        QMetaObject::invokeMethod(this, "_q_writeNotify", Qt::QueuedConnection);
+    }
+
+    // reserve() keeps the packet in one chunk of the buffer
+    memcpy(txBuffer.reserve(size), data, size_t(size));
+    txPacketSizes.enqueue(size);
+    txPacketOpen = false;
+    return size;
+}
+
 void QBluetoothSocketPrivateBluez::close()
 {
-    if (txBuffer.size() > 0)
+    if (bytesToWrite() > 0)
         connectWriteNotifier->setEnabled(true);
     else
         abort();
@@ -670,10 +1165,12 @@ bool QBluetoothSocketPrivateBluez::setSocketDescriptor(int socketDescriptor, QBl
     Q_Q(QBluetoothSocket);
     delete readNotifier;
     readNotifier = nullptr;
+    readPaused = false;
     delete connectWriteNotifier;
     connectWriteNotifier = nullptr;
 
     socketType = socketType_;
+    receiveMtu = sendMtu = -1;
     if (socket != -1)
         QT_CLOSE(socket);
 
@@ -702,7 +1199,10 @@ qint64 QBluetoothSocketPrivateBluez::bytesAvailable() const
 
 qint64 QBluetoothSocketPrivateBluez::bytesToWrite() const
 {
-    return txBuffer.size();
+    qint64 size = txBuffer.size();
+    for (const FileTransfer &transfer : fileTransfers)
+        size += transfer.remaining;
+    return size;
 }
 
 bool QBluetoothSocketPrivateBluez::canReadLine() const
@@ -53,9 +53,13 @@
 
 #include "qbluetoothsocketbase_p.h"
 
+#include <QtCore/QFile>
+#include <QtCore/QPointer>
+#include <QtCore/QQueue>
+
 QT_BEGIN_NAMESPACE
 
-class QBluetoothSocketPrivateBluez final: public QBluetoothSocketBasePrivate
+class Q_AUTOTEST_EXPORT QBluetoothSocketPrivateBluez final: public QBluetoothSocketBasePrivate
 {
     Q_OBJECT
 
@@ -98,9 +102,63 @@ public:
     bool canReadLine() const override;
     qint64 bytesToWrite() const override;
 
+    void setReadBufferSize(qint64 size) override;
+
+    bool supportsDatagrams() const override;
+    bool hasPendingDatagrams() const override;
+    qint64 pendingDatagramSize() const override;
+    qint64 readDatagram(char *data, qint64 maxSize) override;
+    qint64 writeDatagram(const char *data, qint64 size) override;
+
+    bool supportsFileSending() const override;
+    bool sendFile(QFile *file, qint64 offset, qint64 length) override;
+
 private slots:
     void _q_readNotify();
     void _q_writeNotify();
+
+private:
+    struct FileTransfer
+    {
+        QPointer<QFile> file;
+        // bytes of txBuffer that are sent before the file
+        qint64 precedingBytes = 0;
+        qint64 offset = 0;
+        qint64 remaining = 0;
+        // fallback if the kernel cannot send the file with sendfile()
+        bool useMapping = false;
+        uchar *mapping = nullptr;
+        qint64 mappingOffset = 0;
+        qint64 mappingSize = 0;
+    };
+
+    qint64 writeFile(FileTransfer &transfer, int *errorCode);
+    void clearFileTransfers();
+
+    qint64 readStream(int *errorCode);
+    qint64 readPackets(int *errorCode);
+    qint64 writeStream(int *errorCode);
+    qint64 writePackets(int *errorCode);
+    void discardPacketBytes(qint64 size);
+    qint64 packetMtu(bool receive);
+
+    bool isReadBufferFull() const;
+    void resumeReading();
+
+    // reading stopped because the read buffer is full
+    bool readPaused = false;
+
+    // sizes of the L2CAP packets in buffer and txBuffer
+    QQueue<qint64> packetSizes;
+    QQueue<qint64> txPacketSizes;
+    // the last packet in txBuffer was written by write() and may still grow
+    bool txPacketOpen = false;
+    // MTUs of the connected L2CAP channel, -1 until they are queried
+    qint64 receiveMtu = -1;
+    qint64 sendMtu = -1;
+
+    // files queued by sendFile(), in the order of txBuffer
+    QQueue<FileTransfer> fileTransfers;
 };
 
 QT_END_NAMESPACE
@@ -513,6 +513,13 @@ bool QBluetoothSocketPrivateBluezDBus::canReadLine() const
     return false;
 }
 
+void QBluetoothSocketPrivateBluezDBus::setReadBufferSize(qint64 size)
+{
+    readBufferMaxSize = size;
+    if (localSocket)
+        localSocket->setReadBufferSize(size);
+}
+
 qint64 QBluetoothSocketPrivateBluezDBus::bytesToWrite() const
 {
     if (localSocket)
@@ -527,6 +534,7 @@ void QBluetoothSocketPrivateBluezDBus::remoteConnected(const QDBusUnixFileDescri
 
     int descriptor = ::dup(fd.fileDescriptor());
     localSocket = new QLocalSocket(this);
+    localSocket->setReadBufferSize(readBufferMaxSize);
     bool success = localSocket->setSocketDescriptor(
                             descriptor, QLocalSocket::ConnectedState, q->openMode());
     if (!success || !localSocket->isValid()) {
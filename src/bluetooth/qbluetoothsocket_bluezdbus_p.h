@@ -110,6 +110,8 @@ public:
     bool canReadLine() const override;
     qint64 bytesToWrite() const override;
 
+    void setReadBufferSize(qint64 size) override;
+
 private:
     void remoteConnected(const QDBusUnixFileDescriptor &fd);
     void socketStateChanged(QLocalSocket::LocalSocketState newState);
@@ -62,9 +62,8 @@
 #ifndef QPRIVATELINEARBUFFER_BUFFERSIZE
 #define QPRIVATELINEARBUFFER_BUFFERSIZE Q_INT64_C(16384)
 #endif
-// The order is important: bytearray before buffer:
 #include <QtCore/qbytearray.h>
-#include "qprivatelinearbuffer_p.h"
+#include <QtCore/private/qringbuffer_p.h>
 
 #include <QtCore/qscopedpointer.h>
 #include <QtCore/qiodevice.h>
@@ -195,18 +195,16 @@ void QBluetoothSocketPrivateWin::_q_writeNotify()
             return;
         }
 
-        char buf[1024];
-        const int size = txBuffer.read(&buf[0], sizeof(buf));
-        const int writtenBytes = ::send(socket, &buf[0], size, 0);
+        const int size = int(qMin<qint64>(txBuffer.nextDataBlockSize(), 1024));
+        const int writtenBytes = ::send(socket, txBuffer.readPointer(), size, 0);
         if (writtenBytes == SOCKET_ERROR) {
             // every other case returns error
             const int error = ::WSAGetLastError();
             errorString = QBluetoothSocket::tr("Network Error: %1").arg(qt_error_string(error));
             q->setSocketError(QBluetoothSocket::NetworkError);
         } else if (writtenBytes <= size) {
-            // add remainder back to buffer
-            const char *remainder = &buf[writtenBytes];
-            txBuffer.ungetBlock(remainder, size - writtenBytes);
+            // the remainder stays in the buffer
+            txBuffer.free(writtenBytes);
             if (writtenBytes > 0)
                 emit q->bytesWritten(writtenBytes);
         } else {
@@ -43,7 +43,11 @@ QT_BEGIN_NAMESPACE
 
 QBluetoothSocketBasePrivate::QBluetoothSocketBasePrivate(QObject *parent) : QObject(parent)
 {
-
+    // Socket reads reserve QPRIVATELINEARBUFFER_BUFFERSIZE bytes and return what
+    // they did not use. Larger chunks let consecutive small reads share a chunk
+    // while the application does not read. Chunks beyond the first are released
+    // once their data was read.
+    buffer.setChunkSize(4 * QPRIVATELINEARBUFFER_BUFFERSIZE);
 }
 
 QBluetoothSocketBasePrivate::~QBluetoothSocketBasePrivate()
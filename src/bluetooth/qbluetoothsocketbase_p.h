@@ -82,8 +82,9 @@ namespace ABI {
 #ifndef QPRIVATELINEARBUFFER_BUFFERSIZE
 #define QPRIVATELINEARBUFFER_BUFFERSIZE Q_INT64_C(16384)
 #endif
-#include "qprivatelinearbuffer_p.h"
+#include <QtCore/private/qringbuffer_p.h>
 
+QT_FORWARD_DECLARE_CLASS(QFile)
 QT_FORWARD_DECLARE_CLASS(QSocketNotifier)
 QT_FORWARD_DECLARE_CLASS(QBluetoothServiceDiscoveryAgent)
 
@@ -117,6 +118,19 @@ public:
     virtual bool canReadLine() const = 0;
     virtual qint64 bytesToWrite() const = 0;
 
+    virtual void setReadBufferSize(qint64 size) { readBufferMaxSize = size; }
+
+    // backends keeping the boundaries of L2CAP packets override these
+    virtual bool supportsDatagrams() const { return false; }
+    virtual bool hasPendingDatagrams() const { return false; }
+    virtual qint64 pendingDatagramSize() const { return -1; }
+    virtual qint64 readDatagram(char *, qint64) { return -1; }
+    virtual qint64 writeDatagram(const char *, qint64) { return -1; }
+
+    // backends sending files without copying them to the write buffer override these
+    virtual bool supportsFileSending() const { return false; }
+    virtual bool sendFile(QFile *, qint64, qint64) { return false; }
+
     virtual bool setSocketDescriptor(int socketDescriptor, QBluetoothServiceInfo::Protocol socketType,
                              QBluetoothSocket::SocketState socketState = QBluetoothSocket::ConnectedState,
                              QBluetoothSocket::OpenMode openMode = QBluetoothSocket::ReadWrite) = 0;
@@ -148,8 +162,9 @@ public:
 #endif
 
 public:
-    QPrivateLinearBuffer buffer;
-    QPrivateLinearBuffer txBuffer;
+    QRingBuffer buffer;
+    QRingBuffer txBuffer;
+    qint64 readBufferMaxSize = 0; // 0 means unlimited
     int socket = -1;
     QBluetoothServiceInfo::Protocol socketType = QBluetoothServiceInfo::UnknownProtocol;
     QBluetoothSocket::SocketState state = QBluetoothSocket::UnconnectedState;
@@ -704,6 +704,45 @@ void QLowEnergyController::discoverServices()
     d->discoverServices();
 }
 
+/*!
+    \since 6.0
+
+    Initiates the discovery of the characteristics and descriptors of all services
+    which have not been discovered yet. This is equivalent to calling
+    \l QLowEnergyService::discoverDetails() on each of them but permits the backend
+    to discover the details of all services at once. On BlueZ this reduces the
+    number of round trips to the remote device considerably.
+
+    The progress is indicated via the \l {QLowEnergyService::stateChanged()}{stateChanged()}
+    signal of the individual service objects.
+
+    This function does nothing unless the controller is in the \l DiscoveredState.
+
+    \sa discoverServices(), createServiceObject()
+ */
+void QLowEnergyController::discoverAllServiceDetails()
+{
+    Q_D(QLowEnergyController);
+
+    if (d->role != CentralRole) {
+        qCWarning(QT_BT) << "Cannot discover service details in peripheral role";
+        return;
+    }
+    if (d->state != QLowEnergyController::DiscoveredState)
+        return;
+
+    QList<QBluetoothUuid> pendingServices;
+    for (auto it = d->serviceList.constBegin(); it != d->serviceList.constEnd(); ++it) {
+        if (it.value()->state != QLowEnergyService::DiscoveryRequired)
+            continue;
+        it.value()->setState(QLowEnergyService::DiscoveringServices);
+        pendingServices.append(it.key());
+    }
+
+    if (!pendingServices.isEmpty())
+        d->discoverAllServiceDetails(pendingServices);
+}
+
 /*!
     Returns the list of services offered by the remote device, if the controller is in
     the \l CentralRole. Otherwise, the result is unspecified.
@@ -126,6 +126,7 @@ public:
     void disconnectFromDevice();
 
     void discoverServices();
+    void discoverAllServiceDetails();
     QList<QBluetoothUuid> services() const;
     QLowEnergyService *createServiceObject(const QBluetoothUuid &service, QObject *parent = nullptr);
 
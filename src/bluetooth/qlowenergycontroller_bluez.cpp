@@ -39,6 +39,10 @@
 ****************************************************************************/
 
 #include "lecmaccalculator_p.h"
+#include "lesigncounterjournal_p.h"
+#include "leattbearer_p.h"
+#include "leattserverconnection_p.h"
+#include "lewritestream_p.h"
 #include "qlowenergycontroller_bluez_p.h"
 #include "qbluetoothsocketbase_p.h"
 #include "qbluetoothsocket_bluez_p.h"
@@ -55,6 +59,7 @@
 #include "bluez/device_p.h"
 #include "bluez/manager_p.h"
 
+#include <QtCore/QCryptographicHash>
 #include <QtCore/QFileInfo>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QSettings>
@@ -81,6 +86,8 @@
 #define GATT_SECONDARY_SERVICE  quint16(0x2801)
 #define GATT_INCLUDED_SERVICE   quint16(0x2802)
 #define GATT_CHARACTERISTIC     quint16(0x2803)
+#define GATT_DATABASE_HASH      quint16(0x2B2A)
+#define GATT_DATABASE_HASH_SIZE 16
 
 // GATT commands
 #define ATT_OP_ERROR_RESPONSE           0x1
@@ -109,6 +116,8 @@
 #define ATT_OP_HANDLE_VAL_NOTIFICATION  0x1b //informs about value change
 #define ATT_OP_HANDLE_VAL_INDICATION    0x1d //informs about value change -> requires reply
 #define ATT_OP_HANDLE_VAL_CONFIRMATION  0x1e //answer for ATT_OP_HANDLE_VAL_INDICATION
+#define ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST   0x20 //read multiple values incl. their lengths
+#define ATT_OP_READ_MULTIPLE_VARIABLE_RESPONSE  0x21
 #define ATT_OP_WRITE_COMMAND            0x52 //write characteristic without response
 #define ATT_OP_SIGNED_WRITE_COMMAND     0xD2
 
@@ -119,6 +128,7 @@
 #define READ_BY_TYPE_REQ_HEADER_SIZE 7
 #define READ_REQUEST_HEADER_SIZE 3
 #define READ_BLOB_REQUEST_HEADER_SIZE 5
+#define READ_MULTIPLE_REQUEST_HEADER_SIZE 1
 #define WRITE_REQUEST_HEADER_SIZE 3    // same size for WRITE_COMMAND header
 #define PREPARE_WRITE_HEADER_SIZE 5
 #define EXECUTE_WRITE_HEADER_SIZE 2
@@ -163,6 +173,9 @@ using namespace QBluetooth;
 
 const int maxPrepareQueueSize = 1024;
 
+// assumed average value size when combining values of unknown size into a single request
+const int averageReadMultipleValueSize = 8;
+
 static inline QBluetoothUuid convert_uuid128(const quint128 *p)
 {
     quint128 dst_hostOrder, dst_bigEndian;
@@ -245,6 +258,24 @@ static int getUuidSize(const QBluetoothUuid &uuid)
     return uuid.minimumSize() == 2 ? 2 : 16;
 }
 
+/*
+    Returns the size of a descriptor value which is fixed by the specification;
+    otherwise -1. Only such values can be combined into a single
+    ATT Read Multiple request.
+ */
+static int fixedDescriptorValueSize(const QBluetoothUuid &descriptorUuid)
+{
+    // Spec v4.2, Vol. 3, Part G, 3.3.3.x
+    if (descriptorUuid == QBluetoothUuid::CharacteristicExtendedProperties
+            || descriptorUuid == QBluetoothUuid::ClientCharacteristicConfiguration
+            || descriptorUuid == QBluetoothUuid::ServerCharacteristicConfiguration) {
+        return 2;
+    }
+    if (descriptorUuid == QBluetoothUuid::CharacteristicPresentationFormat)
+        return 7;
+    return -1;
+}
+
 template<typename T> static void putDataAndIncrement(const T &src, char *&dst)
 {
     putBtData(src, dst);
@@ -283,6 +314,21 @@ QLowEnergyControllerPrivateBluez::QLowEnergyControllerPrivateBluez()
 
 void QLowEnergyControllerPrivateBluez::init()
 {
+    streamWriter = new LeAttStreamWriter(this);
+    connect(streamWriter, &LeAttStreamWriter::writable,
+            this, &QLowEnergyControllerPrivateBluez::sendNextPendingRequest);
+    connect(streamWriter, &LeAttStreamWriter::errorOccurred, this, [this]() {
+        setError(QLowEnergyController::NetworkError);
+    });
+    signCounterJournal = new LeSignCounterJournal(this);
+
+    // signed writes use the built-in AES-CMAC unless the kernel's is requested,
+    // the database hash of the local services needs it without HCI device as well
+    const LeCmacCalculator::Backend cmacBackend
+            = qgetenv("BLUETOOTH_GATT_CMAC_BACKEND") == "kernel"
+            ? LeCmacCalculator::KernelBackend : LeCmacCalculator::SoftwareBackend;
+    cmacCalculator = new LeCmacCalculator(cmacBackend);
+
     hciManager = new HciManager(localAdapter, this);
     if (!hciManager->isValid())
         return;
@@ -297,25 +343,9 @@ void QLowEnergyControllerPrivateBluez::init()
         qCDebug(QT_BT_BLUEZ) << "received connection complete event, handle:" << handle;
     });
     connect(hciManager, &HciManager::connectionUpdate,
-            [this](quint16 handle, const QLowEnergyConnectionParameters &params) {
-                if (handle == connectionHandle)
-                    emit q_ptr->connectionUpdated(params);
-            }
-    );
+            this, &QLowEnergyControllerPrivateBluez::handleConnectionUpdate);
     connect(hciManager, &HciManager::signatureResolvingKeyReceived,
-            [this](quint16 handle, bool remoteKey, const quint128 &csrk) {
-                if (handle != connectionHandle)
-                    return;
-                if ((remoteKey && role == QLowEnergyController::CentralRole)
-                        || (!remoteKey && role == QLowEnergyController::PeripheralRole)) {
-                    return;
-                }
-                qCDebug(QT_BT_BLUEZ) << "received new signature resolving key"
-                                     << QByteArray(reinterpret_cast<const char *>(csrk.data),
-                                                   sizeof csrk).toHex();
-                signingData.insert(remoteDevice.toUInt64(), SigningData(csrk));
-        }
-    );
+            this, &QLowEnergyControllerPrivateBluez::handleSignatureResolvingKey);
 
     if (role == QLowEnergyController::CentralRole) {
         if (Q_UNLIKELY(!qEnvironmentVariableIsEmpty("BLUETOOTH_GATT_TIMEOUT"))) {
@@ -335,7 +365,122 @@ void QLowEnergyControllerPrivateBluez::init()
                     this, &QLowEnergyControllerPrivateBluez::handleGattRequestTimeout);
             qRegisterMetaTypeStreamOperators<QBluetoothUuid>();
         }
+
+        // permit combining of value reads during service discovery
+        batchedDiscoveryReads = qEnvironmentVariableIntValue("BLUETOOTH_GATT_BATCHED_READS") > 0;
+        if (batchedDiscoveryReads)
+            qCDebug(QT_BT_BLUEZ) << "Enabling batched GATT value reads during service discovery";
+
+        // permit persistent caching of the remote attribute layout
+        const QString gattCacheDirectory = qEnvironmentVariable("BLUETOOTH_GATT_CACHE_DIR");
+        if (!gattCacheDirectory.isEmpty()) {
+            qCDebug(QT_BT_BLUEZ) << "Enabling GATT cache in" << gattCacheDirectory;
+            gattCache = new LeGattCache(gattCacheDirectory);
+        }
+
+        // permit additional ATT bearers to run requests of different services in parallel
+        const int bearerCount = qEnvironmentVariableIntValue("BLUETOOTH_GATT_BEARERS");
+        if (bearerCount > 1) {
+            requestedBearers = qMin(bearerCount, maxAttBearers);
+            qCDebug(QT_BT_BLUEZ) << "Enabling" << requestedBearers - 1
+                                 << "additional ATT bearers";
+            bearerPool = new LeAttBearerPool(this);
+            bearerPool->setRequestTimeout(gattRequestTimeout);
+            connect(bearerPool, &LeAttBearerPool::responseReceived,
+                    this, &QLowEnergyControllerPrivateBluez::bearerResponseReceived);
+            connect(bearerPool, &LeAttBearerPool::unsolicitedReceived,
+                    this, [this](const QByteArray &pdu) {
+                processUnsolicitedReply(pdu.constData(), pdu.size());
+            });
+            connect(bearerPool, &LeAttBearerPool::requestTimedOut,
+                    this, &QLowEnergyControllerPrivateBluez::bearerRequestTimedOut);
+            connect(bearerPool, &LeAttBearerPool::requestsOrphaned,
+                    this, [this](const QVector<Request> &requests) {
+                qCDebug(QT_BT_BLUEZ) << "Moving" << requests.count()
+                                     << "requests to the main bearer";
+                for (const Request &request : requests)
+                    openRequests.enqueue(request);
+                sendNextPendingRequest();
+            });
+        }
+    } else {
+        // permit serving several centrals with the same attribute database
+        const int connectionCount
+                = qEnvironmentVariableIntValue("BLUETOOTH_GATT_SERVER_CONNECTIONS");
+        if (connectionCount > 1) {
+            maxServerConnections = connectionCount;
+            qCDebug(QT_BT_BLUEZ) << "Accepting up to" << maxServerConnections
+                                 << "simultaneous GATT client connections";
+        }
+
+        // pending notifications and indications per central
+        const QByteArray queuePolicy = qgetenv("BLUETOOTH_GATT_SERVER_QUEUE_POLICY");
+        if (queuePolicy == "drop-oldest")
+            valueQueuePolicy = LeAttValueQueue::DropOldestPolicy;
+        else if (queuePolicy == "drop-newest")
+            valueQueuePolicy = LeAttValueQueue::DropNewestPolicy;
+        else if (!queuePolicy.isEmpty() && queuePolicy != "merge")
+            qCWarning(QT_BT_BLUEZ) << "Ignoring unknown notification queue policy" << queuePolicy;
+        const int queueDepth = qEnvironmentVariableIntValue("BLUETOOTH_GATT_SERVER_QUEUE_DEPTH");
+        if (queueDepth > 0)
+            valueQueueDepth = queueDepth;
+
+        // permit centrals to cache our attribute database
+        publishDatabaseHash
+                = qEnvironmentVariableIntValue("BLUETOOTH_GATT_SERVER_DATABASE_HASH") > 0;
+
+        // permit keeping the subscriptions of bonded centrals across restarts
+        const QString cccdDirectory = qEnvironmentVariable("BLUETOOTH_GATT_SERVER_CCCD_DIR");
+        if (!cccdDirectory.isEmpty()) {
+            qCDebug(QT_BT_BLUEZ) << "Storing client configurations in" << cccdDirectory;
+            cccdStore = new LeCccdStore(cccdDirectory);
+        }
+    }
+}
+
+/*
+  Returns \c true if the HCI connection \a handle belongs to this controller.
+  In the peripheral role this is the link of any of the connected centrals.
+ */
+bool QLowEnergyControllerPrivateBluez::ownsHciHandle(quint16 handle) const
+{
+    if (role == QLowEnergyController::PeripheralRole)
+        return serverConnectionForHciHandle(handle) != nullptr;
+    return handle == connectionHandle;
+}
+
+void QLowEnergyControllerPrivateBluez::handleConnectionUpdate(
+        quint16 handle, const QLowEnergyConnectionParameters &params)
+{
+    if (ownsHciHandle(handle))
+        emit q_ptr->connectionUpdated(params);
+}
+
+void QLowEnergyControllerPrivateBluez::handleSignatureResolvingKey(
+        quint16 handle, bool remoteKey, const quint128 &csrk)
+{
+    if ((remoteKey && role == QLowEnergyController::CentralRole)
+            || (!remoteKey && role == QLowEnergyController::PeripheralRole)) {
+        return;
+    }
+
+    // the key belongs to the device at the other end of the link
+    QBluetoothAddress device;
+    if (role == QLowEnergyController::PeripheralRole) {
+        const LeAttServerConnection *connection = serverConnectionForHciHandle(handle);
+        if (!connection)
+            return;
+        device = connection->remoteDevice;
+    } else {
+        if (handle != connectionHandle)
+            return;
+        device = remoteDevice;
     }
+
+    qCDebug(QT_BT_BLUEZ) << "received new signature resolving key for" << device
+                         << QByteArray(reinterpret_cast<const char *>(csrk.data),
+                                       sizeof csrk).toHex();
+    signingData.insert(device.toUInt64(), SigningData(csrk));
 }
 
 void QLowEnergyControllerPrivateBluez::handleGattRequestTimeout()
@@ -385,7 +530,18 @@ void QLowEnergyControllerPrivateBluez::handleGattRequestTimeout()
         case ATT_OP_READ_BLOB_REQUEST:     // read long descriptor or characteristic
         case ATT_OP_WRITE_REQUEST:         // write descriptor or characteristic
         {
-            uint handleData = currentRequest.reference.toUInt();
+            uint handleData = currentRequest.handleData;
+            const QLowEnergyHandle charHandle = (handleData & 0xffff);
+            const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+            processReply(currentRequest, createRequestErrorMessage(command,
+                                descriptorHandle ? descriptorHandle : charHandle));
+        }
+            break;
+        case ATT_OP_READ_MULTIPLE_REQUEST:          // read multiple values during discovery
+        case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST:
+        {
+            const QVector<uint> &handleDataList = currentRequest.handleDataList;
+            const uint handleData = handleDataList.isEmpty() ? 0 : handleDataList.first();
             const QLowEnergyHandle charHandle = (handleData & 0xffff);
             const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
             processReply(currentRequest, createRequestErrorMessage(command,
@@ -394,12 +550,12 @@ void QLowEnergyControllerPrivateBluez::handleGattRequestTimeout()
             break;
         case ATT_OP_FIND_INFORMATION_REQUEST: // get descriptor information
             processReply(currentRequest, createRequestErrorMessage(
-                                            command, currentRequest.reference2.toUInt()));
+                                            command, currentRequest.startHandle));
             break;
         case ATT_OP_PREPARE_WRITE_REQUEST: // prepare to write long desc or char
         case ATT_OP_EXECUTE_WRITE_REQUEST: // execute long write of desc or char
         {
-            uint handleData = currentRequest.reference.toUInt();
+            uint handleData = currentRequest.handleData;
             const QLowEnergyHandle attrHandle = (handleData & 0xffff);
             processReply(currentRequest,
                          createRequestErrorMessage(command, attrHandle));
@@ -421,6 +577,8 @@ QLowEnergyControllerPrivateBluez::~QLowEnergyControllerPrivateBluez()
 {
     closeServerSocket();
     delete cmacCalculator;
+    delete gattCache;
+    delete cccdStore;
 }
 
 class ServerSocket
@@ -484,6 +642,10 @@ void QLowEnergyControllerPrivateBluez::startAdvertising(const QLowEnergyAdvertis
         connect(advertiser, &QLeAdvertiser::errorOccurred, this,
                 &QLowEnergyControllerPrivateBluez::handleAdvertisingError);
     }
+    if (publishDatabaseHash
+            && !localServices.contains(QBluetoothUuid(QBluetoothUuid::GenericAttribute))) {
+        addGenericAttributeService();
+    }
     setState(QLowEnergyController::AdvertisingState);
     advertiser->startAdvertising();
     if (params.mode() == QLowEnergyAdvertisingParameters::AdvNonConnInd
@@ -493,17 +655,23 @@ void QLowEnergyControllerPrivateBluez::startAdvertising(const QLowEnergyAdvertis
         return;
     }
 
-    ServerSocket serverSocket;
-    if (!serverSocket.listen(localAdapter)) {
+    if (!listenForConnections()) {
         setError(QLowEnergyController::AdvertisingError);
         setState(QLowEnergyController::UnconnectedState);
-        return;
     }
+}
+
+bool QLowEnergyControllerPrivateBluez::listenForConnections()
+{
+    ServerSocket serverSocket;
+    if (!serverSocket.listen(localAdapter))
+        return false;
 
     const int socketFd = serverSocket.takeSocket();
     serverSocketNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Read, this);
     connect(serverSocketNotifier, &QSocketNotifier::activated, this,
             &QLowEnergyControllerPrivateBluez::handleConnectionRequest);
+    return true;
 }
 
 void QLowEnergyControllerPrivateBluez::stopAdvertising()
@@ -521,7 +689,7 @@ void QLowEnergyControllerPrivateBluez::requestConnectionUpdate(const QLowEnergyC
     if (role == QLowEnergyController::CentralRole)
         hciManager->sendConnectionUpdateCommand(connectionHandle, params);
     else
-        hciManager->sendConnectionParameterUpdateRequest(connectionHandle, params);
+        hciManager->sendConnectionParameterUpdateRequest(serverHciHandle(), params);
 }
 
 void QLowEnergyControllerPrivateBluez::connectToDevice()
@@ -652,7 +820,7 @@ void QLowEnergyControllerPrivateBluez::establishL2cpClientSocket()
     // Unbuffered mode required to separate each GATT packet
     l2cpSocket->connectToService(remoteDevice, ATTRIBUTE_CHANNEL_ID,
                                  QIODevice::ReadWrite | QIODevice::Unbuffered);
-    loadSigningDataIfNecessary(LocalSigningKey);
+    loadSigningDataIfNecessary(remoteDevice, LocalSigningKey);
 }
 
 void QLowEnergyControllerPrivateBluez::createServicesForCentralIfRequired()
@@ -700,6 +868,15 @@ void QLowEnergyControllerPrivateBluez::createServicesForCentralIfRequired()
     if (service)
         service->setParent(q);
 
+    addGenericAttributeService();
+}
+
+/*
+  Adds the Generic Attribute service with the Service Changed and Database Hash
+  characteristics. The value of the latter is maintained by updateLocalDatabaseHash().
+ */
+void QLowEnergyControllerPrivateBluez::addGenericAttributeService()
+{
     QLowEnergyServiceData gattServiceData;
     gattServiceData.setType(QLowEnergyServiceData::ServiceTypePrimary);
     gattServiceData.setUuid(QBluetoothUuid::GenericAttribute);
@@ -707,8 +884,9 @@ void QLowEnergyControllerPrivateBluez::createServicesForCentralIfRequired()
     QLowEnergyCharacteristicData serviceChangedChar;
     serviceChangedChar.setUuid(QBluetoothUuid::ServiceChanged);
     serviceChangedChar.setProperties(QLowEnergyCharacteristic::Indicate);
-    //arbitrary range of 2 bit handle range (1-4
-    serviceChangedChar.setValue(QByteArray::fromHex("0104"));
+    // affected handle range, set by indicateServiceChange()
+    serviceChangedChar.setValue(QByteArray::fromHex("0100ffff"));
+    serviceChangedChar.setValueLength(4, 4);
 
     const QLowEnergyDescriptorData clientConfig(
                         QBluetoothUuid::ClientCharacteristicConfiguration,
@@ -716,7 +894,15 @@ void QLowEnergyControllerPrivateBluez::createServicesForCentralIfRequired()
     serviceChangedChar.addDescriptor(clientConfig);
     gattServiceData.addCharacteristic(serviceChangedChar);
 
-    service = addServiceHelper(gattServiceData);
+    QLowEnergyCharacteristicData databaseHashChar;
+    databaseHashChar.setUuid(QBluetoothUuid(GATT_DATABASE_HASH));
+    databaseHashChar.setProperties(QLowEnergyCharacteristic::Read);
+    databaseHashChar.setValue(QByteArray(GATT_DATABASE_HASH_SIZE, 0));
+    databaseHashChar.setValueLength(GATT_DATABASE_HASH_SIZE, GATT_DATABASE_HASH_SIZE);
+    gattServiceData.addCharacteristic(databaseHashChar);
+
+    Q_Q(QLowEnergyController);
+    QLowEnergyService *service = addServiceHelper(gattServiceData);
     if (service)
         service->setParent(q);
 }
@@ -726,7 +912,16 @@ void QLowEnergyControllerPrivateBluez::l2cpConnected()
     Q_Q(QLowEnergyController);
 
     securityLevelValue = securityLevel();
+    if (streamWriter)
+        streamWriter->setSocketDescriptor(l2cpSocket->socketDescriptor());
+
+    // the remote device may use the GATT server of the local device as well
+    remoteClientConnection = new LeAttServerConnection;
+    remoteClientConnection->socket = l2cpSocket;
+    remoteClientConnection->socketDescriptor = l2cpSocket->socketDescriptor();
+    remoteClientConnection->remoteDevice = remoteDevice;
     exchangeMTU();
+    openAdditionalBearers();
 
     setState(QLowEnergyController::ConnectedState);
     emit q->connected();
@@ -735,6 +930,9 @@ void QLowEnergyControllerPrivateBluez::l2cpConnected()
 void QLowEnergyControllerPrivateBluez::disconnectFromDevice()
 {
     setState(QLowEnergyController::ClosingState);
+    // all but the last central are disconnected right away
+    while (serverConnections.count() > 1)
+        closeServerConnection(serverConnections.last());
     if (l2cpSocket)
         l2cpSocket->close();
     resetController();
@@ -752,7 +950,8 @@ void QLowEnergyControllerPrivateBluez::l2cpDisconnected()
     Q_Q(QLowEnergyController);
 
     if (role == QLowEnergyController::PeripheralRole) {
-        storeClientConfigurations();
+        if (!serverConnections.isEmpty())
+            storeClientConfigurations(serverConnections.constFirst());
         remoteDevice.clear();
         remoteName.clear();
     }
@@ -797,13 +996,25 @@ void QLowEnergyControllerPrivateBluez::l2cpErrorChanged(QBluetoothSocket::Socket
 
 void QLowEnergyControllerPrivateBluez::resetController()
 {
+    logRequestStatistics();
+    if (signCounterJournal)
+        signCounterJournal->flush();
     openRequests.clear();
-    openPrepareWriteRequests.clear();
-    scheduledIndications.clear();
-    indicationInFlight = false;
+    openRequests.resetStatistics();
+    if (streamWriter)
+        streamWriter->clear();
+    if (bearerPool)
+        bearerPool->clear();
+    encryptionRetryOnBearer = false;
+    encryptionRetryBearer = nullptr;
+    delete remoteClientConnection;
+    remoteClientConnection = nullptr;
     requestPending = false;
     encryptionChangePending = false;
-    receivedMtuExchangeRequest = false;
+    readMultipleSupported = true;
+    readMultipleVariableSupported = true;
+    sweepServices.clear();
+    sweepDescriptorRanges.clear();
     mtuSize = ATT_DEFAULT_LE_MTU;
     securityLevelValue = -1;
     connectionHandle = 0;
@@ -816,6 +1027,43 @@ void QLowEnergyControllerPrivateBluez::resetController()
             advertiser = nullptr;
         }
         localAttributes.clear();
+        localAttributeOwners.clear();
+        localAttributeTypeIndex.clear();
+
+        // The socket of the last connection is released once the next central connects.
+        for (LeAttServerConnection *connection : qAsConst(serverConnections))
+            connection->clearPendingValues();
+        qDeleteAll(serverConnections);
+        serverConnections.clear();
+        deferredReads.clear();
+        if (deferredReadTimer)
+            deferredReadTimer->stop();
+    }
+}
+
+/*!
+    \internal
+
+    Prints the number of requests and their wait times per priority lane
+    of the request scheduler. Long wait times in the bulk lane indicate that
+    the interactive requests starve the service discovery.
+ */
+void QLowEnergyControllerPrivateBluez::logRequestStatistics() const
+{
+    if (!QT_BT_BLUEZ().isDebugEnabled())
+        return;
+
+    for (int i = 0; i < Request::LaneCount; ++i) {
+        const LeAttRequestScheduler::LaneStatistics stats
+                = openRequests.statistics(Request::Lane(i));
+        if (!stats.dispatched)
+            continue;
+
+        qCDebug(QT_BT_BLUEZ) << (i == Request::InteractiveLane ? "Interactive" : "Bulk")
+                             << "ATT requests:" << stats.dispatched
+                             << "max queue depth:" << stats.maxDepth
+                             << "average wait:" << stats.totalWaitTime / qint64(stats.dispatched)
+                             << "us max wait:" << stats.maxWaitTime << "us";
     }
 }
 
@@ -830,17 +1078,28 @@ void QLowEnergyControllerPrivateBluez::restartRequestTimer()
 
 void QLowEnergyControllerPrivateBluez::l2cpReadyRead()
 {
-    const QByteArray incomingPacket = l2cpSocket->readAll();
-    qCDebug(QT_BT_BLUEZ) << "Received size:" << incomingPacket.size() << "data:"
-                         << incomingPacket.toHex();
-    if (incomingPacket.isEmpty())
-        return;
+    // Every packet carries one PDU. A notification may follow the response
+    // which was read with the same notification of the socket. The notifications
+    // of all packets read here end up in the same batch.
+    QBluetoothSocket *socket = l2cpSocket;
+    while (socket == l2cpSocket && socket->hasPendingDatagrams()) {
+        QByteArray incomingPacket(int(socket->pendingDatagramSize()), Qt::Uninitialized);
+        const qint64 size = socket->readDatagram(incomingPacket.data(), incomingPacket.size());
+        qCDebug(QT_BT_BLUEZ) << "Received size:" << size << "data:" << incomingPacket.toHex();
+        if (size <= 0)
+            return;
+
+        processIncomingPacket(incomingPacket);
+    }
+}
 
+void QLowEnergyControllerPrivateBluez::processIncomingPacket(const QByteArray &incomingPacket)
+{
     const quint8 command = incomingPacket.constData()[0];
     switch (command) {
     case ATT_OP_HANDLE_VAL_NOTIFICATION:
     {
-        processUnsolicitedReply(incomingPacket);
+        processUnsolicitedReply(incomingPacket.constData(), incomingPacket.size());
         return;
     }
     case ATT_OP_HANDLE_VAL_INDICATION:
@@ -850,71 +1109,87 @@ void QLowEnergyControllerPrivateBluez::l2cpReadyRead()
         packet.append(static_cast<char>(ATT_OP_HANDLE_VAL_CONFIRMATION));
         sendPacket(packet);
 
-        processUnsolicitedReply(incomingPacket);
+        processUnsolicitedReply(incomingPacket.constData(), incomingPacket.size());
         return;
     }
-    //--------------------------------------------------
-    // Peripheral side packet handling
-    case ATT_OP_EXCHANGE_MTU_REQUEST:
-        handleExchangeMtuRequest(incomingPacket);
+    default:
+        // the remote device may use the GATT server of the local device as well
+        if (remoteClientConnection
+                && processServerPacket(remoteClientConnection, incomingPacket)) {
+            // both devices use the same MTU on the link
+            if (command == ATT_OP_EXCHANGE_MTU_REQUEST)
+                mtuSize = remoteClientConnection->mtuSize;
+            return;
+        }
+
+        //only solicited replies finish pending requests
+        requestPending = false;
+        break;
+    }
+
+    if (openRequests.isEmpty()) {
+        qCWarning(QT_BT_BLUEZ) << "Received unexpected packet from peer, disconnecting.";
+        disconnectFromDevice();
         return;
+    }
+
+    const Request request = openRequests.dequeue();
+    processReply(request, incomingPacket);
+
+    sendNextPendingRequest();
+}
+
+/*
+  Handles \a packet which a GATT client sent to the local GATT server via
+  \a connection. Returns \c false if the packet is not meant for the server.
+ */
+bool QLowEnergyControllerPrivateBluez::processServerPacket(LeAttServerConnection *connection,
+                                                           const QByteArray &packet)
+{
+    const quint8 command = packet.constData()[0];
+    switch (command) {
+    case ATT_OP_EXCHANGE_MTU_REQUEST:
+        handleExchangeMtuRequest(connection, packet);
+        return true;
     case ATT_OP_FIND_INFORMATION_REQUEST:
-        handleFindInformationRequest(incomingPacket);
-        return;
+        handleFindInformationRequest(connection, packet);
+        return true;
     case ATT_OP_FIND_BY_TYPE_VALUE_REQUEST:
-        handleFindByTypeValueRequest(incomingPacket);
-        return;
+        handleFindByTypeValueRequest(connection, packet);
+        return true;
     case ATT_OP_READ_BY_TYPE_REQUEST:
-        handleReadByTypeRequest(incomingPacket);
-        return;
+        handleReadByTypeRequest(connection, packet);
+        return true;
     case ATT_OP_READ_REQUEST:
-        handleReadRequest(incomingPacket);
-        return;
+        handleReadRequest(connection, packet);
+        return true;
     case ATT_OP_READ_BLOB_REQUEST:
-        handleReadBlobRequest(incomingPacket);
-        return;
+        handleReadBlobRequest(connection, packet);
+        return true;
     case ATT_OP_READ_MULTIPLE_REQUEST:
-        handleReadMultipleRequest(incomingPacket);
-        return;
+        handleReadMultipleRequest(connection, packet);
+        return true;
     case ATT_OP_READ_BY_GROUP_REQUEST:
-        handleReadByGroupTypeRequest(incomingPacket);
-        return;
+        handleReadByGroupTypeRequest(connection, packet);
+        return true;
     case ATT_OP_WRITE_REQUEST:
     case ATT_OP_WRITE_COMMAND:
     case ATT_OP_SIGNED_WRITE_COMMAND:
-        handleWriteRequestOrCommand(incomingPacket);
-        return;
+        handleWriteRequestOrCommand(connection, packet);
+        return true;
     case ATT_OP_PREPARE_WRITE_REQUEST:
-        handlePrepareWriteRequest(incomingPacket);
-        return;
+        handlePrepareWriteRequest(connection, packet);
+        return true;
     case ATT_OP_EXECUTE_WRITE_REQUEST:
-        handleExecuteWriteRequest(incomingPacket);
-        return;
+        handleExecuteWriteRequest(connection, packet);
+        return true;
     case ATT_OP_HANDLE_VAL_CONFIRMATION:
-        if (indicationInFlight) {
-            indicationInFlight = false;
-            sendNextIndication();
-        } else {
+        if (!connection->confirmIndication())
             qCWarning(QT_BT_BLUEZ) << "received unexpected handle value confirmation";
-        }
-        return;
-    //--------------------------------------------------
+        return true;
     default:
-        //only solicited replies finish pending requests
-        requestPending = false;
-        break;
-    }
-
-    if (openRequests.isEmpty()) {
-        qCWarning(QT_BT_BLUEZ) << "Received unexpected packet from peer, disconnecting.";
-        disconnectFromDevice();
-        return;
+        return false;
     }
-
-    const Request request = openRequests.dequeue();
-    processReply(request, incomingPacket);
-
-    sendNextPendingRequest();
 }
 
 /*!
@@ -942,17 +1217,28 @@ void QLowEnergyControllerPrivateBluez::encryptionChangedEvent(
         // We could not increase the security of the link
         // The next request was requeued due to security error
         // skip it to avoid endless loop of security negotiations
-        Q_ASSERT(!openRequests.isEmpty());
-        Request failedRequest = openRequests.takeFirst();
+        Request failedRequest;
+        if (encryptionRetryOnBearer) {
+            // the request waits for its retry on the bearer which received the error,
+            // it is lost if the bearer has been closed meanwhile
+            encryptionRetryOnBearer = false;
+            if (encryptionRetryBearer)
+                failedRequest = encryptionRetryBearer->takeContinuation();
+            encryptionRetryBearer = nullptr;
+        } else {
+            Q_ASSERT(!openRequests.isEmpty());
+            failedRequest = openRequests.takeFirst();
+        }
 
         if (failedRequest.command == ATT_OP_WRITE_REQUEST) {
              // Failing write requests trigger some sort of response
-            uint ref = failedRequest.reference.toUInt();
+            uint ref = failedRequest.handleData;
             const QLowEnergyHandle charHandle = (ref & 0xffff);
             const QLowEnergyHandle descriptorHandle = ((ref >> 16) & 0xffff);
 
-            QSharedPointer<QLowEnergyServicePrivate> service
-                                                = serviceForHandle(charHandle);
+            QSharedPointer<QLowEnergyServicePrivate> service = failedRequest.service;
+            if (service.isNull())
+                service = serviceForHandle(charHandle);
             if (!service.isNull() && service->characteristicList.contains(charHandle)) {
                 if (!descriptorHandle)
                     service->setError(QLowEnergyService::CharacteristicWriteError);
@@ -960,14 +1246,10 @@ void QLowEnergyControllerPrivateBluez::encryptionChangedEvent(
                     service->setError(QLowEnergyService::DescriptorWriteError);
             }
         } else if (failedRequest.command == ATT_OP_PREPARE_WRITE_REQUEST) {
-            uint handleData = failedRequest.reference.toUInt();
-            const QLowEnergyHandle attrHandle = (handleData & 0xffff);
-            const QByteArray newValue = failedRequest.reference2.toByteArray();
-
             // Prepare command failed, cancel pending prepare queue on
             // the device. The appropriate (Descriptor|Characteristic)WriteError
             // is emitted too once the execute write request comes through
-            sendExecuteWriteRequest(attrHandle, newValue, true);
+            sendExecuteWriteRequest(failedRequest.service, failedRequest.preparedWrite, true);
         }
     }
 
@@ -975,37 +1257,186 @@ void QLowEnergyControllerPrivateBluez::encryptionChangedEvent(
     sendNextPendingRequest();
 }
 
-void QLowEnergyControllerPrivateBluez::sendPacket(const QByteArray &packet)
+bool QLowEnergyControllerPrivateBluez::sendPacket(const QByteArray &packet)
 {
-    qint64 result = l2cpSocket->write(packet.constData(),
-                                      packet.size());
-    // We ignore result == 0 which is likely to be caused by EAGAIN.
-    // This packet is effectively discarded but the controller can still recover
+    return sendPacket(packet.constData(), packet.size());
+}
+
+/*!
+    \internal
+
+    Returns \c false if the packet was not sent because the socket buffer is full.
+ */
+bool QLowEnergyControllerPrivateBluez::sendPacket(const char *data, int size)
+{
+    qint64 result = l2cpSocket->write(data, size);
+    // result == 0 is caused by EAGAIN. Requests are sent again once the socket
+    // is writable. Other packets are effectively discarded but the controller can
+    // still recover.
+    if (result == 0)
+        return false;
 
     if (result == -1) {
         qCDebug(QT_BT_BLUEZ) << "Cannot write L2CP packet:" << Qt::hex
-                             << packet.toHex()
+                             << QByteArray::fromRawData(data, size).toHex()
                              << l2cpSocket->errorString();
         setError(QLowEnergyController::NetworkError);
-    } else if (result < packet.size()) {
+    } else if (result < size) {
         qCWarning(QT_BT_BLUEZ) << "L2CP write request incomplete:"
-                               << result << "of" << packet.size();
+                               << result << "of" << size;
+    }
+
+    return true;
+}
+
+/*!
+    \internal
+
+    Queues a read or write request issued via QLowEnergyService. The request
+    is sent on an additional ATT bearer if one is available.
+ */
+void QLowEnergyControllerPrivateBluez::enqueueInteractiveRequest(const Request &request)
+{
+    // The requests of a service stay on one queue until it has drained,
+    // otherwise they could complete out of order.
+    if (bearerPool && !openRequests.contains(request.service.data())
+            && (bearerPool->hasRequests(request.service.data())
+                || bearerPool->canSend(request))) {
+        bearerPool->enqueue(request);
+        return;
+    }
+
+    openRequests.enqueue(request);
+    sendNextPendingRequest();
+}
+
+/*!
+    \internal
+
+    Queues \a request to be sent next. Continuations of a response which
+    was received on an additional bearer stay on that bearer.
+ */
+void QLowEnergyControllerPrivateBluez::prependRequest(const Request &request)
+{
+    if (replyBearer)
+        replyBearer->prependRequest(request);
+    else
+        openRequests.prepend(request);
+}
+
+/*!
+    \internal
+
+    Returns the MTU of the bearer whose response is being processed.
+ */
+int QLowEnergyControllerPrivateBluez::replyMtu() const
+{
+    return replyBearer ? replyBearer->mtu() : mtuSize;
+}
+
+/*!
+    \internal
+
+    Opens the additional ATT bearers. Bearers which cannot be established,
+    for example because the remote device does not support Enhanced ATT,
+    are dropped and their requests are sent on the main bearer.
+ */
+void QLowEnergyControllerPrivateBluez::openAdditionalBearers()
+{
+    if (!bearerPool || role != QLowEnergyController::CentralRole)
+        return;
+
+    const quint8 addressTypeToUse = quint8(l2cpSocket->d_ptr->lowEnergySocketType);
+
+    // the additional channels use the local address of the main bearer
+    quint8 localAddressType = BDADDR_LE_PUBLIC;
+    sockaddr_l2 localAddr;
+    socklen_t length = sizeof(localAddr);
+    memset(&localAddr, 0, sizeof(localAddr));
+    if (::getsockname(l2cpSocket->socketDescriptor(),
+                      reinterpret_cast<sockaddr *>(&localAddr), &length) == 0) {
+        localAddressType = localAddr.l2_bdaddr_type;
+    } else {
+        qCWarning(QT_BT_BLUEZ) << "Cannot determine the local address type:"
+                               << qt_error_string(errno);
+    }
+
+    for (int i = 1; i < requestedBearers; ++i) {
+        const int socket = LeAttBearer::openChannel(localAdapter, localAddressType,
+                                                    remoteDevice, addressTypeToUse);
+        if (socket < 0)
+            return;
+        bearerPool->addBearer(new LeAttBearer(socket));
+    }
+}
+
+void QLowEnergyControllerPrivateBluez::bearerResponseReceived(
+        LeAttBearer *bearer, const Request &request, const QByteArray &response)
+{
+    if (encryptionChangePending && quint8(response.at(0)) == ATT_OP_ERROR_RESPONSE) {
+        // retried on the same bearer once the encryption change is done
+        bearer->prependRequest(request);
+        return;
+    }
+
+    replyBearer = bearer;
+    processReply(request, response);
+    replyBearer = nullptr;
+
+    if (encryptionChangePending && bearerPool) {
+        encryptionRetryOnBearer = true;
+        encryptionRetryBearer = bearer;
+        bearerPool->setSuspended(true);
+    }
+}
+
+void QLowEnergyControllerPrivateBluez::bearerRequestTimedOut(
+        LeAttBearer *bearer, const Request &request)
+{
+    Q_UNUSED(bearer);
+    qCWarning(QT_BT_BLUEZ).nospace() << "****** Request type 0x" << Qt::hex << request.command
+                                     << " timed out on an additional ATT bearer, closing it";
+
+    if (encryptionChangePending) {
+        bearerPool->enqueue(request);
+        return;
     }
 
+    const uint handleData = request.handleData;
+    const QLowEnergyHandle charHandle = (handleData & 0xffff);
+    const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+
+    QByteArray errorPackage(ERROR_RESPONSE_HEADER_SIZE, Qt::Uninitialized);
+    errorPackage[0] = ATT_OP_ERROR_RESPONSE;
+    errorPackage[1] = request.command;
+    putBtData(descriptorHandle ? descriptorHandle : charHandle, errorPackage.data() + 2);
+    errorPackage[4] = ATT_ERROR_REQUEST_STALLED;
+    processReply(request, errorPackage);
 }
 
 void QLowEnergyControllerPrivateBluez::sendNextPendingRequest()
 {
+    if (bearerPool)
+        bearerPool->setSuspended(encryptionChangePending);
+
     if (openRequests.isEmpty() || requestPending || encryptionChangePending)
         return;
 
     const Request &request = openRequests.head();
 //    qCDebug(QT_BT_BLUEZ) << "Sending request, type:" << Qt::hex << request.command
-//             << request.payload.toHex();
+//             << QByteArray::fromRawData(request.payload.constData(),
+//                                        request.payload.size()).toHex();
 
     requestPending = true;
     restartRequestTimer();
-    sendPacket(request.payload);
+    if (!sendPacket(request.payload.constData(), request.payload.size())) {
+        // socket buffer is full, e.g. due to streamed write commands
+        requestPending = false;
+        if (requestTimer)
+            requestTimer->stop();
+        if (streamWriter)
+            streamWriter->waitForWritable();
+    }
 }
 
 QLowEnergyHandle parseReadByTypeCharDiscovery(
@@ -1091,6 +1522,10 @@ void QLowEnergyControllerPrivateBluez::processReply(
             mtuSize = ATT_DEFAULT_LE_MTU;
 
         qCDebug(QT_BT_BLUEZ) << "Server MTU:" << mtu << "resulting mtu:" << mtuSize;
+        if (streamWriter)
+            streamWriter->setMtu(mtuSize);
+        if (remoteClientConnection)
+            remoteClientConnection->mtuSize = mtuSize;
     }
         break;
     case ATT_OP_READ_BY_GROUP_REQUEST: // in case of error
@@ -1099,10 +1534,11 @@ void QLowEnergyControllerPrivateBluez::processReply(
         // Discovering services
         Q_ASSERT(request.command == ATT_OP_READ_BY_GROUP_REQUEST);
 
-        const quint16 type = request.reference.toUInt();
+        const quint16 type = request.attributeType;
 
         if (isErrorResponse) {
             if (type == GATT_SECONDARY_SERVICE) {
+                storeGattCache();
                 setState(QLowEnergyController::DiscoveredState);
                 q->discoveryFinished();
             } else { // search for secondary services
@@ -1140,6 +1576,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             if (type != GATT_PRIMARY_SERVICE) //unset PrimaryService bit
                 priv->type &= ~QLowEnergyService::PrimaryService;
             priv->setController(this);
+            watchServiceForGattCache(priv);
 
             QSharedPointer<QLowEnergyServicePrivate> pointer(priv);
 
@@ -1151,6 +1588,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             sendReadByGroupRequest(end+1, 0xFFFF, type);
         } else {
             if (type == GATT_SECONDARY_SERVICE) {
+                storeGattCache();
                 setState(QLowEnergyController::DiscoveredState);
                 emit q->discoveryFinished();
             } else { // search for secondary services
@@ -1165,9 +1603,30 @@ void QLowEnergyControllerPrivateBluez::processReply(
         // Discovering characteristics
         Q_ASSERT(request.command == ATT_OP_READ_BY_TYPE_REQUEST);
 
-        QSharedPointer<QLowEnergyServicePrivate> p =
-                request.reference.value<QSharedPointer<QLowEnergyServicePrivate> >();
-        const quint16 attributeType = request.reference2.toUInt();
+        const quint16 attributeType = request.attributeType;
+
+        if (attributeType == GATT_DATABASE_HASH) {
+            // Validating the GATT cache
+            // packet format: <opcode><elementLength>[<handle><hash>]
+            remoteDatabaseHash.clear();
+            if (!isErrorResponse
+                    && response.size() >= 4 + GATT_DATABASE_HASH_SIZE
+                    && quint8(response.constData()[1]) == 2 + GATT_DATABASE_HASH_SIZE) {
+                remoteDatabaseHash = response.mid(4, GATT_DATABASE_HASH_SIZE);
+            }
+
+            if (!discoverServicesFromCache())
+                sendReadByGroupRequest(0x0001, 0xFFFF, GATT_PRIMARY_SERVICE);
+            break;
+        }
+
+        if (request.service.isNull()) {
+            // part of discoverAllServiceDetails()
+            processSweepReply(request, response, isErrorResponse);
+            break;
+        }
+
+        QSharedPointer<QLowEnergyServicePrivate> p = request.service;
 
         if (isErrorResponse) {
             if (attributeType == GATT_CHARACTERISTIC) {
@@ -1240,7 +1699,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
         //Reading characteristics and descriptors
         Q_ASSERT(request.command == ATT_OP_READ_REQUEST);
 
-        uint handleData = request.reference.toUInt();
+        uint handleData = request.handleData;
         const QLowEnergyHandle charHandle = (handleData & 0xffff);
         const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
 
@@ -1255,7 +1714,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             if (encryptionChangePending) {
                 // Just requested a security level change.
                 // Retry the same command again once the change has happened
-                openRequests.prepend(request);
+                prependRequest(request);
                 break;
             } else if (!isServiceDiscoveryRun) {
                 // not encryption problem -> abort readCharacteristic()/readDescriptor() run
@@ -1271,13 +1730,13 @@ void QLowEnergyControllerPrivateBluez::processReply(
                 updateValueOfDescriptor(charHandle, descriptorHandle,
                                         response.mid(1), NEW_VALUE);
 
-            if (response.size() == mtuSize) {
+            if (response.size() == replyMtu()) {
                 qCDebug(QT_BT_BLUEZ) << "Switching to blob reads for"
                          << charHandle << descriptorHandle
                          << service->characteristicList[charHandle].uuid.toString();
                 // Potentially more data -> switch to blob reads
-                readServiceValuesByOffset(handleData, mtuSize-1,
-                                          request.reference2.toBool());
+                readServiceValuesByOffset(handleData, replyMtu() - 1,
+                                          request.isLastValue);
                 break;
             } else if (!isServiceDiscoveryRun) {
                 // readCharacteristic() or readDescriptor() ongoing
@@ -1292,7 +1751,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             }
         }
 
-        if (request.reference2.toBool() && isServiceDiscoveryRun) {
+        if (request.isLastValue && isServiceDiscoveryRun) {
             // we only run into this code path during the initial service discovery
             // and not when processing readCharacteristics() after service discovery
 
@@ -1311,7 +1770,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
         //Reading characteristic or descriptor with value longer value than MTU
         Q_ASSERT(request.command == ATT_OP_READ_BLOB_REQUEST);
 
-        uint handleData = request.reference.toUInt();
+        uint handleData = request.handleData;
         const QLowEnergyHandle charHandle = (handleData & 0xffff);
         const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
 
@@ -1332,9 +1791,9 @@ void QLowEnergyControllerPrivateBluez::processReply(
                 length = updateValueOfDescriptor(charHandle, descriptorHandle,
                                         response.mid(1), APPEND_VALUE);
 
-            if (response.size() == mtuSize) {
+            if (response.size() == replyMtu()) {
                 readServiceValuesByOffset(handleData, length,
-                                          request.reference2.toBool());
+                                          request.isLastValue);
                 break;
             } else if (service->state == QLowEnergyService::ServiceDiscovered) {
                 // readCharacteristic() or readDescriptor() ongoing
@@ -1354,7 +1813,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
                        << (service->state == QLowEnergyService::ServiceDiscovered) << ")";
         }
 
-        if (request.reference2.toBool()) {
+        if (request.isLastValue) {
             //last overlong characteristic -> progress to descriptor discovery
             //last overlong descriptor -> service discovery is done
 
@@ -1366,31 +1825,171 @@ void QLowEnergyControllerPrivateBluez::processReply(
 
     }
         break;
-    case ATT_OP_FIND_INFORMATION_REQUEST: //error case
-    case ATT_OP_FIND_INFORMATION_RESPONSE:
+    case ATT_OP_READ_MULTIPLE_REQUEST: //error case
+    case ATT_OP_READ_MULTIPLE_RESPONSE:
+    case ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST: //error case
+    case ATT_OP_READ_MULTIPLE_VARIABLE_RESPONSE:
     {
-        //Discovering descriptors
-        Q_ASSERT(request.command == ATT_OP_FIND_INFORMATION_REQUEST);
-
-        /* packet format:
-         *  <opcode><format>[<handle><descriptor_uuid>]+
-         *
-         *  The uuid can be 16 or 128 bit which is indicated by format.
-         */
+        // Reading several characteristic or descriptor values during service discovery
+        Q_ASSERT(request.command == ATT_OP_READ_MULTIPLE_REQUEST
+                 || request.command == ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST);
 
-        QList<QLowEnergyHandle> keys = request.reference.value<QList<QLowEnergyHandle> >();
-        if (keys.isEmpty()) {
-            qCWarning(QT_BT_BLUEZ) << "Descriptor discovery for unknown characteristic received";
-            break;
-        }
-        QLowEnergyHandle charHandle = keys.first();
+        const QVector<uint> &handleDataList = request.handleDataList;
+        Q_ASSERT(handleDataList.count() >= 2);
+        const bool isVariable = request.command == ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST;
+        const bool isDescriptorRead = ((handleDataList.first() >> 16) & 0xffff);
 
-        QSharedPointer<QLowEnergyServicePrivate> p =
-                serviceForHandle(charHandle);
-        Q_ASSERT(!p.isNull());
+        QSharedPointer<QLowEnergyServicePrivate> service =
+                serviceForHandle(handleDataList.first() & 0xffff);
+        Q_ASSERT(!service.isNull());
 
+        // values which could not be obtained from the response are read one by one
+        QVector<uint> pendingHandleData;
         if (isErrorResponse) {
-            if (keys.count() == 1) {
+            const quint8 errorCode = response.constData()[4];
+            Q_ASSERT(!encryptionChangePending);
+            encryptionChangePending = increaseEncryptLevelfRequired(errorCode);
+            if (encryptionChangePending) {
+                prependRequest(request);
+                break;
+            }
+
+            if (errorCode == ATT_ERROR_REQUEST_NOT_SUPPORTED) {
+                qCDebug(QT_BT_BLUEZ) << "Peer does not support read multiple"
+                                     << (isVariable ? "variable" : "") << "requests";
+                if (isVariable)
+                    readMultipleVariableSupported = false;
+                else
+                    readMultipleSupported = false;
+            }
+            pendingHandleData = handleDataList;
+        } else if (isVariable) {
+            /* packet format:
+             *  <opcode>[<length><value>]+
+             *
+             *  The last value may be truncated by the peer.
+             */
+            const char *data = response.constData();
+            int offset = 1;
+            for (const uint handleData : handleDataList) {
+                if (offset + int(sizeof(quint16)) > response.size()) {
+                    pendingHandleData.append(handleData);
+                    continue;
+                }
+                const quint16 valueLength = bt_get_le16(&data[offset]);
+                offset += sizeof(quint16);
+                if (offset + valueLength > response.size()) {
+                    // truncated value
+                    pendingHandleData.append(handleData);
+                    offset = response.size();
+                    continue;
+                }
+
+                const QLowEnergyHandle charHandle = (handleData & 0xffff);
+                const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+                if (!descriptorHandle)
+                    updateValueOfCharacteristic(charHandle, response.mid(offset, valueLength),
+                                                NEW_VALUE);
+                else
+                    updateValueOfDescriptor(charHandle, descriptorHandle,
+                                            response.mid(offset, valueLength), NEW_VALUE);
+                offset += valueLength;
+            }
+        } else {
+            /* packet format:
+             *  <opcode>[<value>]+
+             *
+             *  Only values with a fixed size were requested.
+             */
+            QVector<int> valueSizes;
+            int expectedSize = 1;
+            for (const uint handleData : handleDataList) {
+                const QLowEnergyHandle charHandle = (handleData & 0xffff);
+                const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+                const int valueSize = fixedDescriptorValueSize(
+                    service->characteristicList.value(charHandle)
+                            .descriptorList.value(descriptorHandle).uuid);
+                valueSizes.append(valueSize);
+                expectedSize += valueSize;
+            }
+
+            if (expectedSize != response.size()) {
+                qCDebug(QT_BT_BLUEZ) << "Unexpected read multiple response size"
+                                     << response.size() << "expected:" << expectedSize;
+                pendingHandleData = handleDataList;
+            } else {
+                int offset = 1;
+                for (int i = 0; i < handleDataList.count(); ++i) {
+                    const uint handleData = handleDataList.at(i);
+                    updateValueOfDescriptor(handleData & 0xffff, (handleData >> 16) & 0xffff,
+                                            response.mid(offset, valueSizes.at(i)), NEW_VALUE);
+                    offset += valueSizes.at(i);
+                }
+            }
+        }
+
+        if (!pendingHandleData.isEmpty()) {
+            qCDebug(QT_BT_BLUEZ) << "Falling back to single reads for"
+                                 << pendingHandleData.count() << "values";
+
+            // Prepend in reverse order to preserve the read order.
+            // The last of them inherits the responsibility to continue the discovery.
+            for (int i = pendingHandleData.count() - 1; i >= 0; --i) {
+                const uint handleData = pendingHandleData.at(i);
+                const QLowEnergyHandle charHandle = (handleData & 0xffff);
+                const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
+                const QLowEnergyHandle attributeHandle = descriptorHandle
+                        ? descriptorHandle
+                        : service->characteristicList.value(charHandle).valueHandle;
+                Request readRequest = createReadRequest(attributeHandle, handleData);
+                if (i == pendingHandleData.count() - 1)
+                    readRequest.isLastValue = request.isLastValue;
+                prependRequest(readRequest);
+            }
+            break;
+        }
+
+        if (request.isLastValue) {
+            //last characteristic -> progress to descriptor discovery
+            //last descriptor -> service discovery is done
+            if (!isDescriptorRead)
+                discoverServiceDescriptors(service->uuid);
+            else
+                service->setState(QLowEnergyService::ServiceDiscovered);
+        }
+    }
+        break;
+    case ATT_OP_FIND_INFORMATION_REQUEST: //error case
+    case ATT_OP_FIND_INFORMATION_RESPONSE:
+    {
+        //Discovering descriptors
+        Q_ASSERT(request.command == ATT_OP_FIND_INFORMATION_REQUEST);
+
+        /* packet format:
+         *  <opcode><format>[<handle><descriptor_uuid>]+
+         *
+         *  The uuid can be 16 or 128 bit which is indicated by format.
+         */
+
+        if (request.service.isNull()) {
+            // part of discoverAllServiceDetails()
+            processSweepReply(request, response, isErrorResponse);
+            break;
+        }
+
+        QList<QLowEnergyHandle> keys = request.pendingCharHandles;
+        if (keys.isEmpty()) {
+            qCWarning(QT_BT_BLUEZ) << "Descriptor discovery for unknown characteristic received";
+            break;
+        }
+        QLowEnergyHandle charHandle = keys.first();
+
+        QSharedPointer<QLowEnergyServicePrivate> p =
+                serviceForHandle(charHandle);
+        Q_ASSERT(!p.isNull());
+
+        if (isErrorResponse) {
+            if (keys.count() == 1) {
                 // no more descriptors to discover
                 readServiceValues(p->uuid, false); //read descriptor values
             } else {
@@ -1489,7 +2088,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
         //Write command response
         Q_ASSERT(request.command == ATT_OP_WRITE_REQUEST);
 
-        uint ref = request.reference.toUInt();
+        uint ref = request.handleData;
         const QLowEnergyHandle charHandle = (ref & 0xffff);
         const QLowEnergyHandle descriptorHandle = ((ref >> 16) & 0xffff);
 
@@ -1501,7 +2100,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             Q_ASSERT(!encryptionChangePending);
             encryptionChangePending = increaseEncryptLevelfRequired(response.constData()[4]);
             if (encryptionChangePending) {
-                openRequests.prepend(request);
+                prependRequest(request);
                 break;
             }
 
@@ -1512,7 +2111,7 @@ void QLowEnergyControllerPrivateBluez::processReply(
             break;
         }
 
-        const QByteArray newValue = request.reference2.toByteArray();
+        const QByteArray &newValue = request.value;
         if (!descriptorHandle) {
             QLowEnergyCharacteristic ch(service, charHandle);
             if (ch.properties() & QLowEnergyCharacteristic::Read)
@@ -1531,62 +2130,62 @@ void QLowEnergyControllerPrivateBluez::processReply(
         //Prepare write command response
         Q_ASSERT(request.command == ATT_OP_PREPARE_WRITE_REQUEST);
 
-        uint handleData = request.reference.toUInt();
-        const QLowEnergyHandle attrHandle = (handleData & 0xffff);
-        const QByteArray newValue = request.reference2.toByteArray();
-        const int writtenPayload = ((handleData >> 16) & 0xffff);
+        const QSharedPointer<LePreparedWrite> &write = request.preparedWrite;
+        const int segment = int(request.handleData);
 
         if (isErrorResponse) {
             Q_ASSERT(!encryptionChangePending);
             encryptionChangePending = increaseEncryptLevelfRequired(response.constData()[4]);
             if (encryptionChangePending) {
-                openRequests.prepend(request);
+                prependRequest(request);
                 break;
             }
             //emits error on cancellation and aborts existing prepare reuqests
-            sendExecuteWriteRequest(attrHandle, newValue, true);
+            sendExecuteWriteRequest(request.service, write, true);
+        } else if (!write->verifyEcho(segment, response.constData(), response.size())) {
+            // the server would execute a value which differs from the requested one
+            qCWarning(QT_BT_BLUEZ) << "Prepare write response does not echo segment"
+                                   << segment << "- cancelling write";
+            sendExecuteWriteRequest(request.service, write, true);
+        } else if (segment + 1 < write->segmentCount()) {
+            sendPrepareWriteRequest(request.service, write, segment + 1);
         } else {
-            if (writtenPayload < newValue.size()) {
-                sendNextPrepareWriteRequest(attrHandle, newValue, writtenPayload);
-            } else {
-                sendExecuteWriteRequest(attrHandle, newValue, false);
-            }
+            sendExecuteWriteRequest(request.service, write, false);
         }
     }
         break;
     case ATT_OP_EXECUTE_WRITE_REQUEST: //error case
     case ATT_OP_EXECUTE_WRITE_RESPONSE:
     {
-        // right now used in connection with long characteristic/descriptor value writes
-        // not catering for reliable writes
+        // concludes long writes and reliable writes
         Q_ASSERT(request.command == ATT_OP_EXECUTE_WRITE_REQUEST);
 
-        uint handleData = request.reference.toUInt();
-        const QLowEnergyHandle attrHandle = handleData & 0xffff;
-        bool wasCancellation = !((handleData >> 16) & 0xffff);
-        const QByteArray newValue = request.reference2.toByteArray();
-
-        // is it a descriptor or characteristic?
-        const QLowEnergyDescriptor descriptor = descriptorForHandle(attrHandle);
-        QSharedPointer<QLowEnergyServicePrivate> service = serviceForHandle(attrHandle);
-        Q_ASSERT(!service.isNull());
+        const bool wasCancellation = !request.handleData;
+        const QSharedPointer<QLowEnergyServicePrivate> &service = request.service;
+        const QVector<LePreparedWrite::Entry> &entries = request.preparedWrite->entries();
+        Q_ASSERT(!service.isNull() && !entries.isEmpty());
 
         if (isErrorResponse || wasCancellation) {
-            // charHandle == 0 -> cancellation
-            if (descriptor.isValid())
+            // a reliable write only contains characteristic values
+            if (entries.constFirst().descriptorHandle)
                 service->setError(QLowEnergyService::DescriptorWriteError);
             else
                 service->setError(QLowEnergyService::CharacteristicWriteError);
-        } else {
-            if (descriptor.isValid()) {
-                updateValueOfDescriptor(descriptor.characteristicHandle(),
-                                        attrHandle, newValue, NEW_VALUE);
-                emit service->descriptorWritten(descriptor, newValue);
+            break;
+        }
+
+        for (const LePreparedWrite::Entry &entry : entries) {
+            if (entry.descriptorHandle) {
+                updateValueOfDescriptor(entry.charHandle, entry.descriptorHandle,
+                                        entry.value, NEW_VALUE);
+                QLowEnergyDescriptor descriptor(service, entry.charHandle,
+                                                entry.descriptorHandle);
+                emit service->descriptorWritten(descriptor, entry.value);
             } else {
-                QLowEnergyCharacteristic ch(service, attrHandle);
+                QLowEnergyCharacteristic ch(service, entry.charHandle);
                 if (ch.properties() & QLowEnergyCharacteristic::Read)
-                    updateValueOfCharacteristic(attrHandle, newValue, NEW_VALUE);
-                emit service->characteristicWritten(ch, newValue);
+                    updateValueOfCharacteristic(entry.charHandle, entry.value, NEW_VALUE);
+                emit service->characteristicWritten(ch, entry.value);
             }
         }
     }
@@ -1599,9 +2198,184 @@ void QLowEnergyControllerPrivateBluez::processReply(
 
 void QLowEnergyControllerPrivateBluez::discoverServices()
 {
+    if (gattCache) {
+        // The database hash validates the cache content. Without cache entry
+        // the additional round trip is not worth it.
+        cachedDatabase = gattCache->load(remoteDevice);
+        remoteDatabaseHash.clear();
+        servicesWithKnownDescriptors.clear();
+        gattCacheStale = false;
+        if (!cachedDatabase.services.isEmpty()) {
+            sendDatabaseHashRequest();
+            return;
+        }
+    }
+
     sendReadByGroupRequest(0x0001, 0xFFFF, GATT_PRIMARY_SERVICE);
 }
 
+/*!
+    \internal
+
+    Reads the Database Hash characteristic of the peer. The hash changes
+    whenever the attribute layout of the peer changes.
+ */
+void QLowEnergyControllerPrivateBluez::sendDatabaseHashRequest()
+{
+    quint8 packet[READ_BY_TYPE_REQ_HEADER_SIZE];
+
+    packet[0] = ATT_OP_READ_BY_TYPE_REQUEST;
+    putBtData(quint16(0x0001), &packet[1]);
+    putBtData(quint16(0xFFFF), &packet[3]);
+    putBtData(GATT_DATABASE_HASH, &packet[5]);
+
+    qCDebug(QT_BT_BLUEZ) << "Sending read_by_type request for database hash";
+
+    Request request;
+    request.payload.append(reinterpret_cast<const char *>(packet), READ_BY_TYPE_REQ_HEADER_SIZE);
+    request.command = ATT_OP_READ_BY_TYPE_REQUEST;
+    request.attributeType = GATT_DATABASE_HASH;
+    openRequests.enqueue(request);
+
+    sendNextPendingRequest();
+}
+
+/*!
+    \internal
+
+    Populates the service list from the GATT cache and finishes the service discovery.
+    Returns \c false if the cache does not match the peer. In that case
+    the regular service discovery must be used.
+
+    The cache is valid if its database hash matches the one of the peer.
+    Entries without database hash were stored without reading it, or the
+    peer does not have one. They are only trusted for bonded peers as only
+    those are obliged to report layout changes via Service Changed indications.
+    The hash of the peer is added to the entry with the next update.
+ */
+bool QLowEnergyControllerPrivateBluez::discoverServicesFromCache()
+{
+    Q_Q(QLowEnergyController);
+
+    if (cachedDatabase.services.isEmpty())
+        return false;
+
+    if (!cachedDatabase.hash.isEmpty()) {
+        if (cachedDatabase.hash != remoteDatabaseHash) {
+            qCDebug(QT_BT_BLUEZ) << "Database hash of" << remoteDevice
+                                 << "has changed, discarding GATT cache";
+            invalidateGattCache();
+            return false;
+        }
+    } else if (!isBonded()) {
+        qCDebug(QT_BT_BLUEZ) << "Cannot validate GATT cache of unbonded device" << remoteDevice;
+        cachedDatabase = LeGattCache::Database();
+        return false;
+    }
+
+    qCDebug(QT_BT_BLUEZ) << "Restoring" << cachedDatabase.services.count()
+                         << "services from GATT cache";
+
+    for (const LeGattCache::Service &cachedService : qAsConst(cachedDatabase.services)) {
+        QLowEnergyServicePrivate *priv = new QLowEnergyServicePrivate();
+        priv->uuid = cachedService.uuid;
+        priv->startHandle = cachedService.startHandle;
+        priv->endHandle = cachedService.endHandle;
+        if (!cachedService.isPrimary) //unset PrimaryService bit
+            priv->type &= ~QLowEnergyService::PrimaryService;
+        priv->setController(this);
+        watchServiceForGattCache(priv);
+
+        QSharedPointer<QLowEnergyServicePrivate> pointer(priv);
+
+        serviceList.insert(priv->uuid, pointer);
+        emit q->serviceDiscovered(priv->uuid);
+    }
+
+    setState(QLowEnergyController::DiscoveredState);
+    emit q->discoveryFinished();
+    return true;
+}
+
+/*!
+    \internal
+
+    Restores the characteristics and descriptors of \a service from the GATT cache.
+    Returns \c true on success in which case only the attribute values must be read.
+ */
+bool QLowEnergyControllerPrivateBluez::restoreServiceDetailsFromCache(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    servicesWithKnownDescriptors.remove(service->uuid);
+    if (!gattCache || gattCacheStale)
+        return false;
+
+    const LeGattCache::Service *cachedService = cachedDatabase.service(service->uuid);
+    if (!cachedService || !cachedService->detailsKnown
+            || cachedService->startHandle != service->startHandle
+            || cachedService->endHandle != service->endHandle) {
+        return false;
+    }
+
+    qCDebug(QT_BT_BLUEZ) << "Restoring details of" << service->uuid.toString()
+                         << "from GATT cache";
+    LeGattCache::restoreDetails(*cachedService, service.data());
+    for (const QBluetoothUuid &uuid : qAsConst(service->includedServices)) {
+        if (serviceList.contains(uuid))
+            serviceList[uuid]->type |= QLowEnergyService::IncludedService;
+    }
+    servicesWithKnownDescriptors.insert(service->uuid);
+    return true;
+}
+
+void QLowEnergyControllerPrivateBluez::watchServiceForGattCache(QLowEnergyServicePrivate *service)
+{
+    if (!gattCache)
+        return;
+
+    connect(service, &QLowEnergyServicePrivate::stateChanged,
+            this, [this](QLowEnergyService::ServiceState newState) {
+        if (newState == QLowEnergyService::ServiceDiscovered)
+            storeGattCache();
+    });
+}
+
+/*!
+    \internal
+
+    Writes the current attribute layout to the GATT cache. The details of services
+    which were not discovered during this connection are taken from the previous
+    cache content.
+ */
+void QLowEnergyControllerPrivateBluez::storeGattCache()
+{
+    if (!gattCache || gattCacheStale)
+        return;
+
+    LeGattCache::Database database;
+    database.hash = remoteDatabaseHash;
+    for (const auto &service : qAsConst(serviceList)) {
+        const LeGattCache::Service *cachedService = cachedDatabase.service(service->uuid);
+        if (service->state != QLowEnergyService::ServiceDiscovered && cachedService
+                && cachedService->startHandle == service->startHandle
+                && cachedService->endHandle == service->endHandle) {
+            database.services.append(*cachedService);
+        } else {
+            database.services.append(LeGattCache::fromService(*service));
+        }
+    }
+
+    cachedDatabase = database;
+    gattCache->store(remoteDevice, cachedDatabase);
+}
+
+void QLowEnergyControllerPrivateBluez::invalidateGattCache()
+{
+    cachedDatabase = LeGattCache::Database();
+    servicesWithKnownDescriptors.clear();
+    gattCache->remove(remoteDevice);
+}
+
 void QLowEnergyControllerPrivateBluez::sendReadByGroupRequest(
         QLowEnergyHandle start, QLowEnergyHandle end, quint16 type)
 {
@@ -1613,15 +2387,13 @@ void QLowEnergyControllerPrivateBluez::sendReadByGroupRequest(
     putBtData(end, &packet[3]);
     putBtData(type, &packet[5]);
 
-    QByteArray data(GRP_TYPE_REQ_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet,  GRP_TYPE_REQ_HEADER_SIZE);
     qCDebug(QT_BT_BLUEZ) << "Sending read_by_group_type request, startHandle:" << Qt::hex
              << start << "endHandle:" << end << type;
 
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), GRP_TYPE_REQ_HEADER_SIZE);
     request.command = ATT_OP_READ_BY_GROUP_REQUEST;
-    request.reference = type;
+    request.attributeType = type;
     openRequests.enqueue(request);
 
     sendNextPendingRequest();
@@ -1637,9 +2409,293 @@ void QLowEnergyControllerPrivateBluez::discoverServiceDetails(const QBluetoothUu
 
     QSharedPointer<QLowEnergyServicePrivate> serviceData = serviceList.value(service);
     serviceData->characteristicList.clear();
+    if (restoreServiceDetailsFromCache(serviceData)) {
+        // characteristics and descriptors are known, only values must be read
+        readServiceValues(service, true);
+        return;
+    }
+
     sendReadByTypeRequest(serviceData, serviceData->startHandle, GATT_INCLUDED_SERVICE);
 }
 
+/*!
+    \internal
+
+    Discovers the includes, characteristics and descriptors of all \a services in one pass.
+    Instead of running the discovery for each service separately, the Read By Type and
+    Find Information requests span the handle range of all services. The results
+    are assigned to the services afterwards. Handle ranges of services which are not
+    part of \a services are skipped.
+
+    Once the layout is known, the values are read per service as usual.
+ */
+void QLowEnergyControllerPrivateBluez::discoverAllServiceDetails(
+        const QList<QBluetoothUuid> &services)
+{
+    if (!sweepServices.isEmpty()) {
+        // another sweep is ongoing, avoid mixing them up
+        QLowEnergyControllerPrivate::discoverAllServiceDetails(services);
+        return;
+    }
+
+    for (const QBluetoothUuid &uuid : services) {
+        QSharedPointer<QLowEnergyServicePrivate> serviceData = serviceList.value(uuid);
+        if (serviceData.isNull())
+            continue;
+
+        serviceData->characteristicList.clear();
+        if (restoreServiceDetailsFromCache(serviceData)) {
+            readServiceValues(uuid, true);
+            continue;
+        }
+
+        serviceData->includedServices.clear();
+        sweepServices.append(serviceData);
+    }
+
+    if (sweepServices.isEmpty())
+        return;
+
+    std::sort(sweepServices.begin(), sweepServices.end(),
+              [](const QSharedPointer<QLowEnergyServicePrivate> &a,
+                 const QSharedPointer<QLowEnergyServicePrivate> &b) {
+                  return a->startHandle < b->startHandle;
+              });
+
+    qCDebug(QT_BT_BLUEZ) << "Discovering details of" << sweepServices.count()
+                         << "services in one pass";
+    sendSweepRequest(ATT_OP_READ_BY_TYPE_REQUEST, sweepServices.first()->startHandle,
+                     GATT_INCLUDED_SERVICE);
+}
+
+void QLowEnergyControllerPrivateBluez::sendSweepRequest(
+        quint8 command, QLowEnergyHandle startHandle, quint16 attributeType)
+{
+    Request request;
+    request.command = command;
+    LeAttPdu &data = request.payload;
+
+    if (command == ATT_OP_READ_BY_TYPE_REQUEST) {
+        data.resize(READ_BY_TYPE_REQ_HEADER_SIZE);
+        putBtData(sweepServices.last()->endHandle, data.data() + 3);
+        putBtData(attributeType, data.data() + 5);
+        request.attributeType = attributeType;
+    } else {
+        Q_ASSERT(command == ATT_OP_FIND_INFORMATION_REQUEST);
+        Q_ASSERT(!sweepDescriptorRanges.isEmpty());
+        data.resize(FIND_INFO_REQUEST_HEADER_SIZE);
+        putBtData(sweepDescriptorRanges.last().end, data.data() + 3);
+        request.startHandle = startHandle;
+    }
+    data[0] = command;
+    putBtData(startHandle, data.data() + 1);
+
+    qCDebug(QT_BT_BLUEZ) << "Sending sweep request" << Qt::hex << command
+                         << "startHandle:" << startHandle << "type:" << attributeType;
+
+    // no reference to a single service marks the request as part of the sweep
+    openRequests.enqueue(request);
+
+    sendNextPendingRequest();
+}
+
+/*!
+    \internal
+
+    Returns the service of the ongoing sweep which contains \a handle.
+ */
+QSharedPointer<QLowEnergyServicePrivate> QLowEnergyControllerPrivateBluez::sweepServiceForHandle(
+        QLowEnergyHandle handle) const
+{
+    auto it = std::upper_bound(sweepServices.constBegin(), sweepServices.constEnd(), handle,
+                               [](QLowEnergyHandle h,
+                                  const QSharedPointer<QLowEnergyServicePrivate> &service) {
+                                   return h < service->startHandle;
+                               });
+    if (it == sweepServices.constBegin())
+        return QSharedPointer<QLowEnergyServicePrivate>();
+    --it;
+    if (handle > (*it)->endHandle)
+        return QSharedPointer<QLowEnergyServicePrivate>();
+    return *it;
+}
+
+/*!
+    \internal
+
+    Returns the first handle at or after \a handle which is of interest for the
+    next sweep request of type \a command or \c 0 if the sweep step is complete.
+ */
+QLowEnergyHandle QLowEnergyControllerPrivateBluez::nextSweepHandle(
+        QLowEnergyHandle handle, quint8 command) const
+{
+    if (command == ATT_OP_READ_BY_TYPE_REQUEST) {
+        for (const auto &service : sweepServices) {
+            if (service->endHandle >= handle)
+                return qMax(handle, service->startHandle);
+        }
+    } else {
+        for (const DescriptorRange &range : sweepDescriptorRanges) {
+            if (range.end >= handle)
+                return qMax(handle, range.start);
+        }
+    }
+    return 0;
+}
+
+void QLowEnergyControllerPrivateBluez::processSweepReply(
+        const Request &request, const QByteArray &response, bool isErrorResponse)
+{
+    QLowEnergyHandle lastHandle = 0;
+
+    if (request.command == ATT_OP_READ_BY_TYPE_REQUEST) {
+        const quint16 attributeType = request.attributeType;
+
+        if (!isErrorResponse) {
+            /* packet format:
+             * if GATT_CHARACTERISTIC discovery
+             *      <opcode><elementLength>
+             *          [<handle><property><charHandle><uuid>]+
+             *
+             * if GATT_INCLUDE discovery
+             *      <opcode><elementLength>
+             *          [<handle><startHandle_included><endHandle_included>(<uuid>)]+
+             */
+            const quint16 elementLength = quint8(response.constData()[1]);
+            const quint16 numElements = elementLength ? (response.size() - 2) / elementLength : 0;
+            const char *data = response.constData() + 2;
+            for (int i = 0; i < numElements; i++, data += elementLength) {
+                lastHandle = bt_get_le16(data);
+                QSharedPointer<QLowEnergyServicePrivate> service =
+                        sweepServiceForHandle(lastHandle);
+                if (service.isNull())
+                    continue;
+
+                if (attributeType == GATT_CHARACTERISTIC) {
+                    QLowEnergyServicePrivate::CharData characteristic;
+                    parseReadByTypeCharDiscovery(&characteristic, data, elementLength);
+                    service->characteristicList[lastHandle] = characteristic;
+                } else {
+                    // 128 bit uuids of included services are not part of the response,
+                    // the start handle identifies the service though.
+                    const QLowEnergyHandle includedStart = bt_get_le16(&data[2]);
+                    QBluetoothUuid includedUuid;
+                    for (const auto &candidate : qAsConst(serviceList)) {
+                        if (candidate->startHandle == includedStart) {
+                            includedUuid = candidate->uuid;
+                            candidate->type |= QLowEnergyService::IncludedService;
+                            break;
+                        }
+                    }
+                    if (includedUuid.isNull() && elementLength == 8)
+                        includedUuid = QBluetoothUuid(bt_get_le16(&data[6]));
+                    if (!includedUuid.isNull())
+                        service->includedServices.append(includedUuid);
+                }
+            }
+        }
+
+        const QLowEnergyHandle nextHandle = (isErrorResponse || lastHandle == 0xffff)
+                ? 0 : nextSweepHandle(lastHandle + 1, ATT_OP_READ_BY_TYPE_REQUEST);
+        if (nextHandle) {
+            sendSweepRequest(ATT_OP_READ_BY_TYPE_REQUEST, nextHandle, attributeType);
+            return;
+        }
+
+        if (attributeType == GATT_INCLUDED_SERVICE) {
+            sendSweepRequest(ATT_OP_READ_BY_TYPE_REQUEST, sweepServices.first()->startHandle,
+                             GATT_CHARACTERISTIC);
+            return;
+        }
+
+        // All characteristics are known. Descriptors can only be located between
+        // the value handle of a characteristic and the next characteristic.
+        sweepDescriptorRanges.clear();
+        for (const auto &service : qAsConst(sweepServices)) {
+            QList<QLowEnergyHandle> charHandles = service->characteristicList.keys();
+            std::sort(charHandles.begin(), charHandles.end());
+            for (int i = 0; i < charHandles.count(); ++i) {
+                const QLowEnergyHandle start =
+                        service->characteristicList.value(charHandles.at(i)).valueHandle + 1;
+                const QLowEnergyHandle end = (i + 1 < charHandles.count())
+                        ? charHandles.at(i + 1) - 1 : service->endHandle;
+                if (start > charHandles.at(i) && start <= end)
+                    sweepDescriptorRanges.append({ start, end, charHandles.at(i), service });
+            }
+        }
+
+        if (sweepDescriptorRanges.isEmpty())
+            finishDetailsSweep();
+        else
+            sendSweepRequest(ATT_OP_FIND_INFORMATION_REQUEST,
+                             sweepDescriptorRanges.first().start, 0);
+        return;
+    }
+
+    Q_ASSERT(request.command == ATT_OP_FIND_INFORMATION_REQUEST);
+    if (!isErrorResponse) {
+        /* packet format:
+         *  <opcode><format>[<handle><descriptor_uuid>]+
+         */
+        const quint8 format = response.constData()[1];
+        const int elementLength = (format == 0x01) ? 2 + 2 : 2 + 16;
+        const int numElements = (response.size() - 2) / elementLength;
+        const char *data = response.constData() + 2;
+        for (int i = 0; i < numElements; i++, data += elementLength) {
+            lastHandle = bt_get_le16(data);
+            const QBluetoothUuid uuid = (format == 0x01)
+                    ? QBluetoothUuid(bt_get_le16(&data[2]))
+                    : convert_uuid128(reinterpret_cast<const quint128 *>(&data[2]));
+
+            // skip declarations and value handles between the descriptor ranges
+            auto range = std::lower_bound(sweepDescriptorRanges.constBegin(),
+                                          sweepDescriptorRanges.constEnd(), lastHandle,
+                                          [](const DescriptorRange &r, QLowEnergyHandle h) {
+                                              return r.end < h;
+                                          });
+            if (range == sweepDescriptorRanges.constEnd() || lastHandle < range->start)
+                continue;
+
+            bool ok = false;
+            const quint16 shortUuid = uuid.toUInt16(&ok);
+            if (ok && shortUuid >= QLowEnergyServicePrivate::PrimaryService
+                   && shortUuid <= QLowEnergyServicePrivate::Characteristic) {
+                continue;
+            }
+
+            QLowEnergyServicePrivate::DescData descData;
+            descData.uuid = uuid;
+            range->service->characteristicList[range->charHandle].descriptorList.insert(
+                        lastHandle, descData);
+        }
+    }
+
+    const QLowEnergyHandle nextHandle = (isErrorResponse || lastHandle == 0xffff)
+            ? 0 : nextSweepHandle(lastHandle + 1, ATT_OP_FIND_INFORMATION_REQUEST);
+    if (nextHandle)
+        sendSweepRequest(ATT_OP_FIND_INFORMATION_REQUEST, nextHandle, 0);
+    else
+        finishDetailsSweep();
+}
+
+/*!
+    \internal
+
+    Hands the discovered services over to the regular value reading which
+    completes the discovery of each service.
+ */
+void QLowEnergyControllerPrivateBluez::finishDetailsSweep()
+{
+    const QVector<QSharedPointer<QLowEnergyServicePrivate>> services = sweepServices;
+    sweepServices.clear();
+    sweepDescriptorRanges.clear();
+
+    for (const auto &service : services) {
+        servicesWithKnownDescriptors.insert(service->uuid);
+        readServiceValues(service->uuid, true);
+    }
+}
+
 void QLowEnergyControllerPrivateBluez::sendReadByTypeRequest(
         QSharedPointer<QLowEnergyServicePrivate> serviceData,
         QLowEnergyHandle nextHandle, quint16 attributeType)
@@ -1651,17 +2707,15 @@ void QLowEnergyControllerPrivateBluez::sendReadByTypeRequest(
     putBtData(serviceData->endHandle, &packet[3]);
     putBtData(attributeType, &packet[5]);
 
-    QByteArray data(READ_BY_TYPE_REQ_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet,  READ_BY_TYPE_REQ_HEADER_SIZE);
     qCDebug(QT_BT_BLUEZ) << "Sending read_by_type request, startHandle:" << Qt::hex
              << nextHandle << "endHandle:" << serviceData->endHandle
-             << "type:" << attributeType << "packet:" << data.toHex();
+             << "type:" << attributeType;
 
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), READ_BY_TYPE_REQ_HEADER_SIZE);
     request.command = ATT_OP_READ_BY_TYPE_REQUEST;
-    request.reference = QVariant::fromValue(serviceData);
-    request.reference2 = attributeType;
+    request.service = serviceData;
+    request.attributeType = attributeType;
     openRequests.enqueue(request);
 
     sendNextPendingRequest();
@@ -1675,11 +2729,15 @@ void QLowEnergyControllerPrivateBluez::sendReadByTypeRequest(
 
     \a readCharacteristics determines whether we intend to read a characteristic;
     otherwise we read a descriptor.
+
+    If batched reads are enabled, values of a known fixed size are combined into
+    ATT Read Multiple requests and all other values into ATT Read Multiple Variable
+    requests. Values which do not fit into such a response are read again
+    via a regular read request (see processReply()).
  */
 void QLowEnergyControllerPrivateBluez::readServiceValues(
         const QBluetoothUuid &serviceUuid, bool readCharacteristics)
 {
-    quint8 packet[READ_REQUEST_HEADER_SIZE];
     if (QT_BT_BLUEZ().isDebugEnabled()) {
         if (readCharacteristics)
             qCDebug(QT_BT_BLUEZ) << "Reading all characteristic values for"
@@ -1691,12 +2749,14 @@ void QLowEnergyControllerPrivateBluez::readServiceValues(
 
     QSharedPointer<QLowEnergyServicePrivate> service = serviceList.value(serviceUuid);
 
-    // pair.first -> target attribute
-    // pair.second -> context information for read request
-    QPair<QLowEnergyHandle, quint32> pair;
+    struct ReadTarget {
+        QLowEnergyHandle attributeHandle;   // handle to be read
+        uint handleData;                    // context information for read request
+        int fixedSize;                      // -1 if value size is unknown
+    };
 
     // Create list of attribute handles which need to be read
-    QList<QPair<QLowEnergyHandle, quint32> > targetHandles;
+    QVector<ReadTarget> targets;
 
     CharacteristicDataMap::const_iterator charIt = service->characteristicList.constBegin();
     for ( ; charIt != service->characteristicList.constEnd(); ++charIt) {
@@ -1710,25 +2770,22 @@ void QLowEnergyControllerPrivateBluez::readServiceValues(
             if (!(charDetails.properties & QLowEnergyCharacteristic::Read))
                 continue;
 
-            pair.first = charDetails.valueHandle;
-            pair.second  = charHandle;
-            targetHandles.append(pair);
-
+            targets.append({ charDetails.valueHandle, charHandle, -1 });
         } else {
             // Collect handles of all descriptor attributes
             DescriptorDataMap::const_iterator descIt = charDetails.descriptorList.constBegin();
             for ( ; descIt != charDetails.descriptorList.constEnd(); ++descIt) {
                 const QLowEnergyHandle descriptorHandle = descIt.key();
 
-                pair.first = descriptorHandle;
-                pair.second = (charHandle | (descriptorHandle << 16));
-                targetHandles.append(pair);
+                targets.append({ descriptorHandle,
+                                 uint(charHandle | (descriptorHandle << 16)),
+                                 fixedDescriptorValueSize(descIt.value().uuid) });
             }
         }
     }
 
 
-    if (targetHandles.isEmpty()) {
+    if (targets.isEmpty()) {
         if (readCharacteristics) {
             // none of the characteristics is readable
             // -> continue with descriptor discovery
@@ -1740,26 +2797,118 @@ void QLowEnergyControllerPrivateBluez::readServiceValues(
         return;
     }
 
-    for (int i = 0; i < targetHandles.count(); i++) {
-        pair = targetHandles.at(i);
-        packet[0] = ATT_OP_READ_REQUEST;
-        putBtData(pair.first, &packet[1]);
+    QVector<Request> requests;
+    QVector<ReadTarget> fixedSizeBatch;
+    QVector<ReadTarget> variableSizeBatch;
+    int fixedSizeBatchValueSize = 0;
+
+    const int maxHandlesPerRequest = (mtuSize - READ_MULTIPLE_REQUEST_HEADER_SIZE)
+                                        / int(sizeof(QLowEnergyHandle));
+    // The value sizes are unknown. Limit the number of handles such that an average
+    // value does not get truncated, otherwise we pay for the truncation with an
+    // additional read request.
+    const int maxVariableHandlesPerRequest = qBound(2,
+            (mtuSize - READ_MULTIPLE_REQUEST_HEADER_SIZE)
+                        / (int(sizeof(quint16)) + averageReadMultipleValueSize),
+            maxHandlesPerRequest);
+
+    const auto flushBatch = [this, &requests](QVector<ReadTarget> &batch, quint8 command) {
+        if (batch.count() == 1) {
+            requests.append(createReadRequest(batch.first().attributeHandle,
+                                              batch.first().handleData));
+        } else if (batch.count() > 1) {
+            QVector<QLowEnergyHandle> attributeHandles;
+            QVector<uint> handleData;
+            for (const ReadTarget &target : qAsConst(batch)) {
+                attributeHandles.append(target.attributeHandle);
+                handleData.append(target.handleData);
+            }
+            requests.append(createReadMultipleRequest(command, attributeHandles, handleData));
+        }
+        batch.clear();
+    };
 
-        QByteArray data(READ_REQUEST_HEADER_SIZE, Qt::Uninitialized);
-        memcpy(data.data(), packet,  READ_REQUEST_HEADER_SIZE);
+    for (const ReadTarget &target : qAsConst(targets)) {
+        if (!batchedDiscoveryReads) {
+            requests.append(createReadRequest(target.attributeHandle, target.handleData));
+        } else if (target.fixedSize > 0 && readMultipleSupported) {
+            if (fixedSizeBatch.count() == maxHandlesPerRequest
+                    || fixedSizeBatchValueSize + target.fixedSize
+                            > mtuSize - READ_MULTIPLE_REQUEST_HEADER_SIZE) {
+                flushBatch(fixedSizeBatch, ATT_OP_READ_MULTIPLE_REQUEST);
+                fixedSizeBatchValueSize = 0;
+            }
+            fixedSizeBatch.append(target);
+            fixedSizeBatchValueSize += target.fixedSize;
+        } else if (readMultipleVariableSupported) {
+            if (variableSizeBatch.count() == maxVariableHandlesPerRequest)
+                flushBatch(variableSizeBatch, ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST);
+            variableSizeBatch.append(target);
+        } else {
+            requests.append(createReadRequest(target.attributeHandle, target.handleData));
+        }
+    }
+    flushBatch(fixedSizeBatch, ATT_OP_READ_MULTIPLE_REQUEST);
+    flushBatch(variableSizeBatch, ATT_OP_READ_MULTIPLE_VARIABLE_REQUEST);
 
-        Request request;
-        request.payload = data;
-        request.command = ATT_OP_READ_REQUEST;
-        request.reference = pair.second;
-        // last entry?
-        request.reference2 = QVariant((bool)(i + 1 == targetHandles.count()));
+    qCDebug(QT_BT_BLUEZ) << "Reading" << targets.count() << "values of" << serviceUuid.toString()
+                         << "using" << requests.count() << "requests";
+
+    // last entry triggers the next discovery step
+    requests.last().isLastValue = true;
+    for (const Request &request : qAsConst(requests))
         openRequests.enqueue(request);
-    }
 
     sendNextPendingRequest();
 }
 
+/*!
+    \internal
+
+    Creates a read request for a single characteristic or descriptor value
+    during service discovery. \a handleData contains the characteristic handle
+    in the lower 16 bit and the descriptor handle (if any) in the upper 16 bit.
+ */
+QLowEnergyControllerPrivateBluez::Request QLowEnergyControllerPrivateBluez::createReadRequest(
+        QLowEnergyHandle attributeHandle, uint handleData)
+{
+    Request request;
+    request.payload.resize(READ_REQUEST_HEADER_SIZE);
+    request.payload[0] = ATT_OP_READ_REQUEST;
+    putBtData(attributeHandle, request.payload.data() + 1);
+
+    request.command = ATT_OP_READ_REQUEST;
+    request.handleData = handleData;
+    return request;
+}
+
+/*!
+    \internal
+
+    Creates an ATT Read Multiple (Variable) request for \a attributeHandles.
+    \a handleData contains the read context for each of the handles
+    (see createReadRequest()).
+ */
+QLowEnergyControllerPrivateBluez::Request QLowEnergyControllerPrivateBluez::createReadMultipleRequest(
+        quint8 command, const QVector<QLowEnergyHandle> &attributeHandles,
+        const QVector<uint> &handleData)
+{
+    Q_ASSERT(attributeHandles.count() >= 2);
+    Q_ASSERT(attributeHandles.count() == handleData.count());
+
+    Request request;
+    request.payload.resize(READ_MULTIPLE_REQUEST_HEADER_SIZE
+                           + attributeHandles.count() * int(sizeof(QLowEnergyHandle)));
+    request.payload[0] = command;
+    char *handleDataPtr = request.payload.data() + READ_MULTIPLE_REQUEST_HEADER_SIZE;
+    for (const QLowEnergyHandle handle : attributeHandles)
+        putDataAndIncrement(handle, handleDataPtr);
+
+    request.command = command;
+    request.handleDataList = handleData;
+    return request;
+}
+
 /*!
     \internal
 
@@ -1776,7 +2925,9 @@ void QLowEnergyControllerPrivateBluez::readServiceValuesByOffset(
     const QLowEnergyHandle charHandle = (handleData & 0xffff);
     const QLowEnergyHandle descriptorHandle = ((handleData >> 16) & 0xffff);
 
-    QByteArray data(READ_BLOB_REQUEST_HEADER_SIZE, Qt::Uninitialized);
+    Request request;
+    LeAttPdu &data = request.payload;
+    data.resize(READ_BLOB_REQUEST_HEADER_SIZE);
     data[0] = ATT_OP_READ_BLOB_REQUEST;
 
     QLowEnergyHandle handleToRead = charHandle;
@@ -1801,12 +2952,10 @@ void QLowEnergyControllerPrivateBluez::readServiceValuesByOffset(
     putBtData(handleToRead, data.data() + 1);
     putBtData(offset, data.data() + 3);
 
-    Request request;
-    request.payload = data;
     request.command = ATT_OP_READ_BLOB_REQUEST;
-    request.reference = handleData;
-    request.reference2 = isLastValue;
-    openRequests.prepend(request);
+    request.handleData = handleData;
+    request.isLastValue = isLastValue;
+    prependRequest(request);
 }
 
 void QLowEnergyControllerPrivateBluez::discoverServiceDescriptors(
@@ -1822,6 +2971,12 @@ void QLowEnergyControllerPrivateBluez::discoverServiceDescriptors(
         return;
     }
 
+    if (servicesWithKnownDescriptors.contains(serviceUuid)) {
+        // descriptors are known from GATT cache or discovery sweep
+        readServiceValues(serviceUuid, false);
+        return;
+    }
+
     // start handle of all known characteristics
     QList<QLowEnergyHandle> keys = service->characteristicList.keys();
     std::sort(keys.begin(), keys.end());
@@ -1829,12 +2984,24 @@ void QLowEnergyControllerPrivateBluez::discoverServiceDescriptors(
     discoverNextDescriptor(service, keys, keys[0]);
 }
 
-void QLowEnergyControllerPrivateBluez::processUnsolicitedReply(const QByteArray &payload)
+void QLowEnergyControllerPrivateBluez::processUnsolicitedReply(const char *data, int size)
 {
-    const char *data = payload.constData();
+    if (size < 3) {
+        qCWarning(QT_BT_BLUEZ) << "Received malformed notification/indication";
+        return;
+    }
+
     bool isNotification = (data[0] == ATT_OP_HANDLE_VAL_NOTIFICATION);
     const QLowEnergyHandle changedHandle = bt_get_le16(&data[1]);
 
+    if (gattCache && !isNotification && changedHandle
+            && changedHandle == cachedDatabase.serviceChangedHandle()) {
+        // the attribute layout of the peer has changed
+        qCDebug(QT_BT_BLUEZ) << "Service Changed indication received, discarding GATT cache";
+        invalidateGattCache();
+        gattCacheStale = true;
+    }
+
     if (QT_BT_BLUEZ().isDebugEnabled()) {
         if (isNotification)
             qCDebug(QT_BT_BLUEZ) << "Change notification for handle" << Qt::hex << changedHandle;
@@ -1843,14 +3010,47 @@ void QLowEnergyControllerPrivateBluez::processUnsolicitedReply(const QByteArray
     }
 
     const QLowEnergyCharacteristic ch = characteristicForHandle(changedHandle);
-    if (ch.isValid() && ch.handle() == changedHandle) {
-        if (ch.properties() & QLowEnergyCharacteristic::Read)
-            updateValueOfCharacteristic(ch.attributeHandle(), payload.mid(3), NEW_VALUE);
-        emit ch.d_ptr->characteristicChanged(ch, payload.mid(3));
-    } else {
+    if (!ch.isValid() || ch.handle() != changedHandle) {
         qCWarning(QT_BT_BLUEZ) << "Cannot find matching characteristic for "
                                   "notification/indication";
+        return;
+    }
+
+    const QSharedPointer<QLowEnergyServicePrivate> &service = ch.d_ptr;
+    const auto charData = service->characteristicList.constFind(ch.attributeHandle());
+    const bool updateValue = (ch.properties() & QLowEnergyCharacteristic::Read)
+            && charData != service->characteristicList.constEnd() && !charData->streamOnly;
+
+    if (service->notificationBatchHandler) {
+        if (updateValue)
+            updateValueOfCharacteristic(ch.attributeHandle(), QByteArray(data + 3, size - 3),
+                                        NEW_VALUE);
+        if (!notificationBatchServices.contains(service)) {
+            if (notificationBatchServices.isEmpty()) {
+                QMetaObject::invokeMethod(this,
+                        &QLowEnergyControllerPrivateBluez::deliverNotificationBatches,
+                        Qt::QueuedConnection);
+            }
+            notificationBatchServices.append(service);
+        }
+        service->queueNotification(ch, data + 3, size - 3);
+        return;
     }
+
+    const QByteArray value(data + 3, size - 3);
+    if (updateValue)
+        updateValueOfCharacteristic(ch.attributeHandle(), value, NEW_VALUE);
+    emit service->characteristicChanged(ch, value);
+}
+
+void QLowEnergyControllerPrivateBluez::deliverNotificationBatches()
+{
+    const QVector<QSharedPointer<QLowEnergyServicePrivate>> services
+            = std::move(notificationBatchServices);
+    notificationBatchServices.clear();
+
+    for (const auto &service : services)
+        service->deliverNotificationBatch();
 }
 
 void QLowEnergyControllerPrivateBluez::exchangeMTU()
@@ -1861,11 +3061,8 @@ void QLowEnergyControllerPrivateBluez::exchangeMTU()
     packet[0] = ATT_OP_EXCHANGE_MTU_REQUEST;
     putBtData(quint16(ATT_MAX_LE_MTU), &packet[1]);
 
-    QByteArray data(MTU_EXCHANGE_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet, MTU_EXCHANGE_HEADER_SIZE);
-
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), MTU_EXCHANGE_HEADER_SIZE);
     request.command = ATT_OP_EXCHANGE_MTU_REQUEST;
     openRequests.enqueue(request);
 
@@ -1874,7 +3071,11 @@ void QLowEnergyControllerPrivateBluez::exchangeMTU()
 
 int QLowEnergyControllerPrivateBluez::securityLevel() const
 {
-    int socket = l2cpSocket->socketDescriptor();
+    return securityLevel(l2cpSocket->socketDescriptor());
+}
+
+int QLowEnergyControllerPrivateBluez::securityLevel(int socket)
+{
     if (socket < 0) {
         qCWarning(QT_BT_BLUEZ) << "Invalid l2cp socket, aborting getting of sec level";
         return -1;
@@ -1982,77 +3183,68 @@ void QLowEnergyControllerPrivateBluez::discoverNextDescriptor(
     putBtData(charStartHandle, &packet[1]);
     putBtData(charEndHandle, &packet[3]);
 
-    QByteArray data(FIND_INFO_REQUEST_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet, FIND_INFO_REQUEST_HEADER_SIZE);
-
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), FIND_INFO_REQUEST_HEADER_SIZE);
     request.command = ATT_OP_FIND_INFORMATION_REQUEST;
-    request.reference = QVariant::fromValue<QList<QLowEnergyHandle> >(pendingCharHandles);
-    request.reference2 = startingHandle;
+    request.service = serviceData;
+    request.pendingCharHandles = pendingCharHandles;
+    request.startHandle = startingHandle;
     openRequests.enqueue(request);
 
     sendNextPendingRequest();
 }
 
-void QLowEnergyControllerPrivateBluez::sendNextPrepareWriteRequest(
-        const QLowEnergyHandle handle, const QByteArray &newValue,
-        quint16 offset)
-{
-    // is it a descriptor or characteristic?
-    QLowEnergyHandle targetHandle = 0;
-    const QLowEnergyDescriptor descriptor = descriptorForHandle(handle);
-    if (descriptor.isValid())
-        targetHandle = descriptor.handle();
-    else
-        targetHandle = characteristicForHandle(handle).handle();
-
-    if (!targetHandle) {
-        qCWarning(QT_BT_BLUEZ) << "sendNextPrepareWriteRequest cancelled due to invalid handle"
-                               << handle;
-        return;
-    }
-
-    quint8 packet[PREPARE_WRITE_HEADER_SIZE];
-    packet[0] = ATT_OP_PREPARE_WRITE_REQUEST;
-    putBtData(targetHandle, &packet[1]); // attribute handle
-    putBtData(offset, &packet[3]); // offset into newValue
-
-    qCDebug(QT_BT_BLUEZ) << "Writing long characteristic (prepare):"
-                         << Qt::hex << handle;
-
+/*!
+    \internal
 
-    const int maxAvailablePayload = mtuSize - PREPARE_WRITE_HEADER_SIZE;
-    const int requiredPayload = qMin(newValue.size() - offset, maxAvailablePayload);
-    const int dataSize = PREPARE_WRITE_HEADER_SIZE + requiredPayload;
+    Starts the long or reliable \a write. All prepare write requests are built
+    for the current MTU before the first one is queued.
+ */
+void QLowEnergyControllerPrivateBluez::startPreparedWrite(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QSharedPointer<LePreparedWrite> &write)
+{
+    write->buildSegments(mtuSize);
+    qCDebug(QT_BT_BLUEZ) << "Writing" << write->entries().count() << "value(s) using"
+                         << write->segmentCount() << "prepare write requests";
 
-    Q_ASSERT((offset + requiredPayload) <= newValue.size());
-    Q_ASSERT(dataSize <= mtuSize);
+    sendPrepareWriteRequest(service, write, 0);
+    sendNextPendingRequest();
+}
 
-    QByteArray data(dataSize, Qt::Uninitialized);
-    memcpy(data.data(), packet, PREPARE_WRITE_HEADER_SIZE);
-    memcpy(&(data.data()[PREPARE_WRITE_HEADER_SIZE]), &(newValue.constData()[offset]),
-                                               requiredPayload);
+void QLowEnergyControllerPrivateBluez::sendPrepareWriteRequest(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QSharedPointer<LePreparedWrite> &write, int segment)
+{
+    int size = 0;
+    const char *pdu = write->segment(segment, &size);
+    Q_ASSERT(size <= mtuSize);
 
     Request request;
-    request.payload = data;
+    request.payload.append(pdu, size);
     request.command = ATT_OP_PREPARE_WRITE_REQUEST;
-    request.reference = (handle | ((offset + requiredPayload) << 16));
-    request.reference2 = newValue;
-    openRequests.enqueue(request);
+    request.service = service;
+    request.preparedWrite = write;
+    request.handleData = uint(segment);
+
+    // Subsequent prepare requests continue the running write. They must be
+    // sent before any other request to keep the prepare queue of the server consistent.
+    if (segment == 0)
+        openRequests.enqueue(request);
+    else
+        prependRequest(request);
 }
 
 /*!
-    Sends an "Execute Write Request" for a long characteristic or descriptor write.
-    This cannot be used for executes in relation to reliable write requests.
+    Sends an "Execute Write Request" for a long or reliable \a write.
 
     A cancellation removes all pending prepare write request on the GATT server.
     Otherwise this function sends an execute request for all pending prepare
     write requests.
  */
 void QLowEnergyControllerPrivateBluez::sendExecuteWriteRequest(
-        const QLowEnergyHandle attrHandle, const QByteArray &newValue,
-        bool isCancelation)
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QSharedPointer<LePreparedWrite> &write, bool isCancelation)
 {
     quint8 packet[EXECUTE_WRITE_HEADER_SIZE];
     packet[0] = ATT_OP_EXECUTE_WRITE_REQUEST;
@@ -2061,26 +3253,22 @@ void QLowEnergyControllerPrivateBluez::sendExecuteWriteRequest(
     else
         packet[1] = 0x01; // execute pending write prepare requests
 
-    QByteArray data(EXECUTE_WRITE_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet, EXECUTE_WRITE_HEADER_SIZE);
-
-    qCDebug(QT_BT_BLUEZ) << "Sending Execute Write Request for long characteristic value"
-                         << Qt::hex << attrHandle;
+    qCDebug(QT_BT_BLUEZ) << "Sending Execute Write Request for"
+                         << write->entries().count() << "value(s), cancel:" << isCancelation;
 
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), EXECUTE_WRITE_HEADER_SIZE);
     request.command = ATT_OP_EXECUTE_WRITE_REQUEST;
-    request.reference  = (attrHandle | ((isCancelation ? 0x00 : 0x01) << 16));
-    request.reference2 = newValue;
-    openRequests.prepend(request);
+    request.service = service;
+    request.preparedWrite = write;
+    request.handleData = isCancelation ? 0x00 : 0x01;
+    prependRequest(request);
 }
 
 
 /*!
     Writes long (prepare write request), short (write request)
     and writeWithoutResponse characteristic values.
-
-    TODO Reliable/prepare write across multiple characteristics is not supported
  */
 void QLowEnergyControllerPrivateBluez::writeCharacteristic(
         const QSharedPointer<QLowEnergyServicePrivate> service,
@@ -2111,7 +3299,38 @@ void QLowEnergyControllerPrivateBluez::writeDescriptor(
     if (role == QLowEnergyController::PeripheralRole)
         writeDescriptorForPeripheral(service, charHandle, descriptorHandle, newValue);
     else
-        writeDescriptorForCentral(charHandle, descriptorHandle, newValue);
+        writeDescriptorForCentral(service, charHandle, descriptorHandle, newValue);
+}
+
+/*!
+    \internal
+
+    Writes all \a values within a single prepare queue on the remote device.
+    Either all or none of the values are written.
+ */
+void QLowEnergyControllerPrivateBluez::writeCharacteristicsReliably(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QVector<QPair<QLowEnergyHandle, QByteArray>> &values)
+{
+    Q_ASSERT(!service.isNull());
+    Q_ASSERT(role == QLowEnergyController::CentralRole);
+
+    const auto write = QSharedPointer<LePreparedWrite>::create();
+    for (const auto &value : values) {
+        const auto it = service->characteristicList.constFind(value.first);
+        if (it == service->characteristicList.constEnd()) {
+            service->setError(QLowEnergyService::OperationError);
+            return;
+        }
+
+        LePreparedWrite::Entry entry;
+        entry.charHandle = value.first;
+        entry.attributeHandle = it->valueHandle;
+        entry.value = value.second;
+        write->addEntry(entry);
+    }
+
+    startPreparedWrite(service, write);
 }
 
 /*!
@@ -2140,21 +3359,18 @@ void QLowEnergyControllerPrivateBluez::readCharacteristic(
     packet[0] = ATT_OP_READ_REQUEST;
     putBtData(charDetails.valueHandle, &packet[1]);
 
-    QByteArray data(READ_REQUEST_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet,  READ_REQUEST_HEADER_SIZE);
-
     qCDebug(QT_BT_BLUEZ) << "Targeted reading characteristic" << Qt::hex << charHandle;
 
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), READ_REQUEST_HEADER_SIZE);
     request.command = ATT_OP_READ_REQUEST;
-    request.reference = charHandle;
-    // reference2 not really required but false prevents service discovery
+    request.lane = Request::InteractiveLane;
+    request.service = service;
+    request.handleData = charHandle;
+    // isLastValue not really required but false prevents service discovery
     // code from running in ATT_OP_READ_RESPONSE handler
-    request.reference2 = false;
-    openRequests.enqueue(request);
-
-    sendNextPendingRequest();
+    request.isLastValue = false;
+    enqueueInteractiveRequest(request);
 }
 
 void QLowEnergyControllerPrivateBluez::readDescriptor(
@@ -2175,21 +3391,58 @@ void QLowEnergyControllerPrivateBluez::readDescriptor(
     packet[0] = ATT_OP_READ_REQUEST;
     putBtData(descriptorHandle, &packet[1]);
 
-    QByteArray data(READ_REQUEST_HEADER_SIZE, Qt::Uninitialized);
-    memcpy(data.data(), packet,  READ_REQUEST_HEADER_SIZE);
-
     qCDebug(QT_BT_BLUEZ) << "Targeted reading descriptor" << Qt::hex << descriptorHandle;
 
     Request request;
-    request.payload = data;
+    request.payload.append(reinterpret_cast<const char *>(packet), READ_REQUEST_HEADER_SIZE);
     request.command = ATT_OP_READ_REQUEST;
-    request.reference = (charHandle | (descriptorHandle << 16));
-    // reference2 not really required but false prevents service discovery
+    request.lane = Request::InteractiveLane;
+    request.service = service;
+    request.handleData = (charHandle | (descriptorHandle << 16));
+    // isLastValue not really required but false prevents service discovery
     // code from running in ATT_OP_READ_RESPONSE handler
-    request.reference2 = false;
-    openRequests.enqueue(request);
+    request.isLastValue = false;
+    enqueueInteractiveRequest(request);
+}
 
-    sendNextPendingRequest();
+/*!
+    \internal
+
+    Creates a stream which writes to the characteristic \a charHandle using
+    write commands. The writes are paced by the socket.
+ */
+QIODevice *QLowEnergyControllerPrivateBluez::createWriteStream(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QLowEnergyHandle charHandle, QObject *parent)
+{
+    Q_ASSERT(!service.isNull());
+    if (role != QLowEnergyController::CentralRole || !streamWriter
+            || !service->characteristicList.contains(charHandle)) {
+        return nullptr;
+    }
+
+    return streamWriter->createStream(service->characteristicList[charHandle].valueHandle,
+                                      parent);
+}
+
+/*!
+    \internal
+
+    Removes the queued read and write requests of \a service.
+    Requests which are part of the service discovery are kept.
+ */
+void QLowEnergyControllerPrivateBluez::cancelPendingRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    Q_ASSERT(!service.isNull());
+    if (service->state != QLowEnergyService::ServiceDiscovered)
+        return;
+
+    int cancelled = openRequests.cancel(service.data());
+    if (bearerPool)
+        cancelled += bearerPool->cancel(service.data());
+    qCDebug(QT_BT_BLUEZ) << "Cancelled" << cancelled << "requests of"
+                         << service->uuid.toString();
 }
 
 /*!
@@ -2227,12 +3480,18 @@ bool QLowEnergyControllerPrivateBluez::increaseEncryptLevelfRequired(quint8 erro
 void QLowEnergyControllerPrivateBluez::handleAdvertisingError()
 {
     qCWarning(QT_BT_BLUEZ) << "received advertising error";
+    if (!serverConnections.isEmpty()) {
+        // keep serving the connected centrals
+        closeServerSocket();
+        return;
+    }
     setError(QLowEnergyController::AdvertisingError);
     setState(QLowEnergyController::UnconnectedState);
 }
 
-bool QLowEnergyControllerPrivateBluez::checkPacketSize(const QByteArray &packet, int minSize,
-                                                  int maxSize)
+bool QLowEnergyControllerPrivateBluez::checkPacketSize(LeAttServerConnection *connection,
+                                                       const QByteArray &packet, int minSize,
+                                                       int maxSize)
 {
     if (maxSize == -1)
         maxSize = minSize;
@@ -2240,94 +3499,107 @@ bool QLowEnergyControllerPrivateBluez::checkPacketSize(const QByteArray &packet,
         return true;
     qCWarning(QT_BT_BLUEZ) << "client request of type" << packet.at(0)
                            << "has unexpected packet size" << packet.count();
-    sendErrorResponse(packet.at(0), 0, ATT_ERROR_INVALID_PDU);
+    sendErrorResponse(connection, packet.at(0), 0, ATT_ERROR_INVALID_PDU);
     return false;
 }
 
-bool QLowEnergyControllerPrivateBluez::checkHandle(const QByteArray &packet, QLowEnergyHandle handle)
+bool QLowEnergyControllerPrivateBluez::checkHandle(LeAttServerConnection *connection,
+                                                   const QByteArray &packet,
+                                                   QLowEnergyHandle handle)
 {
     if (handle != 0 && handle <= lastLocalHandle)
         return true;
-    sendErrorResponse(packet.at(0), handle, ATT_ERROR_INVALID_HANDLE);
+    sendErrorResponse(connection, packet.at(0), handle, ATT_ERROR_INVALID_HANDLE);
     return false;
 }
 
-bool QLowEnergyControllerPrivateBluez::checkHandlePair(quint8 request, QLowEnergyHandle startingHandle,
-                                                  QLowEnergyHandle endingHandle)
+bool QLowEnergyControllerPrivateBluez::checkHandlePair(LeAttServerConnection *connection,
+                                                       quint8 request,
+                                                       QLowEnergyHandle startingHandle,
+                                                       QLowEnergyHandle endingHandle)
 {
     if (startingHandle == 0 || startingHandle > endingHandle) {
         qCDebug(QT_BT_BLUEZ) << "handle range invalid";
-        sendErrorResponse(request, startingHandle, ATT_ERROR_INVALID_HANDLE);
+        sendErrorResponse(connection, request, startingHandle, ATT_ERROR_INVALID_HANDLE);
         return false;
     }
     return true;
 }
 
-void QLowEnergyControllerPrivateBluez::handleExchangeMtuRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleExchangeMtuRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.2
 
-    if (!checkPacketSize(packet, 3))
+    if (!checkPacketSize(connection, packet, 3))
         return;
-    if (receivedMtuExchangeRequest) { // Client must only send this once per connection.
+    if (connection->receivedMtuExchangeRequest) { // Client must only send this once per connection.
         qCDebug(QT_BT_BLUEZ) << "Client sent extraneous MTU exchange packet";
-        sendErrorResponse(packet.at(0), 0, ATT_ERROR_REQUEST_NOT_SUPPORTED);
+        sendErrorResponse(connection, packet.at(0), 0, ATT_ERROR_REQUEST_NOT_SUPPORTED);
         return;
     }
-    receivedMtuExchangeRequest = true;
+    connection->receivedMtuExchangeRequest = true;
 
     // Send reply.
     QByteArray reply(MTU_EXCHANGE_HEADER_SIZE, Qt::Uninitialized);
     reply[0] = ATT_OP_EXCHANGE_MTU_RESPONSE;
     putBtData(static_cast<quint16>(ATT_MAX_LE_MTU), reply.data() + 1);
-    sendPacket(reply);
+    connection->sendPdu(reply.constData(), reply.size());
 
     // Apply requested MTU.
     const quint16 clientRxMtu = bt_get_le16(packet.constData() + 1);
-    mtuSize = qMax<quint16>(ATT_DEFAULT_LE_MTU, qMin<quint16>(clientRxMtu, ATT_MAX_LE_MTU));
+    connection->mtuSize = qMax<quint16>(ATT_DEFAULT_LE_MTU,
+                                        qMin<quint16>(clientRxMtu, ATT_MAX_LE_MTU));
     qCDebug(QT_BT_BLUEZ) << "MTU request from client:" << clientRxMtu
-                         << "effective client RX MTU:" << mtuSize;
+                         << "effective client RX MTU:" << connection->mtuSize;
     qCDebug(QT_BT_BLUEZ) << "Sending server RX MTU" << ATT_MAX_LE_MTU;
 }
 
-void QLowEnergyControllerPrivateBluez::handleFindInformationRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleFindInformationRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.3.1-2
 
-    if (!checkPacketSize(packet, 5))
+    if (!checkPacketSize(connection, packet, 5))
         return;
     const QLowEnergyHandle startingHandle = bt_get_le16(packet.constData() + 1);
     const QLowEnergyHandle endingHandle = bt_get_le16(packet.constData() + 3);
     qCDebug(QT_BT_BLUEZ) << "client sends find information request; start:" << startingHandle
                          << "end:" << endingHandle;
-    if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
+    if (!checkHandlePair(connection, packet.at(0), startingHandle, endingHandle))
         return;
 
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle);
-    if (results.isEmpty()) {
-        sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+    if (startingHandle > lastLocalHandle) {
+        sendErrorResponse(connection, packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
     }
-    ensureUniformUuidSizes(results);
 
-    QByteArray responsePrefix(2, Qt::Uninitialized);
-    const int uuidSize = getUuidSize(results.first().type);
-    responsePrefix[0] = ATT_OP_FIND_INFORMATION_RESPONSE;
-    responsePrefix[1] = uuidSize == 2 ? 0x1 : 0x2;
+    // All elements must have the same UUID size as the first one.
+    const int lastHandle = qMin(endingHandle, lastLocalHandle);
+    const int uuidSize = getUuidSize(localAttributes.at(startingHandle).type);
     const int elementSize = sizeof(QLowEnergyHandle) + uuidSize;
-    const auto elemWriter = [](const Attribute &attr, char *&data) {
+    char *header = responseBuilder.startList(ATT_OP_FIND_INFORMATION_RESPONSE,
+                                             connection->mtuSize, elementSize, 1);
+    putDataAndIncrement(quint8(uuidSize == 2 ? 0x1 : 0x2), header);
+    for (int handle = startingHandle; handle <= lastHandle; ++handle) {
+        const Attribute &attr = localAttributes.at(handle);
+        if (getUuidSize(attr.type) != uuidSize)
+            break;
+        char *data = responseBuilder.nextElement();
+        if (!data)
+            break;
         putDataAndIncrement(attr.handle, data);
         putDataAndIncrement(attr.type, data);
-    };
-    sendListResponse(responsePrefix, elementSize, results, elemWriter);
-
+    }
+    sendResponse(connection, responseBuilder.listEnd());
 }
 
-void QLowEnergyControllerPrivateBluez::handleFindByTypeValueRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleFindByTypeValueRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.3.3-4
 
-    if (!checkPacketSize(packet, 7, mtuSize))
+    if (!checkPacketSize(connection, packet, 7, connection->mtuSize))
         return;
     const QLowEnergyHandle startingHandle = bt_get_le16(packet.constData() + 1);
     const QLowEnergyHandle endingHandle = bt_get_le16(packet.constData() + 3);
@@ -2336,33 +3608,39 @@ void QLowEnergyControllerPrivateBluez::handleFindByTypeValueRequest(const QByteA
     qCDebug(QT_BT_BLUEZ) << "client sends find by type value request; start:" << startingHandle
                          << "end:" << endingHandle << "type:" << type
                          << "value:" << value.toHex();
-    if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
+    if (!checkHandlePair(connection, packet.at(0), startingHandle, endingHandle))
         return;
 
-    const auto predicate = [value, this, type](const Attribute &attr) {
-        return attr.type == QBluetoothUuid(type) && attr.value == value
-                && checkReadPermissions(attr) == 0;
-    };
-    const QVector<Attribute> results = getAttributes(startingHandle, endingHandle, predicate);
-    if (results.isEmpty()) {
-        sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
-        return;
-    }
-
-    QByteArray responsePrefix(1, ATT_OP_FIND_BY_TYPE_VALUE_RESPONSE);
-    const int elemSize = 2 * sizeof(QLowEnergyHandle);
-    const auto elemWriter = [](const Attribute &attr, char *&data) {
+    const LocalAttributeRange handles = localAttributesOfType(QBluetoothUuid(type), startingHandle,
+                                                              endingHandle);
+    const int elementSize = 2 * sizeof(QLowEnergyHandle);
+    responseBuilder.startList(ATT_OP_FIND_BY_TYPE_VALUE_RESPONSE, connection->mtuSize,
+                              elementSize, 0);
+    for (auto it = handles.first; it != handles.second; ++it) {
+        const Attribute &attr = localAttributes.at(*it);
+        if (localAttributeValue(connection, attr) != value
+                || checkReadPermissions(connection, attr) != 0) {
+            continue;
+        }
+        char *data = responseBuilder.nextElement();
+        if (!data)
+            break;
         putDataAndIncrement(attr.handle, data);
         putDataAndIncrement(attr.groupEndHandle, data);
-    };
-    sendListResponse(responsePrefix, elemSize, results, elemWriter);
+    }
+    if (responseBuilder.elementCount() == 0) {
+        sendErrorResponse(connection, packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+        return;
+    }
+    sendResponse(connection, responseBuilder.listEnd());
 }
 
-void QLowEnergyControllerPrivateBluez::handleReadByTypeRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleReadByTypeRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.1-2
 
-    if (!checkPacketSize(packet, 7, 21))
+    if (!checkPacketSize(connection, packet, 7, 21))
         return;
     const QLowEnergyHandle startingHandle = bt_get_le16(packet.constData() + 1);
     const QLowEnergyHandle endingHandle = bt_get_le16(packet.constData() + 3);
@@ -2376,112 +3654,252 @@ void QLowEnergyControllerPrivateBluez::handleReadByTypeRequest(const QByteArray
         type = QBluetoothUuid(convert_uuid128(reinterpret_cast<const quint128 *>(typeStart)));
     } else {
         qCWarning(QT_BT_BLUEZ) << "read by type request has invalid packet size" << packet.count();
-        sendErrorResponse(packet.at(0), 0, ATT_ERROR_INVALID_PDU);
+        sendErrorResponse(connection, packet.at(0), 0, ATT_ERROR_INVALID_PDU);
         return;
     }
     qCDebug(QT_BT_BLUEZ) << "client sends read by type request, start:" << startingHandle
                          << "end:" << endingHandle << "type:" << type;
-    if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
+    if (!checkHandlePair(connection, packet.at(0), startingHandle, endingHandle))
         return;
 
-    // Get all attributes with matching type.
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle,
-        [type](const Attribute &attr) { return attr.type == type; });
-    ensureUniformValueSizes(results);
-
-    if (results.isEmpty()) {
-        sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+    const LocalAttributeRange handles = localAttributesOfType(type, startingHandle, endingHandle);
+    if (handles.first == handles.second) {
+        sendErrorResponse(connection, packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
     }
-
-    const int error = checkReadPermissions(results);
+    const Attribute &firstAttr = localAttributes.at(*handles.first);
+    const int error = checkReadPermissions(connection, firstAttr);
     if (error) {
-        sendErrorResponse(packet.at(0), results.first().handle, error);
+        sendErrorResponse(connection, packet.at(0), firstAttr.handle, error);
         return;
     }
 
-    const int elementSize = sizeof(QLowEnergyHandle) + results.first().value.count();
-    QByteArray responsePrefix(2, Qt::Uninitialized);
-    responsePrefix[0] = ATT_OP_READ_BY_TYPE_RESPONSE;
-    responsePrefix[1] = elementSize;
-    const auto elemWriter = [](const Attribute &attr, char *&data) {
+    const int valueSize = localAttributeValue(connection, firstAttr).count();
+    const int elementSize = sizeof(QLowEnergyHandle) + valueSize;
+    char *header = responseBuilder.startList(ATT_OP_READ_BY_TYPE_RESPONSE, connection->mtuSize,
+                                             elementSize, 1);
+    putDataAndIncrement(quint8(elementSize), header);
+    for (auto it = handles.first; it != handles.second; ++it) {
+        const Attribute &attr = localAttributes.at(*it);
+        if (!fitsListElement(connection, attr, valueSize))
+            break;
+        char *data = responseBuilder.nextElement();
+        if (!data)
+            break;
         putDataAndIncrement(attr.handle, data);
-        putDataAndIncrement(attr.value, data);
-    };
-    sendListResponse(responsePrefix, elementSize, results, elemWriter);
+        putDataAndIncrement(localAttributeValue(connection, attr), data);
+    }
+    sendResponse(connection, responseBuilder.listEnd());
 }
 
-void QLowEnergyControllerPrivateBluez::handleReadRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleReadRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.3-4
 
-    if (!checkPacketSize(packet, 3))
+    if (!checkPacketSize(connection, packet, 3))
         return;
     const QLowEnergyHandle handle = bt_get_le16(packet.constData() + 1);
     qCDebug(QT_BT_BLUEZ) << "client sends read request; handle:" << handle;
 
-    if (!checkHandle(packet, handle))
+    if (!checkHandle(connection, packet, handle))
         return;
     const Attribute &attribute = localAttributes.at(handle);
-    const int permissionsError = checkReadPermissions(attribute);
+    const int permissionsError = checkReadPermissions(connection, attribute);
     if (permissionsError) {
-        sendErrorResponse(packet.at(0), handle, permissionsError);
+        sendErrorResponse(connection, packet.at(0), handle, permissionsError);
         return;
     }
 
-    const int sentValueLength = qMin(attribute.value.count(), mtuSize - 1);
-    QByteArray response(1 + sentValueLength, Qt::Uninitialized);
-    response[0] = ATT_OP_READ_RESPONSE;
-    using namespace std;
-    memcpy(response.data() + 1, attribute.value.constData(), sentValueLength);
-    qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
-    sendPacket(response);
+    if (readLocalValueOnDemand(connection, packet.at(0), handle, 0))
+        sendReadResponse(connection, packet.at(0), handle, 0);
 }
 
-void QLowEnergyControllerPrivateBluez::handleReadBlobRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleReadBlobRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.5-6
 
-    if (!checkPacketSize(packet, 5))
+    if (!checkPacketSize(connection, packet, 5))
         return;
     const QLowEnergyHandle handle = bt_get_le16(packet.constData() + 1);
     const quint16 valueOffset = bt_get_le16(packet.constData() + 3);
     qCDebug(QT_BT_BLUEZ) << "client sends read blob request; handle:" << handle
                          << "offset:" << valueOffset;
 
-    if (!checkHandle(packet, handle))
+    if (!checkHandle(connection, packet, handle))
         return;
     const Attribute &attribute = localAttributes.at(handle);
-    const int permissionsError = checkReadPermissions(attribute);
+    const int permissionsError = checkReadPermissions(connection, attribute);
     if (permissionsError) {
-        sendErrorResponse(packet.at(0), handle, permissionsError);
+        sendErrorResponse(connection, packet.at(0), handle, permissionsError);
         return;
     }
-    if (valueOffset > attribute.value.count()) {
-        sendErrorResponse(packet.at(0), handle, ATT_ERROR_INVALID_OFFSET);
-        return;
+
+    if (readLocalValueOnDemand(connection, packet.at(0), handle, valueOffset))
+        sendReadResponse(connection, packet.at(0), handle, valueOffset);
+}
+
+/*
+  Calls the read handler of the local characteristic whose value has \a handle, if
+  there is one. Returns true if the value can be sent right away. Otherwise the
+  response to \a request is sent by provideCharacteristicValue() or, if the
+  application does not provide the value in time, by expireDeferredReads().
+ */
+bool QLowEnergyControllerPrivateBluez::readLocalValueOnDemand(
+        LeAttServerConnection *connection, quint8 request, QLowEnergyHandle handle,
+        quint16 offset)
+{
+    const AttributeOwner &owner = localAttributeOwners.at(handle);
+    const QLowEnergyServicePrivate::CharData *charData = owner.characteristicData(handle);
+    if (!charData || !charData->readHandler)
+        return true;
+
+    // The handler may answer the read from within via provideCharacteristicValue().
+    const quint64 id = ++lastDeferredReadId;
+    deferredReads.append({ id, connection, request, handle, offset,
+                           QDeadlineTimer(deferredReadTimeout) });
+    const QLowEnergyService::CharacteristicReadHandler handler = charData->readHandler;
+    const QLowEnergyCharacteristic characteristic(owner.service, owner.charHandle);
+    QByteArray value = localAttributes.at(handle).value;
+    const bool provided = handler(characteristic, offset, &value);
+
+    const auto it = std::find_if(deferredReads.begin(), deferredReads.end(),
+                                 [id](const DeferredRead &read) { return read.id == id; });
+    if (it == deferredReads.end())
+        return false;
+    if (!provided) {
+        qCDebug(QT_BT_BLUEZ) << "deferring read of attribute" << handle;
+        restartDeferredReadTimer();
+        return false;
     }
-    if (attribute.value.count() <= mtuSize - 3) {
-        sendErrorResponse(packet.at(0), handle, ATT_ERROR_ATTRIBUTE_NOT_LONG);
-        return;
+    deferredReads.erase(it);
+    if (!setLocalValueOnDemand(handle, value)) {
+        sendErrorResponse(connection, request, handle, ATT_ERROR_UNLIKELY);
+        return false;
+    }
+    return true;
+}
+
+/*
+  Stores a value produced on demand without notifying the subscribed centrals.
+ */
+bool QLowEnergyControllerPrivateBluez::setLocalValueOnDemand(QLowEnergyHandle handle,
+                                                           const QByteArray &value)
+{
+    Attribute &attribute = localAttributes[handle];
+    if (value.count() < attribute.minLength || value.count() > attribute.maxLength) {
+        qCWarning(QT_BT_BLUEZ) << "read handler provided value of invalid length"
+                               << value.count() << "for attribute" << handle;
+        return false;
+    }
+    attribute.value = value;
+    if (QLowEnergyServicePrivate::CharData *charData
+            = localAttributeOwners.at(handle).characteristicData(handle)) {
+        charData->value = value;
+    }
+    return true;
+}
+
+void QLowEnergyControllerPrivateBluez::sendReadResponse(LeAttServerConnection *connection,
+                                                        quint8 request, QLowEnergyHandle handle,
+                                                        quint16 offset)
+{
+    const QByteArray &value = localAttributeValue(connection, localAttributes.at(handle));
+    if (request == ATT_OP_READ_BLOB_REQUEST) {
+        if (offset > value.count()) {
+            sendErrorResponse(connection, request, handle, ATT_ERROR_INVALID_OFFSET);
+            return;
+        }
+        if (value.count() <= connection->mtuSize - 3) {
+            sendErrorResponse(connection, request, handle, ATT_ERROR_ATTRIBUTE_NOT_LONG);
+            return;
+        }
     }
 
     // Yes, this value can be zero.
-    const int sentValueLength = qMin(attribute.value.count() - valueOffset, mtuSize - 1);
+    const int sentValueLength = qMin(value.count() - offset, connection->mtuSize - 1);
 
-    QByteArray response(1 + sentValueLength, Qt::Uninitialized);
-    response[0] = ATT_OP_READ_BLOB_RESPONSE;
+    const quint8 opcode = request == ATT_OP_READ_BLOB_REQUEST ? ATT_OP_READ_BLOB_RESPONSE
+                                                              : ATT_OP_READ_RESPONSE;
+    char *data = responseBuilder.start(opcode, connection->mtuSize);
     using namespace std;
-    memcpy(response.data() + 1, attribute.value.constData() + valueOffset, sentValueLength);
-    qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
-    sendPacket(response);
+    memcpy(data, value.constData() + offset, sentValueLength);
+    sendResponse(connection, data + sentValueLength);
+}
+
+void QLowEnergyControllerPrivateBluez::provideCharacteristicValue(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QLowEnergyHandle charHandle,
+        const QByteArray &value)
+{
+    Q_ASSERT(role == QLowEnergyController::PeripheralRole);
+    const auto charIt = service->characteristicList.constFind(charHandle);
+    if (charIt == service->characteristicList.constEnd())
+        return;
+    const QLowEnergyHandle valueHandle = charIt->valueHandle;
+    Q_ASSERT(valueHandle <= lastLocalHandle);
+    const bool valid = setLocalValueOnDemand(valueHandle, value);
+
+    for (int i = 0; i < deferredReads.count(); ) {
+        if (deferredReads.at(i).handle != valueHandle) {
+            ++i;
+            continue;
+        }
+        const DeferredRead read = deferredReads.takeAt(i);
+        if (valid)
+            sendReadResponse(read.connection, read.request, read.handle, read.offset);
+        else
+            sendErrorResponse(read.connection, read.request, read.handle, ATT_ERROR_UNLIKELY);
+    }
+    restartDeferredReadTimer();
+}
+
+/*
+  Fails the deferred reads for which the application did not provide a value
+  in time, before the centrals give up on the connection.
+ */
+void QLowEnergyControllerPrivateBluez::expireDeferredReads()
+{
+    while (!deferredReads.isEmpty() && deferredReads.constFirst().deadline.hasExpired()) {
+        const DeferredRead read = deferredReads.takeFirst();
+        qCWarning(QT_BT_BLUEZ) << "no value provided for read of attribute" << read.handle;
+        sendErrorResponse(read.connection, read.request, read.handle, ATT_ERROR_UNLIKELY);
+    }
+    restartDeferredReadTimer();
 }
 
-void QLowEnergyControllerPrivateBluez::handleReadMultipleRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::restartDeferredReadTimer()
+{
+    if (deferredReads.isEmpty()) {
+        if (deferredReadTimer)
+            deferredReadTimer->stop();
+        return;
+    }
+    if (!deferredReadTimer) {
+        deferredReadTimer = new QTimer(this);
+        deferredReadTimer->setSingleShot(true);
+        connect(deferredReadTimer, &QTimer::timeout,
+                this, &QLowEnergyControllerPrivateBluez::expireDeferredReads);
+    }
+    deferredReadTimer->start(int(deferredReads.constFirst().deadline.remainingTime()));
+}
+
+void QLowEnergyControllerPrivateBluez::dropDeferredReads(
+        const LeAttServerConnection *connection)
+{
+    deferredReads.erase(std::remove_if(deferredReads.begin(), deferredReads.end(),
+            [connection](const DeferredRead &read) { return read.connection == connection; }),
+            deferredReads.end());
+    restartDeferredReadTimer();
+}
+
+void QLowEnergyControllerPrivateBluez::handleReadMultipleRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.7-8
 
-    if (!checkPacketSize(packet, 5, mtuSize))
+    if (!checkPacketSize(connection, packet, 5, connection->mtuSize))
         return;
     QVector<QLowEnergyHandle> handles((packet.count() - 1) / sizeof(QLowEnergyHandle));
     auto *packetPtr = reinterpret_cast<const QLowEnergyHandle *>(packet.constData() + 1);
@@ -2492,32 +3910,36 @@ void QLowEnergyControllerPrivateBluez::handleReadMultipleRequest(const QByteArra
     const auto it = std::find_if(handles.constBegin(), handles.constEnd(),
             [this](QLowEnergyHandle handle) { return handle >= lastLocalHandle; });
     if (it != handles.constEnd()) {
-        sendErrorResponse(packet.at(0), *it, ATT_ERROR_INVALID_HANDLE);
+        sendErrorResponse(connection, packet.at(0), *it, ATT_ERROR_INVALID_HANDLE);
         return;
     }
-    const QVector<Attribute> results = getAttributes(handles.first(), handles.last());
-    QByteArray response(1, ATT_OP_READ_MULTIPLE_RESPONSE);
-    for (const Attribute &attr : results) {
-        const int error = checkReadPermissions(attr);
+    char *data = responseBuilder.start(ATT_OP_READ_MULTIPLE_RESPONSE, connection->mtuSize);
+    const char * const end = responseBuilder.limit();
+    for (const QLowEnergyHandle handle : qAsConst(handles)) {
+        const Attribute &attr = localAttributes.at(handle);
+        const int error = checkReadPermissions(connection, attr);
         if (error) {
-            sendErrorResponse(packet.at(0), attr.handle, error);
+            sendErrorResponse(connection, packet.at(0), attr.handle, error);
             return;
         }
 
         // Note: We do not abort if no more values fit into the packet, because we still have to
         //       report possible permission errors for the other handles.
-        response += attr.value.left(mtuSize - response.count());
+        const QByteArray &value = localAttributeValue(connection, attr);
+        const int valueLength = qMin(value.count(), int(end - data));
+        using namespace std;
+        memcpy(data, value.constData(), valueLength);
+        data += valueLength;
     }
-
-    qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
-    sendPacket(response);
+    sendResponse(connection, data);
 }
 
-void QLowEnergyControllerPrivateBluez::handleReadByGroupTypeRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleReadByGroupTypeRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.4.9-10
 
-    if (!checkPacketSize(packet, 7, 21))
+    if (!checkPacketSize(connection, packet, 7, 21))
         return;
     const QLowEnergyHandle startingHandle = bt_get_le16(packet.constData() + 1);
     const QLowEnergyHandle endingHandle = bt_get_le16(packet.constData() + 3);
@@ -2532,44 +3954,49 @@ void QLowEnergyControllerPrivateBluez::handleReadByGroupTypeRequest(const QByteA
     } else {
         qCWarning(QT_BT_BLUEZ) << "read by group type request has invalid packet size"
                                << packet.count();
-        sendErrorResponse(packet.at(0), 0, ATT_ERROR_INVALID_PDU);
+        sendErrorResponse(connection, packet.at(0), 0, ATT_ERROR_INVALID_PDU);
         return;
     }
     qCDebug(QT_BT_BLUEZ) << "client sends read by group type request, start:" << startingHandle
                          << "end:" << endingHandle << "type:" << type;
 
-    if (!checkHandlePair(packet.at(0), startingHandle, endingHandle))
+    if (!checkHandlePair(connection, packet.at(0), startingHandle, endingHandle))
         return;
     if (type != QBluetoothUuid(static_cast<quint16>(GATT_PRIMARY_SERVICE))
             && type != QBluetoothUuid(static_cast<quint16>(GATT_SECONDARY_SERVICE))) {
-        sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_UNSUPPRTED_GROUP_TYPE);
+        sendErrorResponse(connection, packet.at(0), startingHandle, ATT_ERROR_UNSUPPRTED_GROUP_TYPE);
         return;
     }
 
-    QVector<Attribute> results = getAttributes(startingHandle, endingHandle,
-            [type](const Attribute &attr) { return attr.type == type; });
-    if (results.isEmpty()) {
-        sendErrorResponse(packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+    const LocalAttributeRange handles = localAttributesOfType(type, startingHandle, endingHandle);
+    if (handles.first == handles.second) {
+        sendErrorResponse(connection, packet.at(0), startingHandle, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
         return;
     }
-    const int error = checkReadPermissions(results);
+    const Attribute &firstAttr = localAttributes.at(*handles.first);
+    const int error = checkReadPermissions(connection, firstAttr);
     if (error) {
-        sendErrorResponse(packet.at(0), results.first().handle, error);
+        sendErrorResponse(connection, packet.at(0), firstAttr.handle, error);
         return;
     }
 
-    ensureUniformValueSizes(results);
-
-    const int elementSize = 2 * sizeof(QLowEnergyHandle) + results.first().value.count();
-    QByteArray responsePrefix(2, Qt::Uninitialized);
-    responsePrefix[0] = ATT_OP_READ_BY_GROUP_RESPONSE;
-    responsePrefix[1] = elementSize;
-    const auto elemWriter = [](const Attribute &attr, char *&data) {
+    const int valueSize = localAttributeValue(connection, firstAttr).count();
+    const int elementSize = 2 * sizeof(QLowEnergyHandle) + valueSize;
+    char *header = responseBuilder.startList(ATT_OP_READ_BY_GROUP_RESPONSE, connection->mtuSize,
+                                             elementSize, 1);
+    putDataAndIncrement(quint8(elementSize), header);
+    for (auto it = handles.first; it != handles.second; ++it) {
+        const Attribute &attr = localAttributes.at(*it);
+        if (!fitsListElement(connection, attr, valueSize))
+            break;
+        char *data = responseBuilder.nextElement();
+        if (!data)
+            break;
         putDataAndIncrement(attr.handle, data);
         putDataAndIncrement(attr.groupEndHandle, data);
-        putDataAndIncrement(attr.value, data);
-    };
-    sendListResponse(responsePrefix, elementSize, results, elemWriter);
+        putDataAndIncrement(localAttributeValue(connection, attr), data);
+    }
+    sendResponse(connection, responseBuilder.listEnd());
 }
 
 void QLowEnergyControllerPrivateBluez::updateLocalAttributeValue(
@@ -2579,28 +4006,17 @@ void QLowEnergyControllerPrivateBluez::updateLocalAttributeValue(
         QLowEnergyDescriptor &descriptor)
 {
     localAttributes[handle].value = value;
-    for (const auto &service : qAsConst(localServices)) {
-        if (handle < service->startHandle || handle > service->endHandle)
-            continue;
-        for (auto charIt = service->characteristicList.begin();
-             charIt != service->characteristicList.end(); ++charIt) {
-            QLowEnergyServicePrivate::CharData &charData = charIt.value();
-            if (handle == charIt.key() + 1) { // Char value decl comes right after char decl.
-                charData.value = value;
-                characteristic = QLowEnergyCharacteristic(service, charIt.key());
-                return;
-            }
-            for (auto descIt = charData.descriptorList.begin();
-                 descIt != charData.descriptorList.end(); ++descIt) {
-                if (handle == descIt.key()) {
-                    descIt.value().value = value;
-                    descriptor = QLowEnergyDescriptor(service, charIt.key(), handle);
-                    return;
-                }
-            }
-        }
+    const AttributeOwner &owner = localAttributeOwners.at(handle);
+    if (QLowEnergyServicePrivate::CharData *charData = owner.characteristicData(handle)) {
+        charData->value = value;
+        characteristic = QLowEnergyCharacteristic(owner.service, owner.charHandle);
+    } else if (QLowEnergyServicePrivate::DescData *descData = owner.descriptorData(handle)) {
+        descData->value = value;
+        descriptor = QLowEnergyDescriptor(owner.service, owner.charHandle, handle);
+    } else {
+        qCWarning(QT_BT_BLUEZ) << "no local characteristic or descriptor has the handle"
+                               << handle;
     }
-    qFatal("local services map inconsistent with local attribute map");
 }
 
 static bool isNotificationEnabled(quint16 clientConfigValue) { return clientConfigValue & 0x1; }
@@ -2625,59 +4041,69 @@ void QLowEnergyControllerPrivateBluez::writeCharacteristicForPeripheral(
             = attribute.properties & QLowEnergyCharacteristic::Indicate;
     if (!hasNotifyProperty && !hasIndicateProperty)
         return;
-    for (const QLowEnergyServicePrivate::DescData &desc : qAsConst(charData.descriptorList)) {
-        if (desc.uuid != QBluetoothUuid::ClientCharacteristicConfiguration)
+    for (auto descIt = charData.descriptorList.cbegin();
+         descIt != charData.descriptorList.cend(); ++descIt) {
+        if (descIt->uuid != QBluetoothUuid::ClientCharacteristicConfiguration)
             continue;
 
-        // Notify/indicate currently connected client.
-        const bool isConnected = state == QLowEnergyController::ConnectedState;
-        if (isConnected) {
-            Q_ASSERT(desc.value.count() == 2);
-            quint16 configValue = bt_get_le16(desc.value.constData());
-            if (isNotificationEnabled(configValue) && hasNotifyProperty) {
-                sendNotification(valueHandle);
-            } else if (isIndicationEnabled(configValue) && hasIndicateProperty) {
-                if (indicationInFlight)
-                    scheduledIndications << valueHandle;
-                else
-                    sendIndication(valueHandle);
-            }
-        }
+        // Notify/indicate the connected clients.
+        distributeValue(valueHandle, descIt.key(), attribute.value, attribute.properties);
 
         // Prepare notification/indication of unconnected, bonded clients.
         for (auto it = clientConfigData.begin(); it != clientConfigData.end(); ++it) {
-            if (isConnected && it.key() == remoteDevice.toUInt64())
+            const auto configIt = it->find(valueHandle);
+            if (configIt == it->end() || configIt->charValueWasUpdated
+                    || isServerConnected(it.key())) {
                 continue;
-            QVector<ClientConfigurationData> &configDataList = it.value();
-            for (ClientConfigurationData &configData : configDataList) {
-                if (configData.charValueHandle != valueHandle)
-                    continue;
-                if ((isNotificationEnabled(configData.configValue) && hasNotifyProperty)
-                        || (isIndicationEnabled(configData.configValue) && hasIndicateProperty)) {
-                    configData.charValueWasUpdated = true;
-                    break;
-                }
+            }
+            if ((isNotificationEnabled(configIt->configValue) && hasNotifyProperty)
+                    || (isIndicationEnabled(configIt->configValue) && hasIndicateProperty)) {
+                configIt->charValueWasUpdated = true;
+                if (cccdStore)
+                    cccdStore->update(QBluetoothAddress(it.key()), *it, *configIt);
             }
         }
         break;
     }
 }
 
+/*
+  Sends the new value of a characteristic to all connected centrals which
+  subscribed to it via the configuration descriptor at \a configHandle.
+ */
+void QLowEnergyControllerPrivateBluez::distributeValue(QLowEnergyHandle valueHandle,
+        QLowEnergyHandle configHandle, const QByteArray &value,
+        QLowEnergyCharacteristic::PropertyTypes properties)
+{
+    if (state != QLowEnergyController::ConnectedState)
+        return;
+
+    LeAttServerConnection::distributeValue(serverConnections, valueHandle, configHandle,
+                                           value, properties);
+}
+
 void QLowEnergyControllerPrivateBluez::writeCharacteristicForCentral(const QSharedPointer<QLowEnergyServicePrivate> &service,
         QLowEnergyHandle charHandle,
         QLowEnergyHandle valueHandle,
         const QByteArray &newValue,
         QLowEnergyService::WriteMode mode)
 {
-    QByteArray packet(WRITE_REQUEST_HEADER_SIZE + newValue.count(), Qt::Uninitialized);
+    Request request;
+    LeAttPdu &packet = request.payload;
+    packet.resize(WRITE_REQUEST_HEADER_SIZE + newValue.count());
     putBtData(valueHandle, packet.data() + 1);
     memcpy(packet.data() + 3, newValue.constData(), newValue.count());
     bool writeWithResponse = false;
     switch (mode) {
     case QLowEnergyService::WriteWithResponse:
         if (newValue.size() > (mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
-            sendNextPrepareWriteRequest(charHandle, newValue, 0);
-            sendNextPendingRequest();
+            LePreparedWrite::Entry entry;
+            entry.charHandle = charHandle;
+            entry.attributeHandle = valueHandle;
+            entry.value = newValue;
+            const auto write = QSharedPointer<LePreparedWrite>::create();
+            write->addEntry(entry);
+            startPreparedWrite(service, write);
             return;
         }
         // write value fits into single package
@@ -2706,11 +4132,19 @@ void QLowEnergyControllerPrivateBluez::writeCharacteristicForCentral(const QShar
             return;
         }
         ++signingDataIt.value().counter;
-        packet = LeCmacCalculator::createFullMessage(packet, signingDataIt.value().counter);
-        const quint64 mac = LeCmacCalculator().calculateMac(packet, signingDataIt.value().key);
+        const QByteArray message = LeCmacCalculator::createFullMessage(
+                    QByteArray::fromRawData(packet.constData(), packet.count()),
+                    signingDataIt.value().counter);
+        const quint64 mac = cmacCalculator->calculateMac(message, signingDataIt.value().key);
+        packet.clear();
+        packet.append(message.constData(), message.count());
         packet.resize(packet.count() + sizeof mac);
         putBtData(mac, packet.data() + packet.count() - sizeof mac);
-        storeSignCounter(LocalSigningKey);
+        if (!storeSignCounter(remoteDevice, LocalSigningKey)) {
+            qCWarning(QT_BT_BLUEZ) << "signed write not possible: cannot record sign counter";
+            service->setError(QLowEnergyService::CharacteristicWriteError);
+            return;
+        }
         break;
     }
 
@@ -2723,18 +4157,16 @@ void QLowEnergyControllerPrivateBluez::writeCharacteristicForCentral(const QShar
     // It can be sent at any time and does not produce responses.
     // Therefore we will not put them into the openRequest queue at all.
     if (!writeWithResponse) {
-        sendPacket(packet);
+        sendPacket(packet.constData(), packet.count());
         return;
     }
 
-    Request request;
-    request.payload = packet;
     request.command = ATT_OP_WRITE_REQUEST;
-    request.reference = charHandle;
-    request.reference2 = newValue;
-    openRequests.enqueue(request);
-
-    sendNextPendingRequest();
+    request.lane = Request::InteractiveLane;
+    request.service = service;
+    request.handleData = charHandle;
+    request.value = newValue;
+    enqueueInteractiveRequest(request);
 }
 
 void QLowEnergyControllerPrivateBluez::writeDescriptorForPeripheral(
@@ -2755,13 +4187,20 @@ void QLowEnergyControllerPrivateBluez::writeDescriptorForPeripheral(
 }
 
 void QLowEnergyControllerPrivateBluez::writeDescriptorForCentral(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
         const QLowEnergyHandle charHandle,
         const QLowEnergyHandle descriptorHandle,
         const QByteArray &newValue)
 {
     if (newValue.size() > (mtuSize - WRITE_REQUEST_HEADER_SIZE)) {
-        sendNextPrepareWriteRequest(descriptorHandle, newValue, 0);
-        sendNextPendingRequest();
+        LePreparedWrite::Entry entry;
+        entry.charHandle = charHandle;
+        entry.descriptorHandle = descriptorHandle;
+        entry.attributeHandle = descriptorHandle;
+        entry.value = newValue;
+        const auto write = QSharedPointer<LePreparedWrite>::create();
+        write->addEntry(entry);
+        startPreparedWrite(service, write);
         return;
     }
 
@@ -2770,59 +4209,59 @@ void QLowEnergyControllerPrivateBluez::writeDescriptorForCentral(
     putBtData(descriptorHandle, &packet[1]);
 
     const int size = WRITE_REQUEST_HEADER_SIZE + newValue.size();
-    QByteArray data(size, Qt::Uninitialized);
-    memcpy(data.data(), packet, WRITE_REQUEST_HEADER_SIZE);
-    memcpy(&(data.data()[WRITE_REQUEST_HEADER_SIZE]), newValue.constData(), newValue.size());
+    Request request;
+    request.payload.reserve(size);
+    request.payload.append(reinterpret_cast<const char *>(packet), WRITE_REQUEST_HEADER_SIZE);
+    request.payload.append(newValue.constData(), newValue.size());
 
     qCDebug(QT_BT_BLUEZ) << "Writing descriptor" << Qt::hex << descriptorHandle
                          << "(size:" << size << ")";
 
-    Request request;
-    request.payload = data;
     request.command = ATT_OP_WRITE_REQUEST;
-    request.reference = (charHandle | (descriptorHandle << 16));
-    request.reference2 = newValue;
-    openRequests.enqueue(request);
-
-    sendNextPendingRequest();
+    request.lane = Request::InteractiveLane;
+    request.service = service;
+    request.handleData = (charHandle | (descriptorHandle << 16));
+    request.value = newValue;
+    enqueueInteractiveRequest(request);
 }
 
-void QLowEnergyControllerPrivateBluez::handleWriteRequestOrCommand(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleWriteRequestOrCommand(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.5.1-3
 
     const bool isRequest = packet.at(0) == ATT_OP_WRITE_REQUEST;
     const bool isSigned = quint8(packet.at(0)) == quint8(ATT_OP_SIGNED_WRITE_COMMAND);
-    if (!checkPacketSize(packet, isSigned ? 15 : 3, mtuSize))
+    if (!checkPacketSize(connection, packet, isSigned ? 15 : 3, connection->mtuSize))
         return;
     const QLowEnergyHandle handle = bt_get_le16(packet.constData() + 1);
     qCDebug(QT_BT_BLUEZ) << "client sends" << (isSigned ? "signed" : "") << "write"
                          << (isRequest ? "request" : "command") << "for handle" << handle;
 
-    if (!checkHandle(packet, handle))
+    if (!checkHandle(connection, packet, handle))
         return;
 
     Attribute &attribute = localAttributes[handle];
     const QLowEnergyCharacteristic::PropertyType type = isRequest
             ? QLowEnergyCharacteristic::Write : isSigned
               ? QLowEnergyCharacteristic::WriteSigned : QLowEnergyCharacteristic::WriteNoResponse;
-    const int permissionsError = checkPermissions(attribute, type);
+    const int permissionsError = checkPermissions(connection, attribute, type);
     if (permissionsError) {
-        sendErrorResponse(packet.at(0), handle, permissionsError);
+        sendErrorResponse(connection, packet.at(0), handle, permissionsError);
         return;
     }
 
     int valueLength;
     if (isSigned) {
-        if (!isBonded()) {
+        if (!isBonded(connection->remoteDevice)) {
             qCWarning(QT_BT_BLUEZ) << "Ignoring signed write from non-bonded device.";
             return;
         }
-        if (securityLevel() >= BT_SECURITY_MEDIUM) {
+        if (securityLevel(connection->socketDescriptor) >= BT_SECURITY_MEDIUM) {
             qCWarning(QT_BT_BLUEZ) << "Ignoring signed write on encrypted link.";
             return;
         }
-        const auto signingDataIt = signingData.find(remoteDevice.toUInt64());
+        const auto signingDataIt = signingData.find(connection->remoteDevice.toUInt64());
         if (signingDataIt == signingData.constEnd()) {
             qCWarning(QT_BT_BLUEZ) << "No CSRK found for peer device, ignoring signed write";
             return;
@@ -2842,19 +4281,22 @@ void QLowEnergyControllerPrivateBluez::handleWriteRequestOrCommand(const QByteAr
                 signingDataIt.value().key, signCounter, macFromClient);
         if (!signatureCorrect) {
             qCWarning(QT_BT_BLUEZ) << "Signed Write packet has wrong signature, disconnecting";
-            disconnectFromDevice(); // Recommended by spec v4.2, Vol 3, part C, 10.4.2
+            disconnectCentral(connection); // Recommended by spec v4.2, Vol 3, part C, 10.4.2
             return;
         }
 
         signingDataIt.value().counter = signCounter;
-        storeSignCounter(RemoteSigningKey);
+        if (!storeSignCounter(connection->remoteDevice, RemoteSigningKey)) {
+            qCWarning(QT_BT_BLUEZ) << "Cannot record sign counter, ignoring signed write command.";
+            return;
+        }
         valueLength = packet.count() - 15;
     } else {
         valueLength = packet.count() - 3;
     }
 
     if (valueLength > attribute.maxLength) {
-        sendErrorResponse(packet.at(0), handle, ATT_ERROR_INVAL_ATTR_VALUE_LEN);
+        sendErrorResponse(connection, packet.at(0), handle, ATT_ERROR_INVAL_ATTR_VALUE_LEN);
         return;
     }
 
@@ -2862,80 +4304,89 @@ void QLowEnergyControllerPrivateBluez::handleWriteRequestOrCommand(const QByteAr
     // then we overwrite only the start of the attribute value and keep the rest.
     QByteArray value = packet.mid(3, valueLength);
     if (attribute.minLength == attribute.maxLength && valueLength < attribute.minLength)
-        value += attribute.value.mid(valueLength, attribute.maxLength - valueLength);
+        value += localAttributeValue(connection, attribute).mid(
+                    valueLength, attribute.maxLength - valueLength);
 
     QLowEnergyCharacteristic characteristic;
     QLowEnergyDescriptor descriptor;
     updateLocalAttributeValue(handle, value, characteristic, descriptor);
+    if (attribute.type == QBluetoothUuid::ClientCharacteristicConfiguration) {
+        connection->clientConfigurations.insert(handle, value);
+        persistClientConfiguration(connection, handle);
+    }
 
     if (isRequest) {
-        const QByteArray response = QByteArray(1, ATT_OP_WRITE_RESPONSE);
-        sendPacket(response);
+        const char response = ATT_OP_WRITE_RESPONSE;
+        connection->sendPdu(&response, 1);
     }
 
-    if (characteristic.isValid()) {
+    if (characteristic.isValid())
         emit characteristic.d_ptr->characteristicChanged(characteristic, value);
-    } else {
-        Q_ASSERT(descriptor.isValid());
+    else if (descriptor.isValid())
         emit descriptor.d_ptr->descriptorWritten(descriptor, value);
-    }
 }
 
-void QLowEnergyControllerPrivateBluez::handlePrepareWriteRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handlePrepareWriteRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.6.1
 
-    if (!checkPacketSize(packet, 5, mtuSize))
+    if (!checkPacketSize(connection, packet, 5, connection->mtuSize))
         return;
     const quint16 handle = bt_get_le16(packet.constData() + 1);
     qCDebug(QT_BT_BLUEZ) << "client sends prepare write request for handle" << handle;
 
-    if (!checkHandle(packet, handle))
+    if (!checkHandle(connection, packet, handle))
         return;
     const Attribute &attribute = localAttributes.at(handle);
-    const int permissionsError = checkPermissions(attribute, QLowEnergyCharacteristic::Write);
+    const int permissionsError = checkPermissions(connection, attribute,
+                                                 QLowEnergyCharacteristic::Write);
     if (permissionsError) {
-        sendErrorResponse(packet.at(0), handle, permissionsError);
+        sendErrorResponse(connection, packet.at(0), handle, permissionsError);
         return;
     }
-    if (openPrepareWriteRequests.count() >= maxPrepareQueueSize) {
-        sendErrorResponse(packet.at(0), handle, ATT_ERROR_PREPARE_QUEUE_FULL);
+    if (connection->openPrepareWriteRequests.count() >= maxPrepareQueueSize) {
+        sendErrorResponse(connection, packet.at(0), handle, ATT_ERROR_PREPARE_QUEUE_FULL);
         return;
     }
 
     // The value is not checked here, but on the Execute request.
-    openPrepareWriteRequests << WriteRequest(handle, bt_get_le16(packet.constData() + 3),
-                                                    packet.mid(5));
+    connection->openPrepareWriteRequests << WriteRequest(
+            handle, bt_get_le16(packet.constData() + 3), packet.mid(5));
 
     QByteArray response = packet;
     response[0] = ATT_OP_PREPARE_WRITE_RESPONSE;
-    sendPacket(response);
+    connection->sendPdu(response.constData(), response.size());
 }
 
-void QLowEnergyControllerPrivateBluez::handleExecuteWriteRequest(const QByteArray &packet)
+void QLowEnergyControllerPrivateBluez::handleExecuteWriteRequest(
+        LeAttServerConnection *connection, const QByteArray &packet)
 {
     // Spec v4.2, Vol 3, Part F, 3.4.6.3
 
-    if (!checkPacketSize(packet, 2))
+    if (!checkPacketSize(connection, packet, 2))
         return;
     const bool cancel = packet.at(1) == 0;
     qCDebug(QT_BT_BLUEZ) << "client sends execute write request; flag is"
                          << (cancel ? "cancel" : "flush");
 
-    QVector<WriteRequest> requests = openPrepareWriteRequests;
-    openPrepareWriteRequests.clear();
+    QVector<WriteRequest> requests;
+    requests.swap(connection->openPrepareWriteRequests);
     QVector<QLowEnergyCharacteristic> characteristics;
     QVector<QLowEnergyDescriptor> descriptors;
     if (!cancel) {
         for (const WriteRequest &request : qAsConst(requests)) {
             Attribute &attribute = localAttributes[request.handle];
-            if (request.valueOffset > attribute.value.count()) {
-                sendErrorResponse(packet.at(0), request.handle, ATT_ERROR_INVALID_OFFSET);
+            const QByteArray &value = localAttributeValue(connection, attribute);
+            if (request.valueOffset > value.count()) {
+                sendErrorResponse(connection, packet.at(0), request.handle,
+                                  ATT_ERROR_INVALID_OFFSET);
                 return;
             }
-            const QByteArray newValue = attribute.value.left(request.valueOffset) + request.value;
+            const QByteArray newValue = value.left(request.valueOffset) + request.value;
             if (newValue.count() > attribute.maxLength) {
-                sendErrorResponse(packet.at(0), request.handle, ATT_ERROR_INVAL_ATTR_VALUE_LEN);
+                sendErrorResponse(connection, packet.at(0), request.handle,
+                                  ATT_ERROR_INVAL_ATTR_VALUE_LEN);
                 return;
             }
             QLowEnergyCharacteristic characteristic;
@@ -2943,16 +4394,20 @@ void QLowEnergyControllerPrivateBluez::handleExecuteWriteRequest(const QByteArra
             // TODO: Redundant attribute lookup for the case of the same handle appearing
             //       more than once.
             updateLocalAttributeValue(request.handle, newValue, characteristic, descriptor);
+            if (attribute.type == QBluetoothUuid::ClientCharacteristicConfiguration) {
+                connection->clientConfigurations.insert(request.handle, newValue);
+                persistClientConfiguration(connection, request.handle);
+            }
             if (characteristic.isValid()) {
                 characteristics << characteristic;
             } else if (descriptor.isValid()) {
-                Q_ASSERT(descriptor.isValid());
                 descriptors << descriptor;
             }
         }
     }
 
-    sendPacket(QByteArray(1, ATT_OP_EXECUTE_WRITE_RESPONSE));
+    const char response = ATT_OP_EXECUTE_WRITE_RESPONSE;
+    connection->sendPdu(&response, 1);
 
     for (const QLowEnergyCharacteristic &characteristic : qAsConst(characteristics))
         emit characteristic.d_ptr->characteristicChanged(characteristic, characteristic.value());
@@ -2960,70 +4415,35 @@ void QLowEnergyControllerPrivateBluez::handleExecuteWriteRequest(const QByteArra
         emit descriptor.d_ptr->descriptorWritten(descriptor, descriptor.value());
 }
 
-void QLowEnergyControllerPrivateBluez::sendErrorResponse(quint8 request, quint16 handle, quint8 code)
+void QLowEnergyControllerPrivateBluez::sendErrorResponse(LeAttServerConnection *connection,
+                                                         quint8 request, quint16 handle,
+                                                         quint8 code)
 {
     // An ATT command never receives an error response.
     if (request == ATT_OP_WRITE_COMMAND || request == ATT_OP_SIGNED_WRITE_COMMAND)
         return;
 
-    QByteArray packet(ERROR_RESPONSE_HEADER_SIZE, Qt::Uninitialized);
+    char packet[ERROR_RESPONSE_HEADER_SIZE];
     packet[0] = ATT_OP_ERROR_RESPONSE;
     packet[1] = request;
-    putBtData(handle, packet.data() + 2);
+    putBtData(handle, packet + 2);
     packet[4] = code;
     qCWarning(QT_BT_BLUEZ) << "sending error response; request:" << request << "handle:" << handle
                 << "code:" << code;
-    sendPacket(packet);
-}
-
-void QLowEnergyControllerPrivateBluez::sendListResponse(const QByteArray &packetStart, int elemSize,
-        const QVector<Attribute> &attributes, const ElemWriter &elemWriter)
-{
-    const int offset = packetStart.count();
-    const int elemCount = qMin(attributes.count(), (mtuSize - offset) / elemSize);
-    const int totalPacketSize = offset + elemCount * elemSize;
-    QByteArray response(totalPacketSize, Qt::Uninitialized);
-    using namespace std;
-    memcpy(response.data(), packetStart.constData(), offset);
-    char *data = response.data() + offset;
-    for_each(attributes.constBegin(), attributes.constBegin() + elemCount,
-             [&data, elemWriter](const Attribute &attr) { elemWriter(attr, data); });
-    qCDebug(QT_BT_BLUEZ) << "sending response:" << response.toHex();
-    sendPacket(response);
-}
-
-void QLowEnergyControllerPrivateBluez::sendNotification(QLowEnergyHandle handle)
-{
-    sendNotificationOrIndication(ATT_OP_HANDLE_VAL_NOTIFICATION, handle);
-}
-
-void QLowEnergyControllerPrivateBluez::sendIndication(QLowEnergyHandle handle)
-{
-    Q_ASSERT(!indicationInFlight);
-    indicationInFlight = true;
-    sendNotificationOrIndication(ATT_OP_HANDLE_VAL_INDICATION, handle);
-}
-
-void QLowEnergyControllerPrivateBluez::sendNotificationOrIndication(
-        quint8 opCode,
-        QLowEnergyHandle handle)
-{
-    Q_ASSERT(handle <= lastLocalHandle);
-    const Attribute &attribute = localAttributes.at(handle);
-    const int maxValueLength = qMin(attribute.value.count(), mtuSize - 3);
-    QByteArray packet(3 + maxValueLength, Qt::Uninitialized);
-    packet[0] = opCode;
-    putBtData(handle, packet.data() + 1);
-    using namespace std;
-    memcpy(packet.data() + 3, attribute.value.constData(), maxValueLength);
-    qCDebug(QT_BT_BLUEZ) << "sending notification/indication:" << packet.toHex();
-    sendPacket(packet);
+    connection->sendPdu(packet, ERROR_RESPONSE_HEADER_SIZE);
 }
 
-void QLowEnergyControllerPrivateBluez::sendNextIndication()
+/*
+  Sends the response which was written into responseBuilder up to \a end.
+  The socket copies the data, so the buffer can be reused right away.
+ */
+void QLowEnergyControllerPrivateBluez::sendResponse(LeAttServerConnection *connection,
+                                                    const char *end)
 {
-    if (!scheduledIndications.isEmpty())
-        sendIndication(scheduledIndications.takeFirst());
+    const int size = responseBuilder.size(end);
+    qCDebug(QT_BT_BLUEZ) << "sending response:"
+                         << QByteArray::fromRawData(responseBuilder.constData(), size).toHex();
+    connection->sendPdu(responseBuilder.constData(), size);
 }
 
 static QString nameOfRemoteCentral(const QBluetoothAddress &peerAddress, const QBluetoothAddress &localAdapter)
@@ -3091,7 +4511,9 @@ static QString nameOfRemoteCentral(const QBluetoothAddress &peerAddress, const Q
 
 void QLowEnergyControllerPrivateBluez::handleConnectionRequest()
 {
-    if (state != QLowEnergyController::AdvertisingState) {
+    const bool acceptsFurtherClient = state == QLowEnergyController::ConnectedState
+            && serverConnections.count() < maxServerConnections;
+    if (state != QLowEnergyController::AdvertisingState && !acceptsFurtherClient) {
         qCWarning(QT_BT_BLUEZ) << "Incoming connection request in unexpected state" << state;
         return;
     }
@@ -3108,14 +4530,40 @@ void QLowEnergyControllerPrivateBluez::handleConnectionRequest()
         return;
     }
 
-    remoteDevice = QBluetoothAddress(convertAddress(clientAddr.l2_bdaddr.b));
-    remoteName = nameOfRemoteCentral(remoteDevice, localAdapter);
-    qCDebug(QT_BT_BLUEZ) << "GATT connection from device" << remoteDevice << remoteName;
+    if (serverConnections.count() + 1 < maxServerConnections)
+        serverSocketNotifier->setEnabled(true);
+    else
+        closeServerSocket();
+
+    addServerConnection(clientSocket, QBluetoothAddress(convertAddress(clientAddr.l2_bdaddr.b)));
+}
 
-    if (connectionHandle == 0)
+/*
+  Serves the central with the given \a address on the accepted ATT channel
+  \a socketDescriptor.
+ */
+void QLowEnergyControllerPrivateBluez::addServerConnection(int socketDescriptor,
+                                                           const QBluetoothAddress &address)
+{
+    LeAttServerConnection *connection = new LeAttServerConnection;
+    connection->remoteDevice = address;
+    connection->remoteName = nameOfRemoteCentral(connection->remoteDevice, localAdapter);
+    qCDebug(QT_BT_BLUEZ) << "GATT connection from device" << connection->remoteDevice
+                         << connection->remoteName;
+
+    l2cap_conninfo connInfo;
+    socklen_t connInfoSize = sizeof connInfo;
+    if (::getsockopt(socketDescriptor, SOL_L2CAP, L2CAP_CONNINFO,
+                     &connInfo, &connInfoSize) == 0) {
+        connection->hciHandle = connInfo.hci_handle;
+    } else {
+        // the link of the latest connection complete event
+        connection->hciHandle = connectionHandle;
+    }
+    if (connection->hciHandle == 0)
         qCWarning(QT_BT_BLUEZ) << "Received client connection, but no connection complete event";
 
-    if (l2cpSocket) {
+    if (l2cpSocket && serverConnections.isEmpty()) {
         disconnect(l2cpSocket);
         if (l2cpSocket->isOpen())
             l2cpSocket->close();
@@ -3123,28 +4571,149 @@ void QLowEnergyControllerPrivateBluez::handleConnectionRequest()
         l2cpSocket->deleteLater();
         l2cpSocket = nullptr;
     }
-    closeServerSocket();
 
     QBluetoothSocketPrivateBluez *rawSocketPrivate = new QBluetoothSocketPrivateBluez();
-    l2cpSocket = new QBluetoothSocket(
+    QBluetoothSocket *socket = new QBluetoothSocket(
                 rawSocketPrivate, QBluetoothServiceInfo::L2capProtocol, this);
-    connect(l2cpSocket, &QBluetoothSocket::disconnected,
-            this, &QLowEnergyControllerPrivateBluez::l2cpDisconnected);
-    connect(l2cpSocket, static_cast<void (QBluetoothSocket::*)(QBluetoothSocket::SocketError)>
-            (&QBluetoothSocket::error), this, &QLowEnergyControllerPrivateBluez::l2cpErrorChanged);
-    connect(l2cpSocket, &QIODevice::readyRead, this, &QLowEnergyControllerPrivateBluez::l2cpReadyRead);
-    l2cpSocket->d_ptr->lowEnergySocketType = addressType == QLowEnergyController::PublicAddress
+    connect(socket, &QBluetoothSocket::disconnected, this, [this, socket]() {
+        LeAttServerConnection *connection = serverConnection(socket);
+        if (connection && serverConnections.count() > 1)
+            closeServerConnection(connection);
+        else if (socket == l2cpSocket)
+            l2cpDisconnected();
+    });
+    connect(socket, static_cast<void (QBluetoothSocket::*)(QBluetoothSocket::SocketError)>
+            (&QBluetoothSocket::error), this, [this, socket](QBluetoothSocket::SocketError e) {
+        LeAttServerConnection *connection = serverConnection(socket);
+        if (connection && serverConnections.count() > 1)
+            closeServerConnection(connection);
+        else if (socket == l2cpSocket)
+            l2cpErrorChanged(e);
+    });
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() {
+        // the PDU might have closed the connection
+        while (LeAttServerConnection *connection = serverConnection(socket)) {
+            const QByteArray incomingPacket = connection->readPdu();
+            if (incomingPacket.isEmpty())
+                return;
+            qCDebug(QT_BT_BLUEZ) << "Received size:" << incomingPacket.size() << "data:"
+                                 << incomingPacket.toHex();
+            if (!processServerPacket(connection, incomingPacket)) {
+                qCWarning(QT_BT_BLUEZ) << "Received unexpected packet from peer, disconnecting.";
+                disconnectCentral(connection);
+            }
+        }
+    });
+    socket->d_ptr->lowEnergySocketType = addressType == QLowEnergyController::PublicAddress
             ? BDADDR_LE_PUBLIC : BDADDR_LE_RANDOM;
-    l2cpSocket->setSocketDescriptor(clientSocket, QBluetoothServiceInfo::L2capProtocol,
+    socket->setSocketDescriptor(socketDescriptor, QBluetoothServiceInfo::L2capProtocol,
             QBluetoothSocket::ConnectedState, QIODevice::ReadWrite | QIODevice::Unbuffered);
-    restoreClientConfigurations();
-    loadSigningDataIfNecessary(RemoteSigningKey);
+    connection->socket = socket;
+    connection->socketDescriptor = socketDescriptor;
+    connection->setQueuePolicy(valueQueuePolicy, valueQueueDepth);
+    if (serverConnections.isEmpty()) {
+        l2cpSocket = socket;
+        remoteDevice = connection->remoteDevice;
+        remoteName = connection->remoteName;
+    }
+    serverConnections.append(connection);
+    restoreClientConfigurations(connection);
+    loadSigningDataIfNecessary(connection->remoteDevice, RemoteSigningKey);
+
+    // The adapter stops advertising when a central connects.
+    if (serverSocketNotifier && advertiser)
+        advertiser->startAdvertising();
+
+    if (serverConnections.count() > 1) {
+        qCDebug(QT_BT_BLUEZ) << "Serving" << serverConnections.count() << "GATT clients";
+        return;
+    }
 
     Q_Q(QLowEnergyController);
     setState(QLowEnergyController::ConnectedState);
     emit q->connected();
 }
 
+LeAttServerConnection *QLowEnergyControllerPrivateBluez::serverConnection(
+        const QIODevice *socket) const
+{
+    for (LeAttServerConnection *connection : serverConnections) {
+        if (connection->socket == socket)
+            return connection;
+    }
+    return nullptr;
+}
+
+LeAttServerConnection *QLowEnergyControllerPrivateBluez::serverConnectionForHciHandle(
+        quint16 handle) const
+{
+    return LeAttServerConnection::forHciHandle(serverConnections, handle);
+}
+
+/*
+  Returns the HCI handle of the link to the central which connected first.
+ */
+quint16 QLowEnergyControllerPrivateBluez::serverHciHandle() const
+{
+    return serverConnections.isEmpty() ? connectionHandle
+                                       : serverConnections.constFirst()->hciHandle;
+}
+
+bool QLowEnergyControllerPrivateBluez::isServerConnected(quint64 address) const
+{
+    for (const LeAttServerConnection *connection : serverConnections) {
+        if (connection->remoteDevice.toUInt64() == address)
+            return true;
+    }
+    return false;
+}
+
+/*
+  Ends the connection to a central while other centrals stay connected.
+ */
+void QLowEnergyControllerPrivateBluez::closeServerConnection(LeAttServerConnection *connection)
+{
+    Q_ASSERT(serverConnections.count() > 1);
+
+    storeClientConfigurations(connection);
+    qCDebug(QT_BT_BLUEZ) << "GATT client" << connection->remoteDevice << "disconnected";
+
+    serverConnections.removeOne(connection);
+    dropDeferredReads(connection);
+
+    // stop waiting for the socket before it is closed
+    connection->clearPendingValues();
+    QIODevice *socket = connection->socket;
+    socket->disconnect(this);
+    socket->close();
+    socket->deleteLater();
+    delete connection;
+
+    // the controller reports the central which connected first
+    const LeAttServerConnection *first = serverConnections.constFirst();
+    l2cpSocket = static_cast<QBluetoothSocket *>(first->socket);
+    remoteDevice = first->remoteDevice;
+    remoteName = first->remoteName;
+
+    // accept another central in place of the closed connection
+    if (!serverSocketNotifier && state == QLowEnergyController::ConnectedState
+            && listenForConnections() && advertiser) {
+        advertiser->startAdvertising();
+    }
+}
+
+/*
+  Ends the connection to the central of \a connection, or the connection
+  of the controller if no other central is connected.
+ */
+void QLowEnergyControllerPrivateBluez::disconnectCentral(LeAttServerConnection *connection)
+{
+    if (serverConnections.count() > 1)
+        closeServerConnection(connection);
+    else
+        disconnectFromDevice();
+}
+
 void QLowEnergyControllerPrivateBluez::closeServerSocket()
 {
     if (!serverSocketNotifier)
@@ -3156,93 +4725,191 @@ void QLowEnergyControllerPrivateBluez::closeServerSocket()
 }
 
 bool QLowEnergyControllerPrivateBluez::isBonded() const
+{
+    return isBonded(remoteDevice);
+}
+
+bool QLowEnergyControllerPrivateBluez::isBonded(const QBluetoothAddress &address) const
 {
     // Pairing does not necessarily imply bonding, but we don't know whether the
     // bonding flag was set in the original pairing request.
-    return QBluetoothLocalDevice(localAdapter).pairingStatus(remoteDevice)
+    return QBluetoothLocalDevice(localAdapter).pairingStatus(address)
             != QBluetoothLocalDevice::Unpaired;
 }
 
+/*
+  Returns the client characteristic configuration descriptors of the local
+  services in ascending handle order. Only the first configuration descriptor
+  of a characteristic is taken into account.
+ */
 QVector<QLowEnergyControllerPrivateBluez::TempClientConfigurationData> QLowEnergyControllerPrivateBluez::gatherClientConfigData()
 {
     QVector<TempClientConfigurationData> data;
-    for (const auto &service : qAsConst(localServices)) {
-        for (auto charIt = service->characteristicList.begin();
-             charIt != service->characteristicList.end(); ++charIt) {
-            QLowEnergyServicePrivate::CharData &charData = charIt.value();
-            for (auto descIt = charData.descriptorList.begin();
-                 descIt != charData.descriptorList.end(); ++descIt) {
-                QLowEnergyServicePrivate::DescData &descData = descIt.value();
-                if (descData.uuid == QBluetoothUuid::ClientCharacteristicConfiguration) {
-                    data << TempClientConfigurationData(&descData, charData.valueHandle,
-                                                        descIt.key());
-                    break;
-                }
-            }
-        }
+    if (lastLocalHandle == 0)
+        return data;
+
+    const LocalAttributeRange configHandles = localAttributesOfType(
+                QBluetoothUuid::ClientCharacteristicConfiguration, 1, lastLocalHandle);
+    data.reserve(int(configHandles.second - configHandles.first));
+    for (const QLowEnergyHandle *it = configHandles.first; it != configHandles.second; ++it) {
+        const AttributeOwner &owner = localAttributeOwners.at(*it);
+        if (!owner.service)
+            continue;
+        const QLowEnergyHandle valueHandle = owner.charHandle + 1;
+        if (!data.isEmpty() && data.last().charValueHandle == valueHandle)
+            continue;
+        if (QLowEnergyServicePrivate::DescData *descData = owner.descriptorData(*it))
+            data << TempClientConfigurationData(descData, valueHandle, *it);
     }
     return data;
 }
 
-void QLowEnergyControllerPrivateBluez::storeClientConfigurations()
+/*
+  Identifies the layout of the configuration descriptors. Stored configurations
+  are only valid for the layout they were stored for.
+ */
+quint64 QLowEnergyControllerPrivateBluez::clientConfigSignature(
+        const QVector<TempClientConfigurationData> &configs) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (const TempClientConfigurationData &config : configs) {
+        char handles[2 * sizeof(QLowEnergyHandle)];
+        putBtData(config.charValueHandle, handles);
+        putBtData(config.configHandle, handles + sizeof(QLowEnergyHandle));
+        hash.addData(handles, int(sizeof handles));
+        hash.addData(localAttributes.at(config.charValueHandle).type.toByteArray());
+    }
+    return getBtData<quint64>(hash.result().constData());
+}
+
+void QLowEnergyControllerPrivateBluez::storeClientConfigurations(
+        const LeAttServerConnection *connection)
 {
-    if (!isBonded()) {
-        clientConfigData.remove(remoteDevice.toUInt64());
+    const QBluetoothAddress &address = connection->remoteDevice;
+    if (!isBonded(address)) {
+        clientConfigData.remove(address.toUInt64());
+        if (cccdStore)
+            cccdStore->remove(address);
         return;
     }
-    QVector<ClientConfigurationData> clientConfigs;
+    LeCccdStore::Entries clientConfigs;
     const QVector<TempClientConfigurationData> &tempConfigList = gatherClientConfigData();
     for (const auto &tempConfigData : tempConfigList) {
-        Q_ASSERT(tempConfigData.descData->value.count() == 2);
-        const quint16 value = bt_get_le16(tempConfigData.descData->value.constData());
+        const quint16 value = connection->clientConfiguration(tempConfigData.configHandle);
         if (value != 0) {
-            clientConfigs << ClientConfigurationData(tempConfigData.charValueHandle,
-                                                     tempConfigData.configHandle, value);
+            clientConfigs.insert(tempConfigData.charValueHandle,
+                                 ClientConfigurationData(tempConfigData.charValueHandle,
+                                                         tempConfigData.configHandle, value));
         }
     }
-    clientConfigData.insert(remoteDevice.toUInt64(), clientConfigs);
+    clientConfigData.insert(address.toUInt64(), clientConfigs);
+    if (cccdStore)
+        cccdStore->store(address, clientConfigs);
 }
 
-void QLowEnergyControllerPrivateBluez::restoreClientConfigurations()
+/*
+  Restores the configurations which the bonded central of \a connection wrote
+  during an earlier connection. The configuration descriptors of the local
+  services show the configurations of the central which connected last.
+ */
+void QLowEnergyControllerPrivateBluez::restoreClientConfigurations(
+        LeAttServerConnection *connection)
 {
     const QVector<TempClientConfigurationData> &tempConfigList = gatherClientConfigData();
-    const QVector<ClientConfigurationData> &restoredClientConfigs = isBonded()
-            ? clientConfigData.value(remoteDevice.toUInt64()) : QVector<ClientConfigurationData>();
-    QVector<QLowEnergyHandle> notifications;
+    if (cccdStore) {
+        cccdStore->setDatabaseSignature(clientConfigSignature(tempConfigList));
+        if (!storedClientConfigurationsLoaded)
+            loadStoredClientConfigurations();
+    }
+    const QBluetoothAddress &address = connection->remoteDevice;
+    const LeCccdStore::Entries restoredClientConfigs = isBonded(address)
+            ? clientConfigData.value(address.toUInt64()) : LeCccdStore::Entries();
+    connection->clientConfigurations.clear();
+    bool updatesDelivered = false;
     for (const auto &tempConfigData : tempConfigList) {
-        bool wasRestored = false;
-        for (const auto &restoredData : restoredClientConfigs) {
-            if (restoredData.charValueHandle == tempConfigData.charValueHandle) {
-                Q_ASSERT(tempConfigData.descData->value.count() == 2);
-                putBtData(restoredData.configValue, tempConfigData.descData->value.data());
-                wasRestored = true;
-                if (restoredData.charValueWasUpdated) {
-                    if (isNotificationEnabled(restoredData.configValue))
-                        notifications << restoredData.charValueHandle;
-                    else if (isIndicationEnabled(restoredData.configValue))
-                        scheduledIndications << restoredData.charValueHandle;
-                }
-                break;
+        QByteArray value(2, 0); // Default value.
+        const auto restoredIt = restoredClientConfigs.constFind(tempConfigData.charValueHandle);
+        if (restoredIt != restoredClientConfigs.constEnd()
+                && restoredIt->configHandle == tempConfigData.configHandle) {
+            const ClientConfigurationData &restoredData = *restoredIt;
+            putBtData(restoredData.configValue, value.data());
+            connection->clientConfigurations.insert(tempConfigData.configHandle, value);
+            if (restoredData.charValueWasUpdated) {
+                updatesDelivered = true;
+                const QByteArray &charValue
+                        = localAttributes.at(restoredData.charValueHandle).value;
+                if (isNotificationEnabled(restoredData.configValue))
+                    connection->queueNotification(restoredData.charValueHandle, charValue);
+                else if (isIndicationEnabled(restoredData.configValue))
+                    connection->queueIndication(restoredData.charValueHandle, charValue);
             }
         }
-        if (!wasRestored)
-            tempConfigData.descData->value = QByteArray(2, 0); // Default value.
         Q_ASSERT(lastLocalHandle >= tempConfigData.configHandle);
         Q_ASSERT(tempConfigData.configHandle > tempConfigData.charValueHandle);
-        localAttributes[tempConfigData.configHandle].value = tempConfigData.descData->value;
+        tempConfigData.descData->value = value;
+        localAttributes[tempConfigData.configHandle].value = value;
+    }
+
+    if (updatesDelivered) {
+        LeCccdStore::Entries &entries = clientConfigData[address.toUInt64()];
+        for (ClientConfigurationData &entry : entries)
+            entry.charValueWasUpdated = false;
+        if (cccdStore)
+            cccdStore->store(address, entries);
+    }
+    connection->sendPendingValues();
+}
+
+/*
+  Reads the configurations of all centrals from the store. Configurations
+  which are already known from a connection in this process are kept.
+ */
+void QLowEnergyControllerPrivateBluez::loadStoredClientConfigurations()
+{
+    storedClientConfigurationsLoaded = true;
+    const QList<QBluetoothAddress> peers = cccdStore->peers();
+    for (const QBluetoothAddress &peer : peers) {
+        if (clientConfigData.contains(peer.toUInt64()))
+            continue;
+        const LeCccdStore::Entries entries = cccdStore->load(peer);
+        if (!entries.isEmpty())
+            clientConfigData.insert(peer.toUInt64(), entries);
     }
+    qCDebug(QT_BT_BLUEZ) << "Loaded stored client configurations of" << peers.count()
+                         << "centrals";
+}
 
-    for (const QLowEnergyHandle handle : qAsConst(notifications))
-        sendNotification(handle);
-    sendNextIndication();
+/*
+  Records the configuration written by the bonded central right away such that
+  it survives a crash of the process before the central disconnects.
+ */
+void QLowEnergyControllerPrivateBluez::persistClientConfiguration(
+        const LeAttServerConnection *connection, QLowEnergyHandle configHandle)
+{
+    const QBluetoothAddress &address = connection->remoteDevice;
+    if (!cccdStore || !isBonded(address))
+        return;
+    const AttributeOwner &owner = localAttributeOwners.at(configHandle);
+    if (!owner.service || connection->clientConfigurations.value(configHandle).count() != 2)
+        return;
+
+    const ClientConfigurationData entry(owner.charHandle + 1, configHandle,
+                                        connection->clientConfiguration(configHandle));
+    LeCccdStore::Entries &entries = clientConfigData[address.toUInt64()];
+    if (entry.configValue == 0)
+        entries.remove(entry.charValueHandle);
+    else
+        entries.insert(entry.charValueHandle, entry);
+    cccdStore->update(address, entries, entry);
 }
 
-void QLowEnergyControllerPrivateBluez::loadSigningDataIfNecessary(SigningKeyType keyType)
+void QLowEnergyControllerPrivateBluez::loadSigningDataIfNecessary(
+        const QBluetoothAddress &address, SigningKeyType keyType)
 {
-    const auto signingDataIt = signingData.constFind(remoteDevice.toUInt64());
+    const auto signingDataIt = signingData.constFind(address.toUInt64());
     if (signingDataIt != signingData.constEnd())
         return; // We are up to date for this device.
-    const QString settingsFilePath = keySettingsFilePath();
+    const QString settingsFilePath = keySettingsFilePath(address);
     if (!QFileInfo(settingsFilePath).exists()) {
         qCDebug(QT_BT_BLUEZ) << "No settings found for peer device.";
         return;
@@ -3262,32 +4929,33 @@ void QLowEnergyControllerPrivateBluez::loadSigningDataIfNecessary(SigningKeyType
         return;
     }
     qCDebug(QT_BT_BLUEZ) << "CSRK of peer device is" << keyString;
-    const quint32 counter = settings.value(QLatin1String("Counter"), 0).toUInt();
+    quint32 counter = settings.value(QLatin1String("Counter"), 0).toUInt();
+    if (signCounterJournal)
+        counter = signCounterJournal->load(settingsFilePath, group, counter,
+                                           keyType == LocalSigningKey
+                                           ? LeSignCounterJournal::LocalCounter
+                                           : LeSignCounterJournal::RemoteCounter);
     quint128 csrk;
     using namespace std;
     memcpy(csrk.data, keyData.constData(), keyData.count());
-    signingData.insert(remoteDevice.toUInt64(), SigningData(csrk, counter - 1));
+    signingData.insert(address.toUInt64(), SigningData(csrk, counter - 1));
 }
 
-void QLowEnergyControllerPrivateBluez::storeSignCounter(SigningKeyType keyType) const
+/*
+  Records the counter of the signing key. The settings file is updated later
+  by the sign counter journal.
+
+  Returns \c false if the counter could not be recorded such that it is not
+  safe to use.
+ */
+bool QLowEnergyControllerPrivateBluez::storeSignCounter(const QBluetoothAddress &address,
+                                                        SigningKeyType keyType) const
 {
-    const auto signingDataIt = signingData.constFind(remoteDevice.toUInt64());
-    if (signingDataIt == signingData.constEnd())
-        return;
-    const QString settingsFilePath = keySettingsFilePath();
-    if (!QFileInfo(settingsFilePath).exists())
-        return;
-    QSettings settings(settingsFilePath, QSettings::IniFormat);
-    if (!settings.isWritable())
-        return;
-    settings.beginGroup(signingKeySettingsGroup(keyType));
-    const QString counterKey = QLatin1String("Counter");
-    if (!settings.allKeys().contains(counterKey))
-        return;
-    const quint32 counterValue = signingDataIt.value().counter + 1;
-    if (counterValue == settings.value(counterKey).toUInt())
-        return;
-    settings.setValue(counterKey, counterValue);
+    const auto signingDataIt = signingData.constFind(address.toUInt64());
+    if (signingDataIt == signingData.constEnd() || !signCounterJournal)
+        return true;
+    return signCounterJournal->record(keySettingsFilePath(address), signingKeySettingsGroup(keyType),
+                                      signingDataIt.value().counter + 1);
 }
 
 QString QLowEnergyControllerPrivateBluez::signingKeySettingsGroup(SigningKeyType keyType) const
@@ -3295,10 +4963,10 @@ QString QLowEnergyControllerPrivateBluez::signingKeySettingsGroup(SigningKeyType
     return QLatin1String(keyType == LocalSigningKey ? "LocalSignatureKey" : "RemoteSignatureKey");
 }
 
-QString QLowEnergyControllerPrivateBluez::keySettingsFilePath() const
+QString QLowEnergyControllerPrivateBluez::keySettingsFilePath(const QBluetoothAddress &address) const
 {
     return QString::fromLatin1("/var/lib/bluetooth/%1/%2/info")
-            .arg(localAdapter.toString(), remoteDevice.toString());
+            .arg(localAdapter.toString(), address.toString());
 }
 
 static QByteArray uuidToByteArray(const QBluetoothUuid &uuid)
@@ -3325,6 +4993,10 @@ void QLowEnergyControllerPrivateBluez::addToGenericAttributeList(const QLowEnerg
     // as well as computationally inefficient.
 
     localAttributes.resize(lastLocalHandle + 1);
+    localAttributeOwners.resize(lastLocalHandle + 1);
+    AttributeOwner owner;
+    owner.service = localServices.value(service.uuid());
+    Q_ASSERT(owner.service && owner.service->startHandle == startHandle);
     Attribute serviceAttribute;
     serviceAttribute.handle = startHandle;
     serviceAttribute.type = QBluetoothUuid(static_cast<quint16>(service.type()));
@@ -3373,6 +5045,8 @@ void QLowEnergyControllerPrivateBluez::addToGenericAttributeList(const QLowEnerg
         attribute.minLength = cd.minimumValueLength();
         attribute.maxLength = cd.maximumValueLength();
         localAttributes[attribute.handle] = attribute;
+        owner.charHandle = attribute.handle - 1;
+        localAttributeOwners[attribute.handle] = owner;
 
         const QList<QLowEnergyDescriptorData> descriptors = cd.descriptors();
         for (const QLowEnergyDescriptorData &dd : descriptors) {
@@ -3424,59 +5098,182 @@ void QLowEnergyControllerPrivateBluez::addToGenericAttributeList(const QLowEnerg
                 attribute.value = QByteArray(attribute.minLength, 0);
             }
             localAttributes[attribute.handle] = attribute;
+            localAttributeOwners[attribute.handle] = owner;
         }
     }
     serviceAttribute.groupEndHandle = currentHandle;
     localAttributes[serviceAttribute.handle] = serviceAttribute;
+
+    for (int handle = startHandle; handle <= currentHandle; ++handle)
+        indexLocalAttribute(QLowEnergyHandle(handle));
+
+    updateLocalDatabaseHash();
+    indicateServiceChange(startHandle, currentHandle);
 }
 
-void QLowEnergyControllerPrivateBluez::ensureUniformAttributes(QVector<Attribute> &attributes,
-        const std::function<int (const Attribute &)> &getSize)
+/*
+  Calculates the Database Hash of the local attributes and makes it the value
+  of the Database Hash characteristic, if there is one.
+ */
+void QLowEnergyControllerPrivateBluez::updateLocalDatabaseHash()
 {
-    if (attributes.isEmpty())
+    const LocalAttributeRange hashHandles = localAttributesOfType(
+                QBluetoothUuid(GATT_DATABASE_HASH), 1, lastLocalHandle);
+    if (hashHandles.first == hashHandles.second)
         return;
-    const int firstSize = getSize(attributes.first());
-    const auto it = std::find_if(attributes.begin() + 1, attributes.end(),
-            [firstSize, getSize](const Attribute &attr) { return getSize(attr) != firstSize; });
-    if (it != attributes.end())
-        attributes.erase(it, attributes.end());
 
+    // Spec v5.1, Vol 3, Part G, 7.3: handle, type and, for declarations, the value
+    // of the attributes which make up the structure of the database.
+    QByteArray message;
+    for (int handle = 1; handle <= lastLocalHandle; ++handle) {
+        const Attribute &attribute = localAttributes.at(handle);
+        bool isShortType;
+        const quint16 type = attribute.type.toUInt16(&isShortType);
+        if (!isShortType)
+            continue;
+        bool includeValue;
+        switch (type) {
+        case GATT_PRIMARY_SERVICE:
+        case GATT_SECONDARY_SERVICE:
+        case GATT_INCLUDED_SERVICE:
+        case GATT_CHARACTERISTIC:
+        case QBluetoothUuid::CharacteristicExtendedProperties:
+            includeValue = true;
+            break;
+        case QBluetoothUuid::CharacteristicUserDescription:
+        case QBluetoothUuid::ClientCharacteristicConfiguration:
+        case QBluetoothUuid::ServerCharacteristicConfiguration:
+        case QBluetoothUuid::CharacteristicPresentationFormat:
+        case QBluetoothUuid::CharacteristicAggregateFormat:
+            includeValue = false;
+            break;
+        default:
+            continue;
+        }
+        const int offset = message.count();
+        message.resize(offset + 2 * int(sizeof(quint16)));
+        putBtData(attribute.handle, message.data() + offset);
+        putBtData(type, message.data() + offset + sizeof(quint16));
+        if (includeValue)
+            message += attribute.value;
+    }
+
+    const quint128 zeroKey = {};
+    const QByteArray hash = cmacCalculator->calculateCmac(message, zeroKey);
+    qCDebug(QT_BT_BLUEZ) << "local database hash:" << hash.toHex();
+    for (auto it = hashHandles.first; it != hashHandles.second; ++it) {
+        localAttributes[*it].value = hash;
+        if (QLowEnergyServicePrivate::CharData *charData
+                = localAttributeOwners.at(*it).characteristicData(*it)) {
+            charData->value = hash;
+        }
+    }
 }
 
-void QLowEnergyControllerPrivateBluez::ensureUniformUuidSizes(QVector<Attribute> &attributes)
+/*
+  Indicates the attributes from \a startHandle to \a endHandle as changed to the
+  centrals which subscribed to the Service Changed characteristic. Bonded centrals
+  which are not connected receive the indication when they reconnect.
+ */
+void QLowEnergyControllerPrivateBluez::indicateServiceChange(QLowEnergyHandle startHandle,
+                                                           QLowEnergyHandle endHandle)
 {
-    ensureUniformAttributes(attributes,
-                            [](const Attribute &attr) { return getUuidSize(attr.type); });
+    // Before the first advertisement, no central can know the database.
+    if (role != QLowEnergyController::PeripheralRole
+            || state == QLowEnergyController::UnconnectedState) {
+        return;
+    }
+
+    const LocalAttributeRange handles = localAttributesOfType(
+                QBluetoothUuid(QBluetoothUuid::ServiceChanged), 1, lastLocalHandle);
+    for (auto it = handles.first; it != handles.second; ++it) {
+        const QLowEnergyHandle valueHandle = *it;
+        QLowEnergyServicePrivate::CharData *charData
+                = localAttributeOwners.at(valueHandle).characteristicData(valueHandle);
+        if (!charData)
+            continue;
+
+        // A bonded central which missed an earlier change learns about both at once.
+        LeServiceChangedRange range(startHandle, endHandle);
+        for (const LeCccdStore::Entries &configs : qAsConst(clientConfigData)) {
+            if (configs.value(valueHandle).charValueWasUpdated) {
+                range.merge(localAttributes.at(valueHandle).value);
+                break;
+            }
+        }
+
+        qCDebug(QT_BT_BLUEZ) << "indicating changed attributes from" << range.start
+                             << "to" << range.end;
+        writeCharacteristicForPeripheral(*charData, range.value());
+    }
 }
 
-void QLowEnergyControllerPrivateBluez::ensureUniformValueSizes(QVector<Attribute> &attributes)
+/*
+  Adds \a handle to the type index of the local attributes. The handles of each
+  type are kept in ascending order.
+ */
+void QLowEnergyControllerPrivateBluez::indexLocalAttribute(QLowEnergyHandle handle)
 {
-    ensureUniformAttributes(attributes,
-                            [](const Attribute &attr) { return attr.value.count(); });
+    QVector<QLowEnergyHandle> &handles = localAttributeTypeIndex[localAttributes.at(handle).type];
+    if (handles.isEmpty() || handles.last() < handle)
+        handles.append(handle);
+    else
+        handles.insert(std::lower_bound(handles.begin(), handles.end(), handle), handle);
 }
 
-QVector<QLowEnergyControllerPrivateBluez::Attribute> QLowEnergyControllerPrivateBluez::getAttributes(QLowEnergyHandle startHandle,
-        QLowEnergyHandle endHandle, const AttributePredicate &attributePredicate)
+/*
+  Returns the handles of the local attributes of \a type between
+  \a startHandle and \a endHandle in ascending order.
+ */
+QLowEnergyControllerPrivateBluez::LocalAttributeRange
+QLowEnergyControllerPrivateBluez::localAttributesOfType(const QBluetoothUuid &type,
+                                                        QLowEnergyHandle startHandle,
+                                                        QLowEnergyHandle endHandle) const
 {
-    QVector<Attribute> results;
-    if (startHandle > lastLocalHandle)
-        return results;
-    if (lastLocalHandle == 0) // We have no services at all.
-        return results;
     Q_ASSERT(startHandle <= endHandle); // Must have been checked before.
-    const QLowEnergyHandle firstHandle = qMin(startHandle, lastLocalHandle);
-    const QLowEnergyHandle lastHandle = qMin(endHandle, lastLocalHandle);
-    for (QLowEnergyHandle i = firstHandle; i <= lastHandle; ++i) {
-        const Attribute &attr = localAttributes.at(i);
-        if (attributePredicate(attr))
-            results << attr;
-    }
-    return results;
+    const auto it = localAttributeTypeIndex.constFind(type);
+    if (it == localAttributeTypeIndex.constEnd())
+        return LocalAttributeRange();
+
+    const QLowEnergyHandle *end = it->constData() + it->count();
+    const QLowEnergyHandle *first = std::lower_bound(it->constData(), end, startHandle);
+    const QLowEnergyHandle *last = std::upper_bound(first, end, endHandle);
+    return LocalAttributeRange(first, last);
+}
+
+/*
+  Returns \c true if \a attr may follow the first element of a Read By Type
+  or Read By Group Type response. The spec demands that all elements have the same
+  value size and that the list ends before the first attribute which cannot be read.
+ */
+bool QLowEnergyControllerPrivateBluez::fitsListElement(const LeAttServerConnection *connection,
+                                                       const Attribute &attr, int valueSize)
+{
+    return localAttributeValue(connection, attr).count() == valueSize
+            && checkReadPermissions(connection, attr) == 0;
+}
+
+/*
+  Returns the value of \a attr as seen by the central of \a connection.
+  Each central has its own client characteristic configurations.
+ */
+const QByteArray &QLowEnergyControllerPrivateBluez::localAttributeValue(
+        const LeAttServerConnection *connection, const Attribute &attr) const
+{
+    if (attr.type != QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration))
+        return attr.value;
+    static const QByteArray defaultValue(2, 0);
+    const auto it = connection->clientConfigurations.constFind(attr.handle);
+    return it != connection->clientConfigurations.constEnd() && it->count() == 2
+            ? *it : defaultValue;
 }
 
-int QLowEnergyControllerPrivateBluez::checkPermissions(const Attribute &attr,
+int QLowEnergyControllerPrivateBluez::checkPermissions(const LeAttServerConnection *connection,
+                                                  const Attribute &attr,
                                                   QLowEnergyCharacteristic::PropertyType type)
 {
+    const int securityLevel = QLowEnergyControllerPrivateBluez::securityLevel(
+                connection->socketDescriptor);
     const bool isReadAccess = type == QLowEnergyCharacteristic::Read;
     const bool isWriteCommand = type == QLowEnergyCharacteristic::WriteNoResponse;
     const bool isWriteAccess = type == QLowEnergyCharacteristic::Write
@@ -3491,7 +5288,7 @@ int QLowEnergyControllerPrivateBluez::checkPermissions(const Attribute &attr,
         // can also be used if the link is encrypted.
         const bool unsignedWriteOk = isWriteCommand
                 && (attr.properties & QLowEnergyCharacteristic::WriteSigned)
-                && securityLevel() >= BT_SECURITY_MEDIUM;
+                && securityLevel >= BT_SECURITY_MEDIUM;
         if (!unsignedWriteOk)
             return ATT_ERROR_WRITE_NOT_PERM;
     }
@@ -3499,45 +5296,24 @@ int QLowEnergyControllerPrivateBluez::checkPermissions(const Attribute &attr,
             ? attr.readConstraints : attr.writeConstraints;
     if (constraints.testFlag(AttAuthorizationRequired))
         return ATT_ERROR_INSUF_AUTHORIZATION; // TODO: emit signal (and offer authorization function)?
-    if (constraints.testFlag(AttEncryptionRequired) && securityLevel() < BT_SECURITY_MEDIUM)
+    if (constraints.testFlag(AttEncryptionRequired) && securityLevel < BT_SECURITY_MEDIUM)
         return ATT_ERROR_INSUF_ENCRYPTION;
-    if (constraints.testFlag(AttAuthenticationRequired) && securityLevel() < BT_SECURITY_HIGH)
+    if (constraints.testFlag(AttAuthenticationRequired) && securityLevel < BT_SECURITY_HIGH)
         return ATT_ERROR_INSUF_AUTHENTICATION;
     if (false)
         return ATT_ERROR_INSUF_ENCR_KEY_SIZE;
     return 0;
 }
 
-int QLowEnergyControllerPrivateBluez::checkReadPermissions(const Attribute &attr)
-{
-    return checkPermissions(attr, QLowEnergyCharacteristic::Read);
-}
-
-int QLowEnergyControllerPrivateBluez::checkReadPermissions(QVector<Attribute> &attributes)
+int QLowEnergyControllerPrivateBluez::checkReadPermissions(const LeAttServerConnection *connection,
+                                                          const Attribute &attr)
 {
-    if (attributes.isEmpty())
-        return 0;
-
-    // The logic prescribed in the spec is as follows:
-    //    1) If the first in a list of matching attributes has a permissions error,
-    //       then that error is returned via an error response.
-    //    2) If any other element of that list would cause a permissions error, then all
-    //       attributes from this one on are not part of the result set, but no error is returned.
-    const int error = checkReadPermissions(attributes.first());
-    if (error)
-        return error;
-    const auto it = std::find_if(attributes.begin() + 1, attributes.end(),
-            [this](const Attribute &attr) { return checkReadPermissions(attr) != 0; });
-    if (it != attributes.end())
-        attributes.erase(it, attributes.end());
-    return 0;
+    return checkPermissions(connection, attr, QLowEnergyCharacteristic::Read);
 }
 
 bool QLowEnergyControllerPrivateBluez::verifyMac(const QByteArray &message, const quint128 &csrk,
                                              quint32 signCounter, quint64 expectedMac)
 {
-    if (!cmacCalculator)
-        cmacCalculator = new LeCmacCalculator;
     return cmacCalculator->verify(LeCmacCalculator::createFullMessage(message, signCounter), csrk,
                                 expectedMac);
 }
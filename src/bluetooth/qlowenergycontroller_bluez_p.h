@@ -52,12 +52,19 @@
 //
 
 #include <qglobal.h>
-#include <QtCore/QQueue>
+#include <QtCore/QDeadlineTimer>
+#include <QtCore/QHash>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtCore/QVector>
 #include <QtBluetooth/qbluetooth.h>
 #include <QtBluetooth/qlowenergycharacteristic.h>
 #include "qlowenergycontroller.h"
 #include "qlowenergycontrollerbase_p.h"
+#include "legattcache_p.h"
+#include "leattrequest_p.h"
+#include "leattserverconnection_p.h"
+#include "lecccdstore_p.h"
 
 #include <QtBluetooth/QBluetoothSocket>
 #include <functional>
@@ -68,7 +75,11 @@ class QLowEnergyServiceData;
 class QTimer;
 
 class HciManager;
+class LeAttBearer;
+class LeAttBearerPool;
+class LeAttStreamWriter;
 class LeCmacCalculator;
+class LeSignCounterJournal;
 class QSocketNotifier;
 class RemoteDeviceManager;
 
@@ -90,6 +101,7 @@ public:
 
     void discoverServices() override;
     void discoverServiceDetails(const QBluetoothUuid &service) override;
+    void discoverAllServiceDetails(const QList<QBluetoothUuid> &services) override;
 
     void startAdvertising(const QLowEnergyAdvertisingParameters &params,
                           const QLowEnergyAdvertisingData &advertisingData,
@@ -113,6 +125,17 @@ public:
                          const QLowEnergyHandle charHandle,
                          const QLowEnergyHandle descriptorHandle,
                          const QByteArray &newValue) override;
+    void writeCharacteristicsReliably(
+            const QSharedPointer<QLowEnergyServicePrivate> &service,
+            const QVector<QPair<QLowEnergyHandle, QByteArray>> &values) override;
+
+    void cancelPendingRequests(const QSharedPointer<QLowEnergyServicePrivate> &service) override;
+    QIODevice *createWriteStream(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                                 const QLowEnergyHandle charHandle,
+                                 QObject *parent) override;
+    void provideCharacteristicValue(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                                    const QLowEnergyHandle charHandle,
+                                    const QByteArray &value) override;
 
     void addToGenericAttributeList(const QLowEnergyServiceData &service,
                                    QLowEnergyHandle startHandle) override;
@@ -131,33 +154,20 @@ public:
         int maxLength;
     };
     QVector<Attribute> localAttributes;
+    // service and characteristic declaration handle per characteristic value
+    // or descriptor handle, indexed like localAttributes
+    typedef LeAttributeOwner AttributeOwner;
+    QVector<AttributeOwner> localAttributeOwners;
+    // handles of localAttributes per attribute type in ascending order
+    QHash<QBluetoothUuid, QVector<QLowEnergyHandle>> localAttributeTypeIndex;
 
 private:
     quint16 connectionHandle = 0;
     QBluetoothSocket *l2cpSocket = nullptr;
-    struct Request {
-        quint8 command;
-        QByteArray payload;
-        // TODO reference below is ugly but until we know all commands and their
-        // requirements this is WIP
-        QVariant reference;
-        QVariant reference2;
-    };
-    QQueue<Request> openRequests;
-
-    struct WriteRequest {
-        WriteRequest() {}
-        WriteRequest(quint16 h, quint16 o, const QByteArray &v)
-            : handle(h), valueOffset(o), value(v) {}
-        quint16 handle;
-        quint16 valueOffset;
-        QByteArray value;
-    };
-    QVector<WriteRequest> openPrepareWriteRequests;
+    typedef LeAttRequest Request;
+    LeAttRequestScheduler openRequests;
 
-    // Invariant: !scheduledIndications.isEmpty => indicationInFlight == true
-    QVector<QLowEnergyHandle> scheduledIndications;
-    bool indicationInFlight = false;
+    typedef LeAttServerConnection::WriteRequest WriteRequest;
 
     struct TempClientConfigurationData {
         TempClientConfigurationData(QLowEnergyServicePrivate::DescData *dd = nullptr,
@@ -169,17 +179,13 @@ private:
         QLowEnergyHandle configHandle;
     };
 
-    struct ClientConfigurationData {
-        ClientConfigurationData(QLowEnergyHandle chHndl = 0, QLowEnergyHandle coHndl = 0,
-                                quint16 val = 0)
-            : charValueHandle(chHndl), configHandle(coHndl), configValue(val) {}
-
-        QLowEnergyHandle charValueHandle;
-        QLowEnergyHandle configHandle;
-        quint16 configValue;
-        bool charValueWasUpdated = false;
-    };
-    QHash<quint64, QVector<ClientConfigurationData>> clientConfigData;
+    typedef LeCccdStore::Entry ClientConfigurationData;
+    QHash<quint64, LeCccdStore::Entries> clientConfigData;
+    // persistent configurations of bonded centrals (BLUETOOTH_GATT_SERVER_CCCD_DIR)
+    LeCccdStore *cccdStore = nullptr;
+    bool storedClientConfigurationsLoaded = false;
+    // Generic Attribute service with Database Hash (BLUETOOTH_GATT_SERVER_DATABASE_HASH)
+    bool publishDatabaseHash = false;
 
     struct SigningData {
         SigningData() = default;
@@ -191,18 +197,76 @@ private:
     };
     QHash<quint64, SigningData> signingData;
     LeCmacCalculator *cmacCalculator = nullptr;
+    LeSignCounterJournal *signCounterJournal = nullptr;
 
     bool requestPending;
     quint16 mtuSize;
+    LeAttPduBuilder responseBuilder;
     int securityLevelValue;
     bool encryptionChangePending;
-    bool receivedMtuExchangeRequest = false;
+
+    // combine value reads during service discovery (BLUETOOTH_GATT_BATCHED_READS)
+    bool batchedDiscoveryReads = false;
+    bool readMultipleSupported = true;
+    bool readMultipleVariableSupported = true;
+
+    // persistent cache of the remote attribute layout (BLUETOOTH_GATT_CACHE_DIR)
+    LeGattCache *gattCache = nullptr;
+    LeGattCache::Database cachedDatabase;
+    QByteArray remoteDatabaseHash;
+    QSet<QBluetoothUuid> servicesWithKnownDescriptors;
+    bool gattCacheStale = false;
+
+    // discovery of the details of several services in one pass
+    struct DescriptorRange {
+        QLowEnergyHandle start;
+        QLowEnergyHandle end;
+        QLowEnergyHandle charHandle;
+        QSharedPointer<QLowEnergyServicePrivate> service;
+    };
+    QVector<QSharedPointer<QLowEnergyServicePrivate>> sweepServices; // sorted by start handle
+    QVector<DescriptorRange> sweepDescriptorRanges;
+
+    // centrals connected to the GATT server (BLUETOOTH_GATT_SERVER_CONNECTIONS)
+    QVector<LeAttServerConnection *> serverConnections; // the first one owns l2cpSocket
+    // requests of the remote device to the local GATT server in the central role
+    LeAttServerConnection *remoteClientConnection = nullptr;
+    int maxServerConnections = 1;
+    // notification and indication queues (BLUETOOTH_GATT_SERVER_QUEUE_POLICY/_DEPTH)
+    LeAttValueQueue::Policy valueQueuePolicy = LeAttValueQueue::MergePolicy;
+    int valueQueueDepth = LeAttValueQueue::DefaultMaxDepth;
+
+    // reads of local characteristics waiting for their read handler's value
+    struct DeferredRead {
+        quint64 id;
+        LeAttServerConnection *connection;
+        quint8 request;
+        QLowEnergyHandle handle;
+        quint16 offset;
+        QDeadlineTimer deadline;
+    };
+    enum { deferredReadTimeout = 20000 }; // well below the ATT transaction timeout
+    QVector<DeferredRead> deferredReads; // in order of their deadlines
+    quint64 lastDeferredReadId = 0;
+    QTimer *deferredReadTimer = nullptr;
 
     HciManager *hciManager = nullptr;
     QLeAdvertiser *advertiser = nullptr;
     QSocketNotifier *serverSocketNotifier = nullptr;
     QTimer *requestTimer = nullptr;
     RemoteDeviceManager* device1Manager = nullptr;
+    LeAttStreamWriter *streamWriter = nullptr;
+
+    // additional ATT bearers (BLUETOOTH_GATT_BEARERS)
+    enum { maxAttBearers = 5 };
+    LeAttBearerPool *bearerPool = nullptr;
+    LeAttBearer *replyBearer = nullptr; // bearer whose response is being processed
+    int requestedBearers = 1;
+    bool encryptionRetryOnBearer = false;
+    QPointer<LeAttBearer> encryptionRetryBearer;
+
+    // services with notifications waiting for their batch handler
+    QVector<QSharedPointer<QLowEnergyServicePrivate>> notificationBatchServices;
 
     /*
       Defines the maximum number of milliseconds the implementation will
@@ -221,21 +285,38 @@ private:
      */
     int gattRequestTimeout = 20000;
 
+    bool listenForConnections();
     void handleConnectionRequest();
+    void addServerConnection(int socketDescriptor, const QBluetoothAddress &address);
     void closeServerSocket();
+    LeAttServerConnection *serverConnection(const QIODevice *socket) const;
+    LeAttServerConnection *serverConnectionForHciHandle(quint16 handle) const;
+    quint16 serverHciHandle() const;
+    bool ownsHciHandle(quint16 handle) const;
+    void handleConnectionUpdate(quint16 handle, const QLowEnergyConnectionParameters &params);
+    void handleSignatureResolvingKey(quint16 handle, bool remoteKey, const quint128 &csrk);
+    bool isServerConnected(quint64 address) const;
+    void closeServerConnection(LeAttServerConnection *connection);
+    void disconnectCentral(LeAttServerConnection *connection);
 
     bool isBonded() const;
+    bool isBonded(const QBluetoothAddress &address) const;
     QVector<TempClientConfigurationData> gatherClientConfigData();
-    void storeClientConfigurations();
-    void restoreClientConfigurations();
+    void storeClientConfigurations(const LeAttServerConnection *connection);
+    void restoreClientConfigurations(LeAttServerConnection *connection);
+    void loadStoredClientConfigurations();
+    void persistClientConfiguration(const LeAttServerConnection *connection,
+                                    QLowEnergyHandle configHandle);
+    quint64 clientConfigSignature(const QVector<TempClientConfigurationData> &configs) const;
 
     enum SigningKeyType { LocalSigningKey, RemoteSigningKey };
-    void loadSigningDataIfNecessary(SigningKeyType keyType);
-    void storeSignCounter(SigningKeyType keyType) const;
+    void loadSigningDataIfNecessary(const QBluetoothAddress &address, SigningKeyType keyType);
+    bool storeSignCounter(const QBluetoothAddress &address, SigningKeyType keyType) const;
     QString signingKeySettingsGroup(SigningKeyType keyType) const;
-    QString keySettingsFilePath() const;
+    QString keySettingsFilePath(const QBluetoothAddress &address) const;
 
-    void sendPacket(const QByteArray &packet);
+    bool sendPacket(const QByteArray &packet);
+    bool sendPacket(const char *data, int size);
     void sendNextPendingRequest();
     void processReply(const Request &request, const QByteArray &reply);
 
@@ -243,70 +324,114 @@ private:
                                 quint16 type);
     void sendReadByTypeRequest(QSharedPointer<QLowEnergyServicePrivate> serviceData,
                                QLowEnergyHandle nextHandle, quint16 attributeType);
-    void sendReadValueRequest(QLowEnergyHandle attributeHandle, bool isDescriptor);
+    Request createReadRequest(QLowEnergyHandle attributeHandle, uint handleData);
+    Request createReadMultipleRequest(quint8 command,
+                                      const QVector<QLowEnergyHandle> &attributeHandles,
+                                      const QVector<uint> &handleData);
     void readServiceValues(const QBluetoothUuid &service,
                            bool readCharacteristics);
     void readServiceValuesByOffset(uint handleData, quint16 offset,
                                    bool isLastValue);
 
+    void sendDatabaseHashRequest();
+    bool discoverServicesFromCache();
+    bool restoreServiceDetailsFromCache(const QSharedPointer<QLowEnergyServicePrivate> &service);
+    void watchServiceForGattCache(QLowEnergyServicePrivate *service);
+    void storeGattCache();
+    void invalidateGattCache();
+
+    void sendSweepRequest(quint8 command, QLowEnergyHandle startHandle, quint16 attributeType);
+    void processSweepReply(const Request &request, const QByteArray &response,
+                           bool isErrorResponse);
+    QSharedPointer<QLowEnergyServicePrivate> sweepServiceForHandle(QLowEnergyHandle handle) const;
+    QLowEnergyHandle nextSweepHandle(QLowEnergyHandle handle, quint8 command) const;
+    void finishDetailsSweep();
+
     void discoverServiceDescriptors(const QBluetoothUuid &serviceUuid);
     void discoverNextDescriptor(QSharedPointer<QLowEnergyServicePrivate> serviceData,
                                 const QList<QLowEnergyHandle> pendingCharHandles,
                                 QLowEnergyHandle startingHandle);
-    void processUnsolicitedReply(const QByteArray &msg);
+    void processIncomingPacket(const QByteArray &incomingPacket);
+    bool processServerPacket(LeAttServerConnection *connection, const QByteArray &packet);
+    void processUnsolicitedReply(const char *data, int size);
+    void deliverNotificationBatches();
+    void enqueueInteractiveRequest(const Request &request);
+    void prependRequest(const Request &request);
+    int replyMtu() const;
+    void openAdditionalBearers();
+    void bearerResponseReceived(LeAttBearer *bearer, const Request &request,
+                                const QByteArray &response);
+    void bearerRequestTimedOut(LeAttBearer *bearer, const Request &request);
     void exchangeMTU();
     bool setSecurityLevel(int level);
     int securityLevel() const;
-    void sendExecuteWriteRequest(const QLowEnergyHandle attrHandle,
-                                 const QByteArray &newValue,
+    static int securityLevel(int socketDescriptor);
+    void startPreparedWrite(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                            const QSharedPointer<LePreparedWrite> &write);
+    void sendPrepareWriteRequest(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                                 const QSharedPointer<LePreparedWrite> &write, int segment);
+    void sendExecuteWriteRequest(const QSharedPointer<QLowEnergyServicePrivate> &service,
+                                 const QSharedPointer<LePreparedWrite> &write,
                                  bool isCancelation);
-    void sendNextPrepareWriteRequest(const QLowEnergyHandle handle,
-                                     const QByteArray &newValue, quint16 offset);
     bool increaseEncryptLevelfRequired(quint8 errorCode);
 
     void resetController();
+    void logRequestStatistics() const;
 
     void handleAdvertisingError();
 
-    bool checkPacketSize(const QByteArray &packet, int minSize, int maxSize = -1);
-    bool checkHandle(const QByteArray &packet, QLowEnergyHandle handle);
-    bool checkHandlePair(quint8 request, QLowEnergyHandle startingHandle,
-                         QLowEnergyHandle endingHandle);
-
-    void handleExchangeMtuRequest(const QByteArray &packet);
-    void handleFindInformationRequest(const QByteArray &packet);
-    void handleFindByTypeValueRequest(const QByteArray &packet);
-    void handleReadByTypeRequest(const QByteArray &packet);
-    void handleReadRequest(const QByteArray &packet);
-    void handleReadBlobRequest(const QByteArray &packet);
-    void handleReadMultipleRequest(const QByteArray &packet);
-    void handleReadByGroupTypeRequest(const QByteArray &packet);
-    void handleWriteRequestOrCommand(const QByteArray &packet);
-    void handlePrepareWriteRequest(const QByteArray &packet);
-    void handleExecuteWriteRequest(const QByteArray &packet);
-
-    void sendErrorResponse(quint8 request, quint16 handle, quint8 code);
-
-    using ElemWriter = std::function<void(const Attribute &, char *&)>;
-    void sendListResponse(const QByteArray &packetStart, int elemSize,
-                          const QVector<Attribute> &attributes, const ElemWriter &elemWriter);
-
-    void sendNotification(QLowEnergyHandle handle);
-    void sendIndication(QLowEnergyHandle handle);
-    void sendNotificationOrIndication(quint8 opCode, QLowEnergyHandle handle);
-    void sendNextIndication();
-
-    void ensureUniformAttributes(QVector<Attribute> &attributes, const std::function<int(const Attribute &)> &getSize);
-    void ensureUniformUuidSizes(QVector<Attribute> &attributes);
-    void ensureUniformValueSizes(QVector<Attribute> &attributes);
-
-    using AttributePredicate = std::function<bool(const Attribute &)>;
-    QVector<Attribute> getAttributes(QLowEnergyHandle startHandle, QLowEnergyHandle endHandle,
-            const AttributePredicate &attributePredicate = [](const Attribute &) { return true; });
-
-    int checkPermissions(const Attribute &attr, QLowEnergyCharacteristic::PropertyType type);
-    int checkReadPermissions(const Attribute &attr);
-    int checkReadPermissions(QVector<Attribute> &attributes);
+    bool checkPacketSize(LeAttServerConnection *connection, const QByteArray &packet,
+                         int minSize, int maxSize = -1);
+    bool checkHandle(LeAttServerConnection *connection, const QByteArray &packet,
+                     QLowEnergyHandle handle);
+    bool checkHandlePair(LeAttServerConnection *connection, quint8 request,
+                         QLowEnergyHandle startingHandle, QLowEnergyHandle endingHandle);
+
+    void handleExchangeMtuRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    void handleFindInformationRequest(LeAttServerConnection *connection,
+                                      const QByteArray &packet);
+    void handleFindByTypeValueRequest(LeAttServerConnection *connection,
+                                      const QByteArray &packet);
+    void handleReadByTypeRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    void handleReadRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    void handleReadBlobRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    bool readLocalValueOnDemand(LeAttServerConnection *connection, quint8 request,
+                                QLowEnergyHandle handle, quint16 offset);
+    bool setLocalValueOnDemand(QLowEnergyHandle handle, const QByteArray &value);
+    void sendReadResponse(LeAttServerConnection *connection, quint8 request,
+                          QLowEnergyHandle handle, quint16 offset);
+    void expireDeferredReads();
+    void restartDeferredReadTimer();
+    void dropDeferredReads(const LeAttServerConnection *connection);
+    void handleReadMultipleRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    void handleReadByGroupTypeRequest(LeAttServerConnection *connection,
+                                      const QByteArray &packet);
+    void handleWriteRequestOrCommand(LeAttServerConnection *connection,
+                                     const QByteArray &packet);
+    void handlePrepareWriteRequest(LeAttServerConnection *connection, const QByteArray &packet);
+    void handleExecuteWriteRequest(LeAttServerConnection *connection, const QByteArray &packet);
+
+    void sendErrorResponse(LeAttServerConnection *connection, quint8 request, quint16 handle,
+                           quint8 code);
+
+    void sendResponse(LeAttServerConnection *connection, const char *end);
+
+    void addGenericAttributeService();
+    void updateLocalDatabaseHash();
+    void indicateServiceChange(QLowEnergyHandle startHandle, QLowEnergyHandle endHandle);
+    void indexLocalAttribute(QLowEnergyHandle handle);
+    using LocalAttributeRange = QPair<const QLowEnergyHandle *, const QLowEnergyHandle *>;
+    LocalAttributeRange localAttributesOfType(const QBluetoothUuid &type,
+                                              QLowEnergyHandle startHandle,
+                                              QLowEnergyHandle endHandle) const;
+    const QByteArray &localAttributeValue(const LeAttServerConnection *connection,
+                                          const Attribute &attr) const;
+    bool fitsListElement(const LeAttServerConnection *connection, const Attribute &attr,
+                         int valueSize);
+
+    int checkPermissions(const LeAttServerConnection *connection, const Attribute &attr,
+                         QLowEnergyCharacteristic::PropertyType type);
+    int checkReadPermissions(const LeAttServerConnection *connection, const Attribute &attr);
 
     bool verifyMac(const QByteArray &message, const quint128 &csrk, quint32 signCounter,
                    quint64 expectedMac);
@@ -320,6 +445,9 @@ private:
     void writeCharacteristicForPeripheral(
             QLowEnergyServicePrivate::CharData &charData,
             const QByteArray &newValue);
+    void distributeValue(QLowEnergyHandle valueHandle, QLowEnergyHandle configHandle,
+                         const QByteArray &value,
+                         QLowEnergyCharacteristic::PropertyTypes properties);
     void writeCharacteristicForCentral(const QSharedPointer<QLowEnergyServicePrivate> &service,
             QLowEnergyHandle charHandle,
             QLowEnergyHandle valueHandle,
@@ -332,6 +460,7 @@ private:
             const QLowEnergyHandle descriptorHandle,
             const QByteArray &newValue);
     void writeDescriptorForCentral(
+            const QSharedPointer<QLowEnergyServicePrivate> &service,
             const QLowEnergyHandle charHandle,
             const QLowEnergyHandle descriptorHandle,
             const QByteArray &newValue);
@@ -46,6 +46,8 @@
 #include <QtBluetooth/QLowEnergyDescriptorData>
 #include <QtBluetooth/QLowEnergyServiceData>
 
+#include <algorithm>
+
 QT_BEGIN_NAMESPACE
 
 Q_DECLARE_LOGGING_CATEGORY(QT_BT)
@@ -128,6 +130,11 @@ void QLowEnergyControllerPrivate::setState(
         return;
 
     state = newState;
+    if (state == QLowEnergyController::DiscoveredState) {
+        rebuildHandleIndex();
+    } else if (state == QLowEnergyController::DiscoveringState) {
+        handleIndex.clear();
+    }
     if (state == QLowEnergyController::UnconnectedState
             && role == QLowEnergyController::PeripheralRole) {
         remoteDevice.clear();
@@ -135,17 +142,85 @@ void QLowEnergyControllerPrivate::setState(
     emit q->stateChanged(state);
 }
 
+const ServiceDataMap &QLowEnergyControllerPrivate::currentServices() const
+{
+    if (role == QLowEnergyController::PeripheralRole)
+        return localServices;
+    return serviceList;
+}
+
+/*!
+    Discovers the details of all \a services. The default implementation
+    discovers one service after the other. Backends may override this function
+    to discover the details of all services at once.
+ */
+void QLowEnergyControllerPrivate::discoverAllServiceDetails(const QList<QBluetoothUuid> &services)
+{
+    for (const QBluetoothUuid &service : services)
+        discoverServiceDetails(service);
+}
+
+/*!
+    Writes the characteristic \a values of \a service such that either all
+    or none of them are written. The default implementation sets the
+    \l QLowEnergyService::OperationError as reliable writes are not supported
+    by the backend.
+ */
+void QLowEnergyControllerPrivate::writeCharacteristicsReliably(
+        const QSharedPointer<QLowEnergyServicePrivate> &service,
+        const QVector<QPair<QLowEnergyHandle, QByteArray>> &/*values*/)
+{
+    service->setError(QLowEnergyService::OperationError);
+}
+
+/*!
+    Cancels the queued read and write requests of \a service.
+    The default implementation does nothing.
+ */
+void QLowEnergyControllerPrivate::cancelPendingRequests(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/)
+{
+}
+
+/*!
+    Returns a device which streams its data to the characteristic \a charHandle
+    using write commands. The default implementation returns \c nullptr as
+    streaming is not supported by the backend.
+ */
+QIODevice *QLowEnergyControllerPrivate::createWriteStream(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/,
+        const QLowEnergyHandle /*charHandle*/,
+        QObject */*parent*/)
+{
+    return nullptr;
+}
+
+/*!
+    Answers the reads of the local characteristic \a charHandle which wait for
+    the application to provide its \a value. The default implementation does
+    nothing as the backend does not support characteristic read handlers.
+ */
+void QLowEnergyControllerPrivate::provideCharacteristicValue(
+        const QSharedPointer<QLowEnergyServicePrivate> &/*service*/,
+        const QLowEnergyHandle /*charHandle*/,
+        const QByteArray &/*value*/)
+{
+}
+
 QSharedPointer<QLowEnergyServicePrivate> QLowEnergyControllerPrivate::serviceForHandle(
         QLowEnergyHandle handle)
 {
-    ServiceDataMap &currentList = serviceList;
-    if (role == QLowEnergyController::PeripheralRole)
-        currentList = localServices;
+    if (handleIndex.isValid()) {
+        const QLowEnergyHandleIndex::Entry *entry = handleIndex.entry(handle);
+        return entry ? entry->service : QSharedPointer<QLowEnergyServicePrivate>();
+    }
 
-    const QList<QSharedPointer<QLowEnergyServicePrivate>> values = currentList.values();
-    for (auto service: values)
+    const ServiceDataMap &currentList = currentServices();
+    for (auto it = currentList.constBegin(); it != currentList.constEnd(); ++it) {
+        const QSharedPointer<QLowEnergyServicePrivate> &service = it.value();
         if (service->startHandle <= handle && handle <= service->endHandle)
             return service;
+    }
 
     return QSharedPointer<QLowEnergyServicePrivate>();
 }
@@ -157,28 +232,35 @@ QSharedPointer<QLowEnergyServicePrivate> QLowEnergyControllerPrivate::serviceFor
 QLowEnergyCharacteristic QLowEnergyControllerPrivate::characteristicForHandle(
         QLowEnergyHandle handle)
 {
-    QSharedPointer<QLowEnergyServicePrivate> service = serviceForHandle(handle);
-    if (service.isNull())
-        return QLowEnergyCharacteristic();
-
-    if (service->characteristicList.isEmpty())
-        return QLowEnergyCharacteristic();
-
-    // check whether it is the handle of a characteristic header
-    if (service->characteristicList.contains(handle))
-        return QLowEnergyCharacteristic(service, handle);
-
-    // check whether it is the handle of the characteristic value or its descriptors
-    QList<QLowEnergyHandle> charHandles = service->characteristicList.keys();
-    std::sort(charHandles.begin(), charHandles.end());
-    for (int i = charHandles.size() - 1; i >= 0; i--) {
-        if (charHandles.at(i) > handle)
-            continue;
+    QSharedPointer<QLowEnergyServicePrivate> service;
+    if (handleIndex.isValid()) {
+        const QLowEnergyHandleIndex::Entry *entry = handleIndex.entry(handle);
+        if (!entry)
+            return QLowEnergyCharacteristic();
+        if (entry->detailsIndexed) {
+            if (!entry->charHandle)
+                return QLowEnergyCharacteristic();
+            return QLowEnergyCharacteristic(entry->service, entry->charHandle);
+        }
+        service = entry->service;
+    } else {
+        service = serviceForHandle(handle);
+        if (service.isNull())
+            return QLowEnergyCharacteristic();
+    }
 
-        return QLowEnergyCharacteristic(service, charHandles.at(i));
+    // The service details are not part of the index (yet).
+    // Find the closest characteristic header at or below handle.
+    QLowEnergyHandle charHandle = 0;
+    for (auto it = service->characteristicList.constBegin();
+         it != service->characteristicList.constEnd(); ++it) {
+        if (it.key() <= handle && it.key() > charHandle)
+            charHandle = it.key();
     }
+    if (!charHandle)
+        return QLowEnergyCharacteristic();
 
-    return QLowEnergyCharacteristic();
+    return QLowEnergyCharacteristic(service, charHandle);
 }
 
 /*!
@@ -188,20 +270,51 @@ QLowEnergyCharacteristic QLowEnergyControllerPrivate::characteristicForHandle(
 QLowEnergyDescriptor QLowEnergyControllerPrivate::descriptorForHandle(
         QLowEnergyHandle handle)
 {
+    if (handleIndex.isValid()) {
+        const QLowEnergyHandleIndex::Entry *entry = handleIndex.entry(handle);
+        if (!entry)
+            return QLowEnergyDescriptor();
+        if (entry->detailsIndexed) {
+            if (entry->isDescriptor && entry->handle == handle)
+                return QLowEnergyDescriptor(entry->service, entry->charHandle, handle);
+            return QLowEnergyDescriptor();
+        }
+    }
+
     const QLowEnergyCharacteristic matchingChar = characteristicForHandle(handle);
     if (!matchingChar.isValid())
         return QLowEnergyDescriptor();
 
-    const QLowEnergyServicePrivate::CharData charData = matchingChar.
-            d_ptr->characteristicList[matchingChar.attributeHandle()];
-
-    if (charData.descriptorList.contains(handle))
+    const auto charIt = matchingChar.d_ptr->characteristicList.constFind(
+                matchingChar.attributeHandle());
+    if (charIt != matchingChar.d_ptr->characteristicList.constEnd()
+            && charIt.value().descriptorList.contains(handle)) {
         return QLowEnergyDescriptor(matchingChar.d_ptr, matchingChar.attributeHandle(),
                                     handle);
+    }
 
     return QLowEnergyDescriptor();
 }
 
+/*!
+    Recreates the handle index from the current service map. This is done once the
+    service discovery has finished or local services were added.
+ */
+void QLowEnergyControllerPrivate::rebuildHandleIndex()
+{
+    handleIndex.rebuild(currentServices());
+}
+
+/*!
+    Replaces the index entries of \a service. This is called whenever the
+    state of the service changes, which is when its characteristics
+    and descriptors become known or get discarded.
+ */
+void QLowEnergyControllerPrivate::updateHandleIndex(const QLowEnergyServicePrivate *service)
+{
+    handleIndex.update(currentServices(), service);
+}
+
 /*!
     Returns the length of the updated characteristic value.
  */
@@ -266,6 +379,7 @@ void QLowEnergyControllerPrivate::invalidateServices()
 
     serviceList.clear();
     localServices.clear();
+    handleIndex.clear();
     lastLocalHandle = {};
 }
 
@@ -322,9 +436,109 @@ QLowEnergyService *QLowEnergyControllerPrivate::addServiceHelper(
                    << servicePrivate->uuid;
     }
     this->localServices.insert(servicePrivate->uuid, servicePrivate);
+    if (role == QLowEnergyController::PeripheralRole)
+        rebuildHandleIndex();
 
     this->addToGenericAttributeList(service, servicePrivate->startHandle);
     return new QLowEnergyService(servicePrivate);
 }
 
+void QLowEnergyHandleIndex::clear()
+{
+    entries.clear();
+    valid = false;
+}
+
+/*!
+    Returns the index entry covering \a handle or \c nullptr if
+    \a handle does not belong to any service.
+ */
+const QLowEnergyHandleIndex::Entry *QLowEnergyHandleIndex::entry(QLowEnergyHandle handle) const
+{
+    auto it = std::upper_bound(entries.constBegin(), entries.constEnd(), handle,
+                               [](QLowEnergyHandle h, const Entry &entry) {
+                                   return h < entry.handle;
+                               });
+    if (it == entries.constBegin())
+        return nullptr;
+    --it;
+    if (handle > it->serviceEndHandle)
+        return nullptr;
+    return it;
+}
+
+void QLowEnergyHandleIndex::appendEntries(QVector<Entry> &entries,
+        const QSharedPointer<QLowEnergyServicePrivate> &service)
+{
+    const bool detailsIndexed = service->state == QLowEnergyService::ServiceDiscovered
+                                || service->state == QLowEnergyService::LocalService;
+    entries.append({ service->startHandle, service->endHandle, 0, false, detailsIndexed,
+                     service });
+    if (!detailsIndexed)
+        return;
+
+    for (auto charIt = service->characteristicList.constBegin();
+         charIt != service->characteristicList.constEnd(); ++charIt) {
+        entries.append({ charIt.key(), service->endHandle, charIt.key(), false, true,
+                         service });
+        const DescriptorDataMap &descriptors = charIt.value().descriptorList;
+        for (auto descIt = descriptors.constBegin(); descIt != descriptors.constEnd(); ++descIt)
+            entries.append({ descIt.key(), service->endHandle, charIt.key(), true, true,
+                             service });
+    }
+}
+
+static bool lessThanHandle(const QLowEnergyHandleIndex::Entry &a,
+                           const QLowEnergyHandleIndex::Entry &b)
+{
+    return a.handle < b.handle;
+}
+
+/*!
+    Recreates the index from \a services.
+ */
+void QLowEnergyHandleIndex::rebuild(const ServiceDataMap &services)
+{
+    entries.clear();
+    for (auto it = services.constBegin(); it != services.constEnd(); ++it)
+        appendEntries(entries, it.value());
+    std::sort(entries.begin(), entries.end(), lessThanHandle);
+    valid = true;
+}
+
+/*!
+    Replaces the entries of \a service, which must be part of \a services.
+    Nothing happens if the index has not been built yet.
+ */
+void QLowEnergyHandleIndex::update(const ServiceDataMap &services,
+                                   const QLowEnergyServicePrivate *service)
+{
+    if (!valid)
+        return;
+
+    const auto serviceIt = services.constFind(service->uuid);
+    if (serviceIt == services.constEnd() || serviceIt.value().data() != service)
+        return;
+
+    const auto first = std::lower_bound(entries.begin(), entries.end(),
+                                        service->startHandle,
+                                        [](const Entry &entry, QLowEnergyHandle h) {
+                                            return entry.handle < h;
+                                        });
+    const auto last = std::upper_bound(first, entries.end(), service->endHandle,
+                                       [](QLowEnergyHandle h, const Entry &entry) {
+                                           return h < entry.handle;
+                                       });
+    entries.erase(first, last);
+
+    QVector<Entry> serviceEntries;
+    appendEntries(serviceEntries, serviceIt.value());
+    std::sort(serviceEntries.begin(), serviceEntries.end(), lessThanHandle);
+
+    const int oldCount = entries.count();
+    entries.append(serviceEntries);
+    std::inplace_merge(entries.begin(), entries.begin() + oldCount, entries.end(),
+                       lessThanHandle);
+}
+
 QT_END_NAMESPACE
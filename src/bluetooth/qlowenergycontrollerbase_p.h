@@ -53,6 +53,7 @@
 
 #include <qglobal.h>
 #include <QtCore/qobject.h>
+#include <QtCore/qvector.h>
 
 #include <QtBluetooth/qlowenergycontroller.h>
 
@@ -60,8 +61,46 @@
 
 QT_BEGIN_NAMESPACE
 
+class QIODevice;
+
 typedef QMap<QBluetoothUuid, QSharedPointer<QLowEnergyServicePrivate> > ServiceDataMap;
 
+/*
+  Sorted index of the service, characteristic and descriptor declarations
+  of a service map. An entry covers all handles up to the next entry
+  or the end of its service. It permits handle lookups without scanning the
+  service map for each incoming packet. Services whose details are not
+  known yet are only represented by their service entry.
+ */
+class Q_AUTOTEST_EXPORT QLowEnergyHandleIndex
+{
+public:
+    struct Entry {
+        QLowEnergyHandle handle;
+        QLowEnergyHandle serviceEndHandle;
+        QLowEnergyHandle charHandle;    // 0 for service entries
+        bool isDescriptor;
+        bool detailsIndexed;            // characteristics of service are part of index
+        QSharedPointer<QLowEnergyServicePrivate> service;
+    };
+
+    bool isValid() const { return valid; }
+    int count() const { return entries.count(); }
+    void clear();
+    void rebuild(const ServiceDataMap &services);
+    void update(const ServiceDataMap &services, const QLowEnergyServicePrivate *service);
+    const Entry *entry(QLowEnergyHandle handle) const;
+
+private:
+    static void appendEntries(QVector<Entry> &entries,
+                              const QSharedPointer<QLowEnergyServicePrivate> &service);
+
+    QVector<Entry> entries;
+    bool valid = false;
+};
+
+Q_DECLARE_TYPEINFO(QLowEnergyHandleIndex::Entry, Q_MOVABLE_TYPE);
+
 class QLowEnergyControllerPrivate : public QObject
 {
     Q_OBJECT
@@ -81,6 +120,7 @@ public:
 
     virtual void discoverServices() = 0;
     virtual void discoverServiceDetails(const QBluetoothUuid &/*service*/) = 0;
+    virtual void discoverAllServiceDetails(const QList<QBluetoothUuid> &services);
 
     virtual void readCharacteristic(
                         const QSharedPointer<QLowEnergyServicePrivate> /*service*/,
@@ -101,6 +141,21 @@ public:
                         const QLowEnergyHandle /*descriptorHandle*/,
                         const QByteArray &/*newValue*/) = 0;
 
+    virtual void writeCharacteristicsReliably(
+                        const QSharedPointer<QLowEnergyServicePrivate> &service,
+                        const QVector<QPair<QLowEnergyHandle, QByteArray>> &values);
+
+    virtual void cancelPendingRequests(
+                        const QSharedPointer<QLowEnergyServicePrivate> &service);
+    virtual QIODevice *createWriteStream(
+                        const QSharedPointer<QLowEnergyServicePrivate> &service,
+                        const QLowEnergyHandle charHandle,
+                        QObject *parent);
+    virtual void provideCharacteristicValue(
+                        const QSharedPointer<QLowEnergyServicePrivate> &service,
+                        const QLowEnergyHandle charHandle,
+                        const QByteArray &value);
+
     virtual void startAdvertising(
                         const QLowEnergyAdvertisingParameters &/* params */,
                         const QLowEnergyAdvertisingData &/* advertisingData */,
@@ -144,6 +199,10 @@ public:
                                  bool appendValue);
     void invalidateServices();
 
+    // maintenance of the handle index
+    void rebuildHandleIndex();
+    void updateHandleIndex(const QLowEnergyServicePrivate *service);
+
 protected:
     QLowEnergyController::ControllerState state = QLowEnergyController::UnconnectedState;
     QLowEnergyController::Error error = QLowEnergyController::NoError;
@@ -154,11 +213,16 @@ protected:
 
     QLowEnergyHandle lastLocalHandle{};
 
+    QLowEnergyHandleIndex handleIndex;
+
     QString remoteName; // device name of the remote
     QBluetoothUuid deviceUuid; // quite useless anywhere but Darwin (CoreBluetooth).
 
     Q_DECLARE_PUBLIC(QLowEnergyController)
     QLowEnergyController *q_ptr;
+
+private:
+    const ServiceDataMap &currentServices() const;
 };
 
 QT_END_NAMESPACE
@@ -135,8 +135,15 @@ QT_BEGIN_NAMESPACE
     All requests are serialised based on First-In First-Out principle.
     For example, issuing a second write request, before the previous
     write request has finished, is delayed until the first write request has finished.
+    On BlueZ, read and write requests may be sent ahead of requests which
+    belong to a running service discovery. Queued requests can be withdrawn
+    using \l cancelPendingRequests().
 
-    \note Currently, it is not possible to send signed write or reliable write requests.
+    Several characteristic values can be written as one transaction using
+    \l beginReliableWrite() and \l executeReliableWrite(). Either all or none
+    of the values are written.
+
+    \note Currently, it is not possible to send signed write requests.
 
     \target notifications
 
@@ -155,6 +162,10 @@ QT_BEGIN_NAMESPACE
     are provided by the
     \l {https://developer.bluetooth.org/gatt/descriptors/Pages/DescriptorViewer.aspx?u=org.bluetooth.descriptor.gatt.client_characteristic_configuration.xml}{Bluetooth Specification}.
 
+    Services which receive a high rate of notifications may use
+    \l setNotificationBatchHandler() and \l setStreamOnly() to reduce the
+    processing overhead per notification.
+
     \section1 Service Data Sharing
 
     Each QLowEnergyService instance shares its internal states and information
@@ -559,7 +570,7 @@ QString QLowEnergyService::serviceName() const
     and descriptors contained by the service. The discovery process is indicated
     via the \l stateChanged() signal.
 
-    \sa state()
+    \sa state(), QLowEnergyController::discoverAllServiceDetails()
  */
 void QLowEnergyService::discoverDetails()
 {
@@ -667,7 +678,11 @@ void QLowEnergyService::readCharacteristic(
     For example, if the same descriptor is set to the value A and immediately afterwards
     to B, the two write request are executed in the given order.
 
-    \note Currently, it is not possible to use signed or reliable writes as defined by the
+    While a transaction started by \l beginReliableWrite() is active, a \l WriteWithResponse
+    is not sent immediately. It becomes part of the transaction which is
+    sent by \l executeReliableWrite().
+
+    \note Currently, it is not possible to use signed writes as defined by the
     Bluetooth specification.
 
     A characteristic can only be written if this service is in the \l ServiceDiscovered state
@@ -680,6 +695,9 @@ void QLowEnergyService::readCharacteristic(
     characteristic may only support \l WriteWithResponse. If the hardware returns
     with an error the \l CharacteristicWriteError is set.
 
+    A \l WriteWithoutResponse may be discarded if the connection cannot accept
+    further data. Use \l createWriteStream() to transfer larger amounts of data.
+
     \b {Peripheral role}
 
     The call results in the value of the characteristic getting updated in the local database.
@@ -693,6 +711,9 @@ void QLowEnergyService::readCharacteristic(
     If there is a constraint on the length of the characteristic value and \a newValue
     does not adhere to that constraint, the behavior is unspecified.
 
+    Characteristics whose value is expensive to keep up to date can instead produce
+    it when a client reads it, see \l setCharacteristicReadHandler().
+
     \note The \a mode argument is ignored in peripheral mode.
 
     \sa QLowEnergyService::characteristicWritten(), QLowEnergyService::readCharacteristic()
@@ -713,6 +734,12 @@ void QLowEnergyService::writeCharacteristic(
         return;
     }
 
+    if (d->reliableWriteActive && mode == WriteWithResponse
+            && d->controller->role == QLowEnergyController::CentralRole) {
+        d->reliableWrites.append(qMakePair(characteristic.attributeHandle(), newValue));
+        return;
+    }
+
     // don't write if properties don't permit it
     d->controller->writeCharacteristic(characteristic.d_ptr,
                                        characteristic.attributeHandle(),
@@ -835,4 +862,336 @@ void QLowEnergyService::writeDescriptor(const QLowEnergyDescriptor &descriptor,
                                    newValue);
 }
 
+/*!
+    \since 6.0
+
+    Starts a reliable write transaction. Subsequent calls to \l writeCharacteristic()
+    using the \l WriteWithResponse mode are not sent to the remote device but
+    collected until \l executeReliableWrite() or \l abortReliableWrite() is called.
+    Other write modes and descriptor writes are not affected.
+
+    Calling this function while a transaction is active discards the values
+    collected so far.
+
+    Reliable writes are only available in the central role. The characteristics
+    should have the reliable write extended property.
+
+    \sa executeReliableWrite(), abortReliableWrite()
+ */
+void QLowEnergyService::beginReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    d->reliableWrites.clear();
+    d->reliableWriteActive = true;
+}
+
+/*!
+    \since 6.0
+
+    Sends the characteristic values collected since \l beginReliableWrite() to the
+    remote device and ends the transaction. The remote device writes either all
+    or none of the values.
+
+    The values are queued on the remote device using prepare write requests.
+    The remote device echoes every queued segment. If an echo differs from the
+    sent data, the transaction is cancelled. Once all values are queued, they are
+    written at once. If the operation is successful, the \l characteristicWritten()
+    signal is emitted for every value in the order in which the values were written;
+    otherwise the \l CharacteristicWriteError is set and none of the values is written.
+
+    If this service is not in the \l ServiceDiscovered state, no transaction is active,
+    or the controller is not in the central role, the \l OperationError is set.
+    The \l OperationError is set as well if the platform does not support reliable
+    writes. Currently only the BlueZ backend which does not use the BlueZ DBus API
+    supports them.
+
+    \sa beginReliableWrite(), abortReliableWrite()
+ */
+void QLowEnergyService::executeReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    const bool wasActive = d->reliableWriteActive;
+    const QVector<QPair<QLowEnergyHandle, QByteArray>> values = d->reliableWrites;
+    d->reliableWrites.clear();
+    d->reliableWriteActive = false;
+
+    if (!wasActive || d->controller == nullptr
+            || d->controller->role != QLowEnergyController::CentralRole
+            || state() != ServiceDiscovered) {
+        d->setError(QLowEnergyService::OperationError);
+        return;
+    }
+
+    if (values.isEmpty())
+        return;
+
+    d->controller->writeCharacteristicsReliably(d_ptr, values);
+}
+
+/*!
+    \since 6.0
+
+    Ends the transaction started by \l beginReliableWrite() and discards the
+    characteristic values collected so far. Nothing has been sent to the remote
+    device for them.
+
+    \sa beginReliableWrite(), executeReliableWrite()
+ */
+void QLowEnergyService::abortReliableWrite()
+{
+    Q_D(QLowEnergyService);
+
+    d->reliableWrites.clear();
+    d->reliableWriteActive = false;
+}
+
+/*!
+    \since 6.0
+
+    Cancels the characteristic and descriptor read and write requests of this service
+    which are still waiting in the request queue. No signals are emitted for
+    the cancelled requests.
+
+    A request which has already been sent to the remote device is not affected.
+    The same applies to a long write (see \l writeCharacteristic()) which is
+    already in progress. Requests issued by \l discoverDetails() cannot be cancelled.
+
+    Requests towards the same remote device are serialised. Read and write requests
+    are sent ahead of queued service discovery requests. Cancelling the requests of
+    a service which is no longer of interest lets the requests of other services
+    proceed sooner.
+
+    \note Only the BlueZ backend which does not use the BlueZ DBus API supports
+    cancellation. This function does nothing on other platforms.
+
+    \sa readCharacteristic(), writeCharacteristic(), readDescriptor(), writeDescriptor()
+ */
+void QLowEnergyService::cancelPendingRequests()
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == nullptr || d->controller->role != QLowEnergyController::CentralRole)
+        return;
+
+    d->controller->cancelPendingRequests(d_ptr);
+}
+
+/*!
+    \since 6.0
+
+    Returns a write-only, sequential device which streams the data written to it to
+    \a characteristic. This is intended for transfers of large amounts of data
+    such as firmware updates.
+
+    The data is split into packets of the maximum size permitted by the
+    negotiated MTU and sent using the \l WriteWithoutResponse mode. Data is
+    buffered by the device until the connection to the remote device can accept
+    it. Other than with \l writeCharacteristic() no data is discarded if the
+    remote device cannot keep up. The \l {QIODevice::bytesWritten()}{bytesWritten()}
+    signal of the device is emitted whenever data has been passed on to the
+    Bluetooth stack, and \l {QIODevice::bytesToWrite()}{bytesToWrite()} returns
+    the amount of data which is still buffered. Applications should limit the buffered
+    amount by writing further data in response to
+    \l {QIODevice::bytesWritten()}{bytesWritten()}.
+
+    The device is owned by \a parent. It is closed when the connection to the remote
+    device ends. Closing or deleting the device discards the buffered data.
+
+    Returns \c nullptr and sets the \l OperationError if the service is not in
+    the \l ServiceDiscovered state, \a characteristic does not belong to this
+    service, the controller is not in the central role, or the platform does not
+    support streaming. Currently only the BlueZ backend which does not use the
+    BlueZ DBus API supports it.
+
+    \sa writeCharacteristic()
+ */
+QIODevice *QLowEnergyService::createWriteStream(const QLowEnergyCharacteristic &characteristic,
+                                                QObject *parent)
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == nullptr
+            || d->controller->role != QLowEnergyController::CentralRole
+            || state() != ServiceDiscovered
+            || !contains(characteristic)) {
+        d->setError(QLowEnergyService::OperationError);
+        return nullptr;
+    }
+
+    QIODevice *stream = d->controller->createWriteStream(characteristic.d_ptr,
+                                                         characteristic.attributeHandle(),
+                                                         parent);
+    if (!stream)
+        d->setError(QLowEnergyService::OperationError);
+    return stream;
+}
+
+/*!
+    \typedef QLowEnergyService::NotificationBatchHandler
+    \since 6.0
+
+    Synonym for \c {std::function<void(const QList<QLowEnergyCharacteristic> &characteristics,
+    const QList<QByteArray> &values)>}. The value at a given index of \c values
+    belongs to the characteristic at the same index of \c characteristics.
+
+    \sa setNotificationBatchHandler()
+ */
+
+/*!
+    \since 6.0
+
+    Delivers the notifications and indications of this service in batches to
+    \a handler instead of emitting \l characteristicChanged() for each of them.
+    This reduces the overhead for services which receive many notifications
+    per second.
+
+    The notifications are collected while incoming data is processed and the
+    handler is invoked once control returns to the event loop. The values passed
+    to the handler refer to a buffer which is reused for the next batch. They are
+    only valid during the invocation of the handler and must be copied if they
+    are needed afterwards.
+
+    Passing an empty \a handler restores the emission of \l characteristicChanged().
+
+    \note Only the BlueZ backend which does not use the BlueZ DBus API supports
+    batched delivery. Other backends continue to emit \l characteristicChanged().
+
+    \sa setStreamOnly()
+ */
+void QLowEnergyService::setNotificationBatchHandler(const NotificationBatchHandler &handler)
+{
+    Q_D(QLowEnergyService);
+
+    d->notificationBatchHandler = handler;
+}
+
+/*!
+    \since 6.0
+
+    Sets whether \a characteristic is a stream-only characteristic to
+    \a streamOnly. Notifications and indications of a stream-only characteristic
+    are passed on without updating the cached value returned by
+    \l QLowEnergyCharacteristic::value(). This avoids copying the value of
+    characteristics which only provide a stream of data.
+
+    The setting is ignored if \a characteristic does not belong to this service.
+
+    \note Only the BlueZ backend which does not use the BlueZ DBus API supports
+    stream-only characteristics.
+
+    \sa isStreamOnly(), setNotificationBatchHandler()
+ */
+void QLowEnergyService::setStreamOnly(const QLowEnergyCharacteristic &characteristic,
+                                      bool streamOnly)
+{
+    Q_D(QLowEnergyService);
+
+    if (!contains(characteristic))
+        return;
+
+    d->characteristicList[characteristic.attributeHandle()].streamOnly = streamOnly;
+}
+
+/*!
+    \since 6.0
+
+    Returns \c true if \a characteristic belongs to this service and was marked
+    as stream-only; otherwise \c false.
+
+    \sa setStreamOnly()
+ */
+bool QLowEnergyService::isStreamOnly(const QLowEnergyCharacteristic &characteristic) const
+{
+    Q_D(const QLowEnergyService);
+
+    if (!contains(characteristic))
+        return false;
+
+    return d->characteristicList.value(characteristic.attributeHandle()).streamOnly;
+}
+
+/*!
+    \typedef QLowEnergyService::CharacteristicReadHandler
+    \since 6.0
+
+    Synonym for \c {std::function<bool(const QLowEnergyCharacteristic &characteristic,
+    int offset, QByteArray *value)>}.
+
+    \sa setCharacteristicReadHandler()
+ */
+
+/*!
+    \since 6.0
+
+    Makes \a handler produce the value of the local \a characteristic whenever a
+    client reads it. This saves updating values which are expensive to compute but
+    rarely read. Passing an empty \a handler restores serving the value which was
+    last written.
+
+    The handler receives the \a characteristic, the offset into the value which the
+    client reads from, and the value which was last provided. The offset is non-zero
+    while a client reads a value which does not fit into a single packet. The handler
+    can keep the value of such a read unchanged so that the client receives consistent
+    parts of it.
+
+    If the handler returns \c true, the content of its \c value argument becomes the
+    new value of the characteristic and is sent to the client. If it returns \c false,
+    the client waits until the value is passed to \l provideCharacteristicValue(). A
+    read which is not answered within 20 seconds fails.
+
+    A new value produced by the handler does not cause notifications or indications.
+    Read requests which cover several attributes at once serve the value which was
+    last provided without calling the handler.
+
+    The handler is ignored if the controller is not in the peripheral role or
+    \a characteristic does not belong to this service.
+
+    \note Only the BlueZ backend which does not use the BlueZ DBus API supports read
+    handlers. Other backends serve the value which was last written.
+
+    \sa provideCharacteristicValue(), writeCharacteristic()
+ */
+void QLowEnergyService::setCharacteristicReadHandler(
+        const QLowEnergyCharacteristic &characteristic, const CharacteristicReadHandler &handler)
+{
+    Q_D(QLowEnergyService);
+
+    if (!contains(characteristic))
+        return;
+
+    d->characteristicList[characteristic.attributeHandle()].readHandler = handler;
+}
+
+/*!
+    \since 6.0
+
+    Sets \a value as the value of the local \a characteristic and sends it to
+    the clients whose reads were deferred by the read handler of \a characteristic.
+    Unlike \l writeCharacteristic(), this does not cause notifications or indications.
+
+    If \a value does not adhere to the length constraints of \a characteristic,
+    the deferred reads fail and the value is not changed.
+
+    The \l OperationError is set if the controller is not in the peripheral
+    role or \a characteristic does not belong to this service.
+
+    \sa setCharacteristicReadHandler()
+ */
+void QLowEnergyService::provideCharacteristicValue(
+        const QLowEnergyCharacteristic &characteristic, const QByteArray &value)
+{
+    Q_D(QLowEnergyService);
+
+    if (d->controller == nullptr
+            || d->controller->role != QLowEnergyController::PeripheralRole
+            || !contains(characteristic)) {
+        d->setError(QLowEnergyService::OperationError);
+        return;
+    }
+
+    d->controller->provideCharacteristicValue(d_ptr, characteristic.attributeHandle(), value);
+}
+
 QT_END_NAMESPACE
@@ -44,8 +44,11 @@
 #include <QtBluetooth/QBluetoothUuid>
 #include <QtBluetooth/QLowEnergyCharacteristic>
 
+#include <functional>
+
 QT_BEGIN_NAMESPACE
 
+class QIODevice;
 class QLowEnergyServicePrivate;
 class Q_BLUETOOTH_EXPORT QLowEnergyService : public QObject
 {
@@ -86,6 +89,11 @@ public:
     };
     Q_ENUM(WriteMode)
 
+    typedef std::function<void(const QList<QLowEnergyCharacteristic> &characteristics,
+                               const QList<QByteArray> &values)> NotificationBatchHandler;
+    typedef std::function<bool(const QLowEnergyCharacteristic &characteristic, int offset,
+                               QByteArray *value)> CharacteristicReadHandler;
+
     ~QLowEnergyService();
 
     QList<QBluetoothUuid> includedServices() const;
@@ -113,6 +121,24 @@ public:
     void writeDescriptor(const QLowEnergyDescriptor &descriptor,
                          const QByteArray &newValue);
 
+    void beginReliableWrite();
+    void executeReliableWrite();
+    void abortReliableWrite();
+
+    void cancelPendingRequests();
+
+    QIODevice *createWriteStream(const QLowEnergyCharacteristic &characteristic,
+                                 QObject *parent = nullptr);
+
+    void setNotificationBatchHandler(const NotificationBatchHandler &handler);
+    void setStreamOnly(const QLowEnergyCharacteristic &characteristic, bool streamOnly);
+    bool isStreamOnly(const QLowEnergyCharacteristic &characteristic) const;
+
+    void setCharacteristicReadHandler(const QLowEnergyCharacteristic &characteristic,
+                                      const CharacteristicReadHandler &handler);
+    void provideCharacteristicValue(const QLowEnergyCharacteristic &characteristic,
+                                    const QByteArray &value);
+
 Q_SIGNALS:
     void stateChanged(QLowEnergyService::ServiceState newState);
     void characteristicChanged(const QLowEnergyCharacteristic &info,
@@ -49,7 +49,8 @@ QLowEnergyServicePrivate::QLowEnergyServicePrivate(QObject *parent) :
     endHandle(0),
     type(QLowEnergyService::PrimaryService),
     state(QLowEnergyService::InvalidService),
-    lastError(QLowEnergyService::NoError)
+    lastError(QLowEnergyService::NoError),
+    reliableWriteActive(false)
 {
 }
 
@@ -79,7 +80,59 @@ void QLowEnergyServicePrivate::setState(QLowEnergyService::ServiceState newState
         return;
 
     state = newState;
+    if (controller)
+        controller->updateHandleIndex(this);
     emit stateChanged(newState);
 }
 
+/*
+  Appends a notification to the batch which is passed to notificationBatchHandler
+  by deliverNotificationBatch(). The value is copied into the reused notification buffer.
+ */
+void QLowEnergyServicePrivate::queueNotification(const QLowEnergyCharacteristic &characteristic,
+                                                 const char *value, int size)
+{
+    batchCharacteristics.append(characteristic);
+    batchValueRanges.append(qMakePair(notificationBuffer.size(), size));
+    notificationBuffer.append(value, size);
+}
+
+void QLowEnergyServicePrivate::deliverNotificationBatch()
+{
+    if (batchCharacteristics.isEmpty())
+        return;
+
+    // The handler may process events and thereby start the next batch.
+    QByteArray buffer;
+    buffer.swap(notificationBuffer);
+    const QList<QLowEnergyCharacteristic> characteristics = std::move(batchCharacteristics);
+    batchCharacteristics.clear();
+
+    QList<QByteArray> values;
+    values.reserve(batchValueRanges.size());
+    for (const auto &range : qAsConst(batchValueRanges))
+        values.append(QByteArray::fromRawData(buffer.constData() + range.first, range.second));
+    batchValueRanges.clear();
+
+    // the handler may replace itself
+    const QLowEnergyService::NotificationBatchHandler handler = notificationBatchHandler;
+    if (handler) {
+        handler(characteristics, values);
+    } else {
+        // The handler was removed while the batch was collected. Receivers
+        // of the signal may keep the value, it must not refer to the buffer.
+        for (int i = 0; i < characteristics.size(); ++i) {
+            const QByteArray &value = values.at(i);
+            emit characteristicChanged(characteristics.at(i),
+                                       QByteArray(value.constData(), value.size()));
+        }
+    }
+
+    // reuse the allocated buffer for the next batch
+    if (notificationBuffer.isEmpty()) {
+        buffer.resize(0);
+        notificationBuffer.swap(buffer);
+    }
+}
+
 QT_END_NAMESPACE
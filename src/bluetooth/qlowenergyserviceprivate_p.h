@@ -52,7 +52,9 @@
 //
 
 #include <QtCore/QObject>
+#include <QtCore/QPair>
 #include <QtCore/QPointer>
+#include <QtCore/QVector>
 #include <QtBluetooth/qbluetooth.h>
 #include <QtBluetooth/QLowEnergyService>
 #include <QtBluetooth/QLowEnergyCharacteristic>
@@ -68,7 +70,7 @@ QT_BEGIN_NAMESPACE
 
 class QLowEnergyControllerPrivate;
 
-class QLowEnergyServicePrivate : public QObject
+class Q_AUTOTEST_EXPORT QLowEnergyServicePrivate : public QObject
 {
     Q_OBJECT
 public:
@@ -86,6 +88,9 @@ public:
         QLowEnergyCharacteristic::PropertyTypes properties;
         QByteArray value;
         QHash<QLowEnergyHandle, DescData> descriptorList;
+        bool streamOnly = false; // notifications do not update value
+        // peripheral role: produces the value when a central reads it
+        QLowEnergyService::CharacteristicReadHandler readHandler;
 #ifdef QT_WIN_BLUETOOTH
         Qt::HANDLE hValueChangeEvent;
 #endif
@@ -102,6 +107,10 @@ public:
     void setError(QLowEnergyService::ServiceError newError);
     void setState(QLowEnergyService::ServiceState newState);
 
+    void queueNotification(const QLowEnergyCharacteristic &characteristic,
+                           const char *value, int size);
+    void deliverNotificationBatch();
+
 signals:
     void stateChanged(QLowEnergyService::ServiceState newState);
     void error(QLowEnergyService::ServiceError error);
@@ -128,6 +137,17 @@ public:
 
     QHash<QLowEnergyHandle, CharData> characteristicList;
 
+    // characteristic writes collected since beginReliableWrite()
+    bool reliableWriteActive;
+    QVector<QPair<QLowEnergyHandle, QByteArray>> reliableWrites;
+
+    // notifications collected for the batch handler; the values are
+    // stored back to back in notificationBuffer which is reused
+    QLowEnergyService::NotificationBatchHandler notificationBatchHandler;
+    QList<QLowEnergyCharacteristic> batchCharacteristics;
+    QVector<QPair<int, int>> batchValueRanges; // offset and size in notificationBuffer
+    QByteArray notificationBuffer;
+
     QPointer<QLowEnergyControllerPrivate> controller;
 
 #if defined(QT_ANDROID_BLUETOOTH)
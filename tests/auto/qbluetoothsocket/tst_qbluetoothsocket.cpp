@@ -36,6 +36,16 @@
 #include <qbluetoothservicediscoveryagent.h>
 #include <qbluetoothlocaldevice.h>
 
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+#include <QtBluetooth/private/qbluetoothsocket_bluez_p.h>
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
 QT_USE_NAMESPACE
 
 Q_DECLARE_METATYPE(QBluetoothServiceInfo::Protocol)
@@ -48,6 +58,34 @@ Q_DECLARE_METATYPE(QBluetoothServiceInfo::Protocol)
 static const int MaxConnectTime = 60 * 1000;   // 1 minute in ms
 static const int MaxReadWriteTime = 60 * 1000; // 1 minute in ms
 
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+// socket using the kernel backend, whatever the version of bluetoothd
+class RawBluetoothSocket : public QBluetoothSocket
+{
+public:
+    explicit RawBluetoothSocket(QBluetoothServiceInfo::Protocol protocol)
+        : QBluetoothSocket(new QBluetoothSocketPrivateBluez, protocol)
+    {
+    }
+};
+
+// reads \a size bytes from the peer of a socket pair while the events are processed
+static QByteArray receiveBytes(int socket, int size)
+{
+    QByteArray received;
+    QElapsedTimer timer;
+    timer.start();
+    while (received.size() < size && !timer.hasExpired(MaxReadWriteTime)) {
+        char data[64 * 1024];
+        const ssize_t bytes = ::read(socket, data, sizeof(data));
+        if (bytes > 0)
+            received.append(data, int(bytes));
+        QCoreApplication::processEvents();
+    }
+    return received;
+}
+#endif
+
 class tst_QBluetoothSocket : public QObject
 {
     Q_OBJECT
@@ -78,6 +116,12 @@ private slots:
 
     void tst_preferredSecurityFlags();
 
+    void tst_readBufferSize();
+    void tst_datagrams();
+    void tst_sendFile();
+    void tst_sendFileUnbuffered();
+    void tst_sendFileMapping();
+
     void tst_unsupportedProtocolError();
 
 public slots:
@@ -521,6 +565,268 @@ void tst_QBluetoothSocket::tst_preferredSecurityFlags()
 #endif
 }
 
+void tst_QBluetoothSocket::tst_readBufferSize()
+{
+    QBluetoothSocket socket;
+    QCOMPARE(socket.readBufferSize(), Q_INT64_C(0));
+    socket.setReadBufferSize(4096);
+    QCOMPARE(socket.readBufferSize(), Q_INT64_C(4096));
+    socket.setReadBufferSize(-1);
+    QCOMPARE(socket.readBufferSize(), Q_INT64_C(0));
+
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+    // a local socket pair replaces the RFCOMM connection
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    QVERIFY(::fcntl(sockets[1], F_SETFL, ::fcntl(sockets[1], F_GETFL) | O_NONBLOCK) != -1);
+
+    RawBluetoothSocket rawSocket(QBluetoothServiceInfo::RfcommProtocol);
+    rawSocket.setReadBufferSize(4096);
+    QVERIFY(rawSocket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::RfcommProtocol,
+                                          QBluetoothSocket::ConnectedState,
+                                          QIODevice::ReadWrite | QIODevice::Unbuffered));
+
+    // the peer fills the kernel buffers, the socket takes no more than its limit
+    const QByteArray chunk(1024, 'x');
+    qint64 sent = 0;
+    ssize_t written;
+    while ((written = ::write(sockets[1], chunk.constData(), size_t(chunk.size()))) > 0)
+        sent += written;
+    QCOMPARE(errno, EAGAIN);
+    QVERIFY(sent > 4096);
+    QTRY_COMPARE(rawSocket.bytesAvailable(), Q_INT64_C(4096));
+    QTest::qWait(100);
+    QCOMPARE(rawSocket.bytesAvailable(), Q_INT64_C(4096));
+
+    // reading makes room for the data held back by the kernel
+    qint64 received = 0;
+    QElapsedTimer timer;
+    timer.start();
+    while (received < sent && !timer.hasExpired(MaxReadWriteTime)) {
+        received += rawSocket.readAll().size();
+        QVERIFY(rawSocket.bytesAvailable() <= 4096);
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+    QCOMPARE(received, sent);
+
+    // without limit the socket takes everything
+    rawSocket.setReadBufferSize(0);
+    sent = 0;
+    while ((written = ::write(sockets[1], chunk.constData(), size_t(chunk.size()))) > 0)
+        sent += written;
+    QTRY_COMPARE(rawSocket.bytesAvailable(), sent);
+
+    rawSocket.abort();
+    ::close(sockets[1]);
+#endif
+}
+
+void tst_QBluetoothSocket::tst_datagrams()
+{
+    QBluetoothSocket socket(QBluetoothServiceInfo::RfcommProtocol);
+    QVERIFY(!socket.hasPendingDatagrams());
+    QCOMPARE(socket.pendingDatagramSize(), Q_INT64_C(-1));
+
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+    // a local packet socket pair replaces the L2CAP connection
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+
+    RawBluetoothSocket rawSocket(QBluetoothServiceInfo::L2capProtocol);
+    QVERIFY(rawSocket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::L2capProtocol));
+
+    // received packets keep their boundaries
+    const QList<QByteArray> packets = { QByteArray(1, 'a'), QByteArray(100, 'b'),
+                                        QByteArray(3000, 'c'), QByteArray(20, 'd') };
+    for (const QByteArray &packet : packets)
+        QCOMPARE(::send(sockets[1], packet.constData(), size_t(packet.size()), 0), ssize_t(packet.size()));
+
+    QTRY_COMPARE(rawSocket.bytesAvailable(), Q_INT64_C(3121));
+    char data[4096];
+    for (int i = 0; i < 3; ++i) {
+        QVERIFY(rawSocket.hasPendingDatagrams());
+        QCOMPARE(rawSocket.pendingDatagramSize(), qint64(packets.at(i).size()));
+        const qint64 size = rawSocket.readDatagram(data, sizeof(data));
+        QCOMPARE(QByteArray(data, int(size)), packets.at(i));
+    }
+
+    // the remainder of a truncated packet is dropped
+    QCOMPARE(rawSocket.readDatagram(data, 5), Q_INT64_C(5));
+    QCOMPARE(QByteArray(data, 5), QByteArray(5, 'd'));
+    QVERIFY(!rawSocket.hasPendingDatagrams());
+    QCOMPARE(rawSocket.bytesAvailable(), Q_INT64_C(0));
+    QCOMPARE(rawSocket.readDatagram(data, sizeof(data)), Q_INT64_C(-1));
+
+    // sent datagrams arrive as they are, written data forms separate packets
+    QCOMPARE(rawSocket.writeDatagram(packets.at(0)), qint64(packets.at(0).size()));
+    QCOMPARE(rawSocket.write(QByteArray(10, 'e')), Q_INT64_C(10));
+    QCOMPARE(rawSocket.write(QByteArray(20, 'f')), Q_INT64_C(20));
+    QCOMPARE(rawSocket.writeDatagram(packets.at(2)), qint64(packets.at(2).size()));
+    QTRY_COMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+
+    const QList<QByteArray> expected = { packets.at(0), QByteArray(10, 'e') + QByteArray(20, 'f'),
+                                         packets.at(2) };
+    for (const QByteArray &packet : expected) {
+        const ssize_t size = ::recv(sockets[1], data, sizeof(data), MSG_DONTWAIT);
+        QCOMPARE(QByteArray(data, int(size)), packet);
+    }
+
+    rawSocket.abort();
+    ::close(sockets[1]);
+#else
+    QSKIP("Datagrams are only tested with the BlueZ backend");
+#endif
+}
+
+void tst_QBluetoothSocket::tst_sendFile()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QByteArray contents(3 * 1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < contents.size(); ++i)
+        contents[i] = char(i % 251);
+    QCOMPARE(file.write(contents), qint64(contents.size()));
+    QVERIFY(file.flush());
+
+    QBluetoothSocket socket(QBluetoothServiceInfo::RfcommProtocol);
+    QVERIFY(!socket.sendFile(&file));
+    QCOMPARE(socket.error(), QBluetoothSocket::OperationError);
+
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+    // a local socket pair replaces the RFCOMM connection
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    QVERIFY(::fcntl(sockets[1], F_SETFL, ::fcntl(sockets[1], F_GETFL) | O_NONBLOCK) != -1);
+
+    RawBluetoothSocket rawSocket(QBluetoothServiceInfo::RfcommProtocol);
+    QVERIFY(rawSocket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::RfcommProtocol));
+    qint64 bytesWritten = 0;
+    connect(&rawSocket, &QBluetoothSocket::bytesWritten, this, [&bytesWritten](qint64 bytes) {
+        bytesWritten += bytes;
+    });
+
+    QVERIFY(!rawSocket.sendFile(&file, 10, contents.size()));
+    QCOMPARE(rawSocket.error(), QBluetoothSocket::OperationError);
+
+    // files are sent in order with the written data
+    QCOMPARE(rawSocket.write("head"), Q_INT64_C(4));
+    QVERIFY(rawSocket.sendFile(&file, 10));
+    QCOMPARE(rawSocket.write("middle"), Q_INT64_C(6));
+    QVERIFY(rawSocket.sendFile(&file, 0, 1000));
+    QCOMPARE(rawSocket.write("tail"), Q_INT64_C(4));
+    const QByteArray expected = "head" + contents.mid(10) + "middle" + contents.left(1000) + "tail";
+    QCOMPARE(rawSocket.bytesToWrite(), qint64(expected.size()));
+
+    QVERIFY(receiveBytes(sockets[1], expected.size()) == expected);
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+    QCOMPARE(bytesWritten, qint64(expected.size()));
+    QCOMPARE(file.pos(), qint64(contents.size()));
+
+    // a file which is truncated before it was sent ends with an error
+    QSignalSpy errorSpy(&rawSocket, SIGNAL(error(QBluetoothSocket::SocketError)));
+    QVERIFY(rawSocket.sendFile(&file));
+    QCOMPARE(rawSocket.write("tail"), Q_INT64_C(4));
+    QVERIFY(file.resize(1000));
+    const QByteArray truncated = contents.left(1000) + "tail";
+    QVERIFY(receiveBytes(sockets[1], truncated.size()) == truncated);
+    QCOMPARE(errorSpy.count(), 1);
+    QCOMPARE(rawSocket.error(), QBluetoothSocket::OperationError);
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+
+    rawSocket.abort();
+    ::close(sockets[1]);
+#endif
+}
+
+void tst_QBluetoothSocket::tst_sendFileUnbuffered()
+{
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    const QByteArray contents(1000, 'f');
+    QCOMPARE(file.write(contents), qint64(contents.size()));
+    QVERIFY(file.flush());
+
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    QVERIFY(::fcntl(sockets[1], F_SETFL, ::fcntl(sockets[1], F_GETFL) | O_NONBLOCK) != -1);
+
+    RawBluetoothSocket rawSocket(QBluetoothServiceInfo::RfcommProtocol);
+    QVERIFY(rawSocket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::RfcommProtocol,
+                                          QBluetoothSocket::ConnectedState,
+                                          QIODevice::ReadWrite | QIODevice::Unbuffered));
+
+    // data written after a queued file waits for the file
+    QCOMPARE(rawSocket.write("head"), Q_INT64_C(4));
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+    QVERIFY(rawSocket.sendFile(&file));
+    QCOMPARE(rawSocket.write("tail"), Q_INT64_C(4));
+    QCOMPARE(rawSocket.bytesToWrite(), qint64(contents.size() + 4));
+    const QByteArray expected = "head" + contents + "tail";
+    QVERIFY(receiveBytes(sockets[1], expected.size()) == expected);
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+
+    // once the file was sent, data is written right away again
+    QCOMPARE(rawSocket.write("more"), Q_INT64_C(4));
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+    QCOMPARE(receiveBytes(sockets[1], 4), QByteArray("more"));
+
+    rawSocket.abort();
+    ::close(sockets[1]);
+#else
+    QSKIP("Sending files is only tested with the BlueZ backend");
+#endif
+}
+
+void tst_QBluetoothSocket::tst_sendFileMapping()
+{
+#if defined(QT_BUILD_INTERNAL) && QT_CONFIG(bluez)
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QByteArray contents(3 * 1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < contents.size(); ++i)
+        contents[i] = char(i % 251);
+    QCOMPARE(file.write(contents), qint64(contents.size()));
+    QVERIFY(file.flush());
+
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    QVERIFY(::fcntl(sockets[1], F_SETFL, ::fcntl(sockets[1], F_GETFL) | O_NONBLOCK) != -1);
+
+    RawBluetoothSocket rawSocket(QBluetoothServiceInfo::RfcommProtocol);
+    QVERIFY(rawSocket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::RfcommProtocol));
+
+    // sendfile() refuses sockets in append mode, the file is written from a mapping instead
+    QVERIFY(::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_APPEND) != -1);
+    off_t offset = 0;
+    if (::sendfile(sockets[0], file.handle(), &offset, 1) != -1 || errno != EINVAL) {
+        rawSocket.abort();
+        ::close(sockets[1]);
+        QSKIP("sendfile() accepts sockets in append mode");
+    }
+
+    // the file is mapped in several parts, starting at an unaligned offset
+    QCOMPARE(rawSocket.write("head"), Q_INT64_C(4));
+    QVERIFY(rawSocket.sendFile(&file, 10));
+    QCOMPARE(rawSocket.write("tail"), Q_INT64_C(4));
+    const QByteArray expected = "head" + contents.mid(10) + "tail";
+    QVERIFY(receiveBytes(sockets[1], expected.size()) == expected);
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+    QCOMPARE(rawSocket.error(), QBluetoothSocket::NoSocketError);
+
+    // a file which is truncated before it was mapped ends with an error
+    QVERIFY(rawSocket.sendFile(&file));
+    QVERIFY(file.resize(1000));
+    QTRY_COMPARE(rawSocket.error(), QBluetoothSocket::OperationError);
+    QCOMPARE(rawSocket.bytesToWrite(), Q_INT64_C(0));
+
+    rawSocket.abort();
+    ::close(sockets[1]);
+#else
+    QSKIP("Sending files is only tested with the BlueZ backend");
+#endif
+}
+
 void tst_QBluetoothSocket::tst_unsupportedProtocolError()
 {
 #if defined(QT_ANDROID_BLUETOOTH)
@@ -38,6 +38,7 @@
 #include <QtCore/qhash.h>
 #include <QtCore/qscopedpointer.h>
 #include <QtCore/qsharedpointer.h>
+#include <QtCore/qtimer.h>
 #include <QtCore/qvector.h>
 
 static QByteArray deviceName() { return "Qt GATT server"; }
@@ -184,6 +185,21 @@ int main(int argc, char *argv[])
     const ServicePtr customService = services.value(QBluetoothUuid(quint16(0x2000)));
     Q_ASSERT(customService);
 
+    // The long value is produced when a client starts reading it, and with a delay.
+    const QLowEnergyCharacteristic longChar
+            = customService->characteristic(QBluetoothUuid(quint16(0x5000)));
+    Q_ASSERT(longChar.isValid());
+    QLowEnergyService * const service = customService.data();
+    service->setCharacteristicReadHandler(longChar,
+            [service](const QLowEnergyCharacteristic &characteristic, int offset, QByteArray *) {
+        if (offset > 0)
+            return true;
+        QTimer::singleShot(10, service, [service, characteristic]() {
+            service->provideCharacteristicValue(characteristic, QByteArray(1024, 'x'));
+        });
+        return false;
+    });
+
     const auto stateChangedHandler = [customService]() {
         switch (leController->state()) {
         case QLowEnergyController::ConnectedState:
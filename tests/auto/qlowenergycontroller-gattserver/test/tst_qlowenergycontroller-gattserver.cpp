@@ -37,14 +37,32 @@
 #include <QtBluetooth/qlowenergycharacteristicdata.h>
 #include <QtBluetooth/qlowenergydescriptordata.h>
 #include <QtBluetooth/qlowenergyservicedata.h>
+#include <QtCore/qbuffer.h>
 #include <QtCore/qendian.h>
 #include <QtCore/qscopedpointer.h>
+#include <QtCore/qsettings.h>
+#include <QtCore/qtemporarydir.h>
 //#include <QtCore/qloggingcategory.h>
 #include <QtTest/qsignalspy.h>
 #include <QtTest/QtTest>
 
 #ifdef Q_OS_LINUX
 #include <QtBluetooth/private/lecmaccalculator_p.h>
+#include <QtBluetooth/private/leattrequest_p.h>
+#include <QtBluetooth/private/legattcache_p.h>
+#include <QtBluetooth/private/leattbearer_p.h>
+#include <QtBluetooth/private/leattserverconnection_p.h>
+#include <QtBluetooth/private/lecccdstore_p.h>
+#include <QtBluetooth/private/lesigncounterjournal_p.h>
+#include <QtBluetooth/private/lewritestream_p.h>
+#include <QtBluetooth/private/qlowenergyserviceprivate_p.h>
+#include <QtCore/qsocketnotifier.h>
+#ifdef CONFIG_BLUEZ_LE
+#include <QtBluetooth/private/qbluetoothsocket_bluez_p.h>
+#endif
+
+#include <sys/socket.h>
+#include <unistd.h>
 #endif
 
 #include <algorithm>
@@ -62,11 +80,28 @@ private slots:
     // Static, local stuff goes here.
     void advertisingParameters();
     void advertisingData();
+    void attBearerPool();
+    void attPduBuilder();
+    void attRequestScheduler();
+    void attributeOwner();
+    void attServerConnection();
+    void attValueQueue();
+    void cccdStore();
     void cmacVerifier();
     void cmacVerifier_data();
+    void cmacKeyCache();
     void connectionParameters();
     void controllerType();
+    void databaseHash();
+    void gattCache();
+    void listResponses();
+    void multipleCentrals();
+    void notificationBatch();
+    void preparedWrite();
+    void reliableWrite();
     void serviceData();
+    void signCounterJournal();
+    void writeStream();
 
     // Interaction with actual GATT server goes here. Order is relevant.
     void advertisedData();
@@ -163,9 +198,538 @@ void TestQLowEnergyControllerGattServer::advertisingData()
     QVERIFY(data != QLowEnergyAdvertisingData());
 }
 
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+static LeAttRequest createAttRequest(LeAttRequest::Lane lane, uint id,
+        const QSharedPointer<QLowEnergyServicePrivate> &service = {})
+{
+    LeAttRequest request;
+    request.command = 0x0a; // read request
+    request.lane = lane;
+    request.handleData = id;
+    request.service = service;
+    return request;
+}
+
+// An L2CAP socket as it is created for the ATT channel
+class RawBluetoothSocket : public QBluetoothSocket
+{
+public:
+    explicit RawBluetoothSocket(QObject *parent)
+        : QBluetoothSocket(new QBluetoothSocketPrivateBluez,
+                           QBluetoothServiceInfo::L2capProtocol, parent)
+    {
+    }
+};
+
+// Waits for the next PDU which is sent to the peer of the socket pair
+static QByteArray receivePdu(int socket)
+{
+    QByteArray pdu(512, Qt::Uninitialized);
+    for (int i = 0; i < 500; ++i) {
+        const ssize_t size = ::recv(socket, pdu.data(), size_t(pdu.size()), MSG_DONTWAIT);
+        if (size >= 0) {
+            pdu.resize(int(size));
+            return pdu;
+        }
+        QTest::qWait(10);
+    }
+    return QByteArray();
+}
+
+static bool hasPendingPdu(int socket)
+{
+    char pdu;
+    return ::recv(socket, &pdu, sizeof pdu, MSG_DONTWAIT | MSG_PEEK) >= 0;
+}
+#endif
+
+void TestQLowEnergyControllerGattServer::attBearerPool()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    const LeAttRequest::Lane interactive = LeAttRequest::InteractiveLane;
+    const auto createRequest = [interactive](uint id,
+            const QSharedPointer<QLowEnergyServicePrivate> &service) {
+        LeAttRequest request = createAttRequest(interactive, id, service);
+        request.payload.append(char(request.command));
+        request.payload.append(char(id));
+        request.payload.append(char(0));
+        return request;
+    };
+    const auto readPdu = [](int socket) {
+        char pdu[64];
+        const ssize_t size = ::read(socket, pdu, sizeof pdu);
+        return size > 0 ? QByteArray(pdu, int(size)) : QByteArray();
+    };
+    const auto pdu = [](const LeAttRequest &request) {
+        return QByteArray(request.payload.constData(), request.payload.size());
+    };
+
+    // each bearer is connected to a peer socket which plays the role of the remote server
+    LeAttBearerPool pool;
+    int peers[2];
+    for (int &peer : peers) {
+        int sockets[2];
+        QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sockets), 0);
+        pool.addBearer(new LeAttBearer(sockets[0]));
+        peer = sockets[1];
+    }
+    QTRY_COMPARE(pool.readyBearerCount(), 2);
+
+    const auto serviceA = QSharedPointer<QLowEnergyServicePrivate>::create();
+    const auto serviceB = QSharedPointer<QLowEnergyServicePrivate>::create();
+    const LeAttRequest continuation = createRequest(4, serviceB);
+
+    QList<uint> responses;
+    QList<QByteArray> unsolicited;
+    QVector<LeAttRequest> orphans;
+    connect(&pool, &LeAttBearerPool::responseReceived, this,
+            [&](LeAttBearer *bearer, const LeAttRequest &request, const QByteArray &) {
+        responses.append(request.handleData);
+        if (request.handleData == 3)
+            bearer->prependRequest(continuation);
+    });
+    connect(&pool, &LeAttBearerPool::unsolicitedReceived, this,
+            [&unsolicited](const QByteArray &packet) { unsolicited.append(packet); });
+    connect(&pool, &LeAttBearerPool::requestsOrphaned, this,
+            [&orphans](const QVector<LeAttRequest> &requests) { orphans = requests; });
+
+    // requests of different services are sent in parallel, those of one service in order
+    const LeAttRequest a1 = createRequest(1, serviceA);
+    const LeAttRequest a2 = createRequest(2, serviceA);
+    const LeAttRequest b1 = createRequest(3, serviceB);
+    pool.enqueue(a1);
+    pool.enqueue(a2);
+    pool.enqueue(b1);
+    QCOMPARE(readPdu(peers[0]), pdu(a1));
+    QCOMPARE(readPdu(peers[1]), pdu(b1));
+    QCOMPARE(pool.count(), 1);
+
+    // a continuation is sent next on the bearer which received the response
+    QCOMPARE(::write(peers[1], "\x0b" "b", 2), ssize_t(2));
+    QTRY_COMPARE(responses, QList<uint>() << 3);
+    QCOMPARE(readPdu(peers[1]), pdu(continuation));
+    QCOMPARE(::write(peers[1], "\x0b" "c", 2), ssize_t(2));
+    QTRY_COMPARE(responses, QList<uint>() << 3 << 4);
+    QVERIFY(readPdu(peers[1]).isEmpty());
+
+    QCOMPARE(::write(peers[0], "\x0b" "a", 2), ssize_t(2));
+    QTRY_COMPARE(responses, QList<uint>() << 3 << 4 << 1);
+    QCOMPARE(readPdu(peers[0]), pdu(a2));
+
+    // notifications are passed on, indications are confirmed as well
+    QCOMPARE(::write(peers[1], "\x1b\x10\x00" "n", 4), ssize_t(4));
+    QCOMPARE(::write(peers[1], "\x1d\x10\x00" "i", 4), ssize_t(4));
+    QTRY_COMPARE(unsolicited.count(), 2);
+    QCOMPARE(unsolicited.at(1), QByteArray("\x1d\x10\x00" "i", 4));
+    QCOMPARE(readPdu(peers[1]), QByteArray("\x1e"));
+
+    // requests which exceed the MTU of all bearers cannot be sent
+    LeAttRequest large = createRequest(5, serviceB);
+    large.payload.resize(100);
+    QVERIFY(!pool.canSend(large));
+    QVERIFY(pool.canSend(b1));
+
+    // such a request is handed back together with the later requests of its service
+    QVERIFY(pool.hasRequests(serviceA.data()));
+    QVERIFY(!pool.hasRequests(serviceB.data()));
+    pool.setSuspended(true);
+    pool.enqueue(large);
+    pool.enqueue(createRequest(7, serviceB));
+    QVERIFY(pool.hasRequests(serviceB.data()));
+    pool.setSuspended(false);
+    QCOMPARE(orphans.count(), 2);
+    QCOMPARE(orphans.at(0).handleData, 5u);
+    QCOMPARE(orphans.at(1).handleData, 7u);
+    QCOMPARE(pool.count(), 0);
+    QVERIFY(readPdu(peers[1]).isEmpty());
+    orphans.clear();
+
+    // queued requests can be cancelled, outstanding ones are kept
+    pool.enqueue(createRequest(6, serviceA));
+    QCOMPARE(pool.cancel(serviceA.data()), 1);
+    QCOMPARE(pool.count(), 0);
+
+    // the outstanding request of a lost bearer is sent on another bearer
+    ::close(peers[0]);
+    QTRY_COMPARE(pool.readyBearerCount(), 1);
+    QCOMPARE(readPdu(peers[1]), pdu(a2));
+
+    // without bearers the requests are handed back
+    ::close(peers[1]);
+    QTRY_COMPARE(orphans.count(), 1);
+    QCOMPARE(orphans.first().handleData, 2u);
+    QCOMPARE(pool.readyBearerCount(), 0);
+#else
+    QSKIP("ATT bearer test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::attPduBuilder()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    LeAttPduBuilder builder;
+    char *data = builder.start(0x09, 23);
+    QCOMPARE(builder.limit() - data, 22);
+    *data++ = 0x7;
+    QCOMPARE(builder.size(data), 2);
+    QCOMPARE(QByteArray(builder.constData(), builder.size(data)), QByteArray::fromHex("0907"));
+
+    // the buffer grows with the MTU and is kept for smaller ones
+    data = builder.start(0x11, 247);
+    QCOMPARE(builder.limit() - data, 246);
+    const char *buffer = builder.constData();
+    data = builder.start(0x0b, 23);
+    QCOMPARE(builder.constData(), buffer);
+    QCOMPARE(builder.limit() - data, 22);
+    QCOMPARE(quint8(builder.constData()[0]), quint8(0x0b));
+#else
+    QSKIP("ATT PDU builder test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::attRequestScheduler()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    const LeAttRequest::Lane interactive = LeAttRequest::InteractiveLane;
+    const LeAttRequest::Lane bulk = LeAttRequest::BulkLane;
+
+    const quint64 dispatchedBefore = LeAttRequestScheduler::totalDispatched();
+    LeAttRequestScheduler scheduler;
+    QVERIFY(scheduler.isEmpty());
+
+    // interactive requests are sent ahead of bulk requests
+    scheduler.enqueue(createAttRequest(bulk, 1));
+    scheduler.enqueue(createAttRequest(bulk, 2));
+    scheduler.enqueue(createAttRequest(interactive, 3));
+    QCOMPARE(scheduler.count(), 3);
+    QCOMPARE(scheduler.head().handleData, 3u);
+    scheduler.enqueue(createAttRequest(interactive, 4));
+    QCOMPARE(scheduler.head().handleData, 3u); // stays selected until dequeued
+    QCOMPARE(scheduler.dequeue().handleData, 3u);
+    QCOMPARE(scheduler.dequeue().handleData, 4u);
+    QCOMPARE(scheduler.dequeue().handleData, 1u);
+
+    // continuations of a chain are not interleaved with other lanes
+    scheduler.prepend(createAttRequest(interactive, 5));
+    scheduler.enqueue(createAttRequest(interactive, 6));
+    QCOMPARE(scheduler.head().lane, bulk);
+    QCOMPARE(scheduler.dequeue().handleData, 5u);
+    QCOMPARE(scheduler.dequeue().handleData, 6u);
+    QCOMPARE(scheduler.dequeue().handleData, 2u);
+    QVERIFY(scheduler.isEmpty());
+
+    // bulk requests are not starved
+    scheduler.enqueue(createAttRequest(bulk, 7));
+    for (uint i = 0; i < LeAttRequestScheduler::MaxInteractiveBurst + 1; ++i)
+        scheduler.enqueue(createAttRequest(interactive, 10 + i));
+    for (uint i = 0; i < LeAttRequestScheduler::MaxInteractiveBurst; ++i)
+        QCOMPARE(scheduler.dequeue().handleData, 10 + i);
+    QCOMPARE(scheduler.dequeue().handleData, 7u);
+    QCOMPARE(scheduler.dequeue().lane, interactive);
+    QVERIFY(scheduler.isEmpty());
+
+    LeAttRequestScheduler::LaneStatistics stats = scheduler.statistics(interactive);
+    QCOMPARE(stats.depth, 0);
+    QCOMPARE(stats.maxDepth, LeAttRequestScheduler::MaxInteractiveBurst + 1);
+    QCOMPARE(stats.dispatched, quint64(LeAttRequestScheduler::MaxInteractiveBurst + 4));
+    stats = scheduler.statistics(bulk);
+    QCOMPARE(stats.dispatched, quint64(4));
+    QCOMPARE(stats.maxDepth, 2);
+    // the requests of all schedulers are counted as well
+    QCOMPARE(LeAttRequestScheduler::totalDispatched() - dispatchedBefore,
+             quint64(LeAttRequestScheduler::MaxInteractiveBurst + 8));
+
+    // every request waits from its own enqueue() call
+    {
+        static qint64 currentTime = 0;
+        LeAttRequestScheduler timedScheduler;
+        timedScheduler.setClock([]() { return currentTime; });
+        currentTime = 1000;
+        timedScheduler.enqueue(createAttRequest(bulk, 30));
+        currentTime += 100000;
+        timedScheduler.enqueue(createAttRequest(bulk, 31));
+        currentTime += 100000;
+        QCOMPARE(timedScheduler.dequeue().handleData, 30u);
+        stats = timedScheduler.statistics(bulk);
+        QCOMPARE(stats.totalWaitTime, qint64(200000));
+        QCOMPARE(stats.maxWaitTime, qint64(200000));
+
+        currentTime += 50000;
+        QCOMPARE(timedScheduler.dequeue().handleData, 31u);
+        stats = timedScheduler.statistics(bulk);
+        QCOMPARE(stats.dispatched, quint64(2));
+        QCOMPARE(stats.totalWaitTime, qint64(200000 + 150000));
+        QCOMPARE(stats.maxWaitTime, qint64(200000));
+
+        // continuations wait from their prepend() call
+        currentTime += 10000;
+        timedScheduler.prepend(createAttRequest(bulk, 32));
+        currentTime += 300000;
+        QCOMPARE(timedScheduler.dequeue().handleData, 32u);
+        stats = timedScheduler.statistics(bulk);
+        QCOMPARE(stats.totalWaitTime, qint64(200000 + 150000 + 300000));
+        QCOMPARE(stats.maxWaitTime, qint64(300000));
+    }
+
+    // cancellation keeps the selected request
+    const QSharedPointer<QLowEnergyServicePrivate> service1(new QLowEnergyServicePrivate);
+    const QSharedPointer<QLowEnergyServicePrivate> service2(new QLowEnergyServicePrivate);
+    scheduler.enqueue(createAttRequest(interactive, 20, service1));
+    scheduler.enqueue(createAttRequest(interactive, 21, service2));
+    scheduler.enqueue(createAttRequest(bulk, 22, service1));
+    scheduler.enqueue(createAttRequest(interactive, 23, service1));
+    QCOMPARE(scheduler.head().handleData, 20u);
+    QCOMPARE(scheduler.cancel(service1.data()), 2);
+    QCOMPARE(scheduler.count(), 2);
+    QCOMPARE(scheduler.statistics(interactive).depth, 2);
+    QVERIFY(scheduler.contains(service1.data()));
+    QCOMPARE(scheduler.dequeue().handleData, 20u);
+    QVERIFY(!scheduler.contains(service1.data()));
+    QVERIFY(scheduler.contains(service2.data()));
+    QCOMPARE(scheduler.dequeue().handleData, 21u);
+    QVERIFY(scheduler.isEmpty());
+
+    scheduler.enqueue(createAttRequest(bulk, 24));
+    scheduler.clear();
+    QVERIFY(scheduler.isEmpty());
+    scheduler.resetStatistics();
+    QCOMPARE(scheduler.statistics(bulk).dispatched, quint64(0));
+#else
+    QSKIP("ATT request scheduler test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::attributeOwner()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // characteristic declaration 0x0002, value 0x0003, descriptors 0x0004 and 0x0005
+    const QSharedPointer<QLowEnergyServicePrivate> service(new QLowEnergyServicePrivate);
+    QLowEnergyServicePrivate::CharData charData;
+    charData.valueHandle = 0x0003;
+    charData.uuid = QBluetoothUuid(QBluetoothUuid::BatteryLevel);
+    charData.value = QByteArray::fromHex("64");
+    QLowEnergyServicePrivate::DescData configData;
+    configData.uuid = QBluetoothUuid(QBluetoothUuid::ClientCharacteristicConfiguration);
+    configData.value = QByteArray::fromHex("0000");
+    charData.descriptorList.insert(0x0004, configData);
+    QLowEnergyServicePrivate::DescData descriptionData;
+    descriptionData.uuid = QBluetoothUuid(QBluetoothUuid::CharacteristicUserDescription);
+    descriptionData.value = "level";
+    charData.descriptorList.insert(0x0005, descriptionData);
+    service->characteristicList.insert(0x0002, charData);
+
+    LeAttributeOwner owner;
+    owner.service = service;
+    owner.charHandle = 0x0002;
+
+    // the characteristic value comes right after the declaration
+    QLowEnergyServicePrivate::CharData *foundChar = owner.characteristicData(0x0003);
+    QVERIFY(foundChar);
+    QCOMPARE(foundChar, &service->characteristicList[0x0002]);
+    QCOMPARE(foundChar->value, QByteArray::fromHex("64"));
+    QVERIFY(!owner.descriptorData(0x0003));
+    QVERIFY(!owner.characteristicData(0x0002));
+
+    // descriptors are found by their own handle
+    QLowEnergyServicePrivate::DescData *foundDesc = owner.descriptorData(0x0004);
+    QVERIFY(foundDesc);
+    QVERIFY(foundDesc->uuid == configData.uuid);
+    QVERIFY(!owner.characteristicData(0x0004));
+    foundDesc = owner.descriptorData(0x0005);
+    QVERIFY(foundDesc);
+    QCOMPARE(foundDesc->value, QByteArray("level"));
+    QVERIFY(!owner.descriptorData(0x0006));
+
+    // values are updated in the service
+    owner.descriptorData(0x0004)->value = QByteArray::fromHex("0100");
+    QCOMPARE(service->characteristicList.value(0x0002).descriptorList.value(0x0004).value,
+             QByteArray::fromHex("0100"));
+
+    // an owner whose characteristic is gone finds nothing
+    service->characteristicList.clear();
+    QVERIFY(!owner.characteristicData(0x0003));
+    QVERIFY(!owner.descriptorData(0x0004));
+
+    // declarations have no owner
+    const LeAttributeOwner noOwner;
+    QVERIFY(!noOwner.characteristicData(0x0001));
+    QVERIFY(!noOwner.descriptorData(0x0001));
+#else
+    QSKIP("Attribute owner test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::attServerConnection()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // a local socket pair replaces the ATT channel of the central
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+    RawBluetoothSocket socket(nullptr);
+    QVERIFY(socket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::L2capProtocol,
+                                       QBluetoothSocket::ConnectedState,
+                                       QIODevice::ReadWrite | QIODevice::Unbuffered));
+    LeAttServerConnection connection;
+    connection.socket = &socket;
+    connection.socketDescriptor = sockets[0];
+    QVERIFY(connection.readPdu().isEmpty());
+
+    // two requests which arrive together are read one by one
+    const QByteArray mtuRequest = QByteArray::fromHex("02f700");
+    const QByteArray readRequest = QByteArray::fromHex("0a0300");
+    QCOMPARE(::send(sockets[1], mtuRequest.constData(), size_t(mtuRequest.size()), 0),
+             ssize_t(mtuRequest.size()));
+    QCOMPARE(::send(sockets[1], readRequest.constData(), size_t(readRequest.size()), 0),
+             ssize_t(readRequest.size()));
+
+    QVector<QByteArray> pdus;
+    const auto readPdus = [&connection, &pdus]() {
+        for (QByteArray pdu = connection.readPdu(); !pdu.isEmpty(); pdu = connection.readPdu())
+            pdus.append(pdu);
+        return pdus.count();
+    };
+    QTRY_COMPARE(readPdus(), 2);
+    QCOMPARE(pdus.at(0), mtuRequest);
+    QCOMPARE(pdus.at(1), readRequest);
+    QVERIFY(connection.readPdu().isEmpty());
+    QCOMPARE(socket.bytesAvailable(), Q_INT64_C(0));
+
+    ::close(sockets[1]);
+#else
+    QSKIP("ATT server connection test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::attValueQueue()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    const auto drain = [](LeAttValueQueue &queue) {
+        QList<QByteArray> values;
+        while (!queue.isEmpty()) {
+            const LeAttValueQueue::Entry entry = queue.dequeue();
+            values << QByteArray::number(entry.handle) + ':' + entry.value;
+        }
+        return values;
+    };
+
+    // a new value replaces the pending value of its characteristic in place
+    LeAttValueQueue queue(LeAttValueQueue::MergePolicy, 3);
+    QVERIFY(queue.enqueue(1, "a1"));
+    QVERIFY(queue.enqueue(2, "b1"));
+    QVERIFY(queue.enqueue(1, "a2"));
+    QCOMPARE(queue.count(), 2);
+    QCOMPARE(queue.mergedCount(), quint64(1));
+    QVERIFY(queue.enqueue(3, "c1"));
+    QVERIFY(!queue.enqueue(4, "d1"));
+    QCOMPARE(queue.droppedCount(), quint64(1));
+    QVERIFY(queue.enqueue(3, "c2"));
+    QVERIFY(!queue.enqueue(1, "a3"));
+    QCOMPARE(queue.mergedCount(), quint64(2));
+    QCOMPARE(queue.droppedCount(), quint64(2));
+    QCOMPARE(drain(queue), QList<QByteArray>() << "3:c2" << "4:d1" << "1:a3");
+
+    // the other policies keep every value until the queue is full
+    queue.setPolicy(LeAttValueQueue::DropOldestPolicy, 2);
+    QCOMPARE(queue.maxDepth(), 2);
+    QVERIFY(queue.enqueue(1, "a1"));
+    QVERIFY(queue.enqueue(1, "a2"));
+    QVERIFY(!queue.enqueue(2, "b1"));
+    QCOMPARE(queue.mergedCount(), quint64(2));
+    QCOMPARE(queue.droppedCount(), quint64(3));
+    QCOMPARE(drain(queue), QList<QByteArray>() << "1:a2" << "2:b1");
+
+    queue.setPolicy(LeAttValueQueue::DropNewestPolicy, 2);
+    QVERIFY(queue.enqueue(1, "a1"));
+    QVERIFY(queue.enqueue(1, "a2"));
+    QVERIFY(!queue.enqueue(2, "b1"));
+    QCOMPARE(queue.droppedCount(), quint64(4));
+    QCOMPARE(drain(queue), QList<QByteArray>() << "1:a1" << "1:a2");
+
+    // a connection forgets its pending values when it is closed
+    LeAttServerConnection connection;
+    connection.queueNotification(1, "n");
+    connection.queueIndication(2, "i");
+    connection.indicationInFlight = true;
+    connection.clearPendingValues();
+    QVERIFY(connection.pendingNotifications.isEmpty());
+    QVERIFY(connection.pendingIndications.isEmpty());
+    QVERIFY(!connection.indicationInFlight);
+
+    // a value which could not be sent does not count as sent
+    QBuffer closedSocket;
+    LeAttServerConnection failing;
+    failing.socket = &closedSocket;
+    failing.clientConfigurations.insert(0x0004, QByteArray::fromHex("0300"));
+    const QVector<LeAttServerConnection *> connections{ &failing };
+    QCOMPARE(LeAttServerConnection::distributeValue(connections, 0x0003, 0x0004, "abc",
+                                                    QLowEnergyCharacteristic::Notify), 0);
+    QVERIFY(failing.pendingNotifications.isEmpty());
+    QCOMPARE(LeAttServerConnection::distributeValue(connections, 0x0003, 0x0004, "abc",
+                                                    QLowEnergyCharacteristic::Indicate), 0);
+    QVERIFY(!failing.indicationInFlight);
+    QVERIFY(failing.pendingIndications.isEmpty());
+#else
+    QSKIP("ATT value queue test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::cccdStore()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTemporaryDir storeDir;
+    QVERIFY(storeDir.isValid());
+    const QString directory = storeDir.path() + QLatin1String("/cccd");
+    LeCccdStore store(directory);
+    store.setDatabaseSignature(0x1122334455667788);
+    const QBluetoothAddress device(QStringLiteral("11:22:33:44:55:66"));
+    QVERIFY(store.load(device).isEmpty());
+    QVERIFY(store.peers().isEmpty());
+
+    LeCccdStore::Entries entries;
+    entries.insert(3, LeCccdStore::Entry(3, 4, 0x1));
+    entries.insert(6, LeCccdStore::Entry(6, 7, 0x2));
+    QVERIFY(store.store(device, entries));
+    QCOMPARE(store.peers(), QList<QBluetoothAddress>() << device);
+
+    // appended records replace earlier ones, a value of 0 removes the entry
+    LeCccdStore::Entry updated(3, 4, 0x1);
+    updated.charValueWasUpdated = true;
+    entries.insert(3, updated);
+    QVERIFY(store.update(device, entries, updated));
+    const LeCccdStore::Entry unsubscribed(6, 7, 0);
+    entries.remove(6);
+    QVERIFY(store.update(device, entries, unsubscribed));
+
+    LeCccdStore::Entries loaded = store.load(device);
+    QCOMPARE(loaded.count(), 1);
+    QCOMPARE(loaded.value(3).configHandle, QLowEnergyHandle(4));
+    QCOMPARE(loaded.value(3).configValue, quint16(0x1));
+    QVERIFY(loaded.value(3).charValueWasUpdated);
+
+    // a record cut short by a crash is ignored
+    QFile file(directory + QLatin1String("/112233445566.cccd"));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Append));
+    QCOMPARE(file.write("\x00\x09\x00", 3), qint64(3));
+    file.close();
+    loaded = store.load(device);
+    QCOMPARE(loaded.count(), 1);
+    QVERIFY(store.update(device, entries, LeCccdStore::Entry(9, 10, 0x1)));
+    QCOMPARE(store.load(device).count(), 2);
+
+    // configurations of a different attribute database are not restored
+    store.setDatabaseSignature(0x8877665544332211);
+    QVERIFY(store.load(device).isEmpty());
+
+    store.remove(device);
+    QVERIFY(store.peers().isEmpty());
+#else
+    QSKIP("CCCD store test only applicable for developer builds with BlueZ");
+#endif
+}
+
 void TestQLowEnergyControllerGattServer::cmacVerifier()
 {
-#if defined(CONFIG_LINUX_CRYPTO_API) && defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
     // Test data comes from spec v4.2, Vol 3, Part H, Appendix D.1
     const quint128 csrk = {
         { 0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
@@ -174,18 +738,62 @@ void TestQLowEnergyControllerGattServer::cmacVerifier()
     QFETCH(QByteArray, message);
     QFETCH(quint64, expectedMac);
 
+    QVERIFY(LeCmacCalculator().verify(message, csrk, expectedMac));
+
+#if defined(CONFIG_LINUX_CRYPTO_API)
 #if defined(CHECK_CMAC_SUPPORT)
     if (!checkCmacSupport(csrk)) {
         QSKIP("Needed socket options not available. Running qemu?");
     }
 #endif
 
-    const bool success = LeCmacCalculator().verify(message, csrk, expectedMac);
-    QVERIFY(success);
-#else // CONFIG_LINUX_CRYPTO_API
-    QSKIP("CMAC verification test only applicable for developer builds on Linux "
-          "with BlueZ and crypto API");
-#endif // Q_OS_LINUX
+    const LeCmacCalculator kernelCalculator(LeCmacCalculator::KernelBackend);
+    QCOMPARE(kernelCalculator.backend(), LeCmacCalculator::KernelBackend);
+    QVERIFY(kernelCalculator.verify(message, csrk, expectedMac));
+#endif // CONFIG_LINUX_CRYPTO_API
+#else
+    QSKIP("CMAC verification test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::cmacKeyCache()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // RFC 4493, 4, Example 2, with the key and message in Bluetooth byte order
+    quint128 csrk = {
+        { 0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
+          0xa6, 0xd2, 0xae, 0x28, 0x16, 0x15, 0x7e, 0x2b }
+    };
+    const QByteArray message = QByteArray::fromHex("2a179373117e3de9969f402ee2bec16b");
+    const quint64 expectedMac = Q_UINT64_C(0x070a16b46b4d4144);
+
+    LeCmacCalculator calculator;
+    QCOMPARE(calculator.calculateMac(message, csrk), expectedMac);
+
+    // more keys than the calculator keeps schedules for
+    QSet<quint64> otherMacs;
+    for (int i = 1; i <= 20; ++i) {
+        quint128 otherKey = csrk;
+        otherKey.data[0] ^= quint8(i);
+        const quint64 mac = calculator.calculateMac(message, otherKey);
+        QVERIFY(mac != expectedMac);
+        QCOMPARE(calculator.calculateMac(message, otherKey), mac);
+        otherMacs.insert(mac);
+    }
+    QCOMPARE(otherMacs.count(), 20);
+    QCOMPARE(calculator.calculateMac(message, csrk), expectedMac);
+
+    // full-length CMAC in natural byte order, as used for the Database Hash
+    const quint128 key = {
+        { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+          0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c }
+    };
+    QCOMPARE(calculator.calculateCmac(QByteArray::fromHex("6bc1bee22e409f96e93d7e117393172a"),
+                                      key),
+             QByteArray::fromHex("070a16b46b4d4144f79bdd9dd04a287c"));
+#else
+    QSKIP("CMAC test only applicable for developer builds with BlueZ");
+#endif
 }
 
 #if defined(CHECK_CMAC_SUPPORT)
@@ -267,6 +875,437 @@ void TestQLowEnergyControllerGattServer::connectionParameters()
     QCOMPARE(cp3, connParams);
 }
 
+void TestQLowEnergyControllerGattServer::listResponses()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    LeAttPduBuilder builder;
+    // adds elements until the MTU is reached, each element is filled with its number
+    const auto fillList = [&builder](int elementSize) {
+        QByteArray elements;
+        for (char *element = builder.nextElement(); element; element = builder.nextElement()) {
+            const QByteArray content(elementSize, char(builder.elementCount()));
+            std::memcpy(element, content.constData(), size_t(elementSize));
+            elements += content;
+        }
+        return elements;
+    };
+    const auto pdu = [&builder]() {
+        return QByteArray(builder.constData(), builder.size(builder.listEnd()));
+    };
+
+    // Find Information: five elements with 16 bit UUIDs fit into the default MTU
+    char *header = builder.startList(0x05, 23, 4, 1);
+    *header = 0x01;
+    QCOMPARE(builder.elementCount(), 0);
+    QByteArray elements = fillList(4);
+    QCOMPARE(builder.elementCount(), 5);
+    QCOMPARE(pdu(), QByteArray::fromHex("0501") + elements);
+    QVERIFY(!builder.nextElement());
+    QCOMPARE(builder.elementCount(), 5);
+
+    // ... but only one with a 128 bit UUID
+    builder.startList(0x05, 23, 18, 1)[0] = 0x02;
+    elements = fillList(18);
+    QCOMPARE(builder.elementCount(), 1);
+    QCOMPARE(pdu(), QByteArray::fromHex("0502") + elements);
+
+    // Find By Type Value: the response has no header
+    builder.startList(0x07, 23, 4, 0);
+    QCOMPARE(builder.size(builder.listEnd()), 1);
+    elements = fillList(4);
+    QCOMPARE(builder.elementCount(), 5);
+    QCOMPARE(pdu(), QByteArray::fromHex("07") + elements);
+
+    // Read By Type: three characteristic declarations fill the default MTU
+    builder.startList(0x09, 23, 7, 1)[0] = 7;
+    elements = fillList(7);
+    QCOMPARE(builder.elementCount(), 3);
+    QCOMPARE(pdu(), QByteArray::fromHex("0907") + elements);
+    QCOMPARE(pdu().size(), 23);
+
+    // Read By Group Type: three services with 16 bit UUIDs, one with a 128 bit UUID
+    builder.startList(0x11, 23, 6, 1)[0] = 6;
+    elements = fillList(6);
+    QCOMPARE(builder.elementCount(), 3);
+    QCOMPARE(pdu(), QByteArray::fromHex("1106") + elements);
+    builder.startList(0x11, 23, 20, 1)[0] = 20;
+    elements = fillList(20);
+    QCOMPARE(builder.elementCount(), 1);
+    QCOMPARE(pdu(), QByteArray::fromHex("1114") + elements);
+
+    // an element which exceeds the MTU leaves the list empty
+    builder.startList(0x09, 23, 30, 1)[0] = 30;
+    QVERIFY(!builder.nextElement());
+    QCOMPARE(builder.elementCount(), 0);
+    QCOMPARE(pdu(), QByteArray::fromHex("091e"));
+
+    // a larger MTU takes more elements
+    builder.startList(0x07, 64, 4, 0);
+    elements = fillList(4);
+    QCOMPARE(builder.elementCount(), 15);
+    QCOMPARE(pdu(), QByteArray::fromHex("07") + elements);
+    builder.startList(0x09, 64, 7, 1)[0] = 7;
+    elements = fillList(7);
+    QCOMPARE(builder.elementCount(), 8);
+    QCOMPARE(pdu(), QByteArray::fromHex("0907") + elements);
+#else
+    QSKIP("List response test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::multipleCentrals()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // each central is connected via a socket pair, the characteristic value at
+    // handle 0x03 is longer than any MTU used below, its configuration descriptor
+    // has the handle 0x04
+    int socketsA[2];
+    int socketsB[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socketsA), 0);
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, socketsB), 0);
+    RawBluetoothSocket socketA(nullptr);
+    RawBluetoothSocket socketB(nullptr);
+    QVERIFY(socketA.setSocketDescriptor(socketsA[0], QBluetoothServiceInfo::L2capProtocol,
+                                        QBluetoothSocket::ConnectedState,
+                                        QIODevice::ReadWrite | QIODevice::Unbuffered));
+    QVERIFY(socketB.setSocketDescriptor(socketsB[0], QBluetoothServiceInfo::L2capProtocol,
+                                        QBluetoothSocket::ConnectedState,
+                                        QIODevice::ReadWrite | QIODevice::Unbuffered));
+    const int centralA = socketsA[1];
+    const int centralB = socketsB[1];
+
+    LeAttServerConnection connectionA;
+    connectionA.socket = &socketA;
+    connectionA.socketDescriptor = socketsA[0];
+    connectionA.hciHandle = 0x0040;
+    connectionA.remoteDevice = QBluetoothAddress(QStringLiteral("11:22:33:44:55:a1"));
+    connectionA.mtuSize = 100;
+    LeAttServerConnection connectionB;
+    connectionB.socket = &socketB;
+    connectionB.socketDescriptor = socketsB[0];
+    connectionB.hciHandle = 0x0041;
+    connectionB.remoteDevice = QBluetoothAddress(QStringLiteral("11:22:33:44:55:a2"));
+    const QVector<LeAttServerConnection *> connections{ &connectionA, &connectionB };
+
+    // HCI events are matched with the link of each central
+    QCOMPARE(LeAttServerConnection::forHciHandle(connections, 0x0040), &connectionA);
+    QCOMPARE(LeAttServerConnection::forHciHandle(connections, 0x0041), &connectionB);
+    QVERIFY(!LeAttServerConnection::forHciHandle(connections, 0x0050));
+
+    // only the central which subscribed receives the notification, each one
+    // with the value length its MTU permits
+    const QLowEnergyCharacteristic::PropertyTypes properties =
+            QLowEnergyCharacteristic::Notify | QLowEnergyCharacteristic::Indicate;
+    const QByteArray longValue(200, 'r');
+    connectionA.clientConfigurations.insert(0x0004, QByteArray::fromHex("0100"));
+    QCOMPARE(connectionA.clientConfiguration(0x0004), quint16(0x0001));
+    QCOMPARE(connectionB.clientConfiguration(0x0004), quint16(0));
+    QCOMPARE(LeAttServerConnection::distributeValue(connections, 0x0003, 0x0004, longValue,
+                                                    properties), 1);
+    QCOMPARE(receivePdu(centralA), QByteArray::fromHex("1b0300") + longValue.left(97));
+    QVERIFY(!hasPendingPdu(centralB));
+
+    connectionB.clientConfigurations.insert(0x0004, QByteArray::fromHex("0200"));
+    QCOMPARE(connectionA.clientConfiguration(0x0004), quint16(0x0001));
+    QCOMPARE(connectionB.clientConfiguration(0x0004), quint16(0x0002));
+    QCOMPARE(LeAttServerConnection::distributeValue(connections, 0x0003, 0x0004, "abc",
+                                                    properties), 2);
+    QCOMPARE(receivePdu(centralA).toHex(), QByteArray("1b0300616263"));
+    QCOMPARE(receivePdu(centralB).toHex(), QByteArray("1d0300616263"));
+    QVERIFY(!connectionA.indicationInFlight);
+    QVERIFY(connectionB.indicationInFlight);
+
+    // the unconfirmed indication of one central does not hold up the other one
+    QCOMPARE(LeAttServerConnection::distributeValue(connections, 0x0003, 0x0004, longValue,
+                                                    properties), 2);
+    QCOMPARE(receivePdu(centralA), QByteArray::fromHex("1b0300") + longValue.left(97));
+    QVERIFY(!hasPendingPdu(centralB));
+    QCOMPARE(connectionB.pendingIndications.count(), 1);
+    QVERIFY(!connectionA.confirmIndication());
+    QVERIFY(connectionB.confirmIndication());
+    QCOMPARE(receivePdu(centralB), QByteArray::fromHex("1d0300") + longValue.left(20));
+    QVERIFY(connectionB.pendingIndications.isEmpty());
+    QVERIFY(connectionB.indicationInFlight);
+
+    // the remaining central keeps its state
+    ::close(centralB);
+    connectionB.clearPendingValues();
+    const QVector<LeAttServerConnection *> remaining{ &connectionA };
+    QCOMPARE(LeAttServerConnection::distributeValue(remaining, 0x0003, 0x0004, "d",
+                                                    properties), 1);
+    QCOMPARE(receivePdu(centralA).toHex(), QByteArray("1b030064"));
+    QCOMPARE(LeAttServerConnection::forHciHandle(remaining, 0x0040), &connectionA);
+    QVERIFY(!LeAttServerConnection::forHciHandle(remaining, 0x0041));
+
+    ::close(centralA);
+#else
+    QSKIP("Multiple centrals test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::notificationBatch()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QLowEnergyServicePrivate service;
+    QList<QByteArray> delivered;
+    const char *bufferData = nullptr;
+    int invocations = 0;
+    service.notificationBatchHandler = [&](const QList<QLowEnergyCharacteristic> &characteristics,
+                                           const QList<QByteArray> &values) {
+        ++invocations;
+        QCOMPARE(characteristics.size(), values.size());
+        // the values refer to the shared notification buffer
+        bufferData = values.first().constData();
+        delivered.clear();
+        for (const QByteArray &value : values)
+            delivered.append(QByteArray(value.constData(), value.size()));
+    };
+
+    service.deliverNotificationBatch();
+    QCOMPARE(invocations, 0);
+
+    service.queueNotification(QLowEnergyCharacteristic(), "abc", 3);
+    service.queueNotification(QLowEnergyCharacteristic(), "", 0);
+    service.queueNotification(QLowEnergyCharacteristic(), "defg", 4);
+    service.deliverNotificationBatch();
+    QCOMPARE(invocations, 1);
+    QCOMPARE(delivered, QList<QByteArray>() << "abc" << "" << "defg");
+
+    // the buffer is reused by the next batch
+    const char *firstBuffer = bufferData;
+    service.queueNotification(QLowEnergyCharacteristic(), "xy", 2);
+    service.deliverNotificationBatch();
+    QCOMPARE(invocations, 2);
+    QCOMPARE(delivered, QList<QByteArray>() << "xy");
+    QCOMPARE(bufferData, firstBuffer);
+
+    // without handler each value is emitted on its own
+    QList<QByteArray> changed;
+    connect(&service, &QLowEnergyServicePrivate::characteristicChanged, this,
+            [&changed](const QLowEnergyCharacteristic &, const QByteArray &value) {
+        changed.append(value);
+    });
+    service.notificationBatchHandler = nullptr;
+    service.queueNotification(QLowEnergyCharacteristic(), "z", 1);
+    service.queueNotification(QLowEnergyCharacteristic(), "uvw", 3);
+    service.deliverNotificationBatch();
+    QCOMPARE(invocations, 2);
+    QCOMPARE(changed, QList<QByteArray>() << "z" << "uvw");
+    QVERIFY(service.batchCharacteristics.isEmpty());
+    QVERIFY(service.notificationBuffer.isEmpty());
+
+    // the emitted values do not refer to the reused buffer
+    service.queueNotification(QLowEnergyCharacteristic(), "0123", 4);
+    service.deliverNotificationBatch();
+    QCOMPARE(changed, QList<QByteArray>() << "z" << "uvw" << "0123");
+#else
+    QSKIP("Notification batching is only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::preparedWrite()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    LePreparedWrite write;
+    LePreparedWrite::Entry entry;
+    entry.charHandle = 0x0010;
+    entry.attributeHandle = 0x0011;
+    entry.value = QByteArray(40, 'a');
+    write.addEntry(entry);
+    entry.charHandle = 0x0020;
+    entry.attributeHandle = 0x0021;
+    entry.value.clear();
+    write.addEntry(entry);
+
+    // 18 bytes per segment with the default MTU, the empty value needs one segment
+    write.buildSegments(23);
+    QCOMPARE(write.segmentCount(), 4);
+
+    const int expectedOffsets[] = { 0, 18, 36, 0 };
+    const int expectedSizes[] = { 23, 23, 9, 5 };
+    for (int i = 0; i < write.segmentCount(); ++i) {
+        int size = 0;
+        const char *pdu = write.segment(i, &size);
+        QCOMPARE(size, expectedSizes[i]);
+        QCOMPARE(quint8(pdu[0]), quint8(0x16));
+        QCOMPARE(qFromLittleEndian<quint16>(pdu + 1), quint16(i < 3 ? 0x0011 : 0x0021));
+        QCOMPARE(qFromLittleEndian<quint16>(pdu + 3), quint16(expectedOffsets[i]));
+
+        QByteArray echo(pdu, size);
+        echo[0] = char(0x17);
+        QVERIFY(write.verifyEcho(i, echo.constData(), echo.size()));
+        QVERIFY(!write.verifyEcho(i, echo.constData(), echo.size() - 1));
+        echo[size - 1] = char(echo.at(size - 1) ^ 0x01);
+        QVERIFY(!write.verifyEcho(i, echo.constData(), echo.size()));
+    }
+
+    int size = 0;
+    QByteArray wrongOpcode(write.segment(0, &size), size);
+    QVERIFY(!write.verifyEcho(0, wrongOpcode.constData(), wrongOpcode.size()));
+
+    // a larger MTU needs fewer segments
+    write.buildSegments(100);
+    QCOMPARE(write.segmentCount(), 2);
+    write.segment(0, &size);
+    QCOMPARE(size, 45);
+#else
+    QSKIP("Prepared write test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::reliableWrite()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // a transaction across two characteristics; the first value needs two
+    // segments with the default MTU
+    const QByteArray firstValue(30, 'a');
+    const QByteArray secondValue("bc");
+    LePreparedWrite write;
+    LePreparedWrite::Entry entry;
+    entry.charHandle = 0x0011;
+    entry.attributeHandle = 0x0012;
+    entry.value = firstValue;
+    write.addEntry(entry);
+    entry.charHandle = 0x0013;
+    entry.attributeHandle = 0x0014;
+    entry.value = secondValue;
+    write.addEntry(entry);
+    QCOMPARE(write.entries().count(), 2);
+    QCOMPARE(write.entries().at(0).charHandle, QLowEnergyHandle(0x0011));
+    QCOMPARE(write.entries().at(1).charHandle, QLowEnergyHandle(0x0013));
+
+    // the server queues all segments and executes them at once
+    write.buildSegments(23);
+    QCOMPARE(write.segmentCount(), 3);
+    const QLowEnergyHandle expectedHandles[] = { 0x0012, 0x0012, 0x0014 };
+    const quint16 expectedOffsets[] = { 0, 18, 0 };
+    QHash<QLowEnergyHandle, QByteArray> prepared;
+    for (int i = 0; i < write.segmentCount(); ++i) {
+        int size = 0;
+        const char *pdu = write.segment(i, &size);
+        QVERIFY(size > LePreparedWrite::HeaderSize);
+        QCOMPARE(quint8(pdu[0]), quint8(0x16));
+        QCOMPARE(qFromLittleEndian<quint16>(pdu + 1), expectedHandles[i]);
+        QCOMPARE(qFromLittleEndian<quint16>(pdu + 3), expectedOffsets[i]);
+        prepared[expectedHandles[i]].append(pdu + LePreparedWrite::HeaderSize,
+                                            size - LePreparedWrite::HeaderSize);
+
+        QByteArray echo(pdu, size);
+        echo[0] = char(0x17);
+        QVERIFY(write.verifyEcho(i, echo.constData(), echo.size()));
+    }
+    QCOMPARE(prepared.value(0x0012), firstValue);
+    QCOMPARE(prepared.value(0x0014), secondValue);
+
+    // a corrupted echo of the last value cancels the whole transaction
+    int size = 0;
+    QByteArray echo(write.segment(2, &size), size);
+    QCOMPARE(size, LePreparedWrite::HeaderSize + 2);
+    echo[0] = char(0x17);
+    echo[size - 1] = 'z';
+    QVERIFY(!write.verifyEcho(2, echo.constData(), echo.size()));
+    // an echo for the wrong handle as well
+    QByteArray wrongHandle(write.segment(1, &size), size);
+    wrongHandle[0] = char(0x17);
+    wrongHandle[1] = char(0x14);
+    QVERIFY(!write.verifyEcho(1, wrongHandle.constData(), wrongHandle.size()));
+
+    // reliable writes require the central role
+    QLowEnergyCharacteristicData charData;
+    charData.setUuid(QBluetoothUuid(quint16(0xb001)));
+    charData.setProperties(QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Write
+                           | QLowEnergyCharacteristic::ExtendedProperty);
+    charData.setValue("v");
+    QLowEnergyServiceData serviceData;
+    serviceData.setType(QLowEnergyServiceData::ServiceTypePrimary);
+    serviceData.setUuid(QBluetoothUuid(quint16(0xa001)));
+    serviceData.addCharacteristic(charData);
+    const QScopedPointer<QLowEnergyController> controller(QLowEnergyController::createPeripheral());
+    const QScopedPointer<QLowEnergyService> service(controller->addService(serviceData));
+    QVERIFY(!service.isNull());
+    QSignalSpy errorSpy(service.data(), QOverload<QLowEnergyService::ServiceError>::of(
+                                                &QLowEnergyService::error));
+    service->beginReliableWrite();
+    service->executeReliableWrite();
+    QCOMPARE(errorSpy.count(), 1);
+    QCOMPARE(service->error(), QLowEnergyService::OperationError);
+
+    // an aborted transaction cannot be executed
+    service->beginReliableWrite();
+    service->abortReliableWrite();
+    service->executeReliableWrite();
+    QCOMPARE(errorSpy.count(), 2);
+    QCOMPARE(service->error(), QLowEnergyService::OperationError);
+#else
+    QSKIP("Reliable write test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::writeStream()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    // the peer of the socket pair plays the role of the remote ATT server
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sockets), 0);
+    // a small send buffer forces the writer to wait for the peer
+    const int sendBufferSize = 4096;
+    QCOMPARE(::setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF,
+                          &sendBufferSize, sizeof sendBufferSize), 0);
+
+    const int mtu = 50;
+    const QLowEnergyHandle valueHandle = 0x002a;
+    QByteArray received;
+    int packetCount = 0;
+    bool malformedPacket = false;
+    QSocketNotifier peer(sockets[1], QSocketNotifier::Read);
+    connect(&peer, &QSocketNotifier::activated, &peer, [&]() {
+        char packet[512];
+        ssize_t size;
+        while ((size = ::read(sockets[1], packet, sizeof packet)) > 0) {
+            if (size <= 3 || size > mtu || quint8(packet[0]) != 0x52
+                    || qFromLittleEndian<quint16>(packet + 1) != valueHandle) {
+                malformedPacket = true;
+            }
+            received.append(packet + 3, int(size) - 3);
+            ++packetCount;
+        }
+    });
+
+    LeAttStreamWriter writer;
+    writer.setSocketDescriptor(sockets[0]);
+    writer.setMtu(mtu);
+    QScopedPointer<LeWriteStream> stream(writer.createStream(valueHandle));
+    QVERIFY(stream->isWritable());
+    qint64 bytesWritten = 0;
+    connect(stream.data(), &QIODevice::bytesWritten, this, [&bytesWritten](qint64 bytes) {
+        bytesWritten += bytes;
+    });
+
+    QByteArray data(256 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < data.size(); ++i)
+        data[i] = char(i * 7);
+    QCOMPARE(stream->write(data), qint64(data.size()));
+    // the socket cannot take all data at once, nothing must get lost
+    QVERIFY(stream->bytesToWrite() > 0);
+    QVERIFY(writer.hasPendingData());
+
+    QTRY_COMPARE(received.size(), data.size());
+    QVERIFY(!malformedPacket);
+    QCOMPARE(received, data);
+    QCOMPARE(packetCount, (data.size() + mtu - 4) / (mtu - 3));
+    QCOMPARE(bytesWritten, qint64(data.size()));
+    QCOMPARE(stream->bytesToWrite(), qint64(0));
+    QVERIFY(!writer.hasPendingData());
+
+    writer.clear();
+    QVERIFY(!stream->isOpen());
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+#else
+    QSKIP("Write stream test only applicable for developer builds with BlueZ");
+#endif
+}
+
 void TestQLowEnergyControllerGattServer::advertisedData()
 {
     if (m_serverAddress.isNull())
@@ -560,6 +1599,178 @@ void TestQLowEnergyControllerGattServer::controllerType()
     QCOMPARE(controller->role(), QLowEnergyController::PeripheralRole);
 }
 
+void TestQLowEnergyControllerGattServer::databaseHash()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    const QBluetoothUuid databaseHashUuid(quint16(0x2b2a));
+    const QScopedPointer<QLowEnergyController> controller(QLowEnergyController::createPeripheral());
+
+    // handles 0x0001 to 0x0006
+    QLowEnergyCharacteristicData serviceChangedChar;
+    serviceChangedChar.setUuid(QBluetoothUuid::ServiceChanged);
+    serviceChangedChar.setProperties(QLowEnergyCharacteristic::Indicate);
+    serviceChangedChar.setValue(QByteArray::fromHex("0100ffff"));
+    serviceChangedChar.setValueLength(4, 4);
+    serviceChangedChar.addDescriptor(QLowEnergyDescriptorData(
+            QBluetoothUuid::ClientCharacteristicConfiguration, QByteArray(2, 0)));
+    QLowEnergyCharacteristicData databaseHashChar;
+    databaseHashChar.setUuid(databaseHashUuid);
+    databaseHashChar.setProperties(QLowEnergyCharacteristic::Read);
+    databaseHashChar.setValue(QByteArray(16, 0));
+    databaseHashChar.setValueLength(16, 16);
+    QLowEnergyServiceData gattServiceData;
+    gattServiceData.setType(QLowEnergyServiceData::ServiceTypePrimary);
+    gattServiceData.setUuid(QBluetoothUuid::GenericAttribute);
+    gattServiceData.addCharacteristic(serviceChangedChar);
+    gattServiceData.addCharacteristic(databaseHashChar);
+    const QScopedPointer<QLowEnergyService> gattService(controller->addService(gattServiceData));
+    QVERIFY(!gattService.isNull());
+
+    // handle and type of an attribute, followed by the value for declarations
+    const auto hashEntry = [](QLowEnergyHandle handle, quint16 type,
+                              const QByteArray &value = QByteArray()) {
+        QByteArray entry(4, Qt::Uninitialized);
+        qToLittleEndian(handle, entry.data());
+        qToLittleEndian(type, entry.data() + 2);
+        return entry + value;
+    };
+    const quint128 zeroKey = {};
+    const LeCmacCalculator calculator;
+
+    // characteristic values are not part of the hash, the configuration descriptor
+    // contributes its handle and type only
+    QByteArray message = hashEntry(0x0001, 0x2800, QByteArray::fromHex("0118"))
+            + hashEntry(0x0002, 0x2803, QByteArray::fromHex("200300052a"))
+            + hashEntry(0x0004, 0x2902)
+            + hashEntry(0x0005, 0x2803, QByteArray::fromHex("0206002a2b"));
+    QCOMPARE(gattService->characteristic(databaseHashUuid).value().toHex(),
+             calculator.calculateCmac(message, zeroKey).toHex());
+
+    // handles 0x0007 to 0x000c
+    const QBluetoothUuid customCharUuid(QStringLiteral("{c47774c7-f237-4523-8968-e4ae75431daf}"));
+    const QBluetoothUuid customDescUuid(QStringLiteral("{c47774c7-f237-4523-8968-e4ae75431db0}"));
+    QLowEnergyCharacteristicData customChar;
+    customChar.setUuid(customCharUuid);
+    customChar.setProperties(QLowEnergyCharacteristic::Read);
+    customChar.setValue("value");
+    customChar.addDescriptor(QLowEnergyDescriptorData(
+            QBluetoothUuid::CharacteristicUserDescription, "description"));
+    customChar.addDescriptor(QLowEnergyDescriptorData(customDescUuid, "custom"));
+    customChar.addDescriptor(QLowEnergyDescriptorData(
+            QBluetoothUuid::CharacteristicExtendedProperties, QByteArray::fromHex("0000")));
+    QLowEnergyServiceData customServiceData;
+    customServiceData.setType(QLowEnergyServiceData::ServiceTypePrimary);
+    customServiceData.setUuid(QBluetoothUuid(quint16(0x2000)));
+    customServiceData.addCharacteristic(customChar);
+    const QScopedPointer<QLowEnergyService> customService(
+                controller->addService(customServiceData));
+    QVERIFY(!customService.isNull());
+
+    // the declaration carries the 128 bit type of the characteristic, the attributes
+    // of 128 bit types are skipped, the extended properties contribute their value
+    QByteArray customCharUuidData = customCharUuid.toRfc4122();
+    std::reverse(customCharUuidData.begin(), customCharUuidData.end());
+    message += hashEntry(0x0007, 0x2800, QByteArray::fromHex("0020"))
+            + hashEntry(0x0008, 0x2803, QByteArray::fromHex("020900") + customCharUuidData)
+            + hashEntry(0x000a, 0x2901)
+            + hashEntry(0x000c, 0x2900, QByteArray::fromHex("0000"));
+    const QByteArray hash = calculator.calculateCmac(message, zeroKey);
+    QCOMPARE(gattService->characteristic(databaseHashUuid).value().toHex(), hash.toHex());
+    QCOMPARE(customService->characteristic(customCharUuid).value(), QByteArray("value"));
+
+    // no central can know the database before the first advertisement
+    QCOMPARE(gattService->characteristic(QBluetoothUuid::ServiceChanged).value(),
+             QByteArray::fromHex("0100ffff"));
+
+    // a bonded central which missed the indication of an earlier change
+    // receives the merged range
+    LeServiceChangedRange range(0x0007, 0x000c);
+    QCOMPARE(range.value(), QByteArray::fromHex("07000c00"));
+    range.merge(QByteArray::fromHex("0d001400"));
+    QCOMPARE(range.value(), QByteArray::fromHex("07001400"));
+    range.merge(QByteArray::fromHex("01000800"));
+    QCOMPARE(range.start, QLowEnergyHandle(0x0001));
+    QCOMPARE(range.end, QLowEnergyHandle(0x0014));
+    range.merge(QByteArray::fromHex("0100"));
+    QCOMPARE(range.value(), QByteArray::fromHex("01001400"));
+#else
+    QSKIP("Database hash test only applicable for developer builds with BlueZ");
+#endif
+}
+
+void TestQLowEnergyControllerGattServer::gattCache()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTemporaryDir cacheDir;
+    QVERIFY(cacheDir.isValid());
+    const LeGattCache cache(cacheDir.path() + QLatin1String("/gatt"));
+    const QBluetoothAddress device(QStringLiteral("11:22:33:44:55:66"));
+    QVERIFY(cache.load(device).services.isEmpty());
+
+    LeGattCache::Database database;
+    database.hash = QByteArray::fromHex("f1e2d3c4b5a6978869504132231405f6");
+
+    LeGattCache::Service gattService;
+    gattService.uuid = QBluetoothUuid(QBluetoothUuid::GenericAttribute);
+    gattService.startHandle = 1;
+    gattService.endHandle = 4;
+    gattService.detailsKnown = true;
+    LeGattCache::Characteristic serviceChanged;
+    serviceChanged.handle = 2;
+    serviceChanged.valueHandle = 3;
+    serviceChanged.uuid = QBluetoothUuid(QBluetoothUuid::ServiceChanged);
+    serviceChanged.properties = QLowEnergyCharacteristic::Indicate;
+    serviceChanged.descriptors.append({ 4, QBluetoothUuid(
+            QBluetoothUuid::ClientCharacteristicConfiguration) });
+    gattService.characteristics.append(serviceChanged);
+    database.services.append(gattService);
+
+    LeGattCache::Service customService;
+    customService.uuid = QBluetoothUuid(QStringLiteral("c47774c7-f237-4523-8968-e4ae75431daf"));
+    customService.startHandle = 5;
+    customService.endHandle = 0xffff;
+    customService.isPrimary = false;
+    customService.includedServices.append(gattService.uuid);
+    database.services.append(customService);
+
+    QVERIFY(cache.store(device, database));
+    QVERIFY(cache.load(QBluetoothAddress(QStringLiteral("11:22:33:44:55:67"))).services.isEmpty());
+
+    const LeGattCache::Database loaded = cache.load(device);
+    QCOMPARE(loaded.hash, database.hash);
+    QCOMPARE(loaded.services.count(), 2);
+    QCOMPARE(loaded.serviceChangedHandle(), QLowEnergyHandle(3));
+
+    const LeGattCache::Service *loadedGattService = loaded.service(gattService.uuid);
+    QVERIFY(loadedGattService);
+    QCOMPARE(loadedGattService->startHandle, gattService.startHandle);
+    QCOMPARE(loadedGattService->endHandle, gattService.endHandle);
+    QVERIFY(loadedGattService->isPrimary);
+    QVERIFY(loadedGattService->detailsKnown);
+    QCOMPARE(loadedGattService->characteristics.count(), 1);
+    const LeGattCache::Characteristic &loadedChar = loadedGattService->characteristics.first();
+    QCOMPARE(loadedChar.handle, serviceChanged.handle);
+    QCOMPARE(loadedChar.valueHandle, serviceChanged.valueHandle);
+    QCOMPARE(loadedChar.uuid, serviceChanged.uuid);
+    QCOMPARE(loadedChar.properties, serviceChanged.properties);
+    QCOMPARE(loadedChar.descriptors.count(), 1);
+    QCOMPARE(loadedChar.descriptors.first().handle, QLowEnergyHandle(4));
+    QCOMPARE(loadedChar.descriptors.first().uuid, serviceChanged.descriptors.first().uuid);
+
+    const LeGattCache::Service *loadedCustomService = loaded.service(customService.uuid);
+    QVERIFY(loadedCustomService);
+    QVERIFY(!loadedCustomService->isPrimary);
+    QVERIFY(!loadedCustomService->detailsKnown);
+    QCOMPARE(loadedCustomService->includedServices, customService.includedServices);
+    QVERIFY(loadedCustomService->characteristics.isEmpty());
+
+    cache.remove(device);
+    QVERIFY(cache.load(device).services.isEmpty());
+#else
+    QSKIP("GATT cache test only applicable for developer builds with BlueZ");
+#endif
+}
+
 void TestQLowEnergyControllerGattServer::serviceData()
 {
     QLowEnergyDescriptorData descData;
@@ -689,6 +1900,87 @@ void TestQLowEnergyControllerGattServer::serviceData()
     QCOMPARE(includedServices.first(), secondaryService->serviceUuid());
 }
 
+void TestQLowEnergyControllerGattServer::signCounterJournal()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTemporaryDir settingsDir;
+    QVERIFY(settingsDir.isValid());
+    const QString filePath = settingsDir.filePath(QStringLiteral("info"));
+    const QString group = QStringLiteral("LocalSignatureKey");
+    const QString counterKey = group + QLatin1String("/Counter");
+    {
+        QSettings settings(filePath, QSettings::IniFormat);
+        settings.setValue(counterKey, 5);
+    }
+
+    quint32 counter = 0;
+    {
+        LeSignCounterJournal journal;
+        journal.setReservationSize(16);
+        counter = journal.load(filePath, group, 5, LeSignCounterJournal::LocalCounter);
+        QCOMPARE(counter, quint32(5));
+        while (counter < 40)
+            QVERIFY(journal.record(filePath, group, ++counter));
+        journal.flush();
+        QCOMPARE(QSettings(filePath, QSettings::IniFormat).value(counterKey).toUInt(), counter);
+    }
+
+    // the last flush was lost, the settings file still holds an older counter
+    {
+        QSettings settings(filePath, QSettings::IniFormat);
+        settings.setValue(counterKey, 10);
+    }
+
+    LeSignCounterJournal journal;
+    const quint32 restored = journal.load(filePath, group, 10,
+                                          LeSignCounterJournal::LocalCounter);
+    QVERIFY(restored > counter);
+    QVERIFY(journal.record(filePath, group, restored + 1));
+
+    // counters are only kept in memory if the settings file cannot be written
+    const QString missingFilePath = settingsDir.filePath(QStringLiteral("missing/info"));
+    QCOMPARE(journal.load(missingFilePath, group, 3, LeSignCounterJournal::LocalCounter),
+             quint32(3));
+    QVERIFY(journal.record(missingFilePath, group, 4));
+    QVERIFY(!QFile::exists(missingFilePath + QLatin1String(".qtsigncounters")));
+
+    // the counter of a remote key is not reserved, a bonded central continues with
+    // the next value after a restart
+    const QString remoteGroup = QStringLiteral("RemoteSignatureKey");
+    const QString remoteCounterKey = remoteGroup + QLatin1String("/Counter");
+    {
+        QSettings settings(filePath, QSettings::IniFormat);
+        settings.setValue(remoteCounterKey, 7);
+    }
+    quint32 remoteCounter = 0;
+    {
+        LeSignCounterJournal journal;
+        journal.setReservationSize(16);
+        remoteCounter = journal.load(filePath, remoteGroup, 7,
+                                     LeSignCounterJournal::RemoteCounter);
+        QCOMPARE(remoteCounter, quint32(7));
+        for (int i = 0; i < 20; ++i)
+            QVERIFY(journal.record(filePath, remoteGroup, ++remoteCounter));
+    }
+    QCOMPARE(QSettings(filePath, QSettings::IniFormat).value(remoteCounterKey).toUInt(),
+             remoteCounter);
+    {
+        LeSignCounterJournal journal;
+        journal.setReservationSize(16);
+        const quint32 reloaded = journal.load(filePath, remoteGroup, remoteCounter,
+                                              LeSignCounterJournal::RemoteCounter);
+        QCOMPARE(reloaded, remoteCounter);
+        // the controller accepts signed writes from the loaded counter on
+        QVERIFY(journal.record(filePath, remoteGroup, reloaded + 1));
+        journal.flush();
+    }
+    QCOMPARE(QSettings(filePath, QSettings::IniFormat).value(remoteCounterKey).toUInt(),
+             remoteCounter + 1);
+#else
+    QSKIP("Sign counter journal test only applicable for developer builds with BlueZ");
+#endif
+}
+
 QTEST_MAIN(TestQLowEnergyControllerGattServer)
 
 #include "tst_qlowenergycontroller-gattserver.moc"
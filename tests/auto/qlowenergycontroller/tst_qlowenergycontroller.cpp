@@ -32,6 +32,9 @@
 #if QT_CONFIG(bluez)
 #include <QtBluetooth/private/bluez5_helper_p.h>
 #endif
+#ifdef QT_BUILD_INTERNAL
+#include <QtBluetooth/private/qlowenergycontrollerbase_p.h>
+#endif
 #include <QBluetoothAddress>
 #include <QBluetoothLocalDevice>
 #include <QBluetoothDeviceDiscoveryAgent>
@@ -84,12 +87,14 @@ private slots:
     void tst_emptyCtor();
     void tst_connect();
     void tst_concurrentDiscovery();
+    void tst_discoverAllServiceDetails();
     void tst_defaultBehavior();
     void tst_writeCharacteristic();
     void tst_writeCharacteristicNoResponse();
     void tst_readWriteDescriptor();
     void tst_customProgrammableDevice();
     void tst_errorCases();
+    void tst_handleIndex();
 private:
     void verifyServiceProperties(const QLowEnergyService *info);
     bool verifyClientCharacteristicValue(const QByteArray& value);
@@ -629,6 +634,120 @@ void tst_QLowEnergyController::tst_concurrentDiscovery()
     control.disconnectFromDevice();
 }
 
+void tst_QLowEnergyController::tst_discoverAllServiceDetails()
+{
+    {
+        // no-op unless services were discovered
+        QLowEnergyController control(QBluetoothAddress("11:22:33:44:55:66"));
+        QSignalSpy stateSpy(&control,
+                            SIGNAL(stateChanged(QLowEnergyController::ControllerState)));
+        control.discoverAllServiceDetails();
+        QCOMPARE(control.state(), QLowEnergyController::UnconnectedState);
+        QCOMPARE(control.error(), QLowEnergyController::NoError);
+        QVERIFY(stateSpy.isEmpty());
+        QVERIFY(control.services().isEmpty());
+    }
+
+    {
+        QScopedPointer<QLowEnergyController> peripheral(
+                    QLowEnergyController::createPeripheral());
+        QTest::ignoreMessage(QtWarningMsg, "Cannot discover service details in peripheral role");
+        peripheral->discoverAllServiceDetails();
+        QCOMPARE(peripheral->state(), QLowEnergyController::UnconnectedState);
+    }
+
+#if !defined(Q_OS_MAC) && !QT_CONFIG(winrt_bt)
+    if (QBluetoothLocalDevice::allDevices().isEmpty() || !remoteDeviceInfo.isValid())
+#else
+    if (!remoteDeviceInfo.isValid())
+#endif
+        QSKIP("No local Bluetooth or remote BTLE device found. Skipping test.");
+
+    QLowEnergyController control(remoteDeviceInfo);
+    QCOMPARE(control.error(), QLowEnergyController::NoError);
+
+    const auto connectAndDiscover = [&control]() {
+        control.connectToDevice();
+        QTRY_IMPL(control.state() != QLowEnergyController::ConnectingState, 10000);
+        if (control.state() != QLowEnergyController::ConnectedState)
+            return false;
+        control.discoverServices();
+        QTRY_IMPL(control.state() == QLowEnergyController::DiscoveredState, 20000);
+        return control.state() == QLowEnergyController::DiscoveredState;
+    };
+
+    if (!connectAndDiscover())
+        QSKIP("Unable to connect to remote BTLE device. Skipping test.");
+
+    QList<QSharedPointer<QLowEnergyService>> services;
+    const QList<QBluetoothUuid> uuids = control.services();
+    for (const QBluetoothUuid &uuid : uuids) {
+        services.append(QSharedPointer<QLowEnergyService>(control.createServiceObject(uuid)));
+        QVERIFY(services.last());
+        QCOMPARE(services.last()->state(), QLowEnergyService::DiscoveryRequired);
+    }
+    QVERIFY(!services.isEmpty());
+
+    control.discoverAllServiceDetails();
+    for (const auto &service : qAsConst(services)) {
+        QTRY_VERIFY_WITH_TIMEOUT(
+                    service->state() == QLowEnergyService::ServiceDiscovered, 30000);
+        QCOMPARE(service->error(), QLowEnergyService::NoError);
+    }
+    for (const auto &service : qAsConst(services)) {
+        if (service->serviceUuid()
+                == QBluetoothUuid(QString("f000aa00-0451-4000-b000-000000000000"))) {
+            QVERIFY(!service->characteristics().isEmpty());
+        }
+    }
+
+    // nothing left to discover
+    QSignalSpy serviceStateSpy(services.first().data(),
+                               SIGNAL(stateChanged(QLowEnergyService::ServiceState)));
+    control.discoverAllServiceDetails();
+    QTest::qWait(1000);
+    QVERIFY(serviceStateSpy.isEmpty());
+    QCOMPARE(services.first()->state(), QLowEnergyService::ServiceDiscovered);
+
+    control.disconnectFromDevice();
+    QTRY_COMPARE_WITH_TIMEOUT(control.state(), QLowEnergyController::UnconnectedState, 10000);
+    for (const auto &service : qAsConst(services))
+        QCOMPARE(service->state(), QLowEnergyService::InvalidService);
+
+    // disconnect while the details are still being discovered
+    services.clear();
+    if (!connectAndDiscover())
+        QSKIP("Unable to reconnect to remote BTLE device. Skipping test.");
+
+    const QList<QBluetoothUuid> newUuids = control.services();
+    for (const QBluetoothUuid &uuid : newUuids)
+        services.append(QSharedPointer<QLowEnergyService>(control.createServiceObject(uuid)));
+
+    control.discoverAllServiceDetails();
+    bool discovering = false;
+    for (const auto &service : qAsConst(services))
+        discovering |= (service->state() == QLowEnergyService::DiscoveringServices);
+    QVERIFY(discovering);
+
+    control.disconnectFromDevice();
+    QTRY_COMPARE_WITH_TIMEOUT(control.state(), QLowEnergyController::UnconnectedState, 10000);
+    for (const auto &service : qAsConst(services))
+        QCOMPARE(service->state(), QLowEnergyService::InvalidService);
+
+    // the controller recovers from the interrupted discovery
+    services.clear();
+    if (!connectAndDiscover())
+        QSKIP("Unable to reconnect to remote BTLE device. Skipping test.");
+    QSharedPointer<QLowEnergyService> service(
+                control.createServiceObject(control.services().first()));
+    QVERIFY(service);
+    control.discoverAllServiceDetails();
+    QTRY_COMPARE_WITH_TIMEOUT(service->state(), QLowEnergyService::ServiceDiscovered, 30000);
+
+    control.disconnectFromDevice();
+    QTRY_COMPARE_WITH_TIMEOUT(control.state(), QLowEnergyController::UnconnectedState, 10000);
+}
+
 void tst_QLowEnergyController::verifyServiceProperties(
         const QLowEnergyService *info)
 {
@@ -2831,6 +2950,145 @@ void tst_QLowEnergyController::tst_writeCharacteristicNoResponse()
     control.disconnectFromDevice();
 }
 
+void tst_QLowEnergyController::tst_handleIndex()
+{
+#ifdef QT_BUILD_INTERNAL
+    // service 0x1800 with two characteristics, the second one has two descriptors
+    const auto gapService = QSharedPointer<QLowEnergyServicePrivate>::create();
+    gapService->uuid = QBluetoothUuid(quint16(0x1800));
+    gapService->startHandle = 1;
+    gapService->endHandle = 7;
+    gapService->state = QLowEnergyService::ServiceDiscovered;
+    QLowEnergyServicePrivate::CharData charData;
+    charData.valueHandle = 3;
+    gapService->characteristicList.insert(2, charData);
+    charData.valueHandle = 5;
+    charData.descriptorList.insert(6, QLowEnergyServicePrivate::DescData());
+    charData.descriptorList.insert(7, QLowEnergyServicePrivate::DescData());
+    gapService->characteristicList.insert(4, charData);
+
+    // service 0x180a whose details are not known yet
+    const auto infoService = QSharedPointer<QLowEnergyServicePrivate>::create();
+    infoService->uuid = QBluetoothUuid(quint16(0x180a));
+    infoService->startHandle = 10;
+    infoService->endHandle = 20;
+    infoService->state = QLowEnergyService::DiscoveryRequired;
+
+    ServiceDataMap services;
+    services.insert(gapService->uuid, gapService);
+    services.insert(infoService->uuid, infoService);
+
+    QLowEnergyHandleIndex index;
+    QVERIFY(!index.isValid());
+    QVERIFY(!index.entry(1));
+    index.update(services, gapService.data());
+    QVERIFY(!index.isValid());
+
+    index.rebuild(services);
+    QVERIFY(index.isValid());
+    QCOMPARE(index.count(), 6);
+
+    QVERIFY(!index.entry(0));
+    const QLowEnergyHandleIndex::Entry *entry = index.entry(1);
+    QVERIFY(entry);
+    QCOMPARE(entry->service, gapService);
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(0));
+    QVERIFY(!entry->isDescriptor);
+    QVERIFY(entry->detailsIndexed);
+
+    // value handles belong to the entry of their characteristic declaration
+    entry = index.entry(3);
+    QVERIFY(entry);
+    QCOMPARE(entry->handle, QLowEnergyHandle(2));
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(2));
+    QVERIFY(!entry->isDescriptor);
+    entry = index.entry(5);
+    QVERIFY(entry);
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(4));
+    QVERIFY(!entry->isDescriptor);
+
+    for (QLowEnergyHandle handle : { 6, 7 }) {
+        entry = index.entry(handle);
+        QVERIFY(entry);
+        QCOMPARE(entry->handle, handle);
+        QCOMPARE(entry->charHandle, QLowEnergyHandle(4));
+        QVERIFY(entry->isDescriptor);
+    }
+
+    // gap between the services
+    QVERIFY(!index.entry(8));
+    QVERIFY(!index.entry(9));
+
+    // undiscovered service is only represented by its service entry
+    for (QLowEnergyHandle handle : { 10, 15, 20 }) {
+        entry = index.entry(handle);
+        QVERIFY(entry);
+        QCOMPARE(entry->service, infoService);
+        QCOMPARE(entry->handle, QLowEnergyHandle(10));
+        QVERIFY(!entry->detailsIndexed);
+    }
+    QVERIFY(!index.entry(21));
+    QVERIFY(!index.entry(0xffff));
+
+    // details of the second service become known
+    charData = QLowEnergyServicePrivate::CharData();
+    charData.valueHandle = 12;
+    charData.descriptorList.insert(13, QLowEnergyServicePrivate::DescData());
+    infoService->characteristicList.insert(11, charData);
+    infoService->state = QLowEnergyService::ServiceDiscovered;
+    index.update(services, infoService.data());
+    QCOMPARE(index.count(), 8);
+
+    entry = index.entry(10);
+    QVERIFY(entry);
+    QVERIFY(entry->detailsIndexed);
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(0));
+    entry = index.entry(12);
+    QVERIFY(entry);
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(11));
+    entry = index.entry(13);
+    QVERIFY(entry);
+    QVERIFY(entry->isDescriptor);
+    QCOMPARE(entry->charHandle, QLowEnergyHandle(11));
+    // handles after the last descriptor still belong to the descriptor entry
+    entry = index.entry(20);
+    QVERIFY(entry);
+    QCOMPARE(entry->handle, QLowEnergyHandle(13));
+    QVERIFY(!index.entry(21));
+
+    // the entries of the first service are untouched
+    entry = index.entry(6);
+    QVERIFY(entry);
+    QCOMPARE(entry->service, gapService);
+    QVERIFY(entry->isDescriptor);
+
+    // services which are not part of the map are ignored
+    const auto otherService = QSharedPointer<QLowEnergyServicePrivate>::create();
+    otherService->uuid = infoService->uuid;
+    otherService->startHandle = 10;
+    otherService->endHandle = 20;
+    otherService->state = QLowEnergyService::InvalidService;
+    index.update(services, otherService.data());
+    QCOMPARE(index.count(), 8);
+    QVERIFY(index.entry(13)->detailsIndexed);
+
+    // discarded details
+    infoService->state = QLowEnergyService::InvalidService;
+    index.update(services, infoService.data());
+    QCOMPARE(index.count(), 6);
+    entry = index.entry(13);
+    QVERIFY(entry);
+    QCOMPARE(entry->handle, QLowEnergyHandle(10));
+    QVERIFY(!entry->detailsIndexed);
+
+    index.clear();
+    QVERIFY(!index.isValid());
+    QVERIFY(!index.entry(1));
+#else
+    QSKIP("Handle index test only applicable for developer builds");
+#endif
+}
+
 QTEST_MAIN(tst_QLowEnergyController)
 
 #include "tst_qlowenergycontroller.moc"
@@ -0,0 +1,7 @@
+QT = core bluetooth bluetooth-private testlib
+
+TARGET = tst_bench_attbearers
+CONFIG += benchmark
+qtConfig(bluez_le): DEFINES += CONFIG_BLUEZ_LE
+
+SOURCES += tst_bench_attbearers.cpp
@@ -0,0 +1,141 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QThread>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/leattbearer_p.h>
+#include <QtBluetooth/private/qlowenergyserviceprivate_p.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*!
+  This benchmark measures how the number of ATT bearers affects the time
+  needed to complete read requests of several services. Each bearer is
+  connected to a local socket whose peer thread answers every request
+  after a delay which mimics the connection interval of a radio link.
+  */
+
+QT_USE_NAMESPACE
+
+class tst_bench_AttBearers : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parallelRequests_data();
+    void parallelRequests();
+};
+
+void tst_bench_AttBearers::parallelRequests_data()
+{
+    QTest::addColumn<int>("bearerCount");
+
+    QTest::newRow("1 bearer") << 1;
+    QTest::newRow("2 bearers") << 2;
+    QTest::newRow("4 bearers") << 4;
+}
+
+void tst_bench_AttBearers::parallelRequests()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(int, bearerCount);
+
+    const int serviceCount = 8;
+    const int requestsPerService = 4;
+    const int responseDelay = 8; // milliseconds
+
+    LeAttBearerPool pool;
+    QVector<QThread *> peers;
+    for (int i = 0; i < bearerCount; ++i) {
+        int sockets[2];
+        QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+        QVERIFY(::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK) != -1);
+        pool.addBearer(new LeAttBearer(sockets[0]));
+
+        // answers each read request with a read response until the bearer is closed
+        const int peer = sockets[1];
+        QThread *thread = QThread::create([peer, responseDelay]() {
+            char pdu[64];
+            while (::read(peer, pdu, sizeof pdu) > 0) {
+                QThread::msleep(responseDelay);
+                pdu[0] = char(pdu[0] + 1);
+                if (::write(peer, pdu, 3) != 3)
+                    break;
+            }
+            ::close(peer);
+        });
+        thread->start();
+        peers.append(thread);
+    }
+    QTRY_COMPARE(pool.readyBearerCount(), bearerCount);
+
+    QVector<QSharedPointer<QLowEnergyServicePrivate>> services;
+    for (int i = 0; i < serviceCount; ++i)
+        services.append(QSharedPointer<QLowEnergyServicePrivate>::create());
+
+    int responses = 0;
+    connect(&pool, &LeAttBearerPool::responseReceived, this, [&responses]() { ++responses; });
+
+    QBENCHMARK {
+        responses = 0;
+        for (int i = 0; i < requestsPerService; ++i) {
+            for (const auto &service : qAsConst(services)) {
+                LeAttRequest request;
+                request.command = 0x0a; // read request
+                request.lane = LeAttRequest::InteractiveLane;
+                request.service = service;
+                request.payload.append(char(request.command));
+                request.payload.append(char(0x01));
+                request.payload.append(char(0x00));
+                pool.enqueue(request);
+            }
+        }
+        while (responses < serviceCount * requestsPerService)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+
+    pool.clear();
+    for (QThread *thread : qAsConst(peers)) {
+        QVERIFY(thread->wait(5000));
+        delete thread;
+    }
+#else
+    QSKIP("The ATT bearer benchmark requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_AttBearers)
+
+#include "tst_bench_attbearers.moc"
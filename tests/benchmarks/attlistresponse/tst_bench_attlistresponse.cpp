@@ -0,0 +1,158 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/leattserverconnection_p.h>
+#include <QtCore/qendian.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+/*!
+  This benchmark measures how long a GATT server takes to answer the Read By
+  Type requests with which a client discovers all characteristics of a large
+  attribute database. It mirrors the response assembly of the controller's
+  read by type handler: the declaration handles are looked up in a sorted
+  index and as many elements as fit into the MTU are written in place.
+
+  The response buffer is either reused for all responses, as the controller
+  does, or allocated for every response.
+  */
+
+QT_USE_NAMESPACE
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+struct SyntheticAttribute
+{
+    QLowEnergyHandle handle = 0;
+    QByteArray value;
+};
+#endif
+
+class tst_bench_AttListResponse : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readByTypeScan_data();
+    void readByTypeScan();
+};
+
+void tst_bench_AttListResponse::readByTypeScan_data()
+{
+    QTest::addColumn<int>("characteristicCount");
+    QTest::addColumn<int>("mtu");
+    QTest::addColumn<bool>("reuseBuffer");
+
+    for (const int count : { 1000, 10000 }) {
+        for (const int mtu : { 23, 247, 512 }) {
+            QTest::addRow("%d characteristics, MTU %d, reused buffer", count, mtu)
+                    << count << mtu << true;
+            QTest::addRow("%d characteristics, MTU %d, new buffer", count, mtu)
+                    << count << mtu << false;
+        }
+    }
+}
+
+void tst_bench_AttListResponse::readByTypeScan()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(int, characteristicCount);
+    QFETCH(int, mtu);
+    QFETCH(bool, reuseBuffer);
+
+    // characteristic declarations followed by their values, indexed by handle
+    QVector<SyntheticAttribute> attributes(2 * characteristicCount + 1);
+    QVector<QLowEnergyHandle> declarationHandles;
+    for (int i = 0; i < characteristicCount; ++i) {
+        const QLowEnergyHandle handle = QLowEnergyHandle(2 * i + 1);
+        SyntheticAttribute &declaration = attributes[handle];
+        declaration.handle = handle;
+        declaration.value = QByteArray(5, Qt::Uninitialized);
+        declaration.value[0] = 0x02; // read
+        qToLittleEndian<quint16>(handle + 1, declaration.value.data() + 1);
+        qToLittleEndian<quint16>(quint16(0x2a00 + i % 0x100), declaration.value.data() + 3);
+        declarationHandles.append(handle);
+
+        SyntheticAttribute &value = attributes[handle + 1];
+        value.handle = handle + 1;
+        value.value = QByteArray(4, 'v');
+    }
+
+    const int valueSize = 5;
+    const int elementSize = int(sizeof(QLowEnergyHandle)) + valueSize;
+    LeAttPduBuilder sharedBuilder;
+    int responseCount = 0;
+    int elementCount = 0;
+
+    QBENCHMARK {
+        responseCount = 0;
+        elementCount = 0;
+        QLowEnergyHandle startingHandle = 1;
+        while (true) {
+            const auto first = std::lower_bound(declarationHandles.constBegin(),
+                                                declarationHandles.constEnd(), startingHandle);
+            if (first == declarationHandles.constEnd())
+                break;
+
+            LeAttPduBuilder freshBuilder;
+            LeAttPduBuilder &builder = reuseBuffer ? sharedBuilder : freshBuilder;
+            char *data = builder.start(0x09, mtu);
+            *data++ = char(elementSize);
+            const char * const end = builder.limit();
+            QLowEnergyHandle lastHandle = startingHandle;
+            for (auto it = first; it != declarationHandles.constEnd() && end - data >= elementSize;
+                 ++it) {
+                const SyntheticAttribute &attr = attributes.at(*it);
+                qToLittleEndian(attr.handle, data);
+                data += sizeof(QLowEnergyHandle);
+                memcpy(data, attr.value.constData(), size_t(valueSize));
+                data += valueSize;
+                lastHandle = attr.handle;
+                ++elementCount;
+            }
+            QVERIFY(builder.size(data) > 2);
+            ++responseCount;
+            startingHandle = lastHandle + 1;
+        }
+    }
+
+    QCOMPARE(elementCount, characteristicCount);
+    const int elementsPerResponse = (mtu - 2) / elementSize;
+    QCOMPARE(responseCount, (characteristicCount + elementsPerResponse - 1) / elementsPerResponse);
+#else
+    QSKIP("The ATT list response benchmark requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_AttListResponse)
+
+#include "tst_bench_attlistresponse.moc"
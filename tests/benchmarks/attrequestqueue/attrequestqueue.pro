@@ -0,0 +1,6 @@
+QT = core bluetooth bluetooth-private testlib
+
+TARGET = tst_bench_attrequestqueue
+CONFIG += benchmark
+
+SOURCES += tst_bench_attrequestqueue.cpp
@@ -0,0 +1,325 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QQueue>
+#include <QtCore/QVariant>
+#include <QtBluetooth/private/leattrequest_p.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+/*!
+  Compares the ATT request representation formerly used by the BlueZ
+  controller (a QByteArray payload and two QVariant references in a QQueue)
+  with the typed requests and the ring queue used now. Each cycle
+  creates, enqueues, sends (reads the payload), dequeues and unpacks
+  the requests the same way the controller does.
+
+  The allocations benchmark reports the heap allocations per request once
+  the queue has reached its steady state. Allocations are counted by
+  interposing malloc() which requires glibc.
+  */
+
+QT_USE_NAMESPACE
+
+static std::atomic<qint64> allocationCount{0};
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+enum RequestType {
+    Read,
+    Write,
+    ReadMultiple,
+    FindInformation
+};
+Q_DECLARE_METATYPE(RequestType)
+
+struct LegacyRequest {
+    quint8 command;
+    QByteArray payload;
+    QVariant reference;
+    QVariant reference2;
+};
+
+// requests in flight per cycle, the controller usually has a few queued requests
+static const int queueDepth = 4;
+
+class tst_bench_AttRequestQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_bench_AttRequestQueue();
+
+private slots:
+    void allocations_data();
+    void allocations();
+    void throughput_data();
+    void throughput();
+
+private:
+    void addRows();
+    quint64 runLegacy(RequestType type, int cycles);
+    quint64 runTyped(RequestType type, int cycles);
+
+    QByteArray value;
+    QVector<uint> handleDataList;
+    QList<QLowEnergyHandle> charHandles;
+    QQueue<LegacyRequest> legacyQueue;
+    LeRingQueue<LeAttRequest> typedQueue;
+};
+
+tst_bench_AttRequestQueue::tst_bench_AttRequestQueue()
+    : value(16, 'x')
+{
+    handleDataList << 0x0003 << 0x0006 << 0x0009 << 0x000c;
+    charHandles << 0x0002 << 0x0005 << 0x0008;
+}
+
+void tst_bench_AttRequestQueue::addRows()
+{
+    QTest::addColumn<RequestType>("type");
+    QTest::addColumn<bool>("typed");
+
+    const struct {
+        const char *name;
+        RequestType type;
+    } types[] = {
+        { "read", Read },
+        { "write", Write },
+        { "read multiple", ReadMultiple },
+        { "find information", FindInformation }
+    };
+    for (const auto &t : types) {
+        QTest::addRow("legacy %s", t.name) << t.type << false;
+        QTest::addRow("typed %s", t.name) << t.type << true;
+    }
+}
+
+quint64 tst_bench_AttRequestQueue::runLegacy(RequestType type, int cycles)
+{
+    quint64 sum = 0;
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        for (int i = 0; i < queueDepth; ++i) {
+            const QLowEnergyHandle handle = QLowEnergyHandle(cycle + i);
+            LegacyRequest request;
+            QByteArray data;
+            switch (type) {
+            case Read:
+                data = QByteArray(3, Qt::Uninitialized);
+                data[0] = 0x0a;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                request.reference = uint(handle);
+                request.reference2 = false;
+                break;
+            case Write:
+                data = QByteArray(3 + value.size(), Qt::Uninitialized);
+                data[0] = 0x12;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                memcpy(data.data() + 3, value.constData(), value.size());
+                request.reference = uint(handle);
+                request.reference2 = value;
+                break;
+            case ReadMultiple:
+                data = QByteArray(1 + 2 * handleDataList.count(), Qt::Uninitialized);
+                data[0] = 0x0e;
+                request.reference = QVariant::fromValue(handleDataList);
+                request.reference2 = false;
+                break;
+            case FindInformation:
+                data = QByteArray(5, Qt::Uninitialized);
+                data[0] = 0x04;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                request.reference = QVariant::fromValue<QList<QLowEnergyHandle> >(charHandles);
+                request.reference2 = handle;
+                break;
+            }
+            request.command = quint8(data.at(0));
+            request.payload = data;
+            legacyQueue.enqueue(request);
+        }
+
+        while (!legacyQueue.isEmpty()) {
+            sum += quint8(legacyQueue.head().payload.constData()[0]);
+            const LegacyRequest request = legacyQueue.dequeue();
+            switch (type) {
+            case Read:
+                sum += request.reference.toUInt() + request.reference2.toBool();
+                break;
+            case Write:
+                sum += request.reference.toUInt() + request.reference2.toByteArray().size();
+                break;
+            case ReadMultiple:
+                sum += request.reference.value<QVector<uint> >().first();
+                break;
+            case FindInformation:
+                sum += request.reference.value<QList<QLowEnergyHandle> >().first()
+                        + request.reference2.toUInt();
+                break;
+            }
+        }
+    }
+    return sum;
+}
+
+quint64 tst_bench_AttRequestQueue::runTyped(RequestType type, int cycles)
+{
+    quint64 sum = 0;
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        for (int i = 0; i < queueDepth; ++i) {
+            const QLowEnergyHandle handle = QLowEnergyHandle(cycle + i);
+            LeAttRequest request;
+            LeAttPdu &data = request.payload;
+            switch (type) {
+            case Read:
+                data.resize(3);
+                data[0] = 0x0a;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                request.handleData = handle;
+                break;
+            case Write:
+                data.resize(3 + value.size());
+                data[0] = 0x12;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                memcpy(data.data() + 3, value.constData(), value.size());
+                request.handleData = handle;
+                request.value = value;
+                break;
+            case ReadMultiple:
+                data.resize(1 + 2 * handleDataList.count());
+                data[0] = 0x0e;
+                request.handleDataList = handleDataList;
+                break;
+            case FindInformation:
+                data.resize(5);
+                data[0] = 0x04;
+                memcpy(data.data() + 1, &handle, sizeof handle);
+                request.pendingCharHandles = charHandles;
+                request.startHandle = handle;
+                break;
+            }
+            request.command = quint8(data.at(0));
+            typedQueue.enqueue(request);
+        }
+
+        while (!typedQueue.isEmpty()) {
+            sum += quint8(typedQueue.head().payload.constData()[0]);
+            const LeAttRequest request = typedQueue.dequeue();
+            switch (type) {
+            case Read:
+                sum += request.handleData + request.isLastValue;
+                break;
+            case Write:
+                sum += request.handleData + request.value.size();
+                break;
+            case ReadMultiple:
+                sum += request.handleDataList.first();
+                break;
+            case FindInformation:
+                sum += request.pendingCharHandles.first() + request.startHandle;
+                break;
+            }
+        }
+    }
+    return sum;
+}
+
+void tst_bench_AttRequestQueue::allocations_data()
+{
+    addRows();
+}
+
+void tst_bench_AttRequestQueue::allocations()
+{
+#if !defined(__GLIBC__)
+    QSKIP("Counting allocations requires glibc.");
+#endif
+    QFETCH(RequestType, type);
+    QFETCH(bool, typed);
+
+    const int cycles = 1000;
+
+    // warm up such that queues and metatypes reach their steady state
+    quint64 sum = typed ? runTyped(type, 16) : runLegacy(type, 16);
+
+    const qint64 before = allocationCount.load();
+    sum += typed ? runTyped(type, cycles) : runLegacy(type, cycles);
+    const qint64 allocations = allocationCount.load() - before;
+
+    QVERIFY(sum > 0);
+    QTest::setBenchmarkResult(qreal(allocations) / (cycles * queueDepth), QTest::Events);
+}
+
+void tst_bench_AttRequestQueue::throughput_data()
+{
+    addRows();
+}
+
+void tst_bench_AttRequestQueue::throughput()
+{
+    QFETCH(RequestType, type);
+    QFETCH(bool, typed);
+
+    quint64 sum = 0;
+    QBENCHMARK {
+        sum += typed ? runTyped(type, 1000) : runLegacy(type, 1000);
+    }
+    QVERIFY(sum > 0);
+}
+
+QTEST_MAIN(tst_bench_AttRequestQueue)
+
+#include "tst_bench_attrequestqueue.moc"
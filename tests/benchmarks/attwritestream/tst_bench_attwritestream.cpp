@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QThread>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/lewritestream_p.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <atomic>
+
+/*!
+  This benchmark measures the throughput of the WriteWithoutResponse
+  stream of the BlueZ kernel ATT backend. A local socket pair replaces
+  the L2CAP ATT channel, the remote side consumes the packets in a separate
+  thread. Each row pushes 1 MB of data using the given ATT MTU.
+  */
+
+QT_USE_NAMESPACE
+
+class tst_bench_AttWriteStream : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void streamThroughput_data();
+    void streamThroughput();
+};
+
+void tst_bench_AttWriteStream::streamThroughput_data()
+{
+    QTest::addColumn<int>("mtu");
+
+    QTest::newRow("default mtu") << 23;
+    QTest::newRow("mtu 185") << 185;
+    QTest::newRow("mtu 247") << 247;
+    QTest::newRow("max mtu") << 512;
+}
+
+void tst_bench_AttWriteStream::streamThroughput()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(int, mtu);
+
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+    // only the writer is non-blocking, the peer thread blocks in read()
+    QVERIFY(::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK) != -1);
+
+    std::atomic<qint64> received(0);
+    QScopedPointer<QThread> peer(QThread::create([&received, &sockets]() {
+        char packet[512];
+        ssize_t size;
+        while ((size = ::read(sockets[1], packet, sizeof packet)) > 0)
+            received += size - 3;
+    }));
+    peer->start();
+
+    LeAttStreamWriter writer;
+    writer.setSocketDescriptor(sockets[0]);
+    writer.setMtu(mtu);
+    QScopedPointer<LeWriteStream> stream(writer.createStream(0x0010));
+
+    const QByteArray data(1024 * 1024, 'x');
+    qint64 expected = 0;
+
+    QBENCHMARK {
+        stream->write(data);
+        expected += data.size();
+        while (stream->bytesToWrite() > 0)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        while (received.load() < expected)
+            QThread::yieldCurrentThread();
+    }
+
+    QCOMPARE(received.load(), expected);
+
+    writer.clear();
+    ::shutdown(sockets[0], SHUT_RDWR);
+    QVERIFY(peer->wait(5000));
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+#else
+    QSKIP("The write stream benchmark requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_AttWriteStream)
+
+#include "tst_bench_attwritestream.moc"
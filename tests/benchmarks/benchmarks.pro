@@ -0,0 +1,14 @@
+TEMPLATE = subdirs
+
+qtHaveModule(bluetooth) {
+    SUBDIRS += \
+        attbearers \
+        attlistresponse \
+        attrequestqueue \
+        attwritestream \
+        bluetoothsocketwrite \
+        cmaccalculator \
+        gattserverfanout \
+        signcounterjournal \
+        qlowenergycontroller
+}
@@ -0,0 +1,7 @@
+QT = core bluetooth bluetooth-private testlib
+
+TARGET = tst_bench_bluetoothsocketwrite
+CONFIG += benchmark
+qtConfig(bluez): DEFINES += CONFIG_BLUEZ
+
+SOURCES += tst_bench_bluetoothsocketwrite.cpp
@@ -0,0 +1,221 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include <QtBluetooth/QBluetoothSocket>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QThread>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ)
+#include <QtBluetooth/private/qbluetoothsocket_bluez_p.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include <atomic>
+
+/*!
+  This benchmark measures the write throughput of QBluetoothSocket on the
+  BlueZ kernel socket backend. A local socket pair replaces the RFCOMM
+  stream or the L2CAP channel, the remote side consumes the data in a
+  separate thread. Each row pushes 16 MB through the socket, either via the
+  socket's write buffer or with the socket opened unbuffered. The file rows
+  send a 16 MB file over RFCOMM, read into memory and written, or handed
+  to QBluetoothSocket::sendFile().
+
+  The result is reported in bytes per second.
+  */
+
+QT_USE_NAMESPACE
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ)
+class RawBluetoothSocket : public QBluetoothSocket
+{
+public:
+    explicit RawBluetoothSocket(QBluetoothServiceInfo::Protocol protocol)
+        : QBluetoothSocket(new QBluetoothSocketPrivateBluez, protocol)
+    {
+    }
+};
+#endif
+
+class tst_bench_BluetoothSocketWrite : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void throughput_data();
+    void throughput();
+    void fileThroughput_data();
+    void fileThroughput();
+};
+
+void tst_bench_BluetoothSocketWrite::throughput_data()
+{
+    QTest::addColumn<int>("protocol");
+    QTest::addColumn<bool>("buffered");
+
+    QTest::newRow("rfcomm, buffered") << int(QBluetoothServiceInfo::RfcommProtocol) << true;
+    QTest::newRow("rfcomm, unbuffered") << int(QBluetoothServiceInfo::RfcommProtocol) << false;
+    QTest::newRow("l2cap, buffered") << int(QBluetoothServiceInfo::L2capProtocol) << true;
+    QTest::newRow("l2cap, unbuffered") << int(QBluetoothServiceInfo::L2capProtocol) << false;
+}
+
+void tst_bench_BluetoothSocketWrite::throughput()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ)
+    QFETCH(int, protocol);
+    QFETCH(bool, buffered);
+
+    const bool isL2cap = protocol == QBluetoothServiceInfo::L2capProtocol;
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, isL2cap ? SOCK_SEQPACKET : SOCK_STREAM, 0, sockets), 0);
+
+    const qint64 totalSize = 16 * 1024 * 1024;
+    std::atomic<qint64> received(0);
+    QScopedPointer<QThread> peer(QThread::create([&received, &sockets]() {
+        char data[64 * 1024];
+        ssize_t size;
+        while ((size = ::read(sockets[1], data, sizeof data)) > 0)
+            received += size;
+    }));
+    peer->start();
+
+    RawBluetoothSocket socket{QBluetoothServiceInfo::Protocol(protocol)};
+    QIODevice::OpenMode openMode = QIODevice::ReadWrite;
+    if (!buffered)
+        openMode |= QIODevice::Unbuffered;
+    // the socket takes ownership of the descriptor and makes it non-blocking
+    QVERIFY(socket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::Protocol(protocol),
+                                       QBluetoothSocket::ConnectedState, openMode));
+
+    // unbuffered L2CAP writes are packets, keep them small enough for the peer
+    const qint64 chunkSize = isL2cap ? 1024 : 64 * 1024;
+    const QByteArray data(int(totalSize), 'x');
+
+    QElapsedTimer timer;
+    timer.start();
+    if (buffered) {
+        QCOMPARE(socket.write(data), totalSize);
+        while (socket.bytesToWrite() > 0)
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    } else {
+        qint64 offset = 0;
+        while (offset < totalSize) {
+            const qint64 written = socket.write(data.constData() + offset,
+                                                qMin(chunkSize, totalSize - offset));
+            QVERIFY(written >= 0);
+            if (written == 0)
+                QThread::yieldCurrentThread();
+            offset += written;
+        }
+    }
+    while (received.load() < totalSize)
+        QThread::yieldCurrentThread();
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+
+    QCOMPARE(received.load(), totalSize);
+    QTest::setBenchmarkResult(qreal(totalSize) * 1e9 / qreal(elapsed), QTest::BytesPerSecond);
+
+    socket.abort();
+    QVERIFY(peer->wait(5000));
+    ::close(sockets[1]);
+#else
+    QSKIP("The socket write benchmark requires a developer build with BlueZ");
+#endif
+}
+
+void tst_bench_BluetoothSocketWrite::fileThroughput_data()
+{
+    QTest::addColumn<bool>("sendFile");
+
+    QTest::newRow("read and write") << false;
+    QTest::newRow("sendFile") << true;
+}
+
+void tst_bench_BluetoothSocketWrite::fileThroughput()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ)
+    QFETCH(bool, sendFile);
+
+    const qint64 totalSize = 16 * 1024 * 1024;
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QCOMPARE(file.write(QByteArray(int(totalSize), 'x')), totalSize);
+    QVERIFY(file.flush());
+    QVERIFY(file.seek(0));
+
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+
+    std::atomic<qint64> received(0);
+    QScopedPointer<QThread> peer(QThread::create([&received, &sockets]() {
+        char data[64 * 1024];
+        ssize_t size;
+        while ((size = ::read(sockets[1], data, sizeof data)) > 0)
+            received += size;
+    }));
+    peer->start();
+
+    RawBluetoothSocket socket{QBluetoothServiceInfo::RfcommProtocol};
+    QVERIFY(socket.setSocketDescriptor(sockets[0], QBluetoothServiceInfo::RfcommProtocol));
+
+    QElapsedTimer timer;
+    timer.start();
+    if (sendFile) {
+        QVERIFY(socket.sendFile(&file));
+    } else {
+        QByteArray data;
+        while (!(data = file.read(64 * 1024)).isEmpty())
+            QCOMPARE(socket.write(data), qint64(data.size()));
+    }
+    while (socket.bytesToWrite() > 0)
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    while (received.load() < totalSize)
+        QThread::yieldCurrentThread();
+    const qint64 elapsed = qMax<qint64>(timer.nsecsElapsed(), 1);
+
+    QCOMPARE(received.load(), totalSize);
+    QTest::setBenchmarkResult(qreal(totalSize) * 1e9 / qreal(elapsed), QTest::BytesPerSecond);
+
+    socket.abort();
+    QVERIFY(peer->wait(5000));
+    ::close(sockets[1]);
+#else
+    QSKIP("The socket write benchmark requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_BluetoothSocketWrite)
+
+#include "tst_bench_bluetoothsocketwrite.moc"
@@ -0,0 +1,115 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/qbluetoothuuid.h>
+#include <QtBluetooth/private/lecmaccalculator_p.h>
+#endif
+
+/*!
+  This benchmark measures how long it takes to sign a stream of Signed Write
+  Commands. Each iteration signs 1000 messages of a typical size for a small
+  number of peers, once with the built-in AES-CMAC and once with the Linux
+  crypto API.
+  */
+
+QT_USE_NAMESPACE
+
+static const int messageCount = 1000;
+
+class tst_bench_CmacCalculator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void signMessages_data();
+    void signMessages();
+};
+
+void tst_bench_CmacCalculator::signMessages_data()
+{
+    QTest::addColumn<bool>("kernel");
+    QTest::addColumn<int>("peerCount");
+    QTest::addColumn<int>("valueSize");
+
+    QTest::newRow("built-in, 1 peer, 20 bytes") << false << 1 << 20;
+    QTest::newRow("built-in, 4 peers, 20 bytes") << false << 4 << 20;
+    QTest::newRow("built-in, 1 peer, 200 bytes") << false << 1 << 200;
+    QTest::newRow("kernel, 1 peer, 20 bytes") << true << 1 << 20;
+    QTest::newRow("kernel, 4 peers, 20 bytes") << true << 4 << 20;
+    QTest::newRow("kernel, 1 peer, 200 bytes") << true << 1 << 200;
+}
+
+void tst_bench_CmacCalculator::signMessages()
+{
+    QFETCH(bool, kernel);
+    QFETCH(int, peerCount);
+    QFETCH(int, valueSize);
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    const LeCmacCalculator calculator(kernel ? LeCmacCalculator::KernelBackend
+                                             : LeCmacCalculator::SoftwareBackend);
+    if (kernel && calculator.backend() != LeCmacCalculator::KernelBackend)
+        QSKIP("The Linux crypto API is not available");
+
+    QVector<quint128> keys(peerCount);
+    for (int peer = 0; peer < peerCount; ++peer) {
+        for (int i = 0; i < 16; ++i)
+            keys[peer].data[i] = quint8(peer * 16 + i);
+    }
+    // ATT opcode, attribute handle and value, as for a Signed Write Command
+    const QByteArray message(3 + valueSize, 'v');
+
+    // both backends must agree before their speed is compared
+    const LeCmacCalculator reference;
+    QCOMPARE(calculator.calculateMac(message, keys.first()),
+             reference.calculateMac(message, keys.first()));
+
+    volatile quint64 mac = 0;
+    quint32 signCounter = 0;
+    QBENCHMARK {
+        for (int i = 0; i < messageCount; ++i) {
+            const QByteArray fullMessage
+                    = LeCmacCalculator::createFullMessage(message, ++signCounter);
+            mac = calculator.calculateMac(fullMessage, keys.at(i % peerCount));
+        }
+    }
+    Q_UNUSED(mac);
+#else
+    Q_UNUSED(kernel);
+    Q_UNUSED(peerCount);
+    Q_UNUSED(valueSize);
+    QSKIP("The CMAC calculator requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_CmacCalculator)
+
+#include "tst_bench_cmaccalculator.moc"
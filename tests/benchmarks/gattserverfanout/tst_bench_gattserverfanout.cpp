@@ -0,0 +1,216 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/leattserverconnection_p.h>
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*!
+  This benchmark measures how long a GATT server takes to pass a changed
+  characteristic value on to its subscribed clients. Each simulated client
+  is a local socket pair. The clients drain their sockets after each update.
+
+  It also measures how a client which does not read keeps up with frequent
+  updates of several characteristics. The updates are queued once the
+  socket buffer is full.
+  */
+
+QT_USE_NAMESPACE
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+class SocketDevice : public QIODevice
+{
+public:
+    explicit SocketDevice(int socket) : m_socket(socket)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+    }
+    ~SocketDevice() { ::close(m_socket); }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+    qint64 writeData(const char *data, qint64 size) override
+    {
+        const qint64 result = ::write(m_socket, data, size_t(size));
+        // like QBluetoothSocket, report a full socket buffer as 0 bytes written
+        return result == -1 && errno == EAGAIN ? 0 : result;
+    }
+
+private:
+    int m_socket;
+};
+#endif
+
+class tst_bench_GattServerFanOut : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void distributeValue_data();
+    void distributeValue();
+    void queueUpdates_data();
+    void queueUpdates();
+};
+
+void tst_bench_GattServerFanOut::distributeValue_data()
+{
+    QTest::addColumn<int>("clientCount");
+    QTest::addColumn<int>("mtu");
+
+    QTest::newRow("1 client, MTU 23") << 1 << 23;
+    QTest::newRow("10 clients, MTU 23") << 10 << 23;
+    QTest::newRow("50 clients, MTU 23") << 50 << 23;
+    QTest::newRow("50 clients, MTU 247") << 50 << 247;
+}
+
+void tst_bench_GattServerFanOut::distributeValue()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(int, clientCount);
+    QFETCH(int, mtu);
+
+    const QLowEnergyHandle valueHandle = 0x10;
+    const QLowEnergyHandle configHandle = 0x11;
+    QByteArray notificationsEnabled(2, 0);
+    notificationsEnabled[0] = 0x1;
+
+    QVector<LeAttServerConnection *> connections;
+    QVector<int> clients;
+    for (int i = 0; i < clientCount; ++i) {
+        int sockets[2];
+        QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+        QVERIFY(::fcntl(sockets[1], F_SETFL, ::fcntl(sockets[1], F_GETFL) | O_NONBLOCK) != -1);
+
+        LeAttServerConnection *connection = new LeAttServerConnection;
+        connection->socket = new SocketDevice(sockets[0]);
+        connection->mtuSize = quint16(mtu);
+        connection->clientConfigurations.insert(configHandle, notificationsEnabled);
+        connections.append(connection);
+        clients.append(sockets[1]);
+    }
+
+    const QByteArray value(mtu - 3, 'v');
+    const QLowEnergyCharacteristic::PropertyTypes properties
+            = QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Notify;
+    char pdu[512];
+    int received = 0;
+
+    QBENCHMARK {
+        QCOMPARE(LeAttServerConnection::distributeValue(connections, valueHandle, configHandle,
+                                                        value, properties), clientCount);
+        for (const int client : qAsConst(clients)) {
+            while (::read(client, pdu, sizeof pdu) == mtu)
+                ++received;
+        }
+    }
+    QVERIFY(received >= clientCount);
+
+    for (LeAttServerConnection *connection : qAsConst(connections)) {
+        delete connection->socket;
+        delete connection;
+    }
+    for (const int client : qAsConst(clients))
+        ::close(client);
+#else
+    QSKIP("The GATT server benchmark requires a developer build with BlueZ");
+#endif
+}
+
+void tst_bench_GattServerFanOut::queueUpdates_data()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QTest::addColumn<int>("policy");
+    QTest::addColumn<int>("characteristicCount");
+
+    QTest::newRow("merge, 1 characteristic") << int(LeAttValueQueue::MergePolicy) << 1;
+    QTest::newRow("merge, 16 characteristics") << int(LeAttValueQueue::MergePolicy) << 16;
+    QTest::newRow("drop-oldest, 16 characteristics")
+            << int(LeAttValueQueue::DropOldestPolicy) << 16;
+#endif
+}
+
+void tst_bench_GattServerFanOut::queueUpdates()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    QFETCH(int, policy);
+    QFETCH(int, characteristicCount);
+
+    int sockets[2];
+    QCOMPARE(::socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets), 0);
+    QVERIFY(::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK) != -1);
+
+    QByteArray notificationsEnabled(2, 0);
+    notificationsEnabled[0] = 0x1;
+    LeAttServerConnection *connection = new LeAttServerConnection;
+    connection->socket = new SocketDevice(sockets[0]);
+    connection->socketDescriptor = sockets[0];
+    connection->setQueuePolicy(LeAttValueQueue::Policy(policy), LeAttValueQueue::DefaultMaxDepth);
+    for (int i = 0; i < characteristicCount; ++i)
+        connection->clientConfigurations.insert(QLowEnergyHandle(2 * i + 2), notificationsEnabled);
+
+    const QVector<LeAttServerConnection *> connections{ connection };
+    const QLowEnergyCharacteristic::PropertyTypes properties
+            = QLowEnergyCharacteristic::Read | QLowEnergyCharacteristic::Notify;
+    QByteArray value(20, 'v');
+    quint32 update = 0;
+
+    QBENCHMARK {
+        for (int i = 0; i < characteristicCount; ++i) {
+            memcpy(value.data(), &update, sizeof update);
+            ++update;
+            LeAttServerConnection::distributeValue(connections, QLowEnergyHandle(2 * i + 1),
+                                                   QLowEnergyHandle(2 * i + 2), value,
+                                                   properties);
+        }
+    }
+
+    // the client never reads, the queue must not grow beyond its bound
+    QVERIFY(connection->pendingNotifications.count() <= LeAttValueQueue::DefaultMaxDepth);
+    if (policy == LeAttValueQueue::MergePolicy)
+        QVERIFY(connection->pendingNotifications.count() <= characteristicCount);
+
+    QIODevice *socket = connection->socket;
+    delete connection;
+    delete socket;
+    ::close(sockets[1]);
+#else
+    QSKIP("The GATT server benchmark requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_GattServerFanOut)
+
+#include "tst_bench_gattserverfanout.moc"
@@ -0,0 +1,254 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include <QBluetoothAddress>
+#include <QLowEnergyController>
+#include <QLowEnergyService>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/leattrequest_p.h>
+#endif
+
+#include <algorithm>
+
+/*!
+  This benchmark requires a BTLE peripheral whose address is passed via
+  the BT_TEST_DEVICE environment variable. It measures the time
+  needed to discover the details of each service offered by the device
+  and of all services at once.
+
+  On BlueZ the kernel ATT interface is enforced as the benchmarked code paths
+  are not used by the BlueZ DBus backend. The discoverDetailsRequests rows
+  report the number of ATT round trips per service instead of the time. They
+  are taken from the statistics of the ATT request schedulers and require a
+  developer build.
+  */
+
+QT_USE_NAMESPACE
+
+class tst_bench_QLowEnergyController : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void discoverDetails_data();
+    void discoverDetails();
+    void discoverDetailsRequests_data();
+    void discoverDetailsRequests();
+    void discoverAllDetails_data();
+    void discoverAllDetails();
+
+private:
+    QLowEnergyController *connectToDevice(QObject *parent);
+
+    QBluetoothAddress remoteDevice;
+    QList<QBluetoothUuid> services;
+    // ATT requests of the single reads rows, by service
+    QHash<QBluetoothUuid, int> singleReadRequests;
+};
+
+void tst_bench_QLowEnergyController::initTestCase()
+{
+    const QString remote = qEnvironmentVariable("BT_TEST_DEVICE");
+    if (remote.isEmpty()) {
+        qWarning() << "Set BT_TEST_DEVICE env to run benchmarks against a remote device";
+        return;
+    }
+    remoteDevice = QBluetoothAddress(remote);
+
+    // Versions below 5.42 select the kernel ATT interface
+    qputenv("BLUETOOTH_FORCE_DBUS_LE_VERSION", "5.41");
+
+    QObject parent;
+    QLowEnergyController *control = connectToDevice(&parent);
+    if (!control)
+        return;
+
+    services = control->services();
+    control->disconnectFromDevice();
+    QTRY_COMPARE(control->state(), QLowEnergyController::UnconnectedState);
+}
+
+QLowEnergyController *tst_bench_QLowEnergyController::connectToDevice(QObject *parent)
+{
+    QLowEnergyController *control = QLowEnergyController::createCentral(
+                remoteDevice, QBluetoothAddress(), parent);
+    control->connectToDevice();
+    if (!QTest::qWaitFor([control]() {
+            return control->state() == QLowEnergyController::ConnectedState; }, 10000)) {
+        return nullptr;
+    }
+
+    control->discoverServices();
+    if (!QTest::qWaitFor([control]() {
+            return control->state() == QLowEnergyController::DiscoveredState; }, 20000)) {
+        return nullptr;
+    }
+    return control;
+}
+
+void tst_bench_QLowEnergyController::discoverDetails_data()
+{
+    QTest::addColumn<QBluetoothUuid>("serviceUuid");
+    QTest::addColumn<bool>("batchedReads");
+
+    for (const QBluetoothUuid &uuid : qAsConst(services)) {
+        QTest::addRow("single reads %s", qPrintable(uuid.toString())) << uuid << false;
+        QTest::addRow("batched reads %s", qPrintable(uuid.toString())) << uuid << true;
+    }
+}
+
+void tst_bench_QLowEnergyController::discoverDetails()
+{
+    if (remoteDevice.isNull())
+        QSKIP("No remote BTLE device found. Skipping benchmark.");
+
+    QFETCH(QBluetoothUuid, serviceUuid);
+    QFETCH(bool, batchedReads);
+
+    qputenv("BLUETOOTH_GATT_BATCHED_READS", batchedReads ? "1" : "0");
+
+    QObject parent;
+    QLowEnergyController *control = connectToDevice(&parent);
+    if (!control)
+        QSKIP("Connection to LE device cannot be established. Skipping benchmark.");
+
+    QLowEnergyService *service = control->createServiceObject(serviceUuid, &parent);
+    QVERIFY(service);
+
+    QBENCHMARK_ONCE {
+        service->discoverDetails();
+        QTRY_COMPARE_WITH_TIMEOUT(service->state(), QLowEnergyService::ServiceDiscovered, 30000);
+    }
+
+    control->disconnectFromDevice();
+    QTRY_COMPARE(control->state(), QLowEnergyController::UnconnectedState);
+}
+
+void tst_bench_QLowEnergyController::discoverDetailsRequests_data()
+{
+    discoverDetails_data();
+}
+
+void tst_bench_QLowEnergyController::discoverDetailsRequests()
+{
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    if (remoteDevice.isNull())
+        QSKIP("No remote BTLE device found. Skipping benchmark.");
+
+    QFETCH(QBluetoothUuid, serviceUuid);
+    QFETCH(bool, batchedReads);
+
+    qputenv("BLUETOOTH_GATT_BATCHED_READS", batchedReads ? "1" : "0");
+
+    QObject parent;
+    QLowEnergyController *control = connectToDevice(&parent);
+    if (!control)
+        QSKIP("Connection to LE device cannot be established. Skipping benchmark.");
+
+    QLowEnergyService *service = control->createServiceObject(serviceUuid, &parent);
+    QVERIFY(service);
+
+    const quint64 dispatchedBefore = LeAttRequestScheduler::totalDispatched();
+    service->discoverDetails();
+    QTRY_COMPARE_WITH_TIMEOUT(service->state(), QLowEnergyService::ServiceDiscovered, 30000);
+    const int sentRequests = int(LeAttRequestScheduler::totalDispatched() - dispatchedBefore);
+
+    QVERIFY(sentRequests > 0);
+    if (batchedReads) {
+        // batching must never cost additional round trips
+        const auto single = singleReadRequests.constFind(serviceUuid);
+        if (single != singleReadRequests.cend())
+            QVERIFY2(sentRequests <= *single, qPrintable(QString::fromLatin1(
+                     "%1 batched requests, %2 single requests").arg(sentRequests).arg(*single)));
+    } else {
+        singleReadRequests.insert(serviceUuid, sentRequests);
+    }
+    QTest::setBenchmarkResult(sentRequests, QTest::Events);
+
+    control->disconnectFromDevice();
+    QTRY_COMPARE(control->state(), QLowEnergyController::UnconnectedState);
+#else
+    QSKIP("Counting ATT round trips is only applicable for developer builds with BlueZ");
+#endif
+}
+
+void tst_bench_QLowEnergyController::discoverAllDetails_data()
+{
+    QTest::addColumn<bool>("sweep");
+
+    QTest::newRow("per service") << false;
+    QTest::newRow("single sweep") << true;
+}
+
+void tst_bench_QLowEnergyController::discoverAllDetails()
+{
+    if (remoteDevice.isNull())
+        QSKIP("No remote BTLE device found. Skipping benchmark.");
+
+    QFETCH(bool, sweep);
+
+    qputenv("BLUETOOTH_GATT_BATCHED_READS", "0");
+
+    QObject parent;
+    QLowEnergyController *control = connectToDevice(&parent);
+    if (!control)
+        QSKIP("Connection to LE device cannot be established. Skipping benchmark.");
+
+    QList<QLowEnergyService *> serviceObjects;
+    for (const QBluetoothUuid &uuid : qAsConst(services))
+        serviceObjects.append(control->createServiceObject(uuid, &parent));
+
+    const auto allDiscovered = [&serviceObjects]() {
+        return std::all_of(serviceObjects.cbegin(), serviceObjects.cend(),
+                           [](QLowEnergyService *service) {
+            return service->state() == QLowEnergyService::ServiceDiscovered;
+        });
+    };
+
+    QBENCHMARK_ONCE {
+        if (sweep) {
+            control->discoverAllServiceDetails();
+        } else {
+            for (QLowEnergyService *service : qAsConst(serviceObjects))
+                service->discoverDetails();
+        }
+        QTRY_VERIFY_WITH_TIMEOUT(allDiscovered(), 60000);
+    }
+
+    control->disconnectFromDevice();
+    QTRY_COMPARE(control->state(), QLowEnergyController::UnconnectedState);
+}
+
+QTEST_MAIN(tst_bench_QLowEnergyController)
+
+#include "tst_bench_qlowenergycontroller.moc"
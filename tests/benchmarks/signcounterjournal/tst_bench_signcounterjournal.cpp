@@ -0,0 +1,136 @@
+/****************************************************************************
+**
+** Copyright (C) 2020 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the QtBluetooth module of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:GPL-EXCEPT$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include <QtTest/QtTest>
+
+#include <QtCore/QSettings>
+#include <QtCore/QTemporaryDir>
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+#include <QtBluetooth/private/lesigncounterjournal_p.h>
+#endif
+
+/*!
+  This benchmark measures how long it takes to record the sign counters of
+  a stream of signed writes. Each iteration records 5000 counters. The
+  baseline rewrites the settings file for every counter.
+  */
+
+QT_USE_NAMESPACE
+
+static const int writeCount = 5000;
+
+class tst_bench_SignCounterJournal : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void recordCounters_data();
+    void recordCounters();
+
+private:
+    QString createSettingsFile(const QTemporaryDir &dir);
+};
+
+QString tst_bench_SignCounterJournal::createSettingsFile(const QTemporaryDir &dir)
+{
+    const QString filePath = dir.filePath(QStringLiteral("info"));
+    QSettings settings(filePath, QSettings::IniFormat);
+    settings.setValue(QStringLiteral("General/Name"), QStringLiteral("peer"));
+    settings.setValue(QStringLiteral("RemoteSignatureKey/Key"),
+                      QStringLiteral("00112233445566778899AABBCCDDEEFF"));
+    settings.setValue(QStringLiteral("RemoteSignatureKey/Counter"), 0);
+    settings.setValue(QStringLiteral("RemoteSignatureKey/Authenticated"), false);
+    settings.sync();
+    return filePath;
+}
+
+void tst_bench_SignCounterJournal::recordCounters_data()
+{
+    QTest::addColumn<bool>("useJournal");
+    QTest::addColumn<int>("reservationSize");
+
+    QTest::newRow("settings file per write") << false << 0;
+    QTest::newRow("journal, reservation 64") << true << 64;
+    QTest::newRow("journal, reservation 1024") << true << 1024;
+}
+
+void tst_bench_SignCounterJournal::recordCounters()
+{
+    QFETCH(bool, useJournal);
+    QFETCH(int, reservationSize);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString filePath = createSettingsFile(dir);
+    const QString group = QStringLiteral("RemoteSignatureKey");
+    quint32 counter = 0;
+
+    if (!useJournal) {
+        QBENCHMARK {
+            for (int i = 0; i < writeCount; ++i) {
+                QSettings settings(filePath, QSettings::IniFormat);
+                settings.beginGroup(group);
+                if (settings.allKeys().contains(QStringLiteral("Counter")))
+                    settings.setValue(QStringLiteral("Counter"), ++counter);
+            }
+        }
+        return;
+    }
+
+#if defined(QT_BUILD_INTERNAL) && defined(CONFIG_BLUEZ_LE)
+    {
+        LeSignCounterJournal journal;
+        journal.setReservationSize(quint32(reservationSize));
+        QCOMPARE(journal.load(filePath, group, 0, LeSignCounterJournal::LocalCounter),
+                 quint32(0));
+        QBENCHMARK {
+            for (int i = 0; i < writeCount; ++i)
+                QVERIFY(journal.record(filePath, group, ++counter));
+            journal.flush();
+        }
+    }
+
+    QCOMPARE(QSettings(filePath, QSettings::IniFormat).value(group + QLatin1String("/Counter"))
+             .toUInt(), counter);
+
+    // a restart continues past the last counter even if the settings file is stale
+    LeSignCounterJournal journal;
+    const quint32 restored = journal.load(filePath, group, 0,
+                                          LeSignCounterJournal::LocalCounter);
+    QVERIFY(restored > counter);
+    QVERIFY(restored <= counter + quint32(reservationSize));
+#else
+    Q_UNUSED(reservationSize);
+    QSKIP("The sign counter journal requires a developer build with BlueZ");
+#endif
+}
+
+QTEST_MAIN(tst_bench_SignCounterJournal)
+
+#include "tst_bench_signcounterjournal.moc"